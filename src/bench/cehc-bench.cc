@@ -0,0 +1,206 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+/**
+ * loopback压测：固定并发的闭环请求，统计吞吐、延迟分位数以及事件等待后端每个请求的系统调用次数。
+ * 先启动cehc_loopback_server，再：
+ *   cehc_bench [-p epoll|io_uring] [-e] [-b 自旋us] [-B SO_BUSY_POLL us] [-c 并发] [-n 请求数] [-u url] [-U path]
+ *   -e 嵌入模式：在本线程中cehc_poll_once驱动，否则由http service自己的线程驱动、本线程通过完成队列收割。
+ *   -b/-B 忙轮询，见cehc_http_service_set_busy_poll。
+ *   -U url的host走unix domain socket(server以cehc_loopback_server <port> <path>启动)，见cehc-uds.h。
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../cehc/cehttpclient.h"
+#include "../cehc/cehc-cq.h"
+#include "../cehc/cehc-uds.h"
+
+namespace {
+    int64_t now_ns() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    size_t discard_body(cehc_connection_t*, void*, size_t size, size_t nmemb) {
+        return size * nmemb;
+    }
+
+    void usage(const char *prog) {
+        fprintf(stderr, "usage: %s [-p epoll|io_uring] [-e] [-b spin_us] [-B so_busy_poll_us] "
+                        "[-c concurrency] [-n requests] [-u url] [-U unix_socket_path]\n", prog);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *poller = "epoll";
+    const char *url = "http://127.0.0.1:18080/bytes/128";
+    const char *unix_path = NULL;
+    bool embedded = false;
+    int concurrency = 64;
+    int requests = 100000;
+    int spin_us = 0, so_busy_poll_us = 0;
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "p:eb:B:c:n:u:U:"))) {
+        switch (opt) {
+            case 'p': poller = optarg; break;
+            case 'e': embedded = true; break;
+            case 'b': spin_us = atoi(optarg); break;
+            case 'B': so_busy_poll_us = atoi(optarg); break;
+            case 'c': concurrency = atoi(optarg); break;
+            case 'n': requests = atoi(optarg); break;
+            case 'u': url = optarg; break;
+            case 'U': unix_path = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (concurrency < 1 || requests < concurrency) {
+        usage(argv[0]);
+    }
+
+    cehc_poller_kind_t kind = CEHC_POLLER_EPOLL;
+    if (!strcmp(poller, "io_uring")) {
+        kind = CEHC_POLLER_IO_URING;
+    } else if (strcmp(poller, "epoll")) {
+        usage(argv[0]);
+    }
+
+    cehc_init_curl_global_service();
+    cehc_completion_queue_t *cq = cehc_new_completion_queue((size_t)concurrency);
+    cehc_http_service_t *hs = embedded ? cehc_new_embedded_http_service(1024, 256)
+                                       : cehc_new_http_service(1024, 256, -1);
+    if (!cq || !hs) {
+        fprintf(stderr, "create service failed.\n");
+        return 1;
+    }
+    if (!cehc_http_service_set_poller(hs, kind)) {
+        fprintf(stderr, "poller %s is not available.\n", poller);
+        return 1;
+    }
+    if (!cehc_http_service_set_busy_poll(hs, spin_us, so_busy_poll_us)) {
+        usage(argv[0]);
+    }
+    if (unix_path) {
+        // scheme://host[:port]/...中的host
+        const char *h = strstr(url, "://");
+        h = h ? h + 3 : url;
+        std::string host(h, strcspn(h, ":/"));
+        if (!cehc_http_service_add_unix_route(hs, host.c_str(), -1, unix_path)) {
+            usage(argv[0]);
+        }
+    }
+    if (!embedded && !cehc_run_http_serivce(hs)) {
+        fprintf(stderr, "run service failed.\n");
+        return 1;
+    }
+
+    std::vector<int64_t> starts((size_t)concurrency);
+    std::vector<int64_t> latencies;
+    latencies.reserve((size_t)requests);
+    std::vector<cehc_connection_ptr> conns((size_t)concurrency);
+    char errmsg[CURL_ERROR_SIZE];
+    for (int i = 0; i < concurrency; ++i) {
+        cehc_newconn_params_t params;
+        memset(&params, 0, sizeof(params));
+        params.url = url;
+        params.hs = hs;
+        params.recv_cb = discard_body;
+        params.user_ctx = (void*)(intptr_t)i;
+        params.cq = cq;
+        conns[i] = cehc_new_conn(&params);
+        if (!conns[i]) {
+            fprintf(stderr, "new conn failed.\n");
+            return 1;
+        }
+    }
+
+    // 预热：建好所有keep-alive连接之后再计时。
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < concurrency; ++i) {
+            cehc_run_conn(conns[i], errmsg);
+        }
+        int done = 0;
+        cehc_connection_ptr out[256];
+        while (done < concurrency) {
+            if (embedded) {
+                cehc_poll_once(hs, 10);
+            }
+            int n = cehc_cq_poll(cq, out, 256, embedded ? 0 : 1000);
+            done += n > 0 ? n : 0;
+        }
+    }
+
+    struct rusage ru0, ru1;
+    cehc_poller_stats_t ps0, ps1;
+    getrusage(RUSAGE_SELF, &ru0);
+    cehc_http_service_get_poller_stats(hs, &ps0);
+    int64_t t0 = now_ns();
+    int issued = 0, done = 0, failed = 0;
+    for (int i = 0; i < concurrency; ++i, ++issued) {
+        starts[i] = now_ns();
+        cehc_run_conn(conns[i], errmsg);
+    }
+
+    cehc_connection_ptr out[256];
+    while (done < requests) {
+        if (embedded) {
+            cehc_poll_once(hs, -1);
+        }
+        int n = cehc_cq_poll(cq, out, 256, embedded ? 0 : -1);
+        int64_t now = now_ns();
+        for (int k = 0; k < n; ++k) {
+            cehc_connection_ptr conn = out[k];
+            int idx = (int)(intptr_t)conn->user_ctx;
+            latencies.push_back(now - starts[idx]);
+            if (!cehc_conn_ok_except_httpcode(conn) || conn->http_code >= 400) {
+                ++failed;
+            }
+            ++done;
+            if (issued < requests) {
+                ++issued;
+                starts[idx] = now_ns();
+                cehc_run_conn(conn, errmsg);
+            }
+        }
+    }
+    int64_t elapsed = now_ns() - t0;
+    getrusage(RUSAGE_SELF, &ru1);
+    cehc_http_service_get_poller_stats(hs, &ps1);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&latencies](double p) {
+        return latencies[(size_t)(p * (double)(latencies.size() - 1))] / 1000.0;
+    };
+    double waits = (double)(ps1.waits - ps0.waits) / requests;
+    double ctls = (double)(ps1.ctl_calls - ps0.ctl_calls) / requests;
+    long csw = (ru1.ru_nvcsw - ru0.ru_nvcsw) + (ru1.ru_nivcsw - ru0.ru_nivcsw);
+    double cpu_us = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec + ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1e6
+                    + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec + ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec);
+    printf("poller=%s mode=%s busy_poll=%dus transport=%s concurrency=%d requests=%d failed=%d\n",
+           poller, embedded ? "embedded" : "thread", spin_us, unix_path ? "unix" : "tcp", concurrency, requests, failed);
+    printf("throughput: %.0f req/s\n", requests / (elapsed / 1e9));
+    printf("latency(us): p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", pct(0.5), pct(0.9), pct(0.99), pct(1.0));
+    printf("poller syscalls/req: %.3f (wait %.3f + ctl %.3f), ctx switches/req: %.3f\n",
+           waits + ctls, waits, ctls, (double)csw / requests);
+    printf("client cpu/req: %.2fus\n", cpu_us / requests);
+
+    for (auto &conn : conns) {
+        cehc_delete_conn(&conn);
+    }
+    cehc_delete_http_serivce(&hs);
+    cehc_delete_completion_queue(&cq);
+    cehc_uninit_curl_global_service();
+    return 0;
+}
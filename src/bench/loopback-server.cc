@@ -0,0 +1,349 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+/**
+ * 压测用的loopback http server：单线程epoll，HTTP/1.1 keep-alive。
+ * 路由：
+ *  -> GET/HEAD /bytes/<n>     返回n字节(第i个字节为i % 251)，支持Range: bytes=a-b
+ *  -> GET /ndjson/<n>         返回n行{"i":<行号>}\n
+ *  -> GET /delay/<ms>         延迟ms毫秒后返回"ok"
+ *  -> POST <任意>             读完body(支持chunked)后返回body的长度
+ *  -> 其他                    返回"ok"
+ * 用法：loopback-server [port] [unix socket path(以'@'开头为abstract socket)]
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+namespace {
+    struct Client {
+        std::string in;
+        std::string out;
+        size_t out_off = 0;
+        bool close_after = false;
+        // 延迟响应的到期时间(ms)，0表示没有
+        long long delay_until = 0;
+        std::string delayed;
+    };
+
+    int g_epfd = -1;
+    std::map<int, Client> g_clients;
+
+    long long now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+    void update_events(int fd, Client &c) {
+        struct epoll_event ee;
+        memset(&ee, 0, sizeof(ee));
+        ee.events = EPOLLIN | (c.out_off < c.out.size() ? EPOLLOUT : 0);
+        ee.data.fd = fd;
+        epoll_ctl(g_epfd, EPOLL_CTL_MOD, fd, &ee);
+    }
+
+    void close_client(int fd) {
+        epoll_ctl(g_epfd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        g_clients.erase(fd);
+    }
+
+    std::string header_value(const std::string &head, const char *name) {
+        std::string lower = head;
+        for (auto &ch : lower) {
+            ch = (char)tolower(ch);
+        }
+        std::string key = std::string("\r\n") + name + ":";
+        auto pos = lower.find(key);
+        if (std::string::npos == pos) {
+            return "";
+        }
+        pos += key.size();
+        auto end = head.find("\r\n", pos);
+        while (pos < end && ' ' == head[pos]) {
+            ++pos;
+        }
+        return head.substr(pos, end - pos);
+    }
+
+    void append_response(Client &c, int code, const std::string &extra_headers, const std::string &body,
+                         bool head_only, size_t content_length) {
+        char line[256];
+        snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n", code,
+                 200 == code ? "OK" : (206 == code ? "Partial Content" : "Error"), content_length);
+        c.out += line;
+        c.out += extra_headers;
+        if (c.close_after) {
+            c.out += "Connection: close\r\n";
+        }
+        c.out += "\r\n";
+        if (!head_only) {
+            c.out += body;
+        }
+    }
+
+    void handle_request(Client &c, const std::string &head, const std::string &body) {
+        auto sp1 = head.find(' ');
+        auto sp2 = head.find(' ', sp1 + 1);
+        std::string method = head.substr(0, sp1);
+        std::string path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+        c.close_after = "close" == header_value(head, "connection");
+        bool head_only = "HEAD" == method;
+
+        if ("POST" == method || "PUT" == method) {
+            std::string b = std::to_string(body.size());
+            append_response(c, 200, "", b, false, b.size());
+        } else if (0 == path.compare(0, 7, "/bytes/")) {
+            size_t n = strtoull(path.c_str() + 7, NULL, 10);
+            size_t a = 0, z = n ? n - 1 : 0;
+            int code = 200;
+            std::string extra = "Accept-Ranges: bytes\r\n";
+            std::string range = header_value(head, "range");
+            if (!range.empty() && n) {
+                sscanf(range.c_str(), "bytes=%zu-%zu", &a, &z);
+                if (z >= n) {
+                    z = n - 1;
+                }
+                code = 206;
+                char cr[128];
+                snprintf(cr, sizeof(cr), "Content-Range: bytes %zu-%zu/%zu\r\n", a, z, n);
+                extra += cr;
+            }
+            size_t len = n ? z - a + 1 : 0;
+            std::string b;
+            if (!head_only) {
+                b.resize(len);
+                for (size_t i = 0; i < len; ++i) {
+                    b[i] = (char)((a + i) % 251);
+                }
+            }
+            append_response(c, code, extra, b, head_only, len);
+        } else if (0 == path.compare(0, 8, "/ndjson/")) {
+            size_t n = strtoull(path.c_str() + 8, NULL, 10);
+            std::string b;
+            for (size_t i = 0; i < n; ++i) {
+                b += "{\"i\":" + std::to_string(i) + "}\n";
+            }
+            append_response(c, 200, "Content-Type: application/x-ndjson\r\n", b, head_only, b.size());
+        } else if (0 == path.compare(0, 7, "/delay/")) {
+            long ms = strtol(path.c_str() + 7, NULL, 10);
+            std::string saved;
+            saved.swap(c.out);
+            append_response(c, 200, "", "ok", head_only, 2);
+            c.delayed.swap(c.out);
+            c.out.swap(saved);
+            c.delay_until = now_ms() + ms;
+        } else {
+            append_response(c, 200, "", "ok", head_only, 2);
+        }
+    }
+
+    /**
+     * 解析输入缓冲区中所有完整的请求。
+     * @return false表示请求格式错误需要关闭连接
+     */
+    bool process_input(Client &c) {
+        for (;;) {
+            if (c.delay_until) {
+                return true;
+            }
+            auto hend = c.in.find("\r\n\r\n");
+            if (std::string::npos == hend) {
+                return true;
+            }
+            std::string head = c.in.substr(0, hend + 2);
+            size_t consumed = hend + 4;
+            std::string body;
+            std::string te = header_value(head, "transfer-encoding");
+            if ("chunked" == te) {
+                size_t pos = consumed;
+                for (;;) {
+                    auto lend = c.in.find("\r\n", pos);
+                    if (std::string::npos == lend) {
+                        return true;
+                    }
+                    size_t len = strtoull(c.in.c_str() + pos, NULL, 16);
+                    if (c.in.size() < lend + 2 + len + 2) {
+                        return true;
+                    }
+                    if (!len) {
+                        pos = lend + 4;
+                        break;
+                    }
+                    body.append(c.in, lend + 2, len);
+                    pos = lend + 2 + len + 2;
+                }
+                consumed = pos;
+            } else {
+                std::string cl = header_value(head, "content-length");
+                size_t len = cl.empty() ? 0 : strtoull(cl.c_str(), NULL, 10);
+                if (c.in.size() < consumed + len) {
+                    return true;
+                }
+                body = c.in.substr(consumed, len);
+                consumed += len;
+            }
+            c.in.erase(0, consumed);
+            handle_request(c, head, body);
+        }
+    }
+
+    void flush_output(int fd, Client &c) {
+        while (c.out_off < c.out.size()) {
+            ssize_t n = write(fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+            if (n <= 0) {
+                break;
+            }
+            c.out_off += (size_t)n;
+        }
+        if (c.out_off == c.out.size()) {
+            c.out.clear();
+            c.out_off = 0;
+        }
+    }
+
+    int listen_tcp(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 4096)) {
+            perror("listen tcp");
+            exit(1);
+        }
+        return fd;
+    }
+
+    int listen_unix(const char *path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+        socklen_t len = sizeof(addr);
+        if ('@' == path[0]) {
+            // abstract socket：sun_path以'\0'开头，长度不含结尾。
+            addr.sun_path[0] = '\0';
+            len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path));
+        } else {
+            unlink(path);
+        }
+        if (bind(fd, (struct sockaddr*)&addr, len) || listen(fd, 4096)) {
+            perror("listen unix");
+            exit(1);
+        }
+        return fd;
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 18080;
+    signal(SIGPIPE, SIG_IGN);
+    g_epfd = epoll_create1(0);
+    int listeners[2] = {listen_tcp(port), argc > 2 ? listen_unix(argv[2]) : -1};
+    for (int lfd : listeners) {
+        if (-1 == lfd) {
+            continue;
+        }
+        struct epoll_event ee;
+        memset(&ee, 0, sizeof(ee));
+        ee.events = EPOLLIN;
+        ee.data.fd = lfd;
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, lfd, &ee);
+    }
+
+    struct epoll_event ees[256];
+    char buf[65536];
+    for (;;) {
+        int timeout = -1;
+        long long now = now_ms();
+        for (auto &kv : g_clients) {
+            if (kv.second.delay_until) {
+                long long left = kv.second.delay_until - now;
+                left = left < 0 ? 0 : left;
+                if (-1 == timeout || left < timeout) {
+                    timeout = (int)left;
+                }
+            }
+        }
+
+        int n = epoll_wait(g_epfd, ees, 256, timeout);
+        for (int i = 0; i < n; ++i) {
+            int fd = ees[i].data.fd;
+            if (fd == listeners[0] || fd == listeners[1]) {
+                int cfd;
+                while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    int one = 1;
+                    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    g_clients[cfd] = Client();
+                    struct epoll_event ee;
+                    memset(&ee, 0, sizeof(ee));
+                    ee.events = EPOLLIN;
+                    ee.data.fd = cfd;
+                    epoll_ctl(g_epfd, EPOLL_CTL_ADD, cfd, &ee);
+                }
+                continue;
+            }
+
+            auto it = g_clients.find(fd);
+            if (g_clients.end() == it) {
+                continue;
+            }
+            Client &c = it->second;
+            if (ees[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t r;
+                bool closed = false;
+                while ((r = read(fd, buf, sizeof(buf))) > 0) {
+                    c.in.append(buf, (size_t)r);
+                }
+                if (0 == r || (r < 0 && EAGAIN != errno)) {
+                    closed = true;
+                }
+                if (!process_input(c) || (closed && c.out.empty() && !c.delay_until)) {
+                    close_client(fd);
+                    continue;
+                }
+            }
+            flush_output(fd, c);
+            if (c.out.empty() && c.close_after) {
+                close_client(fd);
+                continue;
+            }
+            update_events(fd, c);
+        }
+
+        now = now_ms();
+        for (auto it = g_clients.begin(); it != g_clients.end(); ++it) {
+            Client &c = it->second;
+            if (c.delay_until && c.delay_until <= now) {
+                c.delay_until = 0;
+                c.out += c.delayed;
+                c.delayed.clear();
+                process_input(c);
+                flush_output(it->first, c);
+                update_events(it->first, c);
+            }
+        }
+    }
+}
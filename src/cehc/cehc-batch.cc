@@ -0,0 +1,374 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/logger.h"
+
+#include "cehc-batch.h"
+
+typedef struct cehc_batch_item_s {
+    cehc_batch_cb cb;
+    void *ctx;
+} cehc_batch_item_t;
+
+/**
+ * 一批，攒好之后交给一个conn，conn结束之后释放。
+ */
+typedef struct cehc_batch_s {
+    struct cehc_batcher_s *batcher;
+    struct cehc_batch_endpoint_s *ep;
+    std::string body;
+    std::vector<cehc_batch_item_t> items;
+} cehc_batch_t;
+
+/**
+ * 一个url，open为正在攒的批，由mtx保护。
+ */
+typedef struct cehc_batch_endpoint_s {
+    struct cehc_batcher_s *batcher;
+    std::string url;
+    std::mutex mtx;
+    cehc_batch_t *open;
+    Timer::TimerCallback linger_cb;  // 每个url一个，作为定时器中订阅的唯一区分
+} cehc_batch_endpoint_t;
+
+struct cehc_batcher_s {
+    cehc_http_service_t *hs;
+    cehc_batch_opts_t opts;
+    struct curl_slist *headers;     // 所有批共享，batcher释放之前所有的批都已结束
+    std::atomic<bool> closing;
+
+    std::mutex mtx;                 // 保护endpoints、inflight
+    std::condition_variable cv;
+    std::unordered_map<std::string, cehc_batch_endpoint_t*> endpoints;
+    uint64_t inflight;
+
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> flush_bytes;
+    std::atomic<uint64_t> flush_count;
+    std::atomic<uint64_t> flush_linger;
+    std::atomic<uint64_t> failed;
+};
+
+static void
+cehc_batch_on_complete(cehc_connection_ptr conn);
+
+/**
+ * 把这一批的结果交给每一条的回调，之后释放这一批。conn可以为NULL(没能创建)。
+ */
+static void
+cehc_batch_fan_out(cehc_batch_t *batch, cehc_connection_ptr conn) {
+    cehc_batcher_t *b = batch->batcher;
+    bool ok = conn && cehc_conn_ok_except_httpcode(conn) && CURLE_OK == conn->result
+              && conn->http_code >= 200 && conn->http_code < 300;
+    if (!ok) {
+        ++b->failed;
+    }
+
+    for (auto &item : batch->items) {
+        if (item.cb) {
+            item.cb(conn, item.ctx);
+        }
+    }
+
+    if (conn) {
+        cehc_delete_conn(&conn);
+    }
+    delete batch;
+
+    std::unique_lock<std::mutex> l(b->mtx);
+    if (0 == --b->inflight) {
+        b->cv.notify_all();
+    }
+}
+
+static void
+cehc_batch_send(cehc_batch_t *batch) {
+    cehc_batcher_t *b = batch->batcher;
+    {
+        std::unique_lock<std::mutex> l(b->mtx);
+        ++b->inflight;
+    }
+    ++b->batches;
+
+    cehc_newconn_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.url = batch->ep->url.c_str();
+    params.hs = b->hs;
+    params.complete_cb = cehc_batch_on_complete;
+    params.user_ctx = batch;
+    cehc_connection_ptr conn = cehc_new_conn(&params);
+    if (!conn) {
+        LOGE("new batch conn of %s failed.", batch->ep->url.c_str());
+        cehc_batch_fan_out(batch, NULL);
+        return;
+    }
+
+    CURLcode cc;
+    if (CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POST, 1L))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)batch->body.size()))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, batch->body.data()))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, b->headers))) {
+        LOGE("set batch conn opts err = %s.", curl_easy_strerror(cc));
+        conn->ce_code = cc;
+        cehc_batch_fan_out(batch, conn);
+        return;
+    }
+
+    char errmsg[CURL_ERROR_SIZE] = {0};
+    if (!cehc_run_conn(conn, errmsg)) {
+        LOGW("run batch conn of %s err = %s.", batch->ep->url.c_str(), errmsg);
+        if (cehc_conn_ok_except_httpcode(conn)) {
+            conn->cm_code = CURLM_INTERNAL_ERROR;
+        }
+        cehc_batch_fan_out(batch, conn);
+    }
+}
+
+static void
+cehc_batch_on_complete(cehc_connection_ptr conn) {
+    cehc_batch_fan_out((cehc_batch_t*)conn->user_ctx, conn);
+}
+
+/**
+ * 摘下正在攒的批，需要持有ep->mtx。
+ */
+static cehc_batch_t *
+cehc_batch_detach(cehc_batch_endpoint_t *ep) {
+    cehc_batch_t *batch = ep->open;
+    ep->open = NULL;
+    if (batch) {
+        // 已到期正在执行的linger回调最多把下一批提前发出，不影响正确性。
+        ep->batcher->hs->timer->UnsubscribeEvents(&ep->linger_cb, false);
+    }
+
+    return batch;
+}
+
+static void
+cehc_batch_on_linger(void *ctx) {
+    cehc_batch_endpoint_t *ep = (cehc_batch_endpoint_t*)ctx;
+    std::unique_lock<std::mutex> l(ep->mtx);
+    cehc_batch_t *batch = ep->open;
+    ep->open = NULL;
+    l.unlock();
+
+    if (batch) {
+        ++ep->batcher->flush_linger;
+        cehc_batch_send(batch);
+    }
+}
+
+void
+cehc_batch_opts_init(cehc_batch_opts_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    opts->max_bytes = 256 * 1024;
+    opts->max_count = 1000;
+    opts->linger_ms = 5;
+    opts->content_type = "application/x-ndjson";
+    opts->delimiter = '\n';
+}
+
+cehc_batcher_t *
+cehc_new_batcher(cehc_http_service_t *hs, const cehc_batch_opts_t *opts) {
+    cehc_batch_opts_t def;
+    if (!opts) {
+        cehc_batch_opts_init(&def);
+        opts = &def;
+    }
+    if (!hs || opts->max_bytes == 0 || opts->max_count <= 0 || opts->linger_ms < 0) {
+        LOGW("invalid batcher params.");
+        return NULL;
+    }
+    if (hs->embedded || !hs->timer) {
+        LOGW("batcher needs a http service with the timer thread.");
+        return NULL;
+    }
+
+    cehc_batcher_t *b = new (std::nothrow) cehc_batcher_t;
+    if (!b) {
+        LOGE("%s oom when new cehc_batcher_t.", __func__);
+        return NULL;
+    }
+
+    b->hs = hs;
+    b->opts = *opts;
+    b->headers = NULL;
+    b->closing = false;
+    b->inflight = 0;
+    b->submitted = 0;
+    b->batches = 0;
+    b->flush_bytes = 0;
+    b->flush_count = 0;
+    b->flush_linger = 0;
+    b->failed = 0;
+    if (opts->content_type) {
+        std::string ct = std::string("Content-Type: ") + opts->content_type;
+        b->headers = curl_slist_append(NULL, ct.c_str());
+        if (!b->headers) {
+            LOGE("%s oom when curl_slist_append.", __func__);
+            delete b;
+            return NULL;
+        }
+    }
+    b->opts.content_type = NULL;
+
+    return b;
+}
+
+bool
+cehc_batcher_submit(cehc_batcher_t *b, const char *url, const void *data, size_t len, cehc_batch_cb cb, void *ctx) {
+    if (!b || !url || (len > 0 && !data)) {
+        LOGW("invalid batch submit params.");
+        return false;
+    }
+
+    cehc_batch_endpoint_t *ep;
+    {
+        std::unique_lock<std::mutex> l(b->mtx);
+        if (b->closing) {
+            return false;
+        }
+        auto it = b->endpoints.find(url);
+        if (it != b->endpoints.end()) {
+            ep = it->second;
+        } else {
+            ep = new cehc_batch_endpoint_t;
+            ep->batcher = b;
+            ep->url = url;
+            ep->open = NULL;
+            ep->linger_cb = cehc_batch_on_linger;
+            b->endpoints[url] = ep;
+        }
+    }
+
+    cehc_batch_t *full = NULL, *ready = NULL;
+    {
+        std::unique_lock<std::mutex> l(ep->mtx);
+        if (b->closing) {
+            return false;
+        }
+
+        // 放不下这一条时先把攒着的发出去，一批的body尽量不超过max_bytes。
+        if (ep->open && ep->open->body.size() + len + 1 > b->opts.max_bytes) {
+            full = cehc_batch_detach(ep);
+        }
+        if (!ep->open) {
+            ep->open = new cehc_batch_t;
+            ep->open->batcher = b;
+            ep->open->ep = ep;
+            Timer::Event ev(ep, &ep->linger_cb);
+            b->hs->timer->SubscribeEventAfter(uctime_t::from_ms(b->opts.linger_ms), ev);
+        }
+
+        cehc_batch_t *batch = ep->open;
+        batch->body.append((const char*)data, len);
+        batch->body.push_back(b->opts.delimiter);
+        batch->items.push_back({cb, ctx});
+        if ((int)batch->items.size() >= b->opts.max_count) {
+            ready = cehc_batch_detach(ep);
+            ++b->flush_count;
+        } else if (batch->body.size() >= b->opts.max_bytes) {
+            ready = cehc_batch_detach(ep);
+            ++b->flush_bytes;
+        }
+    }
+    ++b->submitted;
+
+    if (full) {
+        ++b->flush_bytes;
+        cehc_batch_send(full);
+    }
+    if (ready) {
+        cehc_batch_send(ready);
+    }
+
+    return true;
+}
+
+void
+cehc_batcher_flush(cehc_batcher_t *b) {
+    if (!b) {
+        return;
+    }
+
+    std::vector<cehc_batch_endpoint_t*> eps;
+    {
+        std::unique_lock<std::mutex> l(b->mtx);
+        for (auto &kv : b->endpoints) {
+            eps.push_back(kv.second);
+        }
+    }
+
+    for (auto ep : eps) {
+        std::unique_lock<std::mutex> l(ep->mtx);
+        cehc_batch_t *batch = cehc_batch_detach(ep);
+        l.unlock();
+        if (batch) {
+            cehc_batch_send(batch);
+        }
+    }
+}
+
+void
+cehc_batcher_get_stats(cehc_batcher_t *b, cehc_batch_stats_t *stats) {
+    if (!b || !stats) {
+        return;
+    }
+
+    stats->submitted = b->submitted;
+    stats->batches = b->batches;
+    stats->flush_bytes = b->flush_bytes;
+    stats->flush_count = b->flush_count;
+    stats->flush_linger = b->flush_linger;
+    stats->failed = b->failed;
+    std::unique_lock<std::mutex> l(b->mtx);
+    stats->inflight = b->inflight;
+}
+
+void
+cehc_delete_batcher(cehc_batcher_t **b) {
+    if (!b || !*b) {
+        return;
+    }
+
+    cehc_batcher_t *bt = *b;
+    {
+        std::unique_lock<std::mutex> l(bt->mtx);
+        bt->closing = true;
+    }
+
+    // 之后不会再有新的批(submit在ep->mtx中检查closing)，发出攒着的，等待linger回调及所有的批结束。
+    cehc_batcher_flush(bt);
+    for (auto &kv : bt->endpoints) {
+        bt->hs->timer->UnsubscribeEvents(&kv.second->linger_cb, true);
+    }
+    cehc_batcher_flush(bt);
+
+    std::unique_lock<std::mutex> l(bt->mtx);
+    while (bt->inflight > 0) {
+        bt->cv.wait(l);
+    }
+    l.unlock();
+
+    for (auto &kv : bt->endpoints) {
+        delete kv.second;
+    }
+    curl_slist_free_all(bt->headers);
+    delete bt;
+    *b = NULL;
+}
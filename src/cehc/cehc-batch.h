@@ -0,0 +1,92 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_batch__h
+#define cehc_batch__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 小请求攒批：大量很小的POST(比如上报事件)发往同一个支持批量body(NDJSON等)的url时，
+ * 按url把payload攒在一起，每条之后加一个分隔符，一批只发一个请求。
+ * -> 一批的body达到max_bytes、条数达到max_count，或者第一条进入之后过了linger_ms，就立即发送；
+ * -> linger由http service的定时器驱动，不需要额外的线程；
+ * -> 一批的请求结束之后，依次调用这一批中每一条的回调，都拿到这一批的conn(检查错误码和http_code)。
+ * 用几毫秒的延迟换请求数的数量级下降。payload会被拷贝进这一批的body。
+ * 需要非嵌入模式的http service(嵌入模式没有定时器线程)。
+ */
+typedef struct cehc_batcher_s cehc_batcher_t;
+
+typedef struct cehc_batch_opts_s {
+    size_t max_bytes;           // 一批body的字节数上限，默认256KB
+    int max_count;              // 一批的条数上限，默认1000
+    int linger_ms;              // 第一条进入之后最多等待的时间，默认5ms
+    const char *content_type;   // 默认"application/x-ndjson"
+    char delimiter;             // 每条之后的分隔符，默认'\n'
+} cehc_batch_opts_t;
+
+typedef struct cehc_batch_stats_s {
+    uint64_t submitted;         // 提交的条数
+    uint64_t batches;           // 发出的请求数
+    uint64_t flush_bytes;       // 因字节数发送的批数
+    uint64_t flush_count;       // 因条数发送的批数
+    uint64_t flush_linger;      // 因linger到期发送的批数
+    uint64_t failed;            // 没有成功(conn出错或者http code不是2xx)的批数
+    uint64_t inflight;          // 已发出还未结束的批数
+} cehc_batch_stats_t;
+
+/**
+ * 一条payload的结果，在这一批的conn结束时调用(与complete_cb相同的线程)。
+ * @param conn 这一批的conn，只读，回调返回之后即被释放；为NULL表示没能创建请求
+ * @param ctx 提交时的ctx
+ */
+typedef void (*cehc_batch_cb)(cehc_connection_ptr conn, void *ctx);
+
+void
+cehc_batch_opts_init(cehc_batch_opts_t *opts);
+
+/**
+ * @param hs
+ * @param opts NULL为默认值
+ * @return 失败NULL
+ */
+cehc_batcher_t *
+cehc_new_batcher(cehc_http_service_t *hs, const cehc_batch_opts_t *opts);
+
+/**
+ * 提交一条payload，可在任意线程调用。
+ * @param url 同一个url的payload攒在一批
+ * @param data 会被拷贝
+ * @param len
+ * @param cb 可以为NULL
+ * @param ctx
+ * @return 参数非法或者batcher正在释放时false，此时cb不会被调用
+ */
+bool
+cehc_batcher_submit(cehc_batcher_t *b, const char *url, const void *data, size_t len, cehc_batch_cb cb, void *ctx);
+
+/**
+ * 立即发送所有攒着的payload。
+ */
+void
+cehc_batcher_flush(cehc_batcher_t *b);
+
+void
+cehc_batcher_get_stats(cehc_batcher_t *b, cehc_batch_stats_t *stats);
+
+/**
+ * 发送攒着的payload并等待所有的批结束之后释放，需要在http service释放之前调用，不可在回调中调用。
+ */
+void
+cehc_delete_batcher(cehc_batcher_t **b);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_batch__h
@@ -0,0 +1,320 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-breaker.h"
+#include "cehc-host.h"
+
+// conn的breaker_role
+#define CEHC_BREAKER_ROLE_NONE   0
+#define CEHC_BREAKER_ROLE_NORMAL 1   // closed时放行，结果计入窗口
+#define CEHC_BREAKER_ROLE_PROBE  2   // half-open时放行的探测
+
+#define CEHC_BREAKER_BUCKETS     10  // 滑动窗口的桶数
+
+struct cehc_breaker_s {
+    cehc_breaker_opts_t opts;
+    int64_t bucket_ns;
+};
+
+typedef struct cehc_breaker_bucket_s {
+    int64_t epoch;       // 桶对应的时间片编号(now / bucket_ns)
+    uint32_t total;
+    uint32_t failures;
+} cehc_breaker_bucket_t;
+
+/**
+ * 每个host的熔断状态，挂在cehc_host_t上，所有字段都由multi_handles_mtx保护。
+ */
+struct cehc_host_breaker_s {
+    cehc_http_service_t *hs;
+    cehc_host_t *host;
+    Timer::TimerCallback half_open_cb;  // 每个host一个，作为定时器中订阅的唯一区分
+    cehc_breaker_state_t state;
+    cehc_breaker_bucket_t buckets[CEHC_BREAKER_BUCKETS];
+    int64_t open_until_ns;
+    int probes_inflight;
+    int probes_ok;
+    uint64_t timeouts;
+    uint64_t opens;
+    uint64_t rejected;
+    uint64_t probes;
+};
+
+/**
+ * 打开的时间到了就进入半开，用接下来的请求探测。需持有multi_handles_mtx。
+ */
+static void
+cehc_breaker_try_half_open(cehc_host_breaker_s *hb, int64_t now) {
+    if (CEHC_BREAKER_OPEN == hb->state && now >= hb->open_until_ns) {
+        hb->state = CEHC_BREAKER_HALF_OPEN;
+        hb->probes_inflight = 0;
+        hb->probes_ok = 0;
+        LOGI("circuit breaker of host %s half-open.", hb->host->key.c_str());
+    }
+}
+
+/**
+ * 定时器线程中执行。打开期间再次打开(半开的探测失败)时会有多个事件，只有最后一个生效。
+ */
+static void
+cehc_breaker_on_open_timeout(void *ctx) {
+    cehc_host_breaker_s *hb = (cehc_host_breaker_s*)ctx;
+    if (hb->hs->stop) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hb->hs->multi_handles_mtx);
+    cehc_breaker_try_half_open(hb, CommonUtils::GetCoarseMonotonicNs());
+}
+
+static cehc_host_breaker_s *
+cehc_breaker_of(cehc_connection_ptr conn, bool create) {
+    cehc_host_t *host = conn->host;
+    if (!host) {
+        return NULL;
+    }
+
+    if (!host->breaker && create) {
+        cehc_host_breaker_s *hb = new (std::nothrow) cehc_host_breaker_s();
+        if (!hb) {
+            LOGE("%s oom when new cehc_host_breaker_s.", __func__);
+            return NULL;
+        }
+        hb->hs = conn->http_service;
+        hb->host = host;
+        hb->half_open_cb = cehc_breaker_on_open_timeout;
+        host->breaker = hb;
+    }
+
+    return host->breaker;
+}
+
+static void
+cehc_breaker_window(cehc_breaker_t *b, cehc_host_breaker_s *hb, int64_t now, uint64_t *total, uint64_t *failures) {
+    int64_t epoch = now / b->bucket_ns;
+    *total = *failures = 0;
+    for (auto &bk : hb->buckets) {
+        if (epoch - bk.epoch < CEHC_BREAKER_BUCKETS) {
+            *total += bk.total;
+            *failures += bk.failures;
+        }
+    }
+}
+
+static void
+cehc_breaker_open(cehc_breaker_t *b, cehc_host_breaker_s *hb, int64_t now) {
+    hb->state = CEHC_BREAKER_OPEN;
+    hb->open_until_ns = now + (int64_t)b->opts.open_ms * 1000 * 1000;
+    hb->probes_ok = 0;
+    ++hb->opens;
+    LOGW("circuit breaker of host %s opened.", hb->host->key.c_str());
+    // 没有请求时也要按时进入半开(统计中的状态不会停在打开)；嵌入模式没有定时器，由下一个请求转换。
+    if (hb->hs->timer) {
+        Timer::Event ev(hb, &hb->half_open_cb);
+        hb->hs->timer->SubscribeEventAfter(uctime_t::from_ms(b->opts.open_ms), ev);
+    }
+}
+
+void
+cehc_breaker_opts_init(cehc_breaker_opts_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    opts->window_ms = 10000;
+    opts->min_requests = 20;
+    opts->failure_ratio = 0.5;
+    opts->open_ms = 5000;
+    opts->half_open_probes = 3;
+}
+
+bool
+cehc_http_service_set_host_breaker(cehc_http_service_t *hs, const cehc_breaker_opts_t *opts) {
+    if (!hs || !opts || opts->window_ms < CEHC_BREAKER_BUCKETS || opts->min_requests <= 0
+        || opts->failure_ratio <= 0 || opts->failure_ratio > 1 || opts->open_ms <= 0
+        || opts->half_open_probes <= 0) {
+        LOGW("invalid host breaker opts.");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (!hs->breaker) {
+        hs->breaker = (cehc_breaker_t*)calloc(1, sizeof(cehc_breaker_t));
+        if (!hs->breaker) {
+            LOGE("%s oom when calloc cehc_breaker_t.", __func__);
+            return false;
+        }
+    }
+
+    hs->breaker->opts = *opts;
+    hs->breaker->bucket_ns = (int64_t)opts->window_ms * 1000 * 1000 / CEHC_BREAKER_BUCKETS;
+    return true;
+}
+
+bool
+cehc_http_service_get_host_breaker_stats(cehc_http_service_t *hs, const char *host, int port,
+                                         cehc_breaker_stats_t *stats) {
+    if (!hs || !stats) {
+        return false;
+    }
+
+    bzero(stats, sizeof(cehc_breaker_stats_t));
+    cehc_host_t *h = cehc_host_find(hs, host, port);
+    if (!h) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    cehc_host_breaker_s *hb = h->breaker;
+    if (!hb || !hs->breaker) {
+        return false;
+    }
+
+    stats->state = hb->state;
+    cehc_breaker_window(hs->breaker, hb, CommonUtils::GetMonotonicNs(), &stats->window_total, &stats->window_failures);
+    stats->timeouts = hb->timeouts;
+    stats->opens = hb->opens;
+    stats->rejected = hb->rejected;
+    stats->probes = hb->probes;
+    return true;
+}
+
+void
+cehc_breaker_delete(cehc_breaker_t **breaker) {
+    if (breaker && *breaker) {
+        free(*breaker);
+        *breaker = NULL;
+    }
+}
+
+bool
+cehc_breaker_admit(cehc_connection_ptr conn) {
+    conn->breaker_role = CEHC_BREAKER_ROLE_NONE;
+    cehc_breaker_t *b = conn->http_service->breaker;
+    if (!b) {
+        return true;
+    }
+
+    cehc_host_breaker_s *hb = cehc_breaker_of(conn, true);
+    if (!hb) {
+        return true;
+    }
+
+    if (CEHC_BREAKER_CLOSED == hb->state) {
+        conn->breaker_role = CEHC_BREAKER_ROLE_NORMAL;
+        return true;
+    }
+
+    // 定时器到期之前(或者嵌入模式下)就来了请求，在这里转换。
+    cehc_breaker_try_half_open(hb, CommonUtils::GetCoarseMonotonicNs());
+    if (CEHC_BREAKER_HALF_OPEN == hb->state
+        && hb->probes_inflight + hb->probes_ok < b->opts.half_open_probes) {
+        ++hb->probes_inflight;
+        ++hb->probes;
+        conn->breaker_role = CEHC_BREAKER_ROLE_PROBE;
+        // 每次打开之后是新的一轮半开，用打开次数区分探测属于哪一轮。
+        conn->breaker_round = hb->opens;
+        return true;
+    }
+
+    ++hb->rejected;
+    conn->rejected = CEHC_REJECT_BREAKER_OPEN;
+    snprintf(conn->errormsg, sizeof(conn->errormsg), "circuit breaker of host %s is open.", conn->host->key.c_str());
+    return false;
+}
+
+void
+cehc_breaker_release(cehc_connection_ptr conn) {
+    int role = conn->breaker_role;
+    conn->breaker_role = CEHC_BREAKER_ROLE_NONE;
+    cehc_breaker_t *b = conn->http_service->breaker;
+    cehc_host_breaker_s *hb = cehc_breaker_of(conn, false);
+    if (CEHC_BREAKER_ROLE_NONE == role || !b || !hb) {
+        return;
+    }
+
+    // 上一轮半开的探测晚到了，名额和结果都已经不属于当前这一轮。
+    if (CEHC_BREAKER_ROLE_PROBE == role && conn->breaker_round != hb->opens) {
+        if (CURLE_OPERATION_TIMEDOUT == conn->result) {
+            ++hb->timeouts;
+        }
+        return;
+    }
+
+    // 没有交给curl的(admit_ns为0)不是后端的问题，探测名额直接归还。
+    if (!conn->admit_ns) {
+        if (CEHC_BREAKER_ROLE_PROBE == role) {
+            --hb->probes_inflight;
+        }
+        return;
+    }
+
+    bool failed = CURLE_OK != conn->result || conn->http_code >= 500;
+    if (CURLE_OPERATION_TIMEDOUT == conn->result) {
+        ++hb->timeouts;
+    }
+
+    int64_t now = CommonUtils::GetCoarseMonotonicNs();
+    if (CEHC_BREAKER_ROLE_PROBE == role) {
+        --hb->probes_inflight;
+        if (CEHC_BREAKER_HALF_OPEN != hb->state) {
+            return;
+        }
+        if (failed) {
+            cehc_breaker_open(b, hb, now);
+        } else if (++hb->probes_ok >= b->opts.half_open_probes) {
+            hb->state = CEHC_BREAKER_CLOSED;
+            bzero(hb->buckets, sizeof(hb->buckets));
+            LOGI("circuit breaker of host %s closed.", conn->host->key.c_str());
+        }
+        return;
+    }
+
+    // 打开之前放行的请求陆续结束，不再影响状态。
+    if (CEHC_BREAKER_CLOSED != hb->state) {
+        return;
+    }
+
+    int64_t epoch = now / b->bucket_ns;
+    cehc_breaker_bucket_t *bk = hb->buckets + epoch % CEHC_BREAKER_BUCKETS;
+    if (bk->epoch != epoch) {
+        bk->epoch = epoch;
+        bk->total = bk->failures = 0;
+    }
+    ++bk->total;
+    if (failed) {
+        ++bk->failures;
+    }
+
+    uint64_t total, failures;
+    cehc_breaker_window(b, hb, now, &total, &failures);
+    if (failed && total >= (uint64_t)b->opts.min_requests && failures >= b->opts.failure_ratio * total) {
+        cehc_breaker_open(b, hb, now);
+    }
+}
+
+void
+cehc_breaker_free_host(struct cehc_host_breaker_s *hb) {
+    delete hb;
+}
+
+void
+cehc_breaker_forget(cehc_connection_ptr conn) {
+    if (CEHC_BREAKER_ROLE_NONE == conn->breaker_role) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(conn->http_service->multi_handles_mtx);
+    conn->admit_ns = 0;
+    cehc_breaker_release(conn);
+}
@@ -0,0 +1,107 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_breaker__h
+#define cehc_breaker__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按目标host:port的熔断：后端挂掉时，发往它的请求不再各自占着conn、socket和事件循环直到连接超时，而是直接失败，
+ * 把资源留给健康的host。
+ * -> 统计最近window_ms内完成的请求，传输失败(含超时)和5xx算作错误；
+ * -> 请求数不少于min_requests且错误比例达到failure_ratio时打开(open)：之后cehc_run_conn不再创建传输，
+ *    直接以conn->rejected = CEHC_REJECT_BREAKER_OPEN完成(与正常的完成一样由事件循环走complete_cb/cq/派发)；
+ * -> 打开open_ms之后由定时器转为半开(half-open)：放行half_open_probes个请求作为探测，其余仍然直接失败；
+ *    探测全部成功则关闭(closed)，任何一个失败则重新打开。
+ */
+typedef enum cehc_breaker_state_e {
+    CEHC_BREAKER_CLOSED    = 0,
+    CEHC_BREAKER_OPEN      = 1,
+    CEHC_BREAKER_HALF_OPEN = 2,
+} cehc_breaker_state_t;
+
+typedef struct cehc_breaker_opts_s {
+    int window_ms;          // 统计错误比例的滑动窗口
+    int min_requests;       // 窗口内请求数少于它时不打开
+    double failure_ratio;   // 打开的错误比例，(0, 1]
+    int open_ms;            // 打开之后多久进入半开
+    int half_open_probes;   // 半开时的探测请求数
+} cehc_breaker_opts_t;
+
+typedef struct cehc_breaker_stats_s {
+    cehc_breaker_state_t state;
+    uint64_t window_total;    // 窗口内完成的请求数
+    uint64_t window_failures; // 窗口内的错误数
+    uint64_t timeouts;        // 累计超时的个数
+    uint64_t opens;           // 累计打开的次数
+    uint64_t rejected;        // 累计直接失败的个数
+    uint64_t probes;          // 累计放行的探测个数
+} cehc_breaker_stats_t;
+
+/**
+ * 默认参数：窗口10s，至少20个请求，错误50%打开，打开5s，半开探测3个。
+ */
+void
+cehc_breaker_opts_init(cehc_breaker_opts_t *opts);
+
+/**
+ * 开启按host的熔断，需在cehc_run_http_serivce之前、没有任何conn时调用。
+ * @param hs
+ * @param opts
+ * @return 参数非法时false
+ */
+bool
+cehc_http_service_set_host_breaker(cehc_http_service_t *hs, const cehc_breaker_opts_t *opts);
+
+/**
+ * 得到某个host:port的熔断统计。
+ * @return 没有该host(还没有请求过)或者未开启时false
+ */
+bool
+cehc_http_service_get_host_breaker_stats(cehc_http_service_t *hs, const char *host, int port,
+                                         cehc_breaker_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+typedef struct cehc_breaker_s cehc_breaker_t;
+
+void
+cehc_breaker_delete(cehc_breaker_t **breaker);
+
+/**
+ * cehc_run_conn中调用，需持有multi_handles_mtx。
+ * @return true为放行；false为熔断中，已设置conn->rejected和错误信息，由调用方交给事件循环完成conn
+ */
+bool
+cehc_breaker_admit(cehc_connection_ptr conn);
+
+/**
+ * conn结束时调用，需持有multi_handles_mtx。记录结果并转换状态。
+ */
+void
+cehc_breaker_release(cehc_connection_ptr conn);
+
+/**
+ * 还在排队(没有结束)的conn被释放时归还探测名额，cehc_delete_conn中调用。
+ */
+void
+cehc_breaker_forget(cehc_connection_ptr conn);
+
+/**
+ * 释放host上的熔断状态，cehc_hosts_delete中调用(定时器已经释放)。
+ */
+void
+cehc_breaker_free_host(struct cehc_host_breaker_s *hb);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_breaker__h
@@ -0,0 +1,994 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef CEHC_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../common/logger.h"
+
+#include "cehc-codec.h"
+#include "cehc-cq.h"
+
+#define CEHC_CODEC_BUF_SIZE      (64 * 1024)
+// 池中最多保留的空闲buffer数
+#define CEHC_CODEC_FREE_MAX      256
+// 一个conn排队等待解压的字节数上限，超过时暂停接收，降到一半以下时恢复
+#define CEHC_CODEC_RECV_PENDING  (1024 * 1024)
+// 压缩好还没有发出的字节数上限，低于它时才投递下一个压缩任务
+#define CEHC_CODEC_SEND_AHEAD    (4 * CEHC_CODEC_BUF_SIZE)
+// 一个压缩任务处理的输入字节数
+#define CEHC_CODEC_ENCODE_STEP   (256 * 1024)
+
+typedef struct cehc_codec_service_s {
+    cehc_dispatch_pool_t *pool;
+    int producer;
+    spin_lock_t free_sl;
+    std::vector<char*> free_bufs;
+
+    std::atomic<uint64_t> decode_in;
+    std::atomic<uint64_t> decode_out;
+    std::atomic<uint64_t> encode_in;
+    std::atomic<uint64_t> encode_out;
+    std::atomic<uint64_t> tasks;
+    std::atomic<uint64_t> inline_fallback;
+    std::atomic<uint64_t> recv_paused;
+    std::atomic<uint64_t> buf_allocs;
+} cehc_codec_service_t;
+
+typedef struct cehc_codec_buf_s {
+    char *buf;
+    size_t len;
+} cehc_codec_buf_t;
+
+/**
+ * 排队等待解压的一块数据。enc不为-1表示从这一块开始是一个新的响应。
+ */
+typedef struct cehc_codec_chunk_s {
+    char *buf;
+    size_t len;
+    int enc;
+} cehc_codec_chunk_t;
+
+/**
+ * 解压器，只有持有任务的线程访问。
+ */
+typedef struct cehc_decoder_s {
+    int enc;
+    bool seen;          // 本响应有过输入
+    bool ended;         // 一个完整的压缩流结束了
+    bool z_inited;
+    z_stream zs;
+#ifdef CEHC_WITH_ZSTD
+    ZSTD_DStream *zds;
+#endif
+} cehc_decoder_t;
+
+/**
+ * 一个conn的压缩上传，引用计数：conn、正在排队或执行的任务、追加给上传还没有交还的每个buffer各持有一个引用。
+ */
+typedef struct cehc_encoder_s {
+    std::atomic<int> refs;
+    cehc_codec_service_t *cs;
+
+    std::mutex mtx;                 // 保护conn、scheduled、input_done
+    cehc_connection_ptr conn;       // NULL表示conn已经释放或者换了数据源
+    bool scheduled;
+    bool input_done;                // 压缩流已经全部追加并finish
+    std::atomic<size_t> ahead;      // 已追加给上传还没有交还的字节数
+
+    // 以下只有持有任务的线程访问
+    int enc;
+    z_stream zs;
+#ifdef CEHC_WITH_ZSTD
+    ZSTD_CStream *zcs;
+#endif
+    std::vector<struct iovec> in;
+    size_t cur;
+    size_t off;
+    cehc_upload_release_cb release;
+    void *ctx;
+} cehc_encoder_t;
+
+typedef struct cehc_codec_s {
+    cehc_codec_service_t *cs;
+    struct curl_slist *headers;     // 压缩上传时带Content-Encoding的请求头
+    cehc_encoder_t *encoder;
+
+    bool decode;
+    // 以下只有事件循环线程访问
+    int next_enc;                   // 最近一个响应头中的编码
+    bool new_resp;                  // 新的响应还没有数据
+
+    std::mutex mtx;                 // 保护queue、pending、scheduled、paused、ended
+    std::vector<cehc_codec_chunk_t> queue;
+    size_t pending;
+    bool scheduled;
+    bool paused;
+    bool ended;                     // 传输已结束，由工作线程通知user
+
+    std::atomic<bool> aborted;      // recv_cb中止或者解压出错，之后的数据都丢弃
+    // 以下只有持有任务的线程访问
+    bool failed;
+    char errmsg[CURL_ERROR_SIZE];
+    cehc_decoder_t dec;
+} cehc_codec_t;
+
+static char *
+cehc_codec_buf_get(cehc_codec_service_t *cs) {
+    {
+        SpinLock l(&cs->free_sl);
+        if (!cs->free_bufs.empty()) {
+            char *buf = cs->free_bufs.back();
+            cs->free_bufs.pop_back();
+            return buf;
+        }
+    }
+
+    cs->buf_allocs.fetch_add(1, std::memory_order_relaxed);
+    char *buf = (char*)malloc(CEHC_CODEC_BUF_SIZE);
+    if (!buf) {
+        LOGE("%s oom when malloc codec buffer.", __func__);
+    }
+    return buf;
+}
+
+static void
+cehc_codec_buf_put(cehc_codec_service_t *cs, char *buf) {
+    {
+        SpinLock l(&cs->free_sl);
+        if (cs->free_bufs.size() < CEHC_CODEC_FREE_MAX) {
+            cs->free_bufs.push_back(buf);
+            return;
+        }
+    }
+
+    free(buf);
+}
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，满足SPSC的单生产者要求。环满时在当前线程执行。
+ */
+static void
+cehc_codec_submit(cehc_codec_service_t *cs, void (*func)(void*), void *arg) {
+    cs->tasks.fetch_add(1, std::memory_order_relaxed);
+    if (!cehc_dispatch_pool_submit(cs->pool, cs->producer, func, arg)) {
+        cs->inline_fallback.fetch_add(1, std::memory_order_relaxed);
+        func(arg);
+    }
+}
+
+static const char *
+cehc_encoding_name(int enc) {
+    switch (enc) {
+        case CEHC_ENCODING_GZIP:
+            return "gzip";
+        case CEHC_ENCODING_DEFLATE:
+            return "deflate";
+        case CEHC_ENCODING_ZSTD:
+            return "zstd";
+        case CEHC_ENCODING_IDENTITY:
+            return "identity";
+        default:
+            return "unknown";
+    }
+}
+
+static cehc_codec_t *
+cehc_codec_get(cehc_connection_ptr conn) {
+    if (conn->codec) {
+        return conn->codec;
+    }
+
+    cehc_codec_t *c = new (std::nothrow) cehc_codec_t;
+    if (!c) {
+        LOGE("%s oom when new cehc_codec_t.", __func__);
+        return NULL;
+    }
+
+    c->cs = conn->http_service->codec;
+    c->headers = NULL;
+    c->encoder = NULL;
+    c->decode = false;
+    c->pending = 0;
+    c->scheduled = false;
+    c->dec.enc = CEHC_ENCODING_IDENTITY;
+    c->dec.z_inited = false;
+#ifdef CEHC_WITH_ZSTD
+    c->dec.zds = NULL;
+#endif
+    conn->codec = c;
+    cehc_codec_reset(conn);
+    return c;
+}
+
+// ******** 解压 ********
+
+static void
+cehc_decode_fail(cehc_codec_t *c, const char *fmt, const char *detail) {
+    if (!c->failed) {
+        c->failed = true;
+        snprintf(c->errmsg, sizeof(c->errmsg), fmt, cehc_encoding_name(c->dec.enc), detail);
+    }
+    c->aborted = true;
+}
+
+static void
+cehc_decode_emit(cehc_connection_ptr conn, const char *data, size_t len) {
+    cehc_codec_t *c = conn->codec;
+    if (0 == len || c->aborted) {
+        return;
+    }
+
+    c->cs->decode_out.fetch_add(len, std::memory_order_relaxed);
+    if (conn->recv_cb && conn->recv_cb(conn, (void*)data, 1, len) != len) {
+        c->aborted = true;
+    }
+}
+
+static void
+cehc_decoder_begin(cehc_codec_t *c, int enc) {
+    cehc_decoder_t *d = &c->dec;
+    d->enc = enc;
+    d->seen = false;
+    d->ended = false;
+    if (CEHC_ENCODING_GZIP == enc || CEHC_ENCODING_DEFLATE == enc) {
+        int rc;
+        if (d->z_inited) {
+            rc = inflateReset(&d->zs);
+        } else {
+            memset(&d->zs, 0, sizeof(d->zs));
+            // 15 + 32：自动识别gzip和zlib格式。
+            rc = inflateInit2(&d->zs, 15 + 32);
+            d->z_inited = Z_OK == rc;
+        }
+        if (Z_OK != rc) {
+            cehc_decode_fail(c, "%s init err = %s.", zError(rc));
+        }
+    }
+#ifdef CEHC_WITH_ZSTD
+    else if (CEHC_ENCODING_ZSTD == enc) {
+        if (!d->zds) {
+            d->zds = ZSTD_createDStream();
+        }
+        if (!d->zds || ZSTD_isError(ZSTD_initDStream(d->zds))) {
+            cehc_decode_fail(c, "%s init err = %s.", "ZSTD_initDStream failed");
+        }
+    }
+#endif
+}
+
+static void
+cehc_decode_feed(cehc_connection_ptr conn, const char *src, size_t n, char *out) {
+    cehc_codec_t *c = conn->codec;
+    cehc_decoder_t *d = &c->dec;
+    if (c->aborted || 0 == n) {
+        return;
+    }
+
+    d->seen = true;
+    if (CEHC_ENCODING_GZIP == d->enc || CEHC_ENCODING_DEFLATE == d->enc) {
+        d->zs.next_in = (Bytef*)src;
+        d->zs.avail_in = (uInt)n;
+        size_t produced;
+        do {
+            if (d->ended) {
+                if (0 == d->zs.avail_in) {
+                    break;
+                }
+                // 连续的多个gzip member。
+                inflateReset(&d->zs);
+                d->ended = false;
+            }
+            d->zs.next_out = (Bytef*)out;
+            d->zs.avail_out = CEHC_CODEC_BUF_SIZE;
+            int rc = inflate(&d->zs, Z_NO_FLUSH);
+            if (Z_OK != rc && Z_STREAM_END != rc && Z_BUF_ERROR != rc) {
+                cehc_decode_fail(c, "%s data err = %s.", d->zs.msg ? d->zs.msg : zError(rc));
+                return;
+            }
+            produced = CEHC_CODEC_BUF_SIZE - d->zs.avail_out;
+            cehc_decode_emit(conn, out, produced);
+            d->ended = Z_STREAM_END == rc;
+        } while (!c->aborted && (d->zs.avail_in > 0 || CEHC_CODEC_BUF_SIZE == produced));
+        return;
+    }
+
+#ifdef CEHC_WITH_ZSTD
+    if (CEHC_ENCODING_ZSTD == d->enc) {
+        ZSTD_inBuffer ib = {src, n, 0};
+        size_t produced;
+        do {
+            if (d->ended && ib.pos == ib.size) {
+                break;
+            }
+            ZSTD_outBuffer ob = {out, CEHC_CODEC_BUF_SIZE, 0};
+            size_t rc = ZSTD_decompressStream(d->zds, &ob, &ib);
+            if (ZSTD_isError(rc)) {
+                cehc_decode_fail(c, "%s data err = %s.", ZSTD_getErrorName(rc));
+                return;
+            }
+            produced = ob.pos;
+            cehc_decode_emit(conn, out, produced);
+            d->ended = 0 == rc;
+        } while (!c->aborted && (ib.pos < ib.size || CEHC_CODEC_BUF_SIZE == produced));
+        return;
+    }
+#endif
+
+    // identity或者不认识的编码原样交出。
+    cehc_decode_emit(conn, src, n);
+}
+
+/**
+ * 所有数据都交给了recv_cb，检查结果之后通知user。之后不能再访问conn。
+ */
+static void
+cehc_decode_deliver(cehc_connection_ptr conn) {
+    cehc_codec_t *c = conn->codec;
+    cehc_decoder_t *d = &c->dec;
+    bool compressed = CEHC_ENCODING_GZIP == d->enc || CEHC_ENCODING_DEFLATE == d->enc
+                      || CEHC_ENCODING_ZSTD == d->enc;
+    if (!c->aborted && CURLE_OK == conn->result && compressed && d->seen && !d->ended) {
+        cehc_decode_fail(c, "%s %s.", "body is truncated");
+    }
+
+    if (c->failed) {
+        LOGW("decode body of %s err: %s", conn->url, c->errmsg);
+        conn->result = CURLE_BAD_CONTENT_ENCODING;
+        snprintf(conn->errormsg, sizeof(conn->errormsg), "%s", c->errmsg);
+    } else if (c->aborted && CURLE_OK == conn->result) {
+        // 传输结束之后recv_cb才要求中止。
+        conn->result = CURLE_WRITE_ERROR;
+    }
+
+    if (conn->cq) {
+        cehc_cq_post(conn->cq, conn);
+    } else if (conn->complete_cb) {
+        conn->complete_cb(conn);
+    }
+}
+
+/**
+ * 工作线程(或者退化时在事件循环)中解压一个conn排队的数据，同一个conn同一时刻只有一个。
+ */
+static void
+cehc_decode_run(void *arg) {
+    cehc_connection_ptr conn = (cehc_connection_ptr)arg;
+    cehc_codec_t *c = conn->codec;
+    cehc_codec_service_t *cs = c->cs;
+    char *out = cehc_codec_buf_get(cs);
+    if (!out) {
+        cehc_decode_fail(c, "%s %s.", "out of memory");
+    }
+
+    std::vector<cehc_codec_chunk_t> q;
+    for (;;) {
+        bool deliver = false;
+        {
+            std::unique_lock<std::mutex> l(c->mtx);
+            if (c->queue.empty()) {
+                // 清掉scheduled之后事件循环可能投递新的任务，之后只有通知user时才能访问conn。
+                c->scheduled = false;
+                deliver = c->ended;
+                c->ended = false;
+            } else {
+                q.swap(c->queue);
+            }
+        }
+
+        if (q.empty()) {
+            if (out) {
+                cehc_codec_buf_put(cs, out);
+            }
+            if (deliver) {
+                cehc_decode_deliver(conn);
+            }
+            return;
+        }
+
+        size_t bytes = 0;
+        for (auto &chunk : q) {
+            if (-1 != chunk.enc) {
+                cehc_decoder_begin(c, chunk.enc);
+            }
+            cehc_decode_feed(conn, chunk.buf, chunk.len, out);
+            bytes += chunk.len;
+            cehc_codec_buf_put(cs, chunk.buf);
+        }
+        q.clear();
+        cs->decode_in.fetch_add(bytes, std::memory_order_relaxed);
+
+        bool resume = false;
+        {
+            std::unique_lock<std::mutex> l(c->mtx);
+            c->pending -= bytes;
+            if (c->paused && c->pending < CEHC_CODEC_RECV_PENDING / 2) {
+                c->paused = false;
+                resume = true;
+            }
+        }
+        if (resume) {
+            cehc_resume_conn(conn);
+        }
+    }
+}
+
+bool
+cehc_http_service_set_codec_pool(cehc_http_service_t *hs, cehc_dispatch_pool_t *pool) {
+    if (!hs || !pool || hs->codec) {
+        LOGW("invalid codec pool params.");
+        return false;
+    }
+
+    int producer = cehc_dispatch_pool_register(pool);
+    if (-1 == producer) {
+        LOGE("too many producers on codec pool.");
+        return false;
+    }
+
+    cehc_codec_service_t *cs = new (std::nothrow) cehc_codec_service_t;
+    if (!cs) {
+        LOGE("%s oom when new cehc_codec_service_t.", __func__);
+        return false;
+    }
+
+    cs->pool = pool;
+    cs->producer = producer;
+    cs->free_sl = UNLOCKED;
+    cs->decode_in = 0;
+    cs->decode_out = 0;
+    cs->encode_in = 0;
+    cs->encode_out = 0;
+    cs->tasks = 0;
+    cs->inline_fallback = 0;
+    cs->recv_paused = 0;
+    cs->buf_allocs = 0;
+    hs->codec = cs;
+    return true;
+}
+
+void
+cehc_http_service_get_codec_stats(cehc_http_service_t *hs, cehc_codec_stats_t *stats) {
+    if (!hs || !hs->codec || !stats) {
+        return;
+    }
+
+    cehc_codec_service_t *cs = hs->codec;
+    stats->decode_in = cs->decode_in.load(std::memory_order_relaxed);
+    stats->decode_out = cs->decode_out.load(std::memory_order_relaxed);
+    stats->encode_in = cs->encode_in.load(std::memory_order_relaxed);
+    stats->encode_out = cs->encode_out.load(std::memory_order_relaxed);
+    stats->tasks = cs->tasks.load(std::memory_order_relaxed);
+    stats->inline_fallback = cs->inline_fallback.load(std::memory_order_relaxed);
+    stats->recv_paused = cs->recv_paused.load(std::memory_order_relaxed);
+    stats->buf_allocs = cs->buf_allocs.load(std::memory_order_relaxed);
+}
+
+bool
+cehc_conn_enable_decode(cehc_connection_ptr conn) {
+    if (!conn || !conn->http_service || !conn->http_service->codec) {
+        LOGW("decode needs a http service with codec pool.");
+        return false;
+    }
+
+    cehc_codec_t *c = cehc_codec_get(conn);
+    if (!c) {
+        return false;
+    }
+
+#ifdef CEHC_WITH_ZSTD
+    const char *accept = "gzip, deflate, zstd";
+#else
+    const char *accept = "gzip, deflate";
+#endif
+    CURLcode cc;
+    if (CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_ACCEPT_ENCODING, accept))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_HTTP_CONTENT_DECODING, 0L))) {
+        LOGE("set decode opts err = %s.", curl_easy_strerror(cc));
+        return false;
+    }
+
+    c->decode = true;
+    return true;
+}
+
+bool
+cehc_codec_decoding(cehc_connection_ptr conn) {
+    return conn->codec && conn->codec->decode;
+}
+
+void
+cehc_codec_on_header(cehc_connection_ptr conn, const char *line, size_t len) {
+    cehc_codec_t *c = conn->codec;
+    if (!c->decode) {
+        return;
+    }
+
+    static const char kField[] = "Content-Encoding:";
+    if (len >= 5 && 0 == strncmp(line, "HTTP/", 5)) {
+        c->next_enc = CEHC_ENCODING_IDENTITY;
+        c->new_resp = true;
+        return;
+    }
+    if (len < sizeof(kField) - 1 || 0 != strncasecmp(line, kField, sizeof(kField) - 1)) {
+        return;
+    }
+
+    const char *v = line + sizeof(kField) - 1;
+    const char *end = line + len;
+    while (v < end && (' ' == *v || '\t' == *v)) {
+        ++v;
+    }
+    while (end > v && (' ' == end[-1] || '\t' == end[-1] || '\r' == end[-1] || '\n' == end[-1])) {
+        --end;
+    }
+
+    size_t n = end - v;
+    if ((4 == n && 0 == strncasecmp(v, "gzip", n)) || (6 == n && 0 == strncasecmp(v, "x-gzip", n))) {
+        c->next_enc = CEHC_ENCODING_GZIP;
+    } else if (7 == n && 0 == strncasecmp(v, "deflate", n)) {
+        c->next_enc = CEHC_ENCODING_DEFLATE;
+#ifdef CEHC_WITH_ZSTD
+    } else if (4 == n && 0 == strncasecmp(v, "zstd", n)) {
+        c->next_enc = CEHC_ENCODING_ZSTD;
+#endif
+    } else if (0 == n || (8 == n && 0 == strncasecmp(v, "identity", n))) {
+        c->next_enc = CEHC_ENCODING_IDENTITY;
+    } else {
+        LOGW("unsupported content encoding '%.*s' of %s, pass through.", (int)n, v, conn->url);
+        c->next_enc = CEHC_ENCODING_UNKNOWN;
+    }
+}
+
+size_t
+cehc_codec_on_recv(cehc_connection_ptr conn, void *ptr, size_t size) {
+    cehc_codec_t *c = conn->codec;
+    if (c->aborted) {
+        return 0;
+    }
+
+    bool submit = false;
+    {
+        std::unique_lock<std::mutex> l(c->mtx);
+        if (c->pending >= CEHC_CODEC_RECV_PENDING) {
+            // 数据留在curl中，恢复之后会再交过来。
+            if (!c->paused) {
+                c->paused = true;
+                c->cs->recv_paused.fetch_add(1, std::memory_order_relaxed);
+            }
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        const char *p = (const char*)ptr;
+        size_t left = size;
+        int enc = -1;
+        if (c->new_resp) {
+            enc = c->next_enc;
+            c->new_resp = false;
+        }
+        while (left > 0 || -1 != enc) {
+            if (-1 == enc && !c->queue.empty() && c->queue.back().len < CEHC_CODEC_BUF_SIZE) {
+                cehc_codec_chunk_t &tail = c->queue.back();
+                size_t n = std::min(left, (size_t)CEHC_CODEC_BUF_SIZE - tail.len);
+                memcpy(tail.buf + tail.len, p, n);
+                tail.len += n;
+                p += n;
+                left -= n;
+                continue;
+            }
+
+            char *buf = cehc_codec_buf_get(c->cs);
+            if (!buf) {
+                c->aborted = true;
+                return 0;
+            }
+            c->queue.push_back({buf, 0, enc});
+            enc = -1;
+        }
+
+        c->pending += size;
+        if (!c->scheduled) {
+            c->scheduled = true;
+            submit = true;
+        }
+    }
+
+    if (submit) {
+        cehc_codec_submit(c->cs, cehc_decode_run, conn);
+    }
+    return size;
+}
+
+bool
+cehc_codec_on_complete(cehc_connection_ptr conn) {
+    cehc_codec_t *c = conn->codec;
+    if (!c->decode) {
+        return false;
+    }
+
+    bool submit = false;
+    {
+        std::unique_lock<std::mutex> l(c->mtx);
+        c->ended = true;
+        if (!c->scheduled) {
+            c->scheduled = true;
+            submit = true;
+        }
+    }
+
+    if (submit) {
+        cehc_codec_submit(c->cs, cehc_decode_run, conn);
+    }
+    return true;
+}
+
+// ******** 压缩 ********
+
+static void
+cehc_encoder_unref(cehc_encoder_t *e) {
+    if (1 != e->refs.fetch_sub(1)) {
+        return;
+    }
+
+    // zs没有初始化(全0)时deflateEnd什么也不做。
+    deflateEnd(&e->zs);
+#ifdef CEHC_WITH_ZSTD
+    if (e->zcs) {
+        ZSTD_freeCStream(e->zcs);
+    }
+#endif
+    // 没有压缩完的输入(conn中途被释放)。
+    if (e->release) {
+        for (size_t i = e->cur; i < e->in.size(); ++i) {
+            e->release(e->in[i].iov_base, e->in[i].iov_len, e->ctx);
+        }
+    }
+    delete e;
+}
+
+static void
+cehc_encoder_detach(cehc_codec_t *c) {
+    cehc_encoder_t *e = c->encoder;
+    if (!e) {
+        return;
+    }
+
+    {
+        // 正在追加的任务持有mtx，之后的任务不会再访问conn。
+        std::unique_lock<std::mutex> l(e->mtx);
+        e->conn = NULL;
+    }
+    c->encoder = NULL;
+    cehc_encoder_unref(e);
+}
+
+/**
+ * 上传发完了一个压缩输出的buffer(或者上传被释放)，归还到池中。
+ */
+static void
+cehc_encode_release(void *base, size_t len, void *ctx) {
+    cehc_encoder_t *e = (cehc_encoder_t*)ctx;
+    e->ahead -= len;
+    cehc_codec_buf_put(e->cs, (char*)base);
+    cehc_encoder_unref(e);
+}
+
+/**
+ * 压缩一段输入，输出追加到outs(最后一个buffer可能没有满)。
+ * @return 0继续，1压缩流结束，-1出错
+ */
+static int
+cehc_encode_feed(cehc_encoder_t *e, const char *src, size_t n, bool finish, std::vector<cehc_codec_buf_t> *outs) {
+    for (;;) {
+        if (outs->empty() || CEHC_CODEC_BUF_SIZE == outs->back().len) {
+            char *buf = cehc_codec_buf_get(e->cs);
+            if (!buf) {
+                return -1;
+            }
+            outs->push_back({buf, 0});
+        }
+        cehc_codec_buf_t &out = outs->back();
+
+#ifdef CEHC_WITH_ZSTD
+        if (CEHC_ENCODING_ZSTD == e->enc) {
+            ZSTD_inBuffer ib = {src, n, 0};
+            ZSTD_outBuffer ob = {out.buf, CEHC_CODEC_BUF_SIZE, out.len};
+            size_t rc = ZSTD_compressStream2(e->zcs, &ob, &ib, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(rc)) {
+                LOGE("zstd compress err = %s.", ZSTD_getErrorName(rc));
+                return -1;
+            }
+            out.len = ob.pos;
+            src += ib.pos;
+            n -= ib.pos;
+            if (finish && 0 == rc) {
+                return 1;
+            }
+            if (!finish && 0 == n && ob.pos < ob.size) {
+                return 0;
+            }
+            continue;
+        }
+#endif
+
+        e->zs.next_in = (Bytef*)src;
+        e->zs.avail_in = (uInt)n;
+        e->zs.next_out = (Bytef*)out.buf + out.len;
+        e->zs.avail_out = (uInt)(CEHC_CODEC_BUF_SIZE - out.len);
+        int rc = deflate(&e->zs, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (Z_STREAM_ERROR == rc) {
+            LOGE("deflate err = %s.", zError(rc));
+            return -1;
+        }
+        out.len = CEHC_CODEC_BUF_SIZE - e->zs.avail_out;
+        src += n - e->zs.avail_in;
+        n = e->zs.avail_in;
+        if (Z_STREAM_END == rc) {
+            return 1;
+        }
+        if (!finish && 0 == n && e->zs.avail_out > 0) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * 工作线程(或者退化时在事件循环)中压缩一段输入并追加给上传，同一个conn同一时刻只有一个。
+ */
+static void
+cehc_encode_run(void *arg) {
+    cehc_encoder_t *e = (cehc_encoder_t*)arg;
+    std::vector<cehc_codec_buf_t> outs;
+    size_t budget = CEHC_CODEC_ENCODE_STEP;
+    int rc = 0;
+    while (0 == rc) {
+        if (e->cur == e->in.size()) {
+            rc = cehc_encode_feed(e, NULL, 0, true, &outs);
+            break;
+        }
+
+        const struct iovec &v = e->in[e->cur];
+        size_t n = std::min(v.iov_len - e->off, budget);
+        rc = cehc_encode_feed(e, (const char*)v.iov_base + e->off, n, false, &outs);
+        e->cs->encode_in.fetch_add(n, std::memory_order_relaxed);
+        e->off += n;
+        budget -= n;
+        if (e->off == v.iov_len) {
+            if (e->release) {
+                e->release(v.iov_base, v.iov_len, e->ctx);
+            }
+            ++e->cur;
+            e->off = 0;
+        }
+        if (0 == budget) {
+            // 压缩器可能把输入都留在了内部缓冲中，至少要交出一些数据，否则curl暂停之后没有人恢复它。
+            if (outs.size() > 1 || (1 == outs.size() && outs[0].len > 0)) {
+                break;
+            }
+            budget = CEHC_CODEC_ENCODE_STEP;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> l(e->mtx);
+        cehc_connection_ptr conn = e->conn;
+        for (auto &out : outs) {
+            if (!conn || -1 == rc || 0 == out.len) {
+                cehc_codec_buf_put(e->cs, out.buf);
+                continue;
+            }
+
+            e->ahead += out.len;
+            ++e->refs;
+            e->cs->encode_out.fetch_add(out.len, std::memory_order_relaxed);
+            if (!cehc_upload_append(conn, out.buf, out.len, cehc_encode_release, e)) {
+                e->ahead -= out.len;
+                --e->refs;
+                cehc_codec_buf_put(e->cs, out.buf);
+            }
+        }
+        if (conn && 0 != rc) {
+            // 出错时body不完整，服务端解压会失败。
+            if (-1 == rc) {
+                LOGE("compress body of %s failed, body is truncated.", conn->url);
+            }
+            e->input_done = true;
+            cehc_upload_finish(conn);
+        }
+        e->scheduled = false;
+    }
+    cehc_encoder_unref(e);
+}
+
+void
+cehc_codec_on_send(cehc_connection_ptr conn) {
+    cehc_encoder_t *e = conn->codec->encoder;
+    if (!e) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> l(e->mtx);
+        if (e->scheduled || e->input_done || e->ahead >= CEHC_CODEC_SEND_AHEAD) {
+            return;
+        }
+        e->scheduled = true;
+        ++e->refs;
+    }
+
+    cehc_codec_submit(e->cs, cehc_encode_run, e);
+}
+
+bool
+cehc_conn_upload_encoded(cehc_connection_ptr conn, cehc_encoding_t enc, int level,
+                         const struct curl_slist *headers, const struct iovec *iov, int iovcnt,
+                         cehc_upload_release_cb release, void *ctx) {
+    if (!conn || iovcnt < 0 || (iovcnt > 0 && !iov)) {
+        LOGW("invalid upload encoded params.");
+        return false;
+    }
+#ifdef CEHC_WITH_ZSTD
+    bool supported = CEHC_ENCODING_GZIP == enc || CEHC_ENCODING_DEFLATE == enc || CEHC_ENCODING_ZSTD == enc;
+#else
+    bool supported = CEHC_ENCODING_GZIP == enc || CEHC_ENCODING_DEFLATE == enc;
+#endif
+    if (!supported) {
+        LOGW("unsupported upload encoding %s.", cehc_encoding_name(enc));
+        return false;
+    }
+    if (!conn->http_service || !conn->http_service->codec) {
+        LOGW("encoded upload needs a http service with codec pool.");
+        return false;
+    }
+
+    cehc_codec_t *c = cehc_codec_get(conn);
+    if (!c) {
+        return false;
+    }
+
+    cehc_encoder_t *e = new (std::nothrow) cehc_encoder_t;
+    if (!e) {
+        LOGE("%s oom when new cehc_encoder_t.", __func__);
+        return false;
+    }
+
+    e->refs = 1;
+    e->cs = c->cs;
+    e->conn = conn;
+    e->scheduled = false;
+    e->input_done = false;
+    e->ahead = 0;
+    e->enc = enc;
+    e->cur = 0;
+    e->off = 0;
+    e->release = NULL;
+    e->ctx = ctx;
+    memset(&e->zs, 0, sizeof(e->zs));
+#ifdef CEHC_WITH_ZSTD
+    e->zcs = NULL;
+    if (CEHC_ENCODING_ZSTD == enc) {
+        e->zcs = ZSTD_createCStream();
+        if (!e->zcs || ZSTD_isError(ZSTD_CCtx_setParameter(e->zcs, ZSTD_c_compressionLevel,
+                                                           level < 0 ? ZSTD_CLEVEL_DEFAULT : level))) {
+            LOGE("init zstd compress stream failed.");
+            cehc_encoder_unref(e);
+            return false;
+        }
+    } else
+#endif
+    {
+        // windowBits + 16为gzip格式，否则为zlib格式(http的deflate)。
+        int bits = CEHC_ENCODING_GZIP == enc ? 15 + 16 : 15;
+        int rc = deflateInit2(&e->zs, level < 0 ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED, bits, 8,
+                              Z_DEFAULT_STRATEGY);
+        if (Z_OK != rc) {
+            LOGE("deflateInit2 err = %s.", zError(rc));
+            cehc_encoder_unref(e);
+            return false;
+        }
+    }
+
+    struct curl_slist *hl = NULL;
+    for (const struct curl_slist *h = headers; h; h = h->next) {
+        struct curl_slist *l = curl_slist_append(hl, h->data);
+        if (!l) {
+            break;
+        }
+        hl = l;
+    }
+    std::string ce = std::string("Content-Encoding: ") + cehc_encoding_name(enc);
+    struct curl_slist *l = curl_slist_append(hl, ce.c_str());
+    CURLcode cc = CURLE_OUT_OF_MEMORY;
+    if (!l || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, l))) {
+        LOGE("set encoded upload headers err = %s.", curl_easy_strerror(cc));
+        curl_slist_free_all(l ? l : hl);
+        cehc_encoder_unref(e);
+        return false;
+    }
+    curl_slist_free_all(c->headers);
+    c->headers = l;
+
+    // 先断开旧的压缩任务，它们不能再向新的数据源追加。
+    cehc_encoder_detach(c);
+    if (!cehc_conn_upload_chunked(conn)) {
+        cehc_encoder_unref(e);
+        return false;
+    }
+
+    e->in.assign(iov, iov + iovcnt);
+    e->release = release;
+    c->encoder = e;
+    return true;
+}
+
+// ******** conn ********
+
+void
+cehc_codec_reset(cehc_connection_ptr conn) {
+    cehc_codec_t *c = conn->codec;
+    for (auto &chunk : c->queue) {
+        cehc_codec_buf_put(c->cs, chunk.buf);
+    }
+    c->queue.clear();
+    c->pending = 0;
+    c->paused = false;
+    c->ended = false;
+    c->aborted = false;
+    c->failed = false;
+    c->errmsg[0] = '\0';
+    c->next_enc = CEHC_ENCODING_IDENTITY;
+    c->new_resp = true;
+    c->dec.seen = false;
+    c->dec.ended = false;
+}
+
+void
+cehc_codec_free(cehc_connection_ptr conn) {
+    cehc_codec_t *c = conn->codec;
+    if (!c) {
+        return;
+    }
+
+    cehc_encoder_detach(c);
+    for (auto &chunk : c->queue) {
+        cehc_codec_buf_put(c->cs, chunk.buf);
+    }
+    if (c->dec.z_inited) {
+        inflateEnd(&c->dec.zs);
+    }
+#ifdef CEHC_WITH_ZSTD
+    if (c->dec.zds) {
+        ZSTD_freeDStream(c->dec.zds);
+    }
+#endif
+    curl_slist_free_all(c->headers);
+    delete c;
+    conn->codec = NULL;
+}
+
+void
+cehc_codec_service_delete(cehc_http_service_t *hs) {
+    cehc_codec_service_t *cs = hs->codec;
+    if (!cs) {
+        return;
+    }
+
+    for (auto buf : cs->free_bufs) {
+        free(buf);
+    }
+    delete cs;
+    hs->codec = NULL;
+}
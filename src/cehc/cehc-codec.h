@@ -0,0 +1,139 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_codec__h
+#define cehc_codec__h
+
+#include <sys/uio.h>
+
+#include "cehttpclient.h"
+#include "cehc-dispatch.h"
+#include "cehc-upload.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 在工作线程池中压缩请求body、解压响应body，事件循环只搬运压缩过的字节。
+ * -> 解压：curl不再解压(CURLOPT_HTTP_CONTENT_DECODING为0)，事件循环把收到的数据拷进池化的buffer排队，
+ *    由工作线程按Content-Encoding解压之后调用recv_cb；排队的数据超过上限时暂停接收，工作线程追上之后恢复；
+ * -> 压缩：body以chunked的方式上传(见cehc-upload.h)，curl要数据时事件循环投递压缩任务，
+ *    工作线程每次压缩一段输入，输出的buffer追加给上传，发完之后归还到池中；压缩超前的数据有上限。
+ * 同一个conn同一时刻只有一个压缩/解压任务，数据的顺序不变。
+ * 工作线程池使用cehc_new_dispatch_pool创建的pool，可以与完成派发共用。
+ * 支持gzip、deflate，编译时定义CEHC_WITH_ZSTD时支持zstd。
+ */
+
+typedef enum cehc_encoding_e {
+    CEHC_ENCODING_IDENTITY = 0,
+    CEHC_ENCODING_GZIP     = 1,
+    CEHC_ENCODING_DEFLATE  = 2,
+    CEHC_ENCODING_ZSTD     = 3, // 需要编译时定义CEHC_WITH_ZSTD
+    CEHC_ENCODING_UNKNOWN  = 4  // 响应的Content-Encoding不认识，数据原样交给recv_cb
+} cehc_encoding_t;
+
+typedef struct cehc_codec_stats_s {
+    uint64_t decode_in;         // 解压的输入字节数
+    uint64_t decode_out;        // 解压的输出字节数
+    uint64_t encode_in;         // 压缩的输入字节数
+    uint64_t encode_out;        // 压缩的输出字节数
+    uint64_t tasks;             // 投递给工作线程的任务数
+    uint64_t inline_fallback;   // 环满退化为在事件循环中执行的任务数
+    uint64_t recv_paused;       // 解压跟不上而暂停接收的次数
+    uint64_t buf_allocs;        // 池中没有空闲buffer而新分配的次数
+} cehc_codec_stats_t;
+
+/**
+ * 为http service开启压缩/解压，需在cehc_run_http_serivce之前调用，pool需要在http service释放之后释放。
+ * @return 成功true；pool上注册的http service过多时失败返回false。
+ */
+bool
+cehc_http_service_set_codec_pool(cehc_http_service_t *hs, cehc_dispatch_pool_t *pool);
+
+void
+cehc_http_service_get_codec_stats(cehc_http_service_t *hs, cehc_codec_stats_t *stats);
+
+/**
+ * 在工作线程中解压conn的响应body，需在cehc_run_conn之前调用，conn重复run时重新开始。
+ * -> 请求带上Accept-Encoding(gzip, deflate，以及zstd)；
+ * -> recv_cb在工作线程中调用，拿到的是解压之后的数据，返回值不等于数据大小时中止传输；
+ * -> 此时complete_cb(或者投递cq)也在工作线程中，在所有数据交给recv_cb之后进行；
+ * -> body不完整或者解压出错时conn->result为CURLE_BAD_CONTENT_ENCODING。
+ * 不能与stream、records同时使用。
+ * @return http service没有开启压缩/解压时false
+ */
+bool
+cehc_conn_enable_decode(cehc_connection_ptr conn);
+
+/**
+ * 压缩之后以chunked的方式上传iov，并设置Content-Encoding头。
+ * iov的buffer在压缩完之后(或者conn释放时)通过release交还。之后除了再次调用本函数，不要用cehc-upload.h更换数据源。
+ * @param conn
+ * @param enc CEHC_ENCODING_GZIP、CEHC_ENCODING_DEFLATE或者CEHC_ENCODING_ZSTD
+ * @param level 压缩级别，-1为默认
+ * @param headers 请求的其他头，会被拷贝，可以为NULL。之后不要再设置CURLOPT_HTTPHEADER
+ * @param iov
+ * @param iovcnt
+ * @param release 可以为NULL
+ * @param ctx
+ * @return 失败false，此时buffer不会被交还
+ */
+bool
+cehc_conn_upload_encoded(cehc_connection_ptr conn, cehc_encoding_t enc, int level,
+                         const struct curl_slist *headers, const struct iovec *iov, int iovcnt,
+                         cehc_upload_release_cb release, void *ctx);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * @return conn开启了解压
+ */
+bool
+cehc_codec_decoding(cehc_connection_ptr conn);
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，新的响应头，解析Content-Encoding。
+ */
+void
+cehc_codec_on_header(cehc_connection_ptr conn, const char *line, size_t len);
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，收到的数据排队等待解压。
+ * @return size、0(中止)或者CURL_WRITEFUNC_PAUSE
+ */
+size_t
+cehc_codec_on_recv(cehc_connection_ptr conn, void *ptr, size_t size);
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，curl要发送的数据，需要时投递压缩任务。
+ */
+void
+cehc_codec_on_send(cehc_connection_ptr conn);
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，传输结束。
+ * @return 完成的通知交给了工作线程时true，调用方不再通知user
+ */
+bool
+cehc_codec_on_complete(cehc_connection_ptr conn);
+
+/**
+ * cehc_run_conn时重置。
+ */
+void
+cehc_codec_reset(cehc_connection_ptr conn);
+
+void
+cehc_codec_free(cehc_connection_ptr conn);
+
+void
+cehc_codec_service_delete(cehc_http_service_t *hs);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_codec__h
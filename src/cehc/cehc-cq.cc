@@ -0,0 +1,211 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "../common/logger.h"
+#include "../common/mpmc-ring.h"
+
+#include "cehc-cq.h"
+
+struct cehc_completion_queue_s {
+    explicit cehc_completion_queue_s(size_t capacity) : ring(capacity) {}
+
+    MpmcRing<cehc_connection_ptr> ring;
+    int efd = -1;
+    /**
+     * 消费方准备睡眠时置1，投递方CAS成功(1->0)的那一个负责写eventfd。
+     */
+    volatile int armed = 0;
+    /**
+     * eventfd已被写过且还没有被读掉，消费方据此决定是否需要read清空。
+     */
+    volatile int signaled = 0;
+    /**
+     * 环满时的溢出链表(经由conn->cq_next串起来)。
+     */
+    spin_lock_t overflow_sl = UNLOCKED;
+    cehc_connection_ptr overflow_head = NULL;
+    cehc_connection_ptr overflow_tail = NULL;
+    volatile size_t overflow_cnt = 0;
+
+    std::atomic<uint64_t> posted{0};
+    std::atomic<uint64_t> overflow{0};
+    std::atomic<uint64_t> wakeups{0};
+};
+
+static void
+cehc_cq_clear_signal(cehc_completion_queue_t *cq) {
+    uint64_t cnt;
+    if (-1 == read(cq->efd, &cnt, sizeof(cnt)) && EAGAIN != errno) {
+        int err = errno;
+        LOGE("read cq eventfd err = %s.", strerror(err));
+    }
+}
+
+/**
+ * 非阻塞地取出最多max个完成。
+ */
+static int
+cehc_cq_take(cehc_completion_queue_t *cq, cehc_connection_ptr *out, int max) {
+    if (cq->signaled && atomic_cas(&cq->signaled, 1, 0)) {
+        cehc_cq_clear_signal(cq);
+    }
+
+    int n = (int)cq->ring.TryPopN(out, (size_t)max);
+    if (n < max && cq->overflow_cnt) {
+        SpinLock l(&cq->overflow_sl);
+        while (n < max && cq->overflow_head) {
+            cehc_connection_ptr conn = cq->overflow_head;
+            cq->overflow_head = conn->cq_next;
+            conn->cq_next = NULL;
+            out[n++] = conn;
+            --cq->overflow_cnt;
+        }
+        if (!cq->overflow_head) {
+            cq->overflow_tail = NULL;
+        }
+    }
+
+    return n;
+}
+
+cehc_completion_queue_t *
+cehc_new_completion_queue(size_t capacity) {
+    int efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (-1 == efd) {
+        int err = errno;
+        LOGE("eventfd err = %s.", strerror(err));
+        return NULL;
+    }
+
+    cehc_completion_queue_t *cq = new (std::nothrow) cehc_completion_queue_t(capacity);
+    if (!cq) {
+        LOGE("%s oom when new cehc_completion_queue_t.", __func__);
+        close(efd);
+        return NULL;
+    }
+
+    cq->efd = efd;
+    return cq;
+}
+
+void
+cehc_delete_completion_queue(cehc_completion_queue_t **cq) {
+    if (cq && *cq) {
+        if (-1 != (*cq)->efd) {
+            close((*cq)->efd);
+        }
+        delete *cq;
+        *cq = NULL;
+    }
+}
+
+int
+cehc_cq_poll(cehc_completion_queue_t *cq, cehc_connection_ptr *out, int max, int timeout_ms) {
+    if (!cq || !out || max <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    using namespace std::chrono;
+    auto deadline = steady_clock::now() + milliseconds(timeout_ms > 0 ? timeout_ms : 0);
+    for (;;) {
+        int n = cehc_cq_take(cq, out, max);
+        if (n || 0 == timeout_ms) {
+            return n;
+        }
+
+        if (!cehc_cq_arm(cq)) {
+            continue;
+        }
+
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            auto left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+            if (left <= 0) {
+                return cehc_cq_take(cq, out, max);
+            }
+            wait_ms = (int)left;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = cq->efd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int r = poll(&pfd, 1, wait_ms);
+        if (-1 == r && EINTR != errno) {
+            int err = errno;
+            LOGE("poll cq eventfd err = %s.", strerror(err));
+            errno = err;
+            return -1;
+        }
+        if (r > 0) {
+            // 投递方先写eventfd再置signaled，这里可能先于置位醒来，直接清掉避免空转。
+            cehc_cq_clear_signal(cq);
+        }
+    }
+}
+
+int
+cehc_cq_fd(cehc_completion_queue_t *cq) {
+    return cq ? cq->efd : -1;
+}
+
+bool
+cehc_cq_arm(cehc_completion_queue_t *cq) {
+    if (!cq) {
+        return false;
+    }
+
+    cq->armed = 1;
+    hw_rw_memory_barrier();
+    // arm之后再检查一次，避免投递方在arm之前入队而没有看到armed。
+    return !(cq->ring.Size() || cq->overflow_cnt);
+}
+
+void
+cehc_cq_get_stats(cehc_completion_queue_t *cq, cehc_cq_stats_t *stats) {
+    if (!cq || !stats) {
+        return;
+    }
+
+    stats->posted = cq->posted.load(std::memory_order_relaxed);
+    stats->overflow = cq->overflow.load(std::memory_order_relaxed);
+    stats->wakeups = cq->wakeups.load(std::memory_order_relaxed);
+}
+
+void
+cehc_cq_post(cehc_completion_queue_t *cq, cehc_connection_ptr conn) {
+    if (!cq->ring.TryPush(conn)) {
+        SpinLock l(&cq->overflow_sl);
+        conn->cq_next = NULL;
+        if (cq->overflow_tail) {
+            cq->overflow_tail->cq_next = conn;
+        } else {
+            cq->overflow_head = conn;
+        }
+        cq->overflow_tail = conn;
+        ++cq->overflow_cnt;
+        cq->overflow.fetch_add(1, std::memory_order_relaxed);
+    }
+    cq->posted.fetch_add(1, std::memory_order_relaxed);
+
+    hw_rw_memory_barrier();
+    if (cq->armed && atomic_cas(&cq->armed, 1, 0)) {
+        uint64_t one = 1;
+        if (-1 == write(cq->efd, &one, sizeof(one)) && EAGAIN != errno) {
+            int err = errno;
+            LOGE("write cq eventfd err = %s.", strerror(err));
+        }
+        cq->signaled = 1;
+        cq->wakeups.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,88 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_cq__h
+#define cehc_cq__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 完成队列(类似io_uring的CQ)：批量提交请求，之后由user在自己的循环中批量收割已完成的conn，
+ * 而不是每个请求一次complete_cb。
+ * -> conn创建时指定了cq(cehc_newconn_params_t::cq)，传输结束后事件循环把conn投递到cq，不再调用complete_cb；
+ * -> 投递是一次无锁入环(MPMC，多个http service可以共享一个cq)，环满时挂到溢出链表，事件循环永不阻塞；
+ * -> 只有消费方准备睡眠(已arm)时投递方才写一次eventfd，所以消费方每睡醒一次只有一次系统调用，
+ *    醒来之后cehc_cq_poll一次可以收割多个完成；
+ * -> 也可以把cehc_cq_fd加入user自己的epoll：cehc_cq_arm返回true之后再等待fd可读，返回false说明已有完成可取。
+ * 同一个cq可以有多个消费线程，完成的顺序不保证与结束的顺序一致(溢出时)。
+ * recv_cb/header_cb仍在事件循环中调用(开启了dispatch时cq的conn也不会派发)。
+ */
+typedef struct cehc_completion_queue_s cehc_completion_queue_t;
+
+typedef struct cehc_cq_stats_s {
+    uint64_t posted;   // 投递的完成数
+    uint64_t overflow; // 环满走溢出链表的完成数
+    uint64_t wakeups;  // 写eventfd唤醒消费方的次数
+} cehc_cq_stats_t;
+
+/**
+ * 创建完成队列。
+ * @param capacity 无锁环的容量，向上取整为2的幂
+ * @return 失败NULL
+ */
+cehc_completion_queue_t *
+cehc_new_completion_queue(size_t capacity);
+
+/**
+ * 释放完成队列，需要在所有投递到它的conn都已结束之后调用。
+ * 队列中未取走的conn不会被释放。
+ */
+void
+cehc_delete_completion_queue(cehc_completion_queue_t **cq);
+
+/**
+ * 收割已完成的conn。
+ * @param cq
+ * @param out 输出数组，取走的conn由user负责cehc_delete_conn或重新cehc_run_conn
+ * @param max out的长度
+ * @param timeout_ms 没有完成时的等待时间，0不等待，-1一直等待
+ * @return 取到的conn个数，超时为0；出错为-1并设置errno。
+ */
+int
+cehc_cq_poll(cehc_completion_queue_t *cq, cehc_connection_ptr *out, int max, int timeout_ms);
+
+/**
+ * 用于user自己的事件循环：可读表示有完成可取(需要先cehc_cq_arm)。
+ */
+int
+cehc_cq_fd(cehc_completion_queue_t *cq);
+
+/**
+ * 请求在下一次投递时通过cehc_cq_fd通知。
+ * @return true表示已arm，可以等待fd可读；false表示队列中已有完成，应直接cehc_cq_poll。
+ */
+bool
+cehc_cq_arm(cehc_completion_queue_t *cq);
+
+void
+cehc_cq_get_stats(cehc_completion_queue_t *cq, cehc_cq_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 事件循环线程调用，投递一个完成的conn，非阻塞。
+ */
+void
+cehc_cq_post(cehc_completion_queue_t *cq, cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_cq__h
@@ -0,0 +1,380 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../common/logger.h"
+#include "../common/worker-pool.h"
+
+#include "cehc-dispatch.h"
+#include "cehc-trace.h"
+
+// 一块body缓冲的大小，curl的多次回调拼在同一块中
+#define CEHC_DISPATCH_CHUNK_SIZE      (64 * 1024)
+// pool中最多保留的空闲块数
+#define CEHC_DISPATCH_FREE_MAX        256
+// 一个conn排队等待recv_cb的字节数上限，超过时暂停接收，降到一半以下时恢复
+#define CEHC_DISPATCH_RECV_PENDING    (1024 * 1024)
+
+typedef struct cehc_body_chunk_s {
+    struct cehc_body_chunk_s *next;
+    size_t len;
+    char data[CEHC_DISPATCH_CHUNK_SIZE];
+} cehc_body_chunk_t;
+
+struct cehc_dispatch_pool_s {
+    WorkerPool *wp;
+    std::atomic<uint64_t> inline_fallback;
+    std::atomic<uint64_t> recv_paused;
+    spin_lock_t free_sl;
+    std::vector<cehc_body_chunk_t*> free_chunks;
+};
+
+/**
+ * 一个conn的派发状态。同一时刻最多只有一个任务在处理它，所以回调保序。
+ */
+typedef struct cehc_dispatch_s {
+    std::mutex mtx;                 // 保护head、tail、pending、scheduled、paused、ended
+    cehc_body_chunk_t *head;
+    cehc_body_chunk_t *tail;
+    size_t pending;
+    bool scheduled;
+    bool paused;
+    bool ended;                     // 传输已结束，由工作线程通知user
+
+    std::atomic<bool> aborted;      // recv_cb要求中止，之后的数据都丢弃
+} cehc_dispatch_t;
+
+static cehc_body_chunk_t *
+cehc_dispatch_chunk_get(cehc_dispatch_pool_t *pool) {
+    cehc_body_chunk_t *chunk = NULL;
+    {
+        SpinLock l(&pool->free_sl);
+        if (!pool->free_chunks.empty()) {
+            chunk = pool->free_chunks.back();
+            pool->free_chunks.pop_back();
+        }
+    }
+
+    if (!chunk) {
+        chunk = (cehc_body_chunk_t*)malloc(sizeof(cehc_body_chunk_t));
+        if (!chunk) {
+            LOGE("%s oom when malloc body chunk.", __func__);
+            return NULL;
+        }
+    }
+    chunk->next = NULL;
+    chunk->len = 0;
+    return chunk;
+}
+
+static void
+cehc_dispatch_chunk_put(cehc_dispatch_pool_t *pool, cehc_body_chunk_t *chunk) {
+    {
+        SpinLock l(&pool->free_sl);
+        if (pool->free_chunks.size() < CEHC_DISPATCH_FREE_MAX) {
+            pool->free_chunks.push_back(chunk);
+            return;
+        }
+    }
+
+    free(chunk);
+}
+
+static cehc_dispatch_t *
+cehc_dispatch_get(cehc_connection_ptr conn) {
+    if (conn->dispatch) {
+        return conn->dispatch;
+    }
+
+    cehc_dispatch_t *d = new (std::nothrow) cehc_dispatch_t;
+    if (!d) {
+        LOGE("%s oom when new cehc_dispatch_t.", __func__);
+        return NULL;
+    }
+
+    d->head = d->tail = NULL;
+    conn->dispatch = d;
+    cehc_dispatch_reset(conn);
+    return d;
+}
+
+/**
+ * 所有数据都交给了recv_cb，通知user。之后不能再访问conn。
+ */
+static void
+cehc_dispatch_deliver(cehc_connection_ptr conn, bool aborted) {
+    int64_t now = WorkerPool::NowNs();
+    conn->dispatch_delay_ns = now - conn->dispatch_enqueue_ns;
+    if (aborted && CURLE_OK == conn->result) {
+        // 传输结束之后recv_cb才要求中止。
+        conn->result = CURLE_WRITE_ERROR;
+    }
+
+    if (UNLIKELY(conn->trace_id)) {
+        // NowNs与GetMonotonicNs同为CLOCK_MONOTONIC。
+        cehc_trace_dispatched(conn, conn->dispatch_enqueue_ns);
+        if (conn->complete_cb) {
+            cehc_trace_complete(conn);
+        }
+    } else if (conn->complete_cb) {
+        conn->complete_cb(conn);
+    }
+}
+
+/**
+ * 在工作线程(或者退化时在事件循环)上按顺序把conn排队的数据交给recv_cb，传输结束时再调用complete_cb。
+ */
+static void
+cehc_dispatch_run(void *arg) {
+    cehc_connection_ptr conn = (cehc_connection_ptr)arg;
+    cehc_dispatch_t *d = conn->dispatch;
+    cehc_dispatch_pool_t *pool = conn->http_service->dispatch_pool;
+    for (;;) {
+        cehc_body_chunk_t *chunk = NULL;
+        bool deliver = false;
+        {
+            std::unique_lock<std::mutex> l(d->mtx);
+            if (!d->head) {
+                // 清掉scheduled之后事件循环可能投递新的任务，之后只有通知user时才能访问conn。
+                d->scheduled = false;
+                deliver = d->ended;
+                d->ended = false;
+            } else {
+                chunk = d->head;
+                d->head = chunk->next;
+                if (!d->head) {
+                    d->tail = NULL;
+                }
+            }
+        }
+
+        if (!chunk) {
+            if (deliver) {
+                cehc_dispatch_deliver(conn, d->aborted);
+            }
+            return;
+        }
+
+        size_t len = chunk->len;
+        if (!d->aborted && conn->recv_cb) {
+            size_t n = UNLIKELY(conn->trace_id) ? cehc_trace_recv(conn, chunk->data, 1, len)
+                                                : conn->recv_cb(conn, chunk->data, 1, len);
+            if (n != len) {
+                d->aborted = true;
+            }
+        }
+        cehc_dispatch_chunk_put(pool, chunk);
+
+        bool resume = false;
+        {
+            std::unique_lock<std::mutex> l(d->mtx);
+            d->pending -= len;
+            // 中止之后也要恢复，curl再交数据过来时才能得知中止。
+            if (d->paused && (d->pending < CEHC_DISPATCH_RECV_PENDING / 2 || d->aborted)) {
+                d->paused = false;
+                resume = true;
+            }
+        }
+        if (resume) {
+            cehc_resume_conn(conn);
+        }
+    }
+}
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，满足SPSC的单生产者要求。环满时在当前线程执行。
+ */
+static void
+cehc_dispatch_submit(cehc_connection_ptr conn) {
+    cehc_http_service_t *hs = conn->http_service;
+    if (!hs->dispatch_pool->wp->Submit(hs->dispatch_producer, cehc_dispatch_run, conn)) {
+        hs->dispatch_pool->inline_fallback.fetch_add(1, std::memory_order_relaxed);
+        cehc_dispatch_run(conn);
+    }
+}
+
+cehc_dispatch_pool_t *
+cehc_new_dispatch_pool(int workers, size_t queue_cap) {
+    cehc_dispatch_pool_t *pool = new (std::nothrow) cehc_dispatch_pool_t;
+    if (!pool) {
+        LOGE("%s oom when new cehc_dispatch_pool_t.", __func__);
+        return NULL;
+    }
+
+    pool->wp = new WorkerPool(workers, queue_cap);
+    pool->inline_fallback.store(0);
+    pool->recv_paused.store(0);
+    pool->free_sl = UNLOCKED;
+    pool->wp->Start();
+    return pool;
+}
+
+void
+cehc_delete_dispatch_pool(cehc_dispatch_pool_t **pool) {
+    if (pool && *pool) {
+        (*pool)->wp->Stop();
+        DELETE_PTR((*pool)->wp);
+        for (auto chunk : (*pool)->free_chunks) {
+            free(chunk);
+        }
+        delete *pool;
+        *pool = NULL;
+    }
+}
+
+bool
+cehc_http_service_set_dispatch_pool(cehc_http_service_t *hs, cehc_dispatch_pool_t *pool) {
+    if (!hs || !pool) {
+        return false;
+    }
+
+    int producer = pool->wp->RegisterProducer();
+    if (-1 == producer) {
+        LOGE("too many http services on dispatch pool, max = %d.", WorkerPool::kMaxProducers);
+        return false;
+    }
+
+    hs->dispatch_producer = producer;
+    hs->dispatch_pool = pool;
+    return true;
+}
+
+void
+cehc_dispatch_pool_get_stats(cehc_dispatch_pool_t *pool, cehc_dispatch_stats_t *stats) {
+    WorkerPool::Stats ws;
+    pool->wp->GetStats(&ws);
+    stats->inline_fallback = pool->inline_fallback.load(std::memory_order_relaxed);
+    stats->recv_paused = pool->recv_paused.load(std::memory_order_relaxed);
+    stats->dispatched = ws.executed;
+    stats->stolen = ws.stolen;
+    stats->queue_delay_avg_ns = ws.executed ? ws.queue_delay_total_ns / ws.executed : 0;
+    stats->queue_delay_max_ns = ws.queue_delay_max_ns;
+}
+
+size_t
+cehc_dispatch_on_recv(cehc_connection_ptr conn, void *ptr, size_t size) {
+    cehc_dispatch_t *d = cehc_dispatch_get(conn);
+    if (!d || d->aborted) {
+        return 0;
+    }
+
+    cehc_dispatch_pool_t *pool = conn->http_service->dispatch_pool;
+    bool submit = false;
+    {
+        std::unique_lock<std::mutex> l(d->mtx);
+        if (d->pending >= CEHC_DISPATCH_RECV_PENDING) {
+            // 数据留在curl中，恢复之后会再交过来。
+            if (!d->paused) {
+                d->paused = true;
+                pool->recv_paused.fetch_add(1, std::memory_order_relaxed);
+            }
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        const char *p = (const char*)ptr;
+        size_t left = size;
+        while (left > 0) {
+            cehc_body_chunk_t *tail = d->tail;
+            if (!tail || CEHC_DISPATCH_CHUNK_SIZE == tail->len) {
+                if (!(tail = cehc_dispatch_chunk_get(pool))) {
+                    d->aborted = true;
+                    return 0;
+                }
+                if (d->tail) {
+                    d->tail->next = tail;
+                } else {
+                    d->head = tail;
+                }
+                d->tail = tail;
+            }
+
+            size_t n = std::min(left, (size_t)CEHC_DISPATCH_CHUNK_SIZE - tail->len);
+            memcpy(tail->data + tail->len, p, n);
+            tail->len += n;
+            p += n;
+            left -= n;
+        }
+
+        d->pending += size;
+        if (!d->scheduled) {
+            d->scheduled = true;
+            submit = true;
+        }
+    }
+
+    if (submit) {
+        cehc_dispatch_submit(conn);
+    }
+    return size;
+}
+
+void
+cehc_dispatch_complete(cehc_connection_ptr conn) {
+    conn->dispatch_enqueue_ns = WorkerPool::NowNs();
+    cehc_dispatch_t *d = cehc_dispatch_get(conn);
+    if (!d) {
+        cehc_dispatch_deliver(conn, false);
+        return;
+    }
+
+    bool submit = false;
+    {
+        std::unique_lock<std::mutex> l(d->mtx);
+        d->ended = true;
+        if (!d->scheduled) {
+            d->scheduled = true;
+            submit = true;
+        }
+    }
+
+    if (submit) {
+        cehc_dispatch_submit(conn);
+    }
+}
+
+void
+cehc_dispatch_reset(cehc_connection_ptr conn) {
+    cehc_dispatch_t *d = conn->dispatch;
+    cehc_body_chunk_t *chunk = d->head;
+    while (chunk) {
+        cehc_body_chunk_t *next = chunk->next;
+        cehc_dispatch_chunk_put(conn->http_service->dispatch_pool, chunk);
+        chunk = next;
+    }
+    d->head = d->tail = NULL;
+    d->pending = 0;
+    d->scheduled = false;
+    d->paused = false;
+    d->ended = false;
+    d->aborted = false;
+}
+
+void
+cehc_dispatch_free(cehc_connection_ptr conn) {
+    if (!conn->dispatch) {
+        return;
+    }
+
+    cehc_dispatch_reset(conn);
+    delete conn->dispatch;
+    conn->dispatch = NULL;
+}
+
+int
+cehc_dispatch_pool_register(cehc_dispatch_pool_t *pool) {
+    return pool->wp->RegisterProducer();
+}
+
+bool
+cehc_dispatch_pool_submit(cehc_dispatch_pool_t *pool, int producer, void (*func)(void*), void *arg) {
+    return pool->wp->Submit(producer, func, arg);
+}
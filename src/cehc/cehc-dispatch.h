@@ -0,0 +1,105 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_dispatch__h
+#define cehc_dispatch__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 完成派发模式：把complete_cb/recv_cb从事件循环挪到一个工作线程池中执行。
+ * -> 事件循环只负责传输：recv的数据拷贝到conn的队列(64K一块，块从pool中复用)，有数据时conn作为一个任务
+ *    经由本http service独占的SPSC环投递给工作线程，边收边交给recv_cb；
+ * -> 同一个conn同一时刻只有一个任务在处理，按顺序对每一块数据调用recv_cb，传输结束后调用complete_cb，
+ *    所以同一个conn的回调顺序不变；
+ * -> 每个conn排队的数据有上限(1M)，recv_cb跟不上时暂停传输，消化到一半以下时恢复，内存不会无限增长；
+ * -> recv_cb的返回值与直接模式一样：不等于交给它的长度即中止传输(curl下一次交数据时中止，
+ *    已经收完时result为CURLE_WRITE_ERROR)；工作线程上不支持返回CURL_WRITEFUNC_PAUSE，直接阻塞即可；
+ * -> 空闲的工作线程会从忙碌的工作线程那里偷任务；
+ * -> 所有环都满时退化为在事件循环中执行，事件循环不会因此阻塞。
+ * header_cb仍在事件循环中调用。一个pool可以被多个http service共享。
+ */
+typedef struct cehc_dispatch_pool_s cehc_dispatch_pool_t;
+
+typedef struct cehc_dispatch_stats_s {
+    uint64_t dispatched;         // 在工作线程上执行的任务数
+    uint64_t inline_fallback;    // 环满退化为在事件循环中执行的任务数
+    uint64_t stolen;             // 被偷取执行的任务数
+    uint64_t recv_paused;        // recv_cb跟不上而暂停传输的次数
+    uint64_t queue_delay_avg_ns; // 从投递到开始执行的平均排队延迟
+    uint64_t queue_delay_max_ns; // 最大排队延迟
+} cehc_dispatch_stats_t;
+
+/**
+ * 创建一个完成派发的工作线程池并启动。
+ * @param workers 工作线程数
+ * @param queue_cap 每个http service到每个工作线程的环的容量
+ * @return 失败NULL
+ */
+cehc_dispatch_pool_t *
+cehc_new_dispatch_pool(int workers, size_t queue_cap);
+
+/**
+ * 停止并释放工作线程池，已经投递的完成会先执行完。需要在使用它的http service都释放之后调用。
+ */
+void
+cehc_delete_dispatch_pool(cehc_dispatch_pool_t **pool);
+
+/**
+ * 为http service开启完成派发模式，需在cehc_run_http_serivce之前调用。
+ * @return 成功true；pool上注册的http service过多时失败返回false。
+ */
+bool
+cehc_http_service_set_dispatch_pool(cehc_http_service_t *hs, cehc_dispatch_pool_t *pool);
+
+void
+cehc_dispatch_pool_get_stats(cehc_dispatch_pool_t *pool, cehc_dispatch_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，把body数据排队交给工作线程。
+ */
+size_t
+cehc_dispatch_on_recv(cehc_connection_ptr conn, void *ptr, size_t size);
+
+/**
+ * 事件循环线程调用(持有multi_handles_mtx)，把conn的完成投递给工作线程。
+ */
+void
+cehc_dispatch_complete(cehc_connection_ptr conn);
+
+/**
+ * 再次run之前清空派发状态，conn->dispatch不为NULL时调用。
+ */
+void
+cehc_dispatch_reset(cehc_connection_ptr conn);
+
+void
+cehc_dispatch_free(cehc_connection_ptr conn);
+
+/**
+ * 在pool上注册一个producer，供其他需要工作线程的模块(如cehc-codec.h)使用。
+ * @return producer id，过多时-1
+ */
+int
+cehc_dispatch_pool_register(cehc_dispatch_pool_t *pool);
+
+/**
+ * 投递一个任务，同一个producer id的投递需要调用方保证互斥。
+ * @return 所有环都满时false，由调用方决定降级策略
+ */
+bool
+cehc_dispatch_pool_submit(cehc_dispatch_pool_t *pool, int producer, void (*func)(void*), void *arg);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_dispatch__h
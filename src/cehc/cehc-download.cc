@@ -0,0 +1,839 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/logger.h"
+
+#include "cehc-cq.h"
+#include "cehc-download.h"
+
+#define CEHC_DL_MIN_SEGMENT   (1024 * 1024)
+#define CEHC_DL_PART_SUFFIX   ".cehc-part"
+#define CEHC_DL_PART_MAGIC    "CEHCDL01"
+#define CEHC_DL_ETAG_MAX      128
+#define CEHC_DL_REAP_WAIT_MS  100   // 收割完成时每次等待的上限
+
+/**
+ * 进度文件的头，之后是每段已落盘的字节数(int64_t)。
+ */
+typedef struct cehc_download_part_hdr_s {
+    char magic[8];
+    int64_t total;
+    int64_t segment_size;
+    int64_t segments;
+    char etag[CEHC_DL_ETAG_MAX];
+} cehc_download_part_hdr_t;
+
+typedef struct cehc_download_seg_s {
+    int64_t off;
+    int64_t len;
+    int64_t done;       // 已写入文件的字节数
+    int retries;
+} cehc_download_seg_t;
+
+#define CEHC_DL_PROBE       0
+#define CEHC_DL_SEGMENT     1
+
+#define CEHC_DL_UNCHECKED   0
+#define CEHC_DL_WRITE       1
+#define CEHC_DL_DISCARD     2
+
+/**
+ * 一个下载连接。除了conn之外的字段在run之前由下载线程设置，传输过程中只有事件循环线程访问。
+ */
+typedef struct cehc_download_slot_s {
+    struct cehc_download_s *dl;
+    cehc_connection_ptr conn;
+    int mode;
+    int seg;                // 正在下载的段，-1为空闲
+    int64_t write_off;      // 下一个字节在文件中的偏移
+    int64_t write_end;      // 写入不能超过的偏移(不含)，-1为不限制
+    int64_t got;            // 本次run写入文件的字节数
+    int checked;            // 收到第一块数据时检查响应，决定写入还是丢弃
+    int64_t cr_start;       // 响应的Content-Range，没有为-1
+    int64_t cr_total;
+    std::string etag;
+} cehc_download_slot_t;
+
+struct cehc_download_s {
+    std::vector<cehc_http_service_t*> hs;
+    std::string url;
+    std::string path;
+    std::string part_path;
+    cehc_download_opts_t opts;
+    int fd;
+    int part_fd;
+    cehc_completion_queue_t *cq;
+    std::vector<cehc_download_slot_t*> slots;
+    std::vector<cehc_download_seg_t> segs;
+    size_t next_seg;
+    int inflight;
+    bool failed;
+    std::thread *thread;
+    std::atomic<bool> stop;
+    std::atomic<uint64_t> downloaded;
+
+    // 以下只有下载线程修改，修改及stats读取时持有mtx。
+    std::mutex mtx;
+    std::condition_variable cv;
+    cehc_download_state_t state;
+    int64_t total;
+    std::string etag;
+    uint64_t resumed;
+    int segments;
+    int segments_done;
+    uint64_t retries;
+    char errormsg[CURL_ERROR_SIZE];
+};
+
+static void
+cehc_download_set_error(cehc_download_t *dl, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void
+cehc_download_set_error(cehc_download_t *dl, const char *fmt, ...) {
+    std::unique_lock<std::mutex> l(dl->mtx);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(dl->errormsg, sizeof(dl->errormsg), fmt, ap);
+    va_end(ap);
+    LOGW("download %s failed: %s.", dl->url.c_str(), dl->errormsg);
+}
+
+/**
+ * 解析Content-Range的值"bytes a-b/total"，区间或者总大小为星号(未知)时对应的结果为-1。
+ */
+static void
+cehc_download_parse_range(const char *v, int64_t *start, int64_t *total) {
+    *start = -1;
+    *total = -1;
+    while (' ' == *v) {
+        ++v;
+    }
+    if (0 == strncasecmp(v, "bytes", 5)) {
+        v += 5;
+    }
+    while (' ' == *v) {
+        ++v;
+    }
+
+    char *end;
+    if ('*' != *v) {
+        int64_t s = strtoll(v, &end, 10);
+        if (end != v) {
+            *start = s;
+        }
+    }
+    const char *slash = strchr(v, '/');
+    if (slash && '*' != slash[1]) {
+        int64_t t = strtoll(slash + 1, &end, 10);
+        if (end != slash + 1) {
+            *total = t;
+        }
+    }
+}
+
+static size_t
+cehc_download_on_header(cehc_connection_ptr conn, void *ptr, size_t size, size_t nmemb) {
+    cehc_download_slot_t *slot = (cehc_download_slot_t*)conn->user_ctx;
+    size_t len = size * nmemb;
+    std::string line((const char*)ptr, len);
+    while (!line.empty() && ('\r' == line.back() || '\n' == line.back())) {
+        line.pop_back();
+    }
+
+    if (0 == line.compare(0, 5, "HTTP/")) {
+        // 新的响应(比如重定向之后)，之前的header作废。
+        slot->cr_start = -1;
+        slot->cr_total = -1;
+        slot->etag.clear();
+    } else if (0 == strncasecmp(line.c_str(), "Content-Range:", 14)) {
+        cehc_download_parse_range(line.c_str() + 14, &slot->cr_start, &slot->cr_total);
+    } else if (0 == strncasecmp(line.c_str(), "ETag:", 5)) {
+        size_t b = line.find_first_not_of(' ', 5);
+        slot->etag = std::string::npos == b ? "" : line.substr(b, CEHC_DL_ETAG_MAX - 1);
+    }
+
+    return len;
+}
+
+static size_t
+cehc_download_on_recv(cehc_connection_ptr conn, void *ptr, size_t size, size_t nmemb) {
+    cehc_download_slot_t *slot = (cehc_download_slot_t*)conn->user_ctx;
+    cehc_download_t *dl = slot->dl;
+    size_t len = size * nmemb;
+    if (dl->stop.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    if (CEHC_DL_UNCHECKED == slot->checked) {
+        long code = 0;
+        curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (CEHC_DL_PROBE == slot->mode) {
+            // 探测请求返回200说明服务端不支持Range，这次就是完整的下载；其他响应的body都不需要。
+            slot->checked = 200 == code ? CEHC_DL_WRITE : CEHC_DL_DISCARD;
+        } else if (206 == code && slot->cr_start == slot->write_off && slot->cr_total == dl->total
+                   && (dl->etag.empty() || slot->etag == dl->etag)) {
+            slot->checked = CEHC_DL_WRITE;
+        } else {
+            LOGW("unexpected range response(code = %ld, start = %ld, total = %ld) of %s.",
+                 code, (long)slot->cr_start, (long)slot->cr_total, dl->url.c_str());
+            return 0;
+        }
+    }
+
+    if (CEHC_DL_DISCARD == slot->checked) {
+        return len;
+    }
+    if (slot->write_end >= 0 && slot->write_off + (int64_t)len > slot->write_end) {
+        LOGW("server sent more than the requested range of %s.", dl->url.c_str());
+        return 0;
+    }
+
+    const char *p = (const char*)ptr;
+    size_t left = len;
+    while (left > 0) {
+        ssize_t n = pwrite(dl->fd, p, left, slot->write_off);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            int err = errno;
+            LOGE("write %s err = %s.", dl->path.c_str(), strerror(err));
+            return 0;
+        }
+        p += n;
+        left -= n;
+        slot->write_off += n;
+        slot->got += n;
+    }
+
+    dl->downloaded.fetch_add(len, std::memory_order_relaxed);
+    return len;
+}
+
+/**
+ * 停止时中止传输。数据接收回调只在有数据时才会被调用，卡住的传输靠它(curl至少每秒调用一次)结束。
+ */
+static int
+cehc_download_on_progress(void *ctx, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    cehc_download_slot_t *slot = (cehc_download_slot_t*)ctx;
+    return slot->dl->stop.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+static bool
+cehc_download_transfer_ok(cehc_connection_ptr conn) {
+    return cehc_conn_ok_except_httpcode(conn) && CURLE_OK == conn->result;
+}
+
+static void
+cehc_download_describe(cehc_connection_ptr conn, char *buf, size_t len) {
+    if (CURLE_OK != conn->result) {
+        snprintf(buf, len, "%s", curl_easy_strerror(conn->result));
+    } else if (!cehc_conn_ok_except_httpcode(conn)) {
+        snprintf(buf, len, "conn err(rejected = %d) %s", conn->rejected, conn->errormsg);
+    } else {
+        snprintf(buf, len, "http code %ld", conn->http_code);
+    }
+}
+
+/**
+ * 交给slot的http service，run失败时返回false。
+ */
+static bool
+cehc_download_submit(cehc_download_t *dl, cehc_download_slot_t *slot, const char *range) {
+    slot->got = 0;
+    slot->checked = CEHC_DL_UNCHECKED;
+    slot->cr_start = -1;
+    slot->cr_total = -1;
+    slot->etag.clear();
+
+    CURLcode cc = curl_easy_setopt(slot->conn->easy, CURLOPT_RANGE, range);
+    if (CURLE_OK != cc) {
+        LOGE("set range err = %s.", curl_easy_strerror(cc));
+        return false;
+    }
+
+    char errmsg[CURL_ERROR_SIZE] = {0};
+    if (!cehc_run_conn(slot->conn, errmsg)) {
+        LOGW("run download conn of %s err = %s.", dl->url.c_str(), errmsg);
+        return false;
+    }
+
+    ++dl->inflight;
+    return true;
+}
+
+/**
+ * 收割一个完成，每次最多等待CEHC_DL_REAP_WAIT_MS。停止时传输由进度回调中止，很快就会完成。
+ * cq出错时整个下载失败，但传输中的conn还在http service中，必须收割回来，之后改为不等待的轮询。
+ */
+static cehc_connection_ptr
+cehc_download_reap_one(cehc_download_t *dl) {
+    cehc_connection_ptr conn = NULL;
+    int timeout_ms = CEHC_DL_REAP_WAIT_MS;
+    bool stopping = false;
+    for (;;) {
+        int n = cehc_cq_poll(dl->cq, &conn, 1, timeout_ms);
+        if (1 == n) {
+            break;
+        }
+
+        if (-1 == n) {
+            int err = errno;
+            dl->failed = true;
+            cehc_download_set_error(dl, "poll completion queue err = %s", strerror(err));
+            timeout_ms = 0;
+        }
+        if (0 == timeout_ms) {
+            usleep(CEHC_DL_REAP_WAIT_MS * 1000 / 10);
+        }
+        if (!stopping && dl->stop.load()) {
+            stopping = true;
+            LOGI("download %s stopping, wait for %d transfers to abort.", dl->url.c_str(), dl->inflight);
+        }
+    }
+
+    --dl->inflight;
+    return conn;
+}
+
+/**
+ * 探测总大小及是否支持Range。
+ * @return -1失败；0支持Range，dl->total已设置；1服务端不支持Range或者资源为空，已经下载完成。
+ */
+static int
+cehc_download_probe(cehc_download_t *dl) {
+    cehc_download_slot_t *slot = dl->slots[0];
+    bool no_range = false;
+    char reason[CURL_ERROR_SIZE] = "stopped";
+    for (int attempt = 0; !dl->stop.load(); ++attempt) {
+        slot->mode = CEHC_DL_PROBE;
+        slot->seg = -1;
+        slot->write_off = 0;
+        slot->write_end = -1;
+        if (!cehc_download_submit(dl, slot, no_range ? NULL : "0-0")) {
+            snprintf(reason, sizeof(reason), "run conn failed");
+        } else {
+            cehc_connection_ptr conn = cehc_download_reap_one(dl);
+            if (dl->failed) {
+                return -1;
+            }
+            bool ok = cehc_download_transfer_ok(conn);
+            long code = conn->http_code;
+            if (ok && 206 == code && slot->cr_total >= 0 && !no_range) {
+                std::unique_lock<std::mutex> l(dl->mtx);
+                dl->total = slot->cr_total;
+                dl->etag = slot->etag;
+                return 0;
+            }
+            if (ok && 206 == code && !no_range) {
+                // 服务端不告知总大小，只能不带Range整个下载。
+                no_range = true;
+                --attempt;
+                continue;
+            }
+            if (ok && (200 == code || (416 == code && 0 == slot->cr_total))) {
+                int64_t size = 200 == code ? slot->got : 0;
+                if (-1 == ftruncate(dl->fd, size)) {
+                    int err = errno;
+                    cehc_download_set_error(dl, "truncate err = %s", strerror(err));
+                    return -1;
+                }
+                std::unique_lock<std::mutex> l(dl->mtx);
+                dl->total = size;
+                dl->segments = 1;
+                dl->segments_done = 1;
+                return 1;
+            }
+
+            cehc_download_describe(conn, reason, sizeof(reason));
+            if (ok && code >= 400 && code < 500 && 408 != code && 429 != code) {
+                break;
+            }
+        }
+
+        if (attempt >= dl->opts.max_retries) {
+            break;
+        }
+        std::unique_lock<std::mutex> l(dl->mtx);
+        ++dl->retries;
+    }
+
+    cehc_download_set_error(dl, "probe failed: %s", reason);
+    return -1;
+}
+
+static bool
+cehc_download_load_part(cehc_download_t *dl) {
+    int fd = open(dl->part_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (-1 == fd) {
+        return false;
+    }
+
+    // 进度文件还在而数据文件被删除(start时重新创建为空文件)或者被截断了，进度不可信。
+    struct stat st;
+    if (-1 == fstat(dl->fd, &st) || st.st_size != dl->total) {
+        LOGI("size of %s does not match the progress file, download %s from the beginning.",
+             dl->path.c_str(), dl->url.c_str());
+        close(fd);
+        return false;
+    }
+
+    cehc_download_part_hdr_t hdr;
+    std::string etag = dl->etag.substr(0, CEHC_DL_ETAG_MAX - 1);
+    bool valid = (ssize_t)sizeof(hdr) == pread(fd, &hdr, sizeof(hdr), 0)
+                 && 0 == memcmp(hdr.magic, CEHC_DL_PART_MAGIC, sizeof(hdr.magic))
+                 && hdr.total == dl->total && hdr.segment_size > 0
+                 && hdr.segments == (hdr.total + hdr.segment_size - 1) / hdr.segment_size
+                 && '\0' == hdr.etag[CEHC_DL_ETAG_MAX - 1] && etag == hdr.etag;
+    std::vector<int64_t> done;
+    if (valid) {
+        done.resize(hdr.segments);
+        ssize_t bytes = (ssize_t)(done.size() * sizeof(int64_t));
+        valid = bytes == pread(fd, done.data(), bytes, sizeof(hdr));
+    }
+    if (!valid) {
+        LOGI("progress file %s does not match %s, download from the beginning.",
+             dl->part_path.c_str(), dl->url.c_str());
+        close(fd);
+        return false;
+    }
+
+    uint64_t resumed = 0;
+    for (int64_t i = 0; i < hdr.segments; ++i) {
+        cehc_download_seg_t s;
+        s.off = i * hdr.segment_size;
+        s.len = std::min(hdr.segment_size, hdr.total - s.off);
+        s.done = std::max((int64_t)0, std::min(done[i], s.len));
+        s.retries = 0;
+        resumed += s.done;
+        dl->segs.push_back(s);
+    }
+
+    dl->part_fd = fd;
+    std::unique_lock<std::mutex> l(dl->mtx);
+    dl->resumed = resumed;
+    return true;
+}
+
+static bool
+cehc_download_init_file(cehc_download_t *dl) {
+    int64_t seg_size = (int64_t)dl->opts.segment_size;
+    int64_t per_conn = (dl->total + dl->opts.connections - 1) / dl->opts.connections;
+    if (per_conn < seg_size) {
+        seg_size = std::max(per_conn, (int64_t)CEHC_DL_MIN_SEGMENT);
+    }
+    for (int64_t off = 0; off < dl->total; off += seg_size) {
+        cehc_download_seg_t s;
+        s.off = off;
+        s.len = std::min(seg_size, dl->total - off);
+        s.done = 0;
+        s.retries = 0;
+        dl->segs.push_back(s);
+    }
+
+    // 丢掉旧的内容再整体预分配，文件系统不支持fallocate时退化为ftruncate。
+    if (-1 == ftruncate(dl->fd, 0)
+        || (-1 == fallocate(dl->fd, 0, 0, dl->total) && (EOPNOTSUPP != errno || -1 == ftruncate(dl->fd, dl->total)))) {
+        int err = errno;
+        cehc_download_set_error(dl, "allocate %ld bytes for %s err = %s", (long)dl->total, dl->path.c_str(), strerror(err));
+        return false;
+    }
+
+    if (!dl->opts.resume) {
+        return true;
+    }
+
+    int fd = open(dl->part_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (-1 == fd) {
+        int err = errno;
+        LOGW("create progress file %s err = %s, download without resume.", dl->part_path.c_str(), strerror(err));
+        return true;
+    }
+
+    cehc_download_part_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CEHC_DL_PART_MAGIC, sizeof(hdr.magic));
+    hdr.total = dl->total;
+    hdr.segment_size = seg_size;
+    hdr.segments = (int64_t)dl->segs.size();
+    snprintf(hdr.etag, sizeof(hdr.etag), "%s", dl->etag.c_str());
+    std::vector<int64_t> done(dl->segs.size(), 0);
+    ssize_t bytes = (ssize_t)(done.size() * sizeof(int64_t));
+    if ((ssize_t)sizeof(hdr) != pwrite(fd, &hdr, sizeof(hdr), 0) || bytes != pwrite(fd, done.data(), bytes, sizeof(hdr))) {
+        int err = errno;
+        LOGW("write progress file %s err = %s, download without resume.", dl->part_path.c_str(), strerror(err));
+        close(fd);
+        unlink(dl->part_path.c_str());
+        return true;
+    }
+
+    dl->part_fd = fd;
+    return true;
+}
+
+/**
+ * 记录一段的进度。先让数据落盘，进度文件中的进度才不会超过磁盘上实际的数据。
+ */
+static void
+cehc_download_persist(cehc_download_t *dl, int seg) {
+    if (-1 == dl->part_fd) {
+        return;
+    }
+
+    if (-1 == fdatasync(dl->fd)) {
+        int err = errno;
+        LOGW("fdatasync %s err = %s.", dl->path.c_str(), strerror(err));
+        return;
+    }
+
+    int64_t done = dl->segs[seg].done;
+    off_t off = (off_t)(sizeof(cehc_download_part_hdr_t) + seg * sizeof(int64_t));
+    if ((ssize_t)sizeof(done) != pwrite(dl->part_fd, &done, sizeof(done), off)) {
+        int err = errno;
+        LOGW("update progress file %s err = %s.", dl->part_path.c_str(), strerror(err));
+    }
+}
+
+/**
+ * 一段的一次请求结束了(包括没能run)。
+ * @return 需要在这个slot上重试的段，没有为-1
+ */
+static int
+cehc_download_on_seg_end(cehc_download_t *dl, cehc_download_slot_t *slot, const char *reason) {
+    int seg = slot->seg;
+    cehc_download_seg_t &s = dl->segs[seg];
+    slot->seg = -1;
+    if (slot->got > 0) {
+        s.done += slot->got;
+        cehc_download_persist(dl, seg);
+    }
+
+    if (s.done >= s.len) {
+        std::unique_lock<std::mutex> l(dl->mtx);
+        ++dl->segments_done;
+        return -1;
+    }
+    if (dl->stop.load() || dl->failed) {
+        return -1;
+    }
+    if (s.retries >= dl->opts.max_retries) {
+        dl->failed = true;
+        cehc_download_set_error(dl, "segment %d(%ld-%ld) failed after %d retries: %s",
+                                seg, (long)s.off, (long)(s.off + s.len - 1), s.retries, reason);
+        return -1;
+    }
+
+    ++s.retries;
+    std::unique_lock<std::mutex> l(dl->mtx);
+    ++dl->retries;
+    return seg;
+}
+
+/**
+ * 给空闲的slot派发一段(seg为-1时取下一个没有完成的段)，直到派发成功或者没有段可以派发。
+ */
+static void
+cehc_download_feed(cehc_download_t *dl, cehc_download_slot_t *slot, int seg) {
+    while (!dl->failed && !dl->stop.load()) {
+        if (seg < 0) {
+            while (dl->next_seg < dl->segs.size()
+                   && dl->segs[dl->next_seg].done >= dl->segs[dl->next_seg].len) {
+                ++dl->next_seg;
+            }
+            if (dl->next_seg == dl->segs.size()) {
+                return;
+            }
+            seg = (int)dl->next_seg++;
+        }
+
+        cehc_download_seg_t &s = dl->segs[seg];
+        char range[64];
+        snprintf(range, sizeof(range), "%ld-%ld", (long)(s.off + s.done), (long)(s.off + s.len - 1));
+        slot->mode = CEHC_DL_SEGMENT;
+        slot->seg = seg;
+        slot->write_off = s.off + s.done;
+        slot->write_end = s.off + s.len;
+        if (cehc_download_submit(dl, slot, range)) {
+            return;
+        }
+        seg = cehc_download_on_seg_end(dl, slot, "run conn failed");
+    }
+}
+
+static bool
+cehc_download_execute(cehc_download_t *dl) {
+    int r = cehc_download_probe(dl);
+    if (r != 0) {
+        return 1 == r;
+    }
+
+    if (!dl->opts.resume || !cehc_download_load_part(dl)) {
+        if (!cehc_download_init_file(dl)) {
+            return false;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> l(dl->mtx);
+        dl->segments = (int)dl->segs.size();
+        for (auto &s : dl->segs) {
+            if (s.done >= s.len) {
+                ++dl->segments_done;
+            }
+        }
+    }
+
+    for (auto slot : dl->slots) {
+        cehc_download_feed(dl, slot, -1);
+    }
+
+    while (dl->inflight > 0) {
+        cehc_connection_ptr conn = cehc_download_reap_one(dl);
+        cehc_download_slot_t *slot = (cehc_download_slot_t*)conn->user_ctx;
+        char reason[CURL_ERROR_SIZE];
+        cehc_download_describe(conn, reason, sizeof(reason));
+        cehc_download_feed(dl, slot, cehc_download_on_seg_end(dl, slot, reason));
+    }
+
+    if (dl->failed) {
+        return false;
+    }
+    if (dl->stop.load()) {
+        cehc_download_set_error(dl, "stopped");
+        return false;
+    }
+
+    if (-1 == fdatasync(dl->fd)) {
+        int err = errno;
+        cehc_download_set_error(dl, "fdatasync err = %s", strerror(err));
+        return false;
+    }
+    if (-1 != dl->part_fd) {
+        close(dl->part_fd);
+        dl->part_fd = -1;
+        unlink(dl->part_path.c_str());
+    }
+
+    return true;
+}
+
+static void
+cehc_download_run(cehc_download_t *dl) {
+    bool ok = cehc_download_execute(dl);
+    std::unique_lock<std::mutex> l(dl->mtx);
+    dl->state = ok ? CEHC_DOWNLOAD_DONE : CEHC_DOWNLOAD_FAILED;
+    dl->cv.notify_all();
+}
+
+void
+cehc_download_opts_init(cehc_download_opts_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    opts->connections = 4;
+    opts->segment_size = 16 * 1024 * 1024;
+    opts->max_retries = 3;
+    opts->resume = true;
+}
+
+cehc_download_t *
+cehc_new_download(cehc_http_service_t *const *hs, int hs_cnt, const char *url, const char *path,
+                  const cehc_download_opts_t *opts) {
+    cehc_download_opts_t def;
+    if (!opts) {
+        cehc_download_opts_init(&def);
+        opts = &def;
+    }
+    if (!hs || hs_cnt <= 0 || !url || !path || opts->connections <= 0
+        || opts->segment_size < CEHC_DL_MIN_SEGMENT || opts->max_retries < 0) {
+        LOGW("invalid download params.");
+        return NULL;
+    }
+    for (int i = 0; i < hs_cnt; ++i) {
+        if (!hs[i]) {
+            LOGW("invalid download params.");
+            return NULL;
+        }
+    }
+
+    cehc_download_t *dl = new (std::nothrow) cehc_download_t;
+    if (!dl) {
+        LOGE("%s oom when new cehc_download_t.", __func__);
+        return NULL;
+    }
+
+    dl->hs.assign(hs, hs + hs_cnt);
+    dl->url = url;
+    dl->path = path;
+    dl->part_path = dl->path + CEHC_DL_PART_SUFFIX;
+    dl->opts = *opts;
+    dl->fd = -1;
+    dl->part_fd = -1;
+    dl->next_seg = 0;
+    dl->inflight = 0;
+    dl->failed = false;
+    dl->thread = NULL;
+    dl->stop = false;
+    dl->downloaded = 0;
+    dl->state = CEHC_DOWNLOAD_IDLE;
+    dl->total = -1;
+    dl->resumed = 0;
+    dl->segments = 0;
+    dl->segments_done = 0;
+    dl->retries = 0;
+    dl->errormsg[0] = '\0';
+    dl->cq = cehc_new_completion_queue(opts->connections);
+    if (!dl->cq) {
+        cehc_delete_download(&dl);
+        return NULL;
+    }
+
+    for (int i = 0; i < opts->connections; ++i) {
+        cehc_download_slot_t *slot = new cehc_download_slot_t();
+        slot->dl = dl;
+        slot->seg = -1;
+        dl->slots.push_back(slot);
+
+        cehc_newconn_params_t params;
+        memset(&params, 0, sizeof(params));
+        params.url = url;
+        params.hs = hs[i % hs_cnt];
+        params.recv_cb = cehc_download_on_recv;
+        params.header_cb = cehc_download_on_header;
+        params.user_ctx = slot;
+        params.cq = dl->cq;
+        slot->conn = cehc_new_conn(&params);
+        if (!slot->conn) {
+            cehc_delete_download(&dl);
+            return NULL;
+        }
+        curl_easy_setopt(slot->conn->easy, CURLOPT_XFERINFOFUNCTION, cehc_download_on_progress);
+        curl_easy_setopt(slot->conn->easy, CURLOPT_XFERINFODATA, slot);
+        curl_easy_setopt(slot->conn->easy, CURLOPT_NOPROGRESS, 0L);
+    }
+
+    return dl;
+}
+
+CURL *
+cehc_download_easy(cehc_download_t *dl, int i) {
+    if (!dl || i < 0 || i >= (int)dl->slots.size()) {
+        return NULL;
+    }
+
+    return dl->slots[i]->conn->easy;
+}
+
+bool
+cehc_download_start(cehc_download_t *dl) {
+    if (!dl) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(dl->mtx);
+    if (CEHC_DOWNLOAD_IDLE != dl->state) {
+        LOGW("download %s has already been started.", dl->url.c_str());
+        return false;
+    }
+
+    dl->fd = open(dl->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == dl->fd) {
+        int err = errno;
+        LOGE("open %s err = %s.", dl->path.c_str(), strerror(err));
+        return false;
+    }
+    if (!dl->opts.resume) {
+        unlink(dl->part_path.c_str());
+    }
+
+    dl->state = CEHC_DOWNLOAD_RUNNING;
+    dl->thread = new std::thread(cehc_download_run, dl);
+    return true;
+}
+
+cehc_download_state_t
+cehc_download_wait(cehc_download_t *dl, int timeout_ms) {
+    if (!dl) {
+        return CEHC_DOWNLOAD_FAILED;
+    }
+
+    std::unique_lock<std::mutex> l(dl->mtx);
+    auto finished = [dl] { return CEHC_DOWNLOAD_RUNNING != dl->state; };
+    if (timeout_ms < 0) {
+        dl->cv.wait(l, finished);
+    } else {
+        dl->cv.wait_for(l, std::chrono::milliseconds(timeout_ms), finished);
+    }
+
+    return dl->state;
+}
+
+void
+cehc_download_get_stats(cehc_download_t *dl, cehc_download_stats_t *stats) {
+    if (!dl || !stats) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(dl->mtx);
+    stats->state = dl->state;
+    stats->total = dl->total;
+    stats->downloaded = dl->downloaded.load(std::memory_order_relaxed);
+    stats->resumed = dl->resumed;
+    stats->segments = dl->segments;
+    stats->segments_done = dl->segments_done;
+    stats->retries = dl->retries;
+    snprintf(stats->errormsg, sizeof(stats->errormsg), "%s", dl->errormsg);
+}
+
+void
+cehc_delete_download(cehc_download_t **dl) {
+    if (!dl || !*dl) {
+        return;
+    }
+
+    cehc_download_t *d = *dl;
+    if (d->thread) {
+        d->stop = true;
+        d->thread->join();
+        delete d->thread;
+    }
+
+    for (auto slot : d->slots) {
+        if (slot->conn) {
+            cehc_delete_conn(&slot->conn);
+        }
+        delete slot;
+    }
+    if (d->cq) {
+        cehc_delete_completion_queue(&d->cq);
+    }
+    if (-1 != d->part_fd) {
+        close(d->part_fd);
+    }
+    if (-1 != d->fd) {
+        close(d->fd);
+    }
+
+    delete d;
+    *dl = NULL;
+}
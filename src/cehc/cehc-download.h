@@ -0,0 +1,106 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_download__h
+#define cehc_download__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 分段并发下载到文件：大对象按字节区间(Range)切成多段，用多个conn(可以分布在多个http service上)同时下载。
+ * -> 先用一个Range: bytes=0-0的请求探测总大小和是否支持Range；服务端不支持Range(返回200)时，
+ *    这次探测直接变成单连接的顺序下载；
+ * -> 支持Range时文件按总大小预分配(fallocate)，每段的数据在接收回调中直接pwrite到文件中对应的偏移，
+ *    不经过中间的内存缓存；
+ * -> 每段失败后从已写入的位置继续请求剩余的区间，超过重试次数整个下载失败；
+ * -> 进度记录在<path>.cehc-part中(每段完成、失败时在数据落盘之后更新)，下次下载同一个文件时只下载没有完成的部分，
+ *    总大小或ETag变化了则从头下载；全部完成后删除进度文件。
+ * 下载由一个后台线程驱动(通过完成队列收割各段的完成)，不占用http service的事件循环。
+ */
+typedef struct cehc_download_s cehc_download_t;
+
+typedef enum cehc_download_state_e {
+    CEHC_DOWNLOAD_IDLE    = 0,
+    CEHC_DOWNLOAD_RUNNING = 1,
+    CEHC_DOWNLOAD_DONE    = 2,
+    CEHC_DOWNLOAD_FAILED  = 3
+} cehc_download_state_t;
+
+typedef struct cehc_download_opts_s {
+    int connections;        // 同时在下载的段数，默认4
+    size_t segment_size;    // 每段的最大字节数，默认16MB；总大小较小时会缩小以用满connections(不小于1MB)
+    int max_retries;        // 每段失败之后的重试次数，默认3
+    bool resume;            // 是否使用进度文件续传，默认true
+} cehc_download_opts_t;
+
+typedef struct cehc_download_stats_s {
+    cehc_download_state_t state;
+    int64_t total;          // 资源的总大小，还未知时为-1
+    uint64_t downloaded;    // 本次下载写入文件的字节数
+    uint64_t resumed;       // 根据进度文件跳过的字节数
+    int segments;           // 总段数(不支持Range时为1)
+    int segments_done;
+    uint64_t retries;       // 所有段的重试次数之和
+    char errormsg[CURL_ERROR_SIZE];  // 失败的原因
+} cehc_download_stats_t;
+
+void
+cehc_download_opts_init(cehc_download_opts_t *opts);
+
+/**
+ * 创建下载任务。
+ * @param hs 用于下载的http service，第i个连接使用hs[i % hs_cnt]
+ * @param hs_cnt
+ * @param url
+ * @param path 目标文件，不存在时创建；不续传时会被覆盖
+ * @param opts NULL为默认值
+ * @return 失败NULL
+ */
+cehc_download_t *
+cehc_new_download(cehc_http_service_t *const *hs, int hs_cnt, const char *url, const char *path,
+                  const cehc_download_opts_t *opts);
+
+/**
+ * 得到第i个连接的easy handle，可在start之前设置超时、认证header等公共选项(cehc_new_conn的保留属性及
+ * CURLOPT_RANGE、CURLOPT_NOPROGRESS、CURLOPT_XFERINFO*除外)。
+ * @return i越界时NULL
+ */
+CURL *
+cehc_download_easy(cehc_download_t *dl, int i);
+
+/**
+ * 开始下载，立即返回。一个下载任务只能start一次。
+ * @return 失败(打开文件失败等)false
+ */
+bool
+cehc_download_start(cehc_download_t *dl);
+
+/**
+ * 等待下载结束。
+ * @param timeout_ms -1一直等待
+ * @return 当前的状态，超时时为CEHC_DOWNLOAD_RUNNING
+ */
+cehc_download_state_t
+cehc_download_wait(cehc_download_t *dl, int timeout_ms);
+
+void
+cehc_download_get_stats(cehc_download_t *dl, cehc_download_stats_t *stats);
+
+/**
+ * 释放下载任务。还在下载时会中止下载并等待在传输中的段结束，进度文件保留，之后可以续传。
+ * 传输由curl的进度回调中止，只在curl驱动这个传输时才会被调用；对端完全不响应时要等到传输超时，
+ * 所以建议通过cehc_download_easy设置CURLOPT_LOW_SPEED_LIMIT/CURLOPT_LOW_SPEED_TIME或CURLOPT_TIMEOUT。
+ */
+void
+cehc_delete_download(cehc_download_t **dl);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_download__h
@@ -0,0 +1,122 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+
+#include <mutex>
+#include <unordered_map>
+
+#include "../common/logger.h"
+
+#include "cehc-breaker.h"
+#include "cehc-host.h"
+
+struct cehc_host_table_s {
+    std::mutex mtx;
+    std::unordered_map<std::string, cehc_host_t*> hosts;
+};
+
+bool
+cehc_host_parse_url(const char *url, std::string *host, int *port) {
+    if (!url) {
+        return false;
+    }
+
+    CURLU *u = curl_url();
+    if (!u) {
+        return false;
+    }
+
+    bool ok = false;
+    char *h = NULL, *p = NULL;
+    if (CURLUE_OK == curl_url_set(u, CURLUPART_URL, url, 0)
+        && CURLUE_OK == curl_url_get(u, CURLUPART_HOST, &h, 0)
+        && CURLUE_OK == curl_url_get(u, CURLUPART_PORT, &p, CURLU_DEFAULT_PORT)) {
+        *host = h;
+        *port = atoi(p);
+        ok = true;
+    }
+    curl_free(h);
+    curl_free(p);
+    curl_url_cleanup(u);
+    return ok;
+}
+
+bool
+cehc_hosts_init(cehc_http_service_t *hs) {
+    hs->hosts = new (std::nothrow) cehc_host_table_s;
+    if (!hs->hosts) {
+        LOGE("%s oom when new cehc_host_table_s.", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+cehc_host_t *
+cehc_host_get(cehc_http_service_t *hs, const char *url) {
+    std::string h;
+    int port;
+    if (!cehc_host_parse_url(url, &h, &port)) {
+        LOGW("parse host of url %s failed.", url ? url : "null");
+        return NULL;
+    }
+
+    std::string key = h + ":" + std::to_string(port);
+    cehc_host_table_s *table = hs->hosts;
+    std::unique_lock<std::mutex> l(table->mtx);
+    auto it = table->hosts.find(key);
+    if (it != table->hosts.end()) {
+        return it->second;
+    }
+
+    cehc_host_t *host = new cehc_host_t;
+    host->host = h;
+    host->port = port;
+    host->key = key;
+    host->limiter = NULL;
+    host->breaker = NULL;
+    table->hosts[key] = host;
+    return host;
+}
+
+void
+cehc_host_foreach(cehc_http_service_t *hs, void (*fn)(cehc_host_t *host, void *ctx), void *ctx) {
+    if (!hs->hosts) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hs->hosts->mtx);
+    for (auto &kv : hs->hosts->hosts) {
+        fn(kv.second, ctx);
+    }
+}
+
+cehc_host_t *
+cehc_host_find(cehc_http_service_t *hs, const char *host, int port) {
+    if (!hs->hosts || !host) {
+        return NULL;
+    }
+
+    std::string key = std::string(host) + ":" + std::to_string(port);
+    std::unique_lock<std::mutex> l(hs->hosts->mtx);
+    auto it = hs->hosts->hosts.find(key);
+    return it == hs->hosts->hosts.end() ? NULL : it->second;
+}
+
+void
+cehc_hosts_delete(cehc_http_service_t *hs) {
+    if (!hs->hosts) {
+        return;
+    }
+
+    for (auto &kv : hs->hosts->hosts) {
+        free(kv.second->limiter);
+        cehc_breaker_free_host(kv.second->breaker);
+        delete kv.second;
+    }
+    delete hs->hosts;
+    hs->hosts = NULL;
+}
@@ -0,0 +1,65 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_host__h
+#define cehc_host__h
+
+#include <string>
+
+#include "cehttpclient.h"
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * http service中每个目标host:port的状态，按主机限流、熔断等以host为单位的功能挂在这里。
+ * conn创建时按url绑定(conn->host)，之后不再解析url。表项在service释放时才释放。
+ */
+typedef struct cehc_host_s {
+    std::string host;
+    int port;
+    std::string key;                       // host:port
+    struct cehc_host_limiter_s *limiter;   // 见cehc-limiter.h，未开启为NULL
+    struct cehc_host_breaker_s *breaker;   // 见cehc-breaker.h，未开启为NULL
+} cehc_host_t;
+
+/**
+ * 从url中解析出host和端口(没有写端口的按scheme的默认端口)。
+ * @return url非法时false
+ */
+bool
+cehc_host_parse_url(const char *url, std::string *host, int *port);
+
+/**
+ * 创建hs的表，cehc_new_http_service中调用。
+ */
+bool
+cehc_hosts_init(cehc_http_service_t *hs);
+
+/**
+ * 查找或者创建conn的url对应的表项，线程安全。
+ * @return url非法时NULL
+ */
+cehc_host_t *
+cehc_host_get(cehc_http_service_t *hs, const char *url);
+
+/**
+ * 遍历所有表项，需持有multi_handles_mtx(表项的内容由它保护)。
+ */
+void
+cehc_host_foreach(cehc_http_service_t *hs, void (*fn)(cehc_host_t *host, void *ctx), void *ctx);
+
+/**
+ * 按host:port查找，没有时NULL。
+ */
+cehc_host_t *
+cehc_host_find(cehc_http_service_t *hs, const char *host, int port);
+
+/**
+ * 释放hs的所有表项，cehc_delete_http_serivce中调用。
+ */
+void
+cehc_hosts_delete(cehc_http_service_t *hs);
+
+#endif //cehc_host__h
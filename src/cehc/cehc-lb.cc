@@ -0,0 +1,374 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-host.h"
+#include "cehc-lb.h"
+
+#define CEHC_LB_EWMA_ALPHA      0.3   // 延迟变小时EWMA的平滑系数
+#define CEHC_LB_HEALTH_STEP     0.1   // 成功一次恢复的健康度
+#define CEHC_LB_HEALTH_MIN      0.05
+#define CEHC_LB_MAX_EJECT_SHIFT 3     // 摘除时长最多翻到8倍
+
+/**
+ * 一个副本，除了base_url和host之外的字段都由multi_handles_mtx保护。
+ */
+typedef struct cehc_endpoint_s {
+    std::string base_url;
+    cehc_host_t *host;
+    uint64_t inflight;
+    double ewma_ns;
+    double health;
+    int consecutive_failures;
+    int64_t ejected_until_ns;
+    uint64_t picked;
+    uint64_t failures;
+    uint64_t ejections;
+} cehc_endpoint_t;
+
+typedef struct cehc_lb_group_s {
+    cehc_lb_opts_t opts;
+    std::vector<cehc_endpoint_t*> endpoints;
+    uint64_t rand_state;
+    // 挑选时复用的缓冲，与其他字段一样由multi_handles_mtx保护。
+    std::vector<cehc_endpoint_t*> alive;
+    std::string url;
+} cehc_lb_group_t;
+
+/**
+ * 注册之后只读，查找不需要加锁。
+ */
+struct cehc_lb_s {
+    std::unordered_map<std::string, cehc_lb_group_t*> groups;
+};
+
+static inline uint64_t
+cehc_lb_rand(cehc_lb_group_t *g) {
+    // xorshift64，只用于挑选候选，不需要密码学强度。
+    uint64_t x = g->rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    g->rand_state = x;
+    return x;
+}
+
+static inline bool
+cehc_lb_ejected(cehc_endpoint_t *ep, int64_t now) {
+    return ep->ejected_until_ns > now;
+}
+
+/**
+ * 分数越小越好。还没有延迟样本的副本用group的平均延迟，不至于一开始所有请求都涌向它。
+ */
+static inline double
+cehc_lb_score(cehc_endpoint_t *ep, double avg_ewma_ns) {
+    double ewma = ep->ewma_ns > 0 ? ep->ewma_ns : avg_ewma_ns;
+    return (ep->inflight + 1) * (ewma > 0 ? ewma : 1) / ep->health;
+}
+
+static cehc_endpoint_t *
+cehc_lb_choose(cehc_lb_group_t *g, cehc_endpoint_t *prev, int64_t now) {
+    std::vector<cehc_endpoint_t*> &alive = g->alive;
+    alive.clear();
+    cehc_endpoint_t *earliest = NULL;
+    double ewma_sum = 0;
+    int ewma_cnt = 0;
+    for (auto ep : g->endpoints) {
+        if (!cehc_lb_ejected(ep, now)) {
+            alive.push_back(ep);
+            if (ep->ewma_ns > 0) {
+                ewma_sum += ep->ewma_ns;
+                ++ewma_cnt;
+            }
+        } else if (!earliest || ep->ejected_until_ns < earliest->ejected_until_ns) {
+            earliest = ep;
+        }
+    }
+
+    if (alive.empty()) {
+        return earliest;
+    }
+    if (1 == alive.size()) {
+        return alive[0];
+    }
+
+    cehc_endpoint_t *a, *b;
+    if (prev && !cehc_lb_ejected(prev, now)) {
+        a = prev;
+        do {
+            b = alive[cehc_lb_rand(g) % alive.size()];
+        } while (b == a);
+    } else {
+        size_t i = cehc_lb_rand(g) % alive.size();
+        size_t j = cehc_lb_rand(g) % (alive.size() - 1);
+        a = alive[i];
+        b = alive[j >= i ? j + 1 : j];
+    }
+
+    double avg = ewma_cnt ? ewma_sum / ewma_cnt : 0;
+    return cehc_lb_score(b, avg) < cehc_lb_score(a, avg) ? b : a;
+}
+
+static void
+cehc_lb_on_failure(cehc_lb_group_t *g, cehc_endpoint_t *ep, int64_t now) {
+    ++ep->failures;
+    ep->health *= 0.5;
+    if (ep->health < CEHC_LB_HEALTH_MIN) {
+        ep->health = CEHC_LB_HEALTH_MIN;
+    }
+
+    if (++ep->consecutive_failures >= g->opts.eject_failures) {
+        int shift = ep->ejections < CEHC_LB_MAX_EJECT_SHIFT ? (int)ep->ejections : CEHC_LB_MAX_EJECT_SHIFT;
+        ep->ejected_until_ns = now + ((int64_t)g->opts.eject_ms * 1000 * 1000 << shift);
+        ++ep->ejections;
+        ep->consecutive_failures = 0;
+        // 恢复之后从较低的健康度开始接流量。
+        ep->health = g->opts.reentry_health;
+        LOGW("endpoint %s ejected for %d ms.", ep->base_url.c_str(), g->opts.eject_ms << shift);
+    }
+}
+
+void
+cehc_lb_opts_init(cehc_lb_opts_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    opts->eject_failures = 5;
+    opts->eject_ms = 10000;
+    opts->reentry_health = 0.1;
+}
+
+bool
+cehc_http_service_add_endpoint_group(cehc_http_service_t *hs, const char *name,
+                                     const char *const *base_urls, int cnt, const cehc_lb_opts_t *opts) {
+    cehc_lb_opts_t def;
+    if (!opts) {
+        cehc_lb_opts_init(&def);
+        opts = &def;
+    }
+    if (!hs || !name || !base_urls || cnt <= 0 || opts->eject_failures <= 0 || opts->eject_ms <= 0
+        || opts->reentry_health <= 0 || opts->reentry_health > 1) {
+        LOGW("invalid endpoint group params.");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (!hs->lb) {
+        hs->lb = new (std::nothrow) cehc_lb_t;
+        if (!hs->lb) {
+            LOGE("%s oom when new cehc_lb_t.", __func__);
+            return false;
+        }
+    }
+    if (hs->lb->groups.count(name)) {
+        LOGW("endpoint group %s already exists.", name);
+        return false;
+    }
+
+    cehc_lb_group_t *g = new cehc_lb_group_t;
+    g->opts = *opts;
+    g->rand_state = (uint64_t)CommonUtils::GetMonotonicNs() | 1;
+    for (int i = 0; i < cnt; ++i) {
+        std::string base = base_urls[i] ? base_urls[i] : "";
+        while (!base.empty() && '/' == base.back()) {
+            base.pop_back();
+        }
+        cehc_host_t *host = cehc_host_get(hs, base.c_str());
+        if (!host) {
+            LOGW("invalid base url %s of endpoint group %s.", base.c_str(), name);
+            for (auto ep : g->endpoints) {
+                delete ep;
+            }
+            delete g;
+            return false;
+        }
+
+        cehc_endpoint_t *ep = new cehc_endpoint_t();
+        ep->base_url = base;
+        ep->host = host;
+        ep->health = 1.0;
+        g->endpoints.push_back(ep);
+    }
+    g->alive.reserve(g->endpoints.size());
+
+    hs->lb->groups[name] = g;
+    return true;
+}
+
+int
+cehc_http_service_get_endpoint_stats(cehc_http_service_t *hs, const char *name,
+                                     cehc_endpoint_stats_t *stats, int max) {
+    if (!hs || !hs->lb || !name || !stats) {
+        return -1;
+    }
+
+    auto it = hs->lb->groups.find(name);
+    if (it == hs->lb->groups.end()) {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    int64_t now = CommonUtils::GetMonotonicNs();
+    int n = 0;
+    for (auto ep : it->second->endpoints) {
+        if (n >= max) {
+            break;
+        }
+        cehc_endpoint_stats_t *s = stats + n++;
+        s->base_url = ep->base_url.c_str();
+        s->inflight = ep->inflight;
+        s->picked = ep->picked;
+        s->failures = ep->failures;
+        s->ejections = ep->ejections;
+        s->ewma_us = (uint64_t)ep->ewma_ns / 1000;
+        s->health = ep->health;
+        s->ejected = cehc_lb_ejected(ep, now);
+    }
+
+    return n;
+}
+
+void
+cehc_lb_delete(cehc_lb_t **lb) {
+    if (lb && *lb) {
+        for (auto &kv : (*lb)->groups) {
+            for (auto ep : kv.second->endpoints) {
+                delete ep;
+            }
+            delete kv.second;
+        }
+        delete *lb;
+        *lb = NULL;
+    }
+}
+
+void
+cehc_lb_bind_conn(cehc_connection_ptr conn) {
+    cehc_lb_t *lb = conn->http_service->lb;
+    if (!lb || !conn->url) {
+        return;
+    }
+
+    std::string host;
+    int port;
+    if (!cehc_host_parse_url(conn->url, &host, &port)) {
+        return;
+    }
+
+    auto it = lb->groups.find(host);
+    if (it == lb->groups.end()) {
+        return;
+    }
+
+    // scheme://name[:port]之后的部分(path、query、fragment)原样接在副本的base url后面，
+    // 没有path(如http://name?a=1)时补上"/"。
+    const char *p = strstr(conn->url, "://");
+    p = p ? strpbrk(p + 3, "/?#") : NULL;
+    if (!p) {
+        conn->lb_path = strdup("/");
+    } else if ('/' == *p) {
+        conn->lb_path = strdup(p);
+    } else {
+        size_t len = strlen(p);
+        conn->lb_path = (char*)malloc(len + 2);
+        if (conn->lb_path) {
+            conn->lb_path[0] = '/';
+            memcpy(conn->lb_path + 1, p, len + 1);
+        }
+    }
+    if (!conn->lb_path) {
+        LOGE("%s oom when strdup path.", __func__);
+        return;
+    }
+    conn->lb_group = it->second;
+}
+
+bool
+cehc_lb_pick(cehc_connection_ptr conn) {
+    cehc_lb_group_t *g = conn->lb_group;
+    if (!g) {
+        return true;
+    }
+
+    cehc_endpoint_t *ep = cehc_lb_choose(g, conn->endpoint, CommonUtils::GetCoarseMonotonicNs());
+    // curl会拷贝url，拼接用group的缓冲即可。
+    g->url.assign(ep->base_url).append(conn->lb_path);
+    if (CURLE_OK != (conn->ce_code = curl_easy_setopt(conn->easy, CURLOPT_URL, g->url.c_str()))) {
+        sprintf(conn->errormsg, "%s", curl_easy_strerror(conn->ce_code));
+        return false;
+    }
+
+    conn->endpoint = ep;
+    conn->host = ep->host;
+    conn->lb_inflight = true;
+    ++ep->inflight;
+    ++ep->picked;
+    return true;
+}
+
+void
+cehc_lb_release(cehc_connection_ptr conn) {
+    if (!conn->lb_inflight) {
+        return;
+    }
+
+    cehc_endpoint_t *ep = conn->endpoint;
+    conn->lb_inflight = false;
+    --ep->inflight;
+
+    int64_t now = CommonUtils::GetMonotonicNs();
+    if (CEHC_REJECT_BREAKER_OPEN == conn->rejected) {
+        cehc_lb_on_failure(conn->lb_group, ep, now);
+        return;
+    }
+    if (!conn->admit_ns) {
+        // 本地排队满了或者没能交给curl，与副本无关。
+        return;
+    }
+
+    double rtt = (double)(now - conn->admit_ns);
+    bool failed = CURLE_OK != conn->result || conn->http_code >= 500;
+    if (failed) {
+        cehc_lb_on_failure(conn->lb_group, ep, now);
+    } else {
+        ep->consecutive_failures = 0;
+        ep->health += CEHC_LB_HEALTH_STEP;
+        if (ep->health > 1.0) {
+            ep->health = 1.0;
+        }
+    }
+
+    // 变慢时立即反映，变快时平滑，尾延迟高的副本更快被避开；快速失败不能让副本看起来更快。
+    if (rtt > ep->ewma_ns) {
+        ep->ewma_ns = rtt;
+    } else if (!failed) {
+        ep->ewma_ns += CEHC_LB_EWMA_ALPHA * (rtt - ep->ewma_ns);
+    }
+}
+
+void
+cehc_lb_free_conn(cehc_connection_ptr conn) {
+    if (conn->lb_inflight) {
+        // 还在本地排队时被释放，归还在传输数。
+        std::unique_lock<std::mutex> l(conn->http_service->multi_handles_mtx);
+        conn->admit_ns = 0;
+        cehc_lb_release(conn);
+    }
+    if (conn->lb_path) {
+        free(conn->lb_path);
+        conn->lb_path = NULL;
+    }
+}
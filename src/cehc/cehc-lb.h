@@ -0,0 +1,108 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_lb__h
+#define cehc_lb__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 客户端负载均衡：给一组后端副本起一个逻辑名字(endpoint group)，url的host写成这个名字即可，
+ * 例如注册了"user-svc" -> {"http://10.0.0.1:8080", "http://10.0.0.2:8080/api"}之后，
+ * "http://user-svc/users/1"每次cehc_run_conn时会被改写为其中一个副本的base url + "/users/1"。
+ * -> 选择副本用power of two choices：随机取两个，选(在传输数 + 1) * 延迟EWMA / 健康度小的那个；
+ *    延迟取自完成路径(交给curl到结束)，EWMA对变慢敏感(样本大于当前值时直接取样本)；
+ * -> conn上一次用的副本总是其中一个候选(只要没被摘除)，这样conn复用的连接大多还在，另一个候选随机保证分散；
+ * -> 传输失败、5xx或者被熔断降低健康度，连续失败eject_failures次摘除eject_ms(多次摘除时翻倍，最多8倍)，
+ *    之后以较低的健康度重新加入，成功一次恢复一点，慢慢接回流量；全部被摘除时选最早恢复的那个。
+ * 选中的副本的host:port同时作为按host限流、熔断(cehc-limiter.h、cehc-breaker.h)的host。
+ * 注意：逻辑名字的conn不使用后台DNS解析缓存(cehc-resolver.h)，副本的域名由curl自己解析。
+ */
+typedef struct cehc_lb_opts_s {
+    int eject_failures;     // 连续失败多少次摘除
+    int eject_ms;           // 第一次摘除的时长
+    double reentry_health;  // 重新加入时的健康度，(0, 1]
+} cehc_lb_opts_t;
+
+typedef struct cehc_endpoint_stats_s {
+    const char *base_url;
+    uint64_t inflight;
+    uint64_t picked;        // 累计被选中的次数
+    uint64_t failures;      // 累计失败的次数
+    uint64_t ejections;     // 累计被摘除的次数
+    uint64_t ewma_us;       // 延迟EWMA
+    double health;          // 健康度，(0, 1]
+    bool ejected;
+} cehc_endpoint_stats_t;
+
+/**
+ * 默认参数：连续失败5次摘除10s，重新加入时健康度0.1。
+ */
+void
+cehc_lb_opts_init(cehc_lb_opts_t *opts);
+
+/**
+ * 注册一个endpoint group，需在cehc_run_http_serivce之前、创建用到它的conn之前调用。
+ * @param hs
+ * @param name 逻辑名字，即url中的host
+ * @param base_urls 副本的base url，如"http://10.0.0.1:8080"，可以带path前缀
+ * @param cnt
+ * @param opts NULL为默认参数
+ * @return 参数非法或者重名时false
+ */
+bool
+cehc_http_service_add_endpoint_group(cehc_http_service_t *hs, const char *name,
+                                     const char *const *base_urls, int cnt, const cehc_lb_opts_t *opts);
+
+/**
+ * 得到某个endpoint group中各个副本的统计。
+ * @param stats 至少max个
+ * @return 副本个数(最多max)，没有该group时-1
+ */
+int
+cehc_http_service_get_endpoint_stats(cehc_http_service_t *hs, const char *name,
+                                     cehc_endpoint_stats_t *stats, int max);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+typedef struct cehc_lb_s cehc_lb_t;
+
+void
+cehc_lb_delete(cehc_lb_t **lb);
+
+/**
+ * cehc_new_conn中调用：url的host是注册过的逻辑名字时绑定group。
+ */
+void
+cehc_lb_bind_conn(cehc_connection_ptr conn);
+
+/**
+ * cehc_run_conn中调用，需持有multi_handles_mtx。选一个副本并改写easy的url、conn的host。
+ * @return 设置url失败时false，已设置conn的错误信息
+ */
+bool
+cehc_lb_pick(cehc_connection_ptr conn);
+
+/**
+ * conn结束(或者没能交给curl)时调用，需持有multi_handles_mtx。记录延迟和结果。
+ */
+void
+cehc_lb_release(cehc_connection_ptr conn);
+
+/**
+ * 释放conn绑定的资源，cehc_delete_conn中调用。
+ */
+void
+cehc_lb_free_conn(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_lb__h
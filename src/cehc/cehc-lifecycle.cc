@@ -0,0 +1,258 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-lifecycle.h"
+
+typedef struct cehc_lifecycle_s {
+    cehc_lifecycle_opts_t opts;
+    cehc_lifecycle_stats_t stats;   // 由multi_handles_mtx保护
+    Timer::TimerCallback sweep_cb;
+} cehc_lifecycle_t;
+
+typedef struct cehc_sweep_ctx_s {
+    cehc_lifecycle_t *lc;
+    int64_t now_ns;
+} cehc_sweep_ctx_t;
+
+static inline bool
+cehc_lifecycle_is_idle(const cehc_sock_entry_t *e) {
+    return !e->watched && e->idle_ns > 0;
+}
+
+/**
+ * 断开连接。fd还在curl的连接缓存中，curl下一次挑选连接(或者cleanup)时发现已断开才关闭它，这里不能close。
+ */
+static void
+cehc_lifecycle_retire(int fd, cehc_sock_entry_t *e, uint64_t *counter) {
+    if (-1 == shutdown(fd, SHUT_RDWR) && ENOTCONN != errno) {
+        int err = errno;
+        LOGW("shutdown fd = %d of %s err = %s.", fd, e->peer, strerror(err));
+    }
+    e->closing = true;
+    ++*counter;
+}
+
+static void
+cehc_lifecycle_sweep_one(int fd, cehc_sock_entry_t *e, void *arg) {
+    if (e->closing || !cehc_lifecycle_is_idle(e)) {
+        return;
+    }
+
+    auto ctx = (cehc_sweep_ctx_t*)arg;
+    cehc_lifecycle_t *lc = ctx->lc;
+    if (e->retired) {
+        cehc_lifecycle_retire(fd, e, &lc->stats.recycled_requests);
+    } else if (lc->opts.max_age_ms > 0 && ctx->now_ns - e->born_ns >= (int64_t)lc->opts.max_age_ms * 1000000) {
+        cehc_lifecycle_retire(fd, e, &lc->stats.recycled_age);
+    } else if (lc->opts.idle_timeout_ms > 0
+               && ctx->now_ns - e->idle_ns >= (int64_t)lc->opts.idle_timeout_ms * 1000000) {
+        cehc_lifecycle_retire(fd, e, &lc->stats.reaped_idle);
+    }
+}
+
+static void
+cehc_lifecycle_schedule(cehc_http_service_t *hs) {
+    Timer::Event ev(hs, &hs->lifecycle->sweep_cb);
+    hs->timer->SubscribeEventAfter(uctime_t::from_ms(hs->lifecycle->opts.sweep_interval_ms), ev);
+}
+
+static void
+cehc_lifecycle_on_sweep(void *ctx) {
+    cehc_http_service_t *hs = (cehc_http_service_t*)ctx;
+    if (hs->stop) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    cehc_sweep_ctx_t sweep;
+    sweep.lc = hs->lifecycle;
+    sweep.now_ns = CommonUtils::GetCoarseMonotonicNs();
+    cehc_sock_foreach(hs, cehc_lifecycle_sweep_one, &sweep);
+    ++hs->lifecycle->stats.sweeps;
+    l.unlock();
+
+    cehc_lifecycle_schedule(hs);
+}
+
+bool
+cehc_http_service_set_lifecycle(cehc_http_service_t *hs, const cehc_lifecycle_opts_t *opts) {
+    if (!hs || !opts || opts->idle_timeout_ms < 0 || opts->max_age_ms < 0 || opts->max_requests < 0
+        || opts->sweep_interval_ms < 0) {
+        LOGW("invalid lifecycle opts.");
+        return false;
+    }
+    if (hs->lifecycle) {
+        LOGW("lifecycle of http service is already set.");
+        return false;
+    }
+
+    cehc_lifecycle_t *lc = new (std::nothrow) cehc_lifecycle_t;
+    if (!lc) {
+        LOGE("%s oom when new cehc_lifecycle_t.", __func__);
+        return false;
+    }
+
+    lc->opts = *opts;
+    if (0 == lc->opts.sweep_interval_ms) {
+        lc->opts.sweep_interval_ms = 1000;
+    }
+    bzero(&lc->stats, sizeof(lc->stats));
+    lc->sweep_cb = cehc_lifecycle_on_sweep;
+    hs->lifecycle = lc;
+
+    if (hs->timer && (opts->idle_timeout_ms > 0 || opts->max_age_ms > 0 || opts->max_requests > 0)) {
+        cehc_lifecycle_schedule(hs);
+    } else if (hs->embedded) {
+        LOGI("embedded http service has no timer, idle connections are only checked by curl.");
+    }
+
+    return true;
+}
+
+void
+cehc_http_service_get_lifecycle_stats(cehc_http_service_t *hs, cehc_lifecycle_stats_t *stats) {
+    if (!hs || !stats) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (hs->lifecycle) {
+        *stats = hs->lifecycle->stats;
+    } else {
+        bzero(stats, sizeof(cehc_lifecycle_stats_t));
+    }
+}
+
+typedef struct cehc_gauge_ctx_s {
+    std::vector<cehc_conn_gauge_t> gauges;
+    std::unordered_map<std::string, size_t> index;
+} cehc_gauge_ctx_t;
+
+static void
+cehc_lifecycle_gauge_one(int fd, cehc_sock_entry_t *e, void *arg) {
+    auto ctx = (cehc_gauge_ctx_t*)arg;
+    auto it = ctx->index.find(e->peer);
+    if (it == ctx->index.end()) {
+        cehc_conn_gauge_t g;
+        bzero(&g, sizeof(g));
+        strcpy(g.peer, e->peer);
+        it = ctx->index.emplace(e->peer, ctx->gauges.size()).first;
+        ctx->gauges.push_back(g);
+    }
+
+    cehc_conn_gauge_t &g = ctx->gauges[it->second];
+    ++g.open;
+    if (e->closing) {
+        ++g.closing;
+    } else if (cehc_lifecycle_is_idle(e)) {
+        ++g.idle;
+    }
+    g.requests += e->requests;
+}
+
+int
+cehc_http_service_get_conn_gauges(cehc_http_service_t *hs, cehc_conn_gauge_t *gauges, int cap) {
+    if (!hs || cap < 0 || (cap > 0 && !gauges)) {
+        LOGW("invalid conn gauges params.");
+        return -1;
+    }
+
+    cehc_gauge_ctx_t ctx;
+    {
+        std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+        cehc_sock_foreach(hs, cehc_lifecycle_gauge_one, &ctx);
+    }
+
+    int n = (int)ctx.gauges.size();
+    if (n > 0 && cap > 0) {
+        memcpy(gauges, ctx.gauges.data(), sizeof(cehc_conn_gauge_t) * (n < cap ? n : cap));
+    }
+
+    return n;
+}
+
+CURLcode
+cehc_lifecycle_setup_easy(cehc_http_service_t *hs, CURL *easy) {
+    cehc_lifecycle_t *lc = hs->lifecycle;
+    if (!lc) {
+        return CURLE_OK;
+    }
+
+    // curl的期限以秒为单位，向上取整，更精确的回收由巡检完成。
+    CURLcode cc;
+    if (lc->opts.idle_timeout_ms > 0) {
+        long s = (lc->opts.idle_timeout_ms + 999) / 1000;
+        if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_MAXAGE_CONN, s))) {
+            return cc;
+        }
+    }
+#if LIBCURL_VERSION_NUM >= 0x075000
+    if (lc->opts.max_age_ms > 0) {
+        long s = (lc->opts.max_age_ms + 999) / 1000;
+        if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_MAXLIFETIME_CONN, s))) {
+            return cc;
+        }
+    }
+#endif
+
+    return CURLE_OK;
+}
+
+void
+cehc_lifecycle_on_poll(cehc_http_service_t *hs, int fd, bool watched) {
+    cehc_sock_entry_t *e = cehc_sock_lookup(hs, fd);
+    if (e) {
+        e->watched = watched;
+        if (watched) {
+            e->idle_ns = 0;
+        }
+    }
+}
+
+void
+cehc_lifecycle_on_done(cehc_connection_ptr conn) {
+    cehc_http_service_t *hs = conn->http_service;
+    curl_socket_t fd = conn->fd;
+    cehc_sock_entry_t *e = cehc_sock_lookup(hs, fd);
+    if (!e) {
+        // 复用的连接上响应已经就绪时，curl可能在一次处理中就完成传输，不会通知fd。
+        // CURLINFO_ACTIVESOCKET要遍历连接缓存，所以只作为后备，并且要在curl_multi_remove_handle之前。
+        if (CURLE_OK != curl_easy_getinfo(conn->easy, CURLINFO_ACTIVESOCKET, &fd)
+            || !(e = cehc_sock_lookup(hs, fd))) {
+            return;
+        }
+    }
+
+    ++e->requests;
+    e->idle_ns = CommonUtils::GetCoarseMonotonicNs();
+    cehc_lifecycle_t *lc = hs->lifecycle;
+    if (lc && lc->opts.max_requests > 0 && e->requests >= (uint32_t)lc->opts.max_requests && !e->closing) {
+        // 已经回到池中的连接立即回收，还有其他传输(如HTTP/2的多路复用)在用的等巡检。
+        if (e->watched) {
+            e->retired = true;
+        } else {
+            cehc_lifecycle_retire(fd, e, &lc->stats.recycled_requests);
+        }
+    }
+}
+
+void
+cehc_lifecycle_delete(cehc_http_service_t *hs) {
+    if (hs->lifecycle) {
+        delete hs->lifecycle;
+        hs->lifecycle = NULL;
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_lifecycle__h
+#define cehc_lifecycle__h
+
+#include "cehttpclient.h"
+#include "cehc-socket.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 连接池中连接的生命周期：空闲回收、按存活时间和请求数轮换，以及按对端统计的连接数。
+ * curl的连接缓存只在下一次挑选连接时才检查空闲和存活时间，流量高峰过后没有新请求时，空闲的连接会一直占着fd和对端的资源；
+ * 而长期复用的连接也不会轮换到新的副本上(如对端扩容之后)。
+ * -> 每个easy设置CURLOPT_MAXAGE_CONN/CURLOPT_MAXLIFETIME_CONN，curl挑选连接时不再复用超时的连接；
+ * -> 定时器线程按间隔巡检service的socket表，空闲超时、存活超时或者请求数到达上限的空闲连接被shutdown，
+ *    对端立即收到FIN、释放它那一端的资源，本端不会再复用这个连接；
+ * -> 但fd仍然属于curl的连接缓存，curl没有主动清理缓存的接口(超时驱动curl_multi_socket_action也不会检查
+ *    空闲的连接)，本端的fd要等这个service下一次挑选连接(有新的请求，清理至多每秒一次)或者service释放时
+ *    才由curl关闭；在此之前它们在gauge中计为closing。完全没有流量的service不会因此少占fd；
+ * -> 正在使用的连接不会被回收，请求数到达上限的连接在当前的请求完成之后回收。
+ * 嵌入模式没有定时器线程，只有curl的检查和请求数上限生效。
+ */
+
+typedef struct cehc_lifecycle_opts_s {
+    int idle_timeout_ms;   // 在池中空闲超过该时间的连接关闭，0为curl的默认(空闲118秒之后不再复用)
+    int max_age_ms;        // 建立超过该时间的连接不再复用，0不限
+    int max_requests;      // 完成了该数量请求的连接不再复用，0不限
+    int sweep_interval_ms; // 巡检间隔，0为1000
+} cehc_lifecycle_opts_t;
+
+typedef struct cehc_lifecycle_stats_s {
+    uint64_t sweeps;            // 巡检次数
+    uint64_t reaped_idle;       // 空闲超时回收的连接数
+    uint64_t recycled_age;      // 存活超时回收的连接数
+    uint64_t recycled_requests; // 请求数到达上限回收的连接数
+} cehc_lifecycle_stats_t;
+
+/**
+ * 一个对端的连接数。
+ */
+typedef struct cehc_conn_gauge_s {
+    char peer[CEHC_SOCK_PEER_LEN]; // 见CEHC_SOCK_PEER_LEN
+    int open;                      // 打开的连接数
+    int idle;                      // 其中在池中空闲的
+    int closing;                   // 其中已被回收、等待curl关闭的
+    uint64_t requests;             // 打开的连接上完成的请求数
+} cehc_conn_gauge_t;
+
+/**
+ * 设置连接的生命周期策略，需在创建conn之前调用(curl的选项在创建conn时设置)。
+ * @param hs
+ * @param opts
+ * @return 参数非法或者重复设置时false
+ */
+bool
+cehc_http_service_set_lifecycle(cehc_http_service_t *hs, const cehc_lifecycle_opts_t *opts);
+
+void
+cehc_http_service_get_lifecycle_stats(cehc_http_service_t *hs, cehc_lifecycle_stats_t *stats);
+
+/**
+ * 按对端统计当前打开的连接，不需要设置生命周期策略。
+ * @param hs
+ * @param gauges
+ * @param cap gauges的容量
+ * @return 对端的个数(可能大于cap，只填充前cap个)；参数非法时-1
+ */
+int
+cehc_http_service_get_conn_gauges(cehc_http_service_t *hs, cehc_conn_gauge_t *gauges, int cap);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 为easy设置curl的连接复用期限，没有设置策略时什么也不做。
+ * @return curl_easy_setopt的结果
+ */
+CURLcode
+cehc_lifecycle_setup_easy(cehc_http_service_t *hs, CURL *easy);
+
+/**
+ * curl开始(watched为true)或者停止等待fd的事件，需持有multi_handles_mtx。
+ */
+void
+cehc_lifecycle_on_poll(cehc_http_service_t *hs, int fd, bool watched);
+
+/**
+ * 传输结束，按conn使用的fd计数，需持有multi_handles_mtx，并且在curl_multi_remove_handle之前调用。
+ */
+void
+cehc_lifecycle_on_done(cehc_connection_ptr conn);
+
+/**
+ * 需在定时器释放之后调用。
+ */
+void
+cehc_lifecycle_delete(cehc_http_service_t *hs);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_lifecycle__h
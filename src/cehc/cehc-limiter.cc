@@ -0,0 +1,326 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-host.h"
+#include "cehc-limiter.h"
+#include "cehc-sched.h"
+
+#define CEHC_LIMIT_NONE      0
+#define CEHC_LIMIT_WAITING   1
+#define CEHC_LIMIT_ADMITTED  2
+
+#define CEHC_LIMIT_DECREASE  0.9   // 过载时limit的乘数
+#define CEHC_LIMIT_SMOOTHING 0.2   // gradient新旧limit的平滑系数
+#define CEHC_LIMIT_RTT_ALPHA 0.1   // 延迟的指数平滑系数
+
+struct cehc_limiter_s {
+    cehc_limiter_opts_t opts;
+};
+
+/**
+ * 每个host的限流状态，挂在cehc_host_t上，所有字段都由multi_handles_mtx保护。
+ */
+struct cehc_host_limiter_s {
+    double limit;
+    int inflight;
+    cehc_connection_ptr head;   // 排队的conn，FIFO
+    cehc_connection_ptr tail;
+    uint64_t queued;
+    int64_t rtt_noload_ns;
+    int64_t window_min_ns;      // 本窗口内的最小延迟
+    int window_cnt;
+    double rtt_ns;
+    uint64_t admitted;
+    uint64_t rejected;
+    uint64_t drops;
+    bool pumping;
+};
+
+static inline double
+cehc_limiter_clamp(double v, double lo, double hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static cehc_host_limiter_s *
+cehc_limiter_of(cehc_connection_ptr conn, bool create) {
+    cehc_host_t *host = conn->host;
+    if (!host) {
+        return NULL;
+    }
+
+    if (!host->limiter && create) {
+        cehc_host_limiter_s *hl = (cehc_host_limiter_s*)calloc(1, sizeof(cehc_host_limiter_s));
+        if (!hl) {
+            LOGE("%s oom when calloc cehc_host_limiter_s.", __func__);
+            return NULL;
+        }
+        hl->limit = conn->http_service->limiter->opts.initial_limit;
+        host->limiter = hl;
+    }
+
+    return host->limiter;
+}
+
+/**
+ * 传输失败、429、503为过载信号。
+ */
+static inline bool
+cehc_limiter_is_drop(cehc_connection_ptr conn) {
+    return CURLE_OK != conn->result || 429 == conn->http_code || 503 == conn->http_code;
+}
+
+/**
+ * 用一个延迟样本调整limit。
+ */
+static void
+cehc_limiter_sample(const cehc_limiter_opts_t *opts, cehc_host_limiter_s *hl, int64_t rtt, bool drop) {
+    // 快速失败的延迟不代表后端的处理能力，只作为过载信号。
+    bool app_limited = hl->inflight * 2 < hl->limit;
+    if (drop) {
+        ++hl->drops;
+        hl->limit = cehc_limiter_clamp(hl->limit * CEHC_LIMIT_DECREASE, opts->min_limit, opts->max_limit);
+        return;
+    }
+
+    if (!hl->rtt_noload_ns || rtt < hl->rtt_noload_ns) {
+        hl->rtt_noload_ns = rtt;
+    }
+    if (!hl->window_cnt || rtt < hl->window_min_ns) {
+        hl->window_min_ns = rtt;
+    }
+    // 窗口结束时用窗口内的最小值代替，后端整体变慢之后无负载延迟也跟着上调。
+    if (++hl->window_cnt >= opts->window) {
+        hl->rtt_noload_ns = hl->window_min_ns;
+        hl->window_cnt = 0;
+    }
+    hl->rtt_ns = hl->rtt_ns ? hl->rtt_ns + CEHC_LIMIT_RTT_ALPHA * (rtt - hl->rtt_ns) : rtt;
+
+    // 只用了不到一半时(app_limited)说明瓶颈不在这里，不增加limit。
+    double limit = hl->limit;
+    if (CEHC_LIMIT_AIMD == opts->algo) {
+        if (rtt > opts->tolerance * hl->rtt_noload_ns) {
+            limit *= CEHC_LIMIT_DECREASE;
+        } else if (!app_limited) {
+            limit += 1.0 / limit;
+        }
+    } else {
+        double gradient = cehc_limiter_clamp(opts->tolerance * hl->rtt_noload_ns / hl->rtt_ns, 0.5, 1.0);
+        double target = limit * gradient + sqrt(limit);
+        target = limit * (1 - CEHC_LIMIT_SMOOTHING) + target * CEHC_LIMIT_SMOOTHING;
+        if (target < limit || !app_limited) {
+            limit = target;
+        }
+    }
+
+    hl->limit = cehc_limiter_clamp(limit, opts->min_limit, opts->max_limit);
+}
+
+static inline void
+cehc_limiter_take(cehc_host_limiter_s *hl, cehc_connection_ptr conn) {
+    ++hl->inflight;
+    ++hl->admitted;
+    conn->limit_state = CEHC_LIMIT_ADMITTED;
+}
+
+/**
+ * 有名额就放行排队的请求，交给按优先级放行(如果开启了)再交给curl。
+ */
+static void
+cehc_limiter_pump(cehc_host_limiter_s *hl) {
+    if (hl->pumping) {
+        // 交给curl失败时结束conn会重入release，由外层的循环继续放行。
+        return;
+    }
+
+    hl->pumping = true;
+    while (hl->head && hl->inflight < (int)hl->limit) {
+        cehc_connection_ptr conn = hl->head;
+        hl->head = conn->limit_next;
+        if (!hl->head) {
+            hl->tail = NULL;
+        }
+        conn->limit_next = NULL;
+        --hl->queued;
+
+        cehc_limiter_take(hl, conn);
+        if (cehc_sched_submit(conn) && !cehc_add_conn_to_multi(conn)) {
+            cehc_finish_conn(conn);
+        }
+    }
+    hl->pumping = false;
+}
+
+void
+cehc_limiter_opts_init(cehc_limiter_opts_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    opts->algo = CEHC_LIMIT_GRADIENT;
+    opts->initial_limit = 20;
+    opts->min_limit = 1;
+    opts->max_limit = 1000;
+    opts->max_queue = 100;
+    opts->tolerance = 2.0;
+    opts->window = 1000;
+}
+
+bool
+cehc_http_service_set_host_limiter(cehc_http_service_t *hs, const cehc_limiter_opts_t *opts) {
+    if (!hs || !opts || opts->min_limit <= 0 || opts->max_limit < opts->min_limit
+        || opts->initial_limit < opts->min_limit || opts->initial_limit > opts->max_limit
+        || opts->max_queue < 0 || opts->tolerance < 1.0 || opts->window <= 0
+        || (CEHC_LIMIT_AIMD != opts->algo && CEHC_LIMIT_GRADIENT != opts->algo)) {
+        LOGW("invalid host limiter opts.");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (!hs->limiter) {
+        hs->limiter = (cehc_limiter_t*)calloc(1, sizeof(cehc_limiter_t));
+        if (!hs->limiter) {
+            LOGE("%s oom when calloc cehc_limiter_t.", __func__);
+            return false;
+        }
+    }
+
+    hs->limiter->opts = *opts;
+    return true;
+}
+
+bool
+cehc_http_service_get_host_limiter_stats(cehc_http_service_t *hs, const char *host, int port,
+                                         cehc_limiter_stats_t *stats) {
+    if (!hs || !stats) {
+        return false;
+    }
+
+    bzero(stats, sizeof(cehc_limiter_stats_t));
+    cehc_host_t *h = cehc_host_find(hs, host, port);
+    if (!h) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    cehc_host_limiter_s *hl = h->limiter;
+    if (!hl) {
+        return false;
+    }
+
+    stats->limit = hl->limit;
+    stats->inflight = hl->inflight;
+    stats->queued = hl->queued;
+    stats->rtt_noload_us = hl->rtt_noload_ns / 1000;
+    stats->rtt_us = (uint64_t)hl->rtt_ns / 1000;
+    stats->admitted = hl->admitted;
+    stats->rejected = hl->rejected;
+    stats->drops = hl->drops;
+    return true;
+}
+
+void
+cehc_limiter_delete(cehc_limiter_t **limiter) {
+    if (limiter && *limiter) {
+        free(*limiter);
+        *limiter = NULL;
+    }
+}
+
+int
+cehc_limiter_submit(cehc_connection_ptr conn) {
+    if (!conn->http_service->limiter) {
+        return CEHC_LIMIT_PASS;
+    }
+
+    cehc_host_limiter_s *hl = cehc_limiter_of(conn, true);
+    if (!hl) {
+        return CEHC_LIMIT_PASS;
+    }
+
+    if (!hl->head && hl->inflight < (int)hl->limit) {
+        cehc_limiter_take(hl, conn);
+        return CEHC_LIMIT_PASS;
+    }
+
+    if (hl->queued >= (uint64_t)conn->http_service->limiter->opts.max_queue) {
+        ++hl->rejected;
+        conn->rejected = CEHC_REJECT_HOST_LIMIT;
+        sprintf(conn->errormsg, "host %s over concurrency limit %d.", conn->host->key.c_str(), (int)hl->limit);
+        return CEHC_LIMIT_REJECTED;
+    }
+
+    conn->limit_state = CEHC_LIMIT_WAITING;
+    conn->limit_next = NULL;
+    if (hl->tail) {
+        hl->tail->limit_next = conn;
+    } else {
+        hl->head = conn;
+    }
+    hl->tail = conn;
+    ++hl->queued;
+    return CEHC_LIMIT_QUEUED;
+}
+
+void
+cehc_limiter_release(cehc_connection_ptr conn) {
+    if (CEHC_LIMIT_ADMITTED != conn->limit_state) {
+        return;
+    }
+
+    cehc_host_limiter_s *hl = cehc_limiter_of(conn, false);
+    conn->limit_state = CEHC_LIMIT_NONE;
+    if (!hl) {
+        return;
+    }
+
+    // 没有交给curl(admit_ns为0)的没有延迟样本。
+    if (conn->admit_ns) {
+        int64_t rtt = CommonUtils::GetMonotonicNs() - conn->admit_ns;
+        cehc_limiter_sample(&conn->http_service->limiter->opts, hl, rtt > 0 ? rtt : 1, cehc_limiter_is_drop(conn));
+    }
+    // 样本在归还名额之前记录，app_limited按这个请求还在传输计算。
+    --hl->inflight;
+    cehc_limiter_pump(hl);
+}
+
+void
+cehc_limiter_forget(cehc_connection_ptr conn) {
+    if (CEHC_LIMIT_WAITING != conn->limit_state) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(conn->http_service->multi_handles_mtx);
+    cehc_host_limiter_s *hl = cehc_limiter_of(conn, false);
+    if (!hl || CEHC_LIMIT_WAITING != conn->limit_state) {
+        return;
+    }
+
+    cehc_connection_ptr prev = NULL;
+    for (cehc_connection_ptr c = hl->head; c; prev = c, c = c->limit_next) {
+        if (c != conn) {
+            continue;
+        }
+
+        if (prev) {
+            prev->limit_next = c->limit_next;
+        } else {
+            hl->head = c->limit_next;
+        }
+        if (hl->tail == c) {
+            hl->tail = prev;
+        }
+        c->limit_next = NULL;
+        --hl->queued;
+        break;
+    }
+    conn->limit_state = CEHC_LIMIT_NONE;
+}
@@ -0,0 +1,110 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_limiter__h
+#define cehc_limiter__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按目标host:port自适应的并发限制：每个host允许同时在传输的请求数(limit)由该host的延迟决定，
+ * 后端变慢时limit随之降低，多出来的请求在本地排队或者直接拒绝，而不是都压到后端上越排越慢、继而引发重试风暴。
+ * -> 延迟样本取自完成路径：交给curl到传输结束的时间(不含本地排队)；
+ * -> 无负载延迟(rtt_noload)为一个窗口(默认1000个样本)内的最小延迟，窗口结束时更新，所以后端整体变慢之后也能适应；
+ * -> 传输失败、429、503视为丢包(过载)信号；
+ * -> 超过limit的请求进入该host的FIFO队列，队列满了cehc_run_conn直接返回false(conn->rejected为CEHC_REJECT_HOST_LIMIT)。
+ * 算法：
+ * -> CEHC_LIMIT_AIMD：延迟超过tolerance倍的无负载延迟或者丢包时limit乘以0.9，否则每个样本加1/limit(约每轮加1)；
+ * -> CEHC_LIMIT_GRADIENT：梯度 = clamp(tolerance * rtt_noload / rtt, 0.5, 1)，
+ *    新limit = limit * 梯度 + sqrt(limit)(允许的排队量)，再和旧值做指数平滑；丢包时乘以0.9。
+ * 两者都只在请求数用满了limit的一半以上时才增加limit，避免空闲时limit无限上涨。
+ */
+typedef enum cehc_limiter_algo_e {
+    CEHC_LIMIT_AIMD     = 0,
+    CEHC_LIMIT_GRADIENT = 1,
+} cehc_limiter_algo_t;
+
+typedef struct cehc_limiter_opts_s {
+    cehc_limiter_algo_t algo;
+    int initial_limit;   // 初始limit
+    int min_limit;       // limit的下限
+    int max_limit;       // limit的上限
+    int max_queue;       // 每个host排队的上限，超过直接拒绝；0为不排队
+    double tolerance;    // 延迟容忍的倍数
+    int window;          // 更新无负载延迟的样本窗口
+} cehc_limiter_opts_t;
+
+typedef struct cehc_limiter_stats_s {
+    double limit;          // 当前limit
+    uint64_t inflight;     // 当前在传输的个数
+    uint64_t queued;       // 当前排队的个数
+    uint64_t rtt_noload_us;
+    uint64_t rtt_us;       // 平滑之后的延迟
+    uint64_t admitted;     // 累计放行的个数
+    uint64_t rejected;     // 累计拒绝的个数
+    uint64_t drops;        // 累计的丢包(失败/429/503)样本数
+} cehc_limiter_stats_t;
+
+/**
+ * 默认参数：gradient，初始20，[1, 1000]，排队100，容忍2倍，窗口1000。
+ */
+void
+cehc_limiter_opts_init(cehc_limiter_opts_t *opts);
+
+/**
+ * 开启按host的自适应并发限制，需在cehc_run_http_serivce之前、没有任何conn时调用。
+ * @param hs
+ * @param opts
+ * @return 参数非法时false
+ */
+bool
+cehc_http_service_set_host_limiter(cehc_http_service_t *hs, const cehc_limiter_opts_t *opts);
+
+/**
+ * 得到某个host:port的统计。
+ * @return 没有该host(还没有请求过)或者未开启时false
+ */
+bool
+cehc_http_service_get_host_limiter_stats(cehc_http_service_t *hs, const char *host, int port,
+                                         cehc_limiter_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+typedef struct cehc_limiter_s cehc_limiter_t;
+
+void
+cehc_limiter_delete(cehc_limiter_t **limiter);
+
+/**
+ * cehc_run_conn中调用，需持有multi_handles_mtx。
+ * @return CEHC_LIMIT_PASS放行，CEHC_LIMIT_QUEUED已排队，CEHC_LIMIT_REJECTED拒绝(已设置conn的错误信息)
+ */
+#define CEHC_LIMIT_PASS      0
+#define CEHC_LIMIT_QUEUED    1
+#define CEHC_LIMIT_REJECTED  2
+int
+cehc_limiter_submit(cehc_connection_ptr conn);
+
+/**
+ * conn结束时调用，需持有multi_handles_mtx。记录延迟样本、调整limit、归还名额并放行排队的请求。
+ */
+void
+cehc_limiter_release(cehc_connection_ptr conn);
+
+/**
+ * 把排队中的conn摘出来，cehc_delete_conn中调用。
+ */
+void
+cehc_limiter_forget(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_limiter__h
@@ -0,0 +1,614 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+
+#ifdef CEHC_WITH_IO_URING
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <vector>
+#endif
+
+#include "../common/logger.h"
+#include "../common/spin-lock.h"
+#include "../common/usdt.h"
+
+#include "cehc-poller.h"
+
+using namespace cehc::common;
+
+typedef struct cehc_poller_ops_s {
+    const char *name;
+    bool (*init)(cehc_poller_t *p, int ev_cnt);
+    void (*destroy)(cehc_poller_t *p);
+    int (*ctl)(cehc_poller_t *p, int op, int fd, uint32_t events);
+    int (*wait)(cehc_poller_t *p, struct epoll_event *ees, int max, int timeout_ms);
+    void (*flush)(cehc_poller_t *p);
+} cehc_poller_ops_t;
+
+struct cehc_poller_s {
+    const cehc_poller_ops_t *ops;
+    int fd;
+    void *ctx;
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> ctl_calls{0};
+    std::atomic<uint64_t> events{0};
+};
+
+/******************************** epoll ********************************/
+
+static bool
+cehc_epoll_init(cehc_poller_t *p, int ev_cnt) {
+    p->fd = epoll_create(ev_cnt > 0 ? ev_cnt : 1);
+    if (-1 == p->fd) {
+        int err = errno;
+        LOGE("epoll_create err = %s.", strerror(err));
+        return false;
+    }
+
+    return true;
+}
+
+static void
+cehc_epoll_destroy(cehc_poller_t *p) {
+    if (-1 != p->fd) {
+        close(p->fd);
+    }
+}
+
+static int
+cehc_epoll_ctl(cehc_poller_t *p, int op, int fd, uint32_t events) {
+    struct epoll_event ee;
+    bzero(&ee, sizeof(ee));
+    ee.events = events;
+    ee.data.fd = fd;
+    p->ctl_calls.fetch_add(1, std::memory_order_relaxed);
+    return epoll_ctl(p->fd, op, fd, &ee);
+}
+
+static int
+cehc_epoll_wait(cehc_poller_t *p, struct epoll_event *ees, int max, int timeout_ms) {
+    p->waits.fetch_add(1, std::memory_order_relaxed);
+    int n = epoll_wait(p->fd, ees, max, timeout_ms);
+    if (n > 0) {
+        p->events.fetch_add((uint64_t)n, std::memory_order_relaxed);
+    }
+
+    return n;
+}
+
+static void
+cehc_epoll_flush(cehc_poller_t *p) {}
+
+static const cehc_poller_ops_t s_epoll_ops = {
+    "epoll",
+    cehc_epoll_init,
+    cehc_epoll_destroy,
+    cehc_epoll_ctl,
+    cehc_epoll_wait,
+    cehc_epoll_flush,
+};
+
+/******************************** io_uring ********************************/
+
+#ifdef CEHC_WITH_IO_URING
+
+// user_data的高32位为代数，低32位为fd；代数不匹配的cqe是已经被修改/删除的旧poll留下的，直接丢弃。
+#define CEHC_URING_UD(gen, fd)         ((((uint64_t)(gen)) << 32) | (uint32_t)(fd))
+#define CEHC_URING_UD_FD(ud)           ((int)(uint32_t)(ud))
+#define CEHC_URING_UD_GEN(ud)          ((uint32_t)((ud) >> 32))
+// POLL_REMOVE自身的cqe
+#define CEHC_URING_UD_IGNORE           (~(uint64_t)0)
+#define CEHC_URING_MIN_ENTRIES         64
+
+typedef struct cehc_uring_fd_s {
+    uint32_t gen;
+    uint32_t events;
+    bool active;
+} cehc_uring_fd_t;
+
+typedef struct cehc_uring_s {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned cq_entries;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /**
+     * 保护SQ和fd状态表：ctl可能来自事件循环之外的线程。
+     */
+    spin_lock_t sl;
+    std::vector<cehc_uring_fd_t> fds;
+    /**
+     * 事件循环线程，其他线程ctl时需要自己提交，否则要等到事件循环下一次醒来。
+     */
+    volatile pthread_t loop_tid;
+} cehc_uring_t;
+
+static inline int
+cehc_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/**
+ * 已写入SQ但内核还没有取走的SQE个数。内核只会按顺序取，所以它就是下一次应当提交的个数，
+ * 部分提交或者多个线程先后提交都不会出错。
+ */
+static inline unsigned
+cehc_uring_pending(cehc_uring_t *u) {
+    return __atomic_load_n(u->sq_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * 提交pending的SQE，需持有sl。
+ */
+static int
+cehc_uring_submit_locked(cehc_poller_t *p, cehc_uring_t *u) {
+    unsigned pending;
+    while ((pending = cehc_uring_pending(u))) {
+        int n = cehc_uring_enter(u->ring_fd, pending, 0, 0, NULL, 0);
+        p->ctl_calls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0 && EINTR != errno) {
+            int err = errno;
+            LOGE("io_uring_enter submit err = %s.", strerror(err));
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * 取一个空闲的SQE，SQ满时先提交，需持有sl。
+ */
+static struct io_uring_sqe *
+cehc_uring_get_sqe(cehc_poller_t *p, cehc_uring_t *u) {
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= u->sq_entries) {
+        if (-1 == cehc_uring_submit_locked(p, u)) {
+            return NULL;
+        }
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= u->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    bzero(sqe, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+static inline void
+cehc_uring_commit_sqe(cehc_uring_t *u) {
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static int
+cehc_uring_prep_poll_add(cehc_poller_t *p, cehc_uring_t *u, int fd) {
+    struct io_uring_sqe *sqe = cehc_uring_get_sqe(p, u);
+    if (!sqe) {
+        return -1;
+    }
+
+    cehc_uring_fd_t &st = u->fds[fd];
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    // multishot是边沿触发的：只关注读时curl每次都会读到EAGAIN(或自己安排立即重试)，可以用multishot省去重复注册；
+    // 关注写时curl写一块就返回，socket仍可写但不会再有唤醒，所以用一次性的poll在每次事件后重新注册，即level trigger。
+    if (!(st.events & EPOLLOUT)) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    // epoll与poll的事件位在linux上是一致的，去掉EPOLLET等poll不认识的位。
+    sqe->poll32_events = st.events & (POLLIN|POLLOUT|POLLPRI|POLLRDHUP|POLLERR|POLLHUP);
+    sqe->user_data = CEHC_URING_UD(st.gen, fd);
+    cehc_uring_commit_sqe(u);
+    return 0;
+}
+
+static int
+cehc_uring_prep_poll_remove(cehc_poller_t *p, cehc_uring_t *u, int fd) {
+    struct io_uring_sqe *sqe = cehc_uring_get_sqe(p, u);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = CEHC_URING_UD(u->fds[fd].gen, fd);
+    sqe->user_data = CEHC_URING_UD_IGNORE;
+    cehc_uring_commit_sqe(u);
+    return 0;
+}
+
+static bool
+cehc_uring_init(cehc_poller_t *p, int ev_cnt) {
+    cehc_uring_t *u = new (std::nothrow) cehc_uring_t();
+    if (!u) {
+        LOGE("%s oom when new cehc_uring_t.", __func__);
+        return false;
+    }
+
+    p->ctx = u;
+    u->ring_fd = -1;
+    u->sl = UNLOCKED;
+    u->fds.resize(1024);
+
+    struct io_uring_params params;
+    bzero(&params, sizeof(params));
+    // cq给足余量，避免同一批中多个fd的multishot事件把cq打满。
+    params.flags = IORING_SETUP_CQSIZE;
+    unsigned entries = ev_cnt > CEHC_URING_MIN_ENTRIES ? (unsigned)ev_cnt : CEHC_URING_MIN_ENTRIES;
+    params.cq_entries = entries * 4;
+    u->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (-1 == u->ring_fd) {
+        int err = errno;
+        LOGE("io_uring_setup err = %s.", strerror(err));
+        return false;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)
+        || !(params.features & IORING_FEAT_EXT_ARG)) {
+        LOGE("io_uring features 0x%x not supported, kernel too old.", params.features);
+        return false;
+    }
+
+    u->sq_entries = params.sq_entries;
+    u->cq_entries = params.cq_entries;
+    u->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // SINGLE_MMAP：sq与cq共用一块映射。
+    if (u->cq_len > u->sq_len) {
+        u->sq_len = u->cq_len;
+    }
+    u->cq_len = u->sq_len;
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == u->sq_ptr) {
+        int err = errno;
+        u->sq_ptr = NULL;
+        LOGE("mmap sq ring err = %s.", strerror(err));
+        return false;
+    }
+    u->cq_ptr = u->sq_ptr;
+
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                                         u->ring_fd, IORING_OFF_SQES);
+    if (MAP_FAILED == (void*)u->sqes) {
+        int err = errno;
+        u->sqes = NULL;
+        LOGE("mmap sqes err = %s.", strerror(err));
+        return false;
+    }
+
+    char *sq = (char*)u->sq_ptr;
+    u->sq_head = (unsigned*)(sq + params.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + params.sq_off.array);
+    char *cq = (char*)u->cq_ptr;
+    u->cq_head = (unsigned*)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    p->fd = u->ring_fd;
+    return true;
+}
+
+static void
+cehc_uring_destroy(cehc_poller_t *p) {
+    cehc_uring_t *u = (cehc_uring_t*)p->ctx;
+    if (!u) {
+        return;
+    }
+
+    if (u->sqes) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->sq_ptr) {
+        munmap(u->sq_ptr, u->sq_len);
+    }
+    if (-1 != u->ring_fd) {
+        close(u->ring_fd);
+    }
+    delete u;
+    p->ctx = NULL;
+}
+
+static int
+cehc_uring_ctl(cehc_poller_t *p, int op, int fd, uint32_t events) {
+    cehc_uring_t *u = (cehc_uring_t*)p->ctx;
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    SpinLock l(&u->sl);
+    if ((size_t)fd >= u->fds.size()) {
+        u->fds.resize((size_t)fd * 2);
+    }
+
+    cehc_uring_fd_t &st = u->fds[fd];
+    int r = 0;
+    switch (op) {
+        case EPOLL_CTL_ADD: {
+            if (st.active) {
+                errno = EEXIST;
+                return -1;
+            }
+            ++st.gen;
+            st.events = events;
+            st.active = true;
+            r = cehc_uring_prep_poll_add(p, u, fd);
+            break;
+        }
+        case EPOLL_CTL_MOD: {
+            if (!st.active) {
+                errno = ENOENT;
+                return -1;
+            }
+            // 关注事件不变时什么也不用做，这是相对epoll_ctl最常见的节省。
+            if (st.events == events) {
+                return 0;
+            }
+            r = cehc_uring_prep_poll_remove(p, u, fd);
+            ++st.gen;
+            st.events = events;
+            r = r ? r : cehc_uring_prep_poll_add(p, u, fd);
+            break;
+        }
+        case EPOLL_CTL_DEL: {
+            if (!st.active) {
+                errno = ENOENT;
+                return -1;
+            }
+            r = cehc_uring_prep_poll_remove(p, u, fd);
+            ++st.gen;
+            st.active = false;
+            break;
+        }
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    // 不在事件循环线程时自己提交：事件循环可能正阻塞在io_uring_enter中，看不到新的SQE。
+    // 尤其是DEL，poll持有file的引用，不提交的话curl关闭的socket不会真正释放。
+    if (!r && !pthread_equal(u->loop_tid, pthread_self())) {
+        r = cehc_uring_submit_locked(p, u);
+    }
+
+    return r;
+}
+
+static int
+cehc_uring_reap(cehc_poller_t *p, cehc_uring_t *u, struct epoll_event *ees, int max) {
+    int n = 0;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    SpinLock l(&u->sl);
+    while (head != tail && n < max) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        ++head;
+        uint64_t ud = cqe->user_data;
+        if (CEHC_URING_UD_IGNORE == ud) {
+            continue;
+        }
+
+        int fd = CEHC_URING_UD_FD(ud);
+        if ((size_t)fd >= u->fds.size()) {
+            continue;
+        }
+        cehc_uring_fd_t &st = u->fds[fd];
+        if (!st.active || st.gen != CEHC_URING_UD_GEN(ud)) {
+            continue;
+        }
+
+        uint32_t revents;
+        if (cqe->res < 0) {
+            if (-ECANCELED == cqe->res) {
+                // multishot被内核终止(比如cq溢出)，重新注册即可。
+                cehc_uring_prep_poll_add(p, u, fd);
+                continue;
+            }
+            revents = EPOLLERR;
+        } else {
+            revents = (uint32_t)cqe->res;
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                cehc_uring_prep_poll_add(p, u, fd);
+            }
+        }
+
+        ees[n].events = revents;
+        ees[n].data.fd = fd;
+        ++n;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+static int
+cehc_uring_wait(cehc_poller_t *p, struct epoll_event *ees, int max, int timeout_ms) {
+    cehc_uring_t *u = (cehc_uring_t*)p->ctx;
+    u->loop_tid = pthread_self();
+    int n = cehc_uring_reap(p, u, ees, max);
+    while (!n && timeout_ms) {
+        // 提交本轮积累的关注事件修改和等待合并为一次io_uring_enter。
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        bzero(&arg, sizeof(arg));
+        if (timeout_ms > 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000 * 1000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+
+        p->waits.fetch_add(1, std::memory_order_relaxed);
+        if (-1 == cehc_uring_enter(u->ring_fd, cehc_uring_pending(u), 1,
+                                   IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg))) {
+            int err = errno;
+            if (EINTR == err) {
+                return -1;
+            }
+            if (ETIME != err) {
+                LOGE("io_uring_enter wait err = %s.", strerror(err));
+                errno = err;
+                return -1;
+            }
+        }
+
+        n = cehc_uring_reap(p, u, ees, max);
+        if (timeout_ms > 0) {
+            // 有超时时不再细算剩余时间，醒来一次即返回，由调用方决定是否继续等待。
+            break;
+        }
+        // 没有超时而只得到了被丢弃的cqe(旧代的poll、POLL_REMOVE)时继续等待，和epoll_wait的语义保持一致。
+    }
+
+    if (!n && !timeout_ms && cehc_uring_pending(u)) {
+        // 不等待(忙轮询)时只收割不提交的话，积累的re-arm永远到不了内核，这里提交之后再收割一次。
+        {
+            SpinLock l(&u->sl);
+            cehc_uring_submit_locked(p, u);
+        }
+        n = cehc_uring_reap(p, u, ees, max);
+    }
+
+    if (n) {
+        p->events.fetch_add((uint64_t)n, std::memory_order_relaxed);
+    }
+
+    return n;
+}
+
+static void
+cehc_uring_flush(cehc_poller_t *p) {
+    cehc_uring_t *u = (cehc_uring_t*)p->ctx;
+    if (cehc_uring_pending(u)) {
+        SpinLock l(&u->sl);
+        cehc_uring_submit_locked(p, u);
+    }
+}
+
+static const cehc_poller_ops_t s_uring_ops = {
+    "io_uring",
+    cehc_uring_init,
+    cehc_uring_destroy,
+    cehc_uring_ctl,
+    cehc_uring_wait,
+    cehc_uring_flush,
+};
+
+#endif // CEHC_WITH_IO_URING
+
+/******************************** common ********************************/
+
+cehc_poller_t *
+cehc_poller_new(cehc_poller_kind_t kind, int ev_cnt) {
+    const cehc_poller_ops_t *ops = NULL;
+    switch (kind) {
+        case CEHC_POLLER_EPOLL:
+            ops = &s_epoll_ops;
+            break;
+        case CEHC_POLLER_IO_URING:
+#ifdef CEHC_WITH_IO_URING
+            ops = &s_uring_ops;
+#endif
+            break;
+    }
+
+    if (!ops) {
+        LOGE("poller kind %d is not compiled in.", (int)kind);
+        return NULL;
+    }
+
+    cehc_poller_t *p = new (std::nothrow) cehc_poller_t;
+    if (!p) {
+        LOGE("%s oom when new cehc_poller_t.", __func__);
+        return NULL;
+    }
+
+    p->ops = ops;
+    p->fd = -1;
+    p->ctx = NULL;
+    if (!ops->init(p, ev_cnt)) {
+        cehc_poller_delete(&p);
+        return NULL;
+    }
+
+    return p;
+}
+
+void
+cehc_poller_delete(cehc_poller_t **poller) {
+    if (poller && *poller) {
+        (*poller)->ops->destroy(*poller);
+        delete *poller;
+        *poller = NULL;
+    }
+}
+
+int
+cehc_poller_fd(cehc_poller_t *poller) {
+    return poller->fd;
+}
+
+int
+cehc_poller_ctl(cehc_poller_t *poller, int op, int fd, uint32_t events) {
+    int ret = poller->ops->ctl(poller, op, fd, events);
+    CEHC_PROBE4(poller__ctl, fd, op, events, ret);
+    return ret;
+}
+
+int
+cehc_poller_wait(cehc_poller_t *poller, struct epoll_event *ees, int max, int timeout_ms) {
+    return poller->ops->wait(poller, ees, max, timeout_ms);
+}
+
+void
+cehc_poller_flush(cehc_poller_t *poller) {
+    poller->ops->flush(poller);
+}
+
+void
+cehc_poller_get_stats(cehc_poller_t *poller, cehc_poller_stats_t *stats) {
+    stats->waits = poller->waits.load(std::memory_order_relaxed);
+    stats->ctl_calls = poller->ctl_calls.load(std::memory_order_relaxed);
+    stats->events = poller->events.load(std::memory_order_relaxed);
+}
+
+const char *
+cehc_poller_name(cehc_poller_t *poller) {
+    return poller->ops->name;
+}
@@ -0,0 +1,87 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_poller__h
+#define cehc_poller__h
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * http service的事件等待后端。
+ * 关注的事件和得到的事件统一使用epoll的表示(struct epoll_event/EPOLLIN/EPOLLOUT...)，所以事件循环与后端无关。
+ * -> epoll：每次修改关注事件一次epoll_ctl，每次等待一次epoll_wait；
+ * -> io_uring：multishot的IORING_OP_POLL_ADD，修改关注事件只是写SQE，在下一次等待时随同一次io_uring_enter批量提交，
+ *    关注事件不变时不产生任何提交。需要编译时定义CEHC_WITH_IO_URING，内核5.13以上。
+ * 两者都是level trigger的语义：io_uring下某个fd处理完之后若仍就绪，会再次投递事件。
+ */
+typedef enum cehc_poller_kind_e {
+    CEHC_POLLER_EPOLL    = 0,
+    CEHC_POLLER_IO_URING = 1,
+} cehc_poller_kind_t;
+
+typedef struct cehc_poller_stats_s {
+    uint64_t waits;     // 等待事件的系统调用次数(epoll_wait/带GETEVENTS的io_uring_enter)
+    uint64_t ctl_calls; // 单独修改关注事件的系统调用次数(epoll_ctl/只提交的io_uring_enter)
+    uint64_t events;    // 得到的事件数
+} cehc_poller_stats_t;
+
+typedef struct cehc_poller_s cehc_poller_t;
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 创建一个后端。
+ * @param kind
+ * @param ev_cnt 关注的fd个数的参考值
+ * @return 失败(包括未编译进来的后端)返回NULL
+ */
+cehc_poller_t *
+cehc_poller_new(cehc_poller_kind_t kind, int ev_cnt);
+
+void
+cehc_poller_delete(cehc_poller_t **poller);
+
+/**
+ * 可被poll/epoll的fd，有事件可取时可读。
+ */
+int
+cehc_poller_fd(cehc_poller_t *poller);
+
+/**
+ * 同epoll_ctl，线程安全。
+ * @param op EPOLL_CTL_ADD/EPOLL_CTL_MOD/EPOLL_CTL_DEL
+ * @return 成功0，失败-1并设置errno
+ */
+int
+cehc_poller_ctl(cehc_poller_t *poller, int op, int fd, uint32_t events);
+
+/**
+ * 同epoll_wait，只能在事件循环线程中调用。
+ */
+int
+cehc_poller_wait(cehc_poller_t *poller, struct epoll_event *ees, int max, int timeout_ms);
+
+/**
+ * 把尚未提交的关注事件修改提交给内核，事件循环线程在一次迭代结束时调用。
+ */
+void
+cehc_poller_flush(cehc_poller_t *poller);
+
+void
+cehc_poller_get_stats(cehc_poller_t *poller, cehc_poller_stats_t *stats);
+
+const char *
+cehc_poller_name(cehc_poller_t *poller);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_poller__h
@@ -0,0 +1,104 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "../common/logger.h"
+
+#include "cehc-prewarm.h"
+
+typedef struct cehc_prewarm_s {
+    cehc_http_service_t *hs;
+    cehc_prewarm_cb cb;
+    void *ctx;
+    int total;
+    std::atomic<int> remaining;
+    std::atomic<int> ok;
+} cehc_prewarm_t;
+
+/**
+ * 一个预热请求结束了，最后一个结束的负责回调并释放。
+ */
+static void
+cehc_prewarm_done(cehc_prewarm_t *pw, bool ok) {
+    if (ok) {
+        pw->ok.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (1 == pw->remaining.fetch_sub(1, std::memory_order_acq_rel)) {
+        LOGI("prewarm done, ok = %d, total = %d.", pw->ok.load(), pw->total);
+        if (pw->cb) {
+            pw->cb(pw->hs, pw->ok.load(), pw->total, pw->ctx);
+        }
+        delete pw;
+    }
+}
+
+static void
+cehc_prewarm_complete_cb(cehc_connection_ptr conn) {
+    cehc_prewarm_t *pw = (cehc_prewarm_t*)conn->user_ctx;
+    bool ok = cehc_conn_ok_except_httpcode(conn) && conn->http_code > 0;
+    if (!ok) {
+        LOGW("prewarm %s failed, err = %s.", conn->url, conn->errormsg);
+    }
+
+    cehc_delete_conn(&conn);
+    cehc_prewarm_done(pw, ok);
+}
+
+bool
+cehc_prewarm(cehc_http_service_t *hs, const char *const *urls, int url_cnt, int conns_per_host,
+             cehc_prewarm_cb cb, void *ctx) {
+    if (!hs || !urls || url_cnt <= 0 || conns_per_host <= 0) {
+        LOGW("invalid prewarm params.");
+        return false;
+    }
+
+    cehc_prewarm_t *pw = new (std::nothrow) cehc_prewarm_t;
+    if (!pw) {
+        LOGE("%s oom when new cehc_prewarm_t.", __func__);
+        return false;
+    }
+
+    pw->hs = hs;
+    pw->cb = cb;
+    pw->ctx = ctx;
+    pw->total = url_cnt * conns_per_host;
+    pw->remaining.store(pw->total);
+    pw->ok.store(0);
+
+    char errmsg[CURL_ERROR_SIZE];
+    for (int i = 0; i < url_cnt; ++i) {
+        for (int j = 0; j < conns_per_host; ++j) {
+            cehc_newconn_params_t params;
+            bzero(&params, sizeof(params));
+            params.url = urls[i];
+            params.hs = hs;
+            params.complete_cb = cehc_prewarm_complete_cb;
+            params.user_ctx = pw;
+            cehc_connection_ptr conn = cehc_new_conn(&params);
+            if (!conn || !conn->easy) {
+                LOGE("prewarm new conn for %s failed.", urls[i]);
+                if (conn) {
+                    cehc_delete_conn(&conn);
+                }
+                cehc_prewarm_done(pw, false);
+                continue;
+            }
+
+            curl_easy_setopt(conn->easy, CURLOPT_NOBODY, 1L);
+            if (!cehc_run_conn(conn, errmsg)) {
+                LOGE("prewarm run conn for %s err = %s.", urls[i], errmsg);
+                cehc_delete_conn(&conn);
+                cehc_prewarm_done(pw, false);
+            }
+        }
+    }
+
+    return true;
+}
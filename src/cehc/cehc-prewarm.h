@@ -0,0 +1,50 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_prewarm__h
+#define cehc_prewarm__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 连接预热：接流量之前，通过http service正常的事件循环对每个host并发发起若干个HEAD请求，
+ * 结束之后连接(DNS解析、TCP、TLS都已完成)留在service的连接缓存中，之后的请求直接复用，
+ * 避免新进程的第一批请求都付出建连的代价。
+ * -> 不用CURLOPT_CONNECT_ONLY是因为curl不会把connect only的连接给普通请求复用；
+ * -> 多个分片(http service)时对每个分片各调用一次，配合cehc-share.h的共享缓存，DNS和TLS session只需要第一次完整地做；
+ * -> 预热的连接数(host数 * conns_per_host)不应超过multi的连接缓存上限(256)，否则先建的会被淘汰。
+ */
+
+/**
+ * 预热结束的回调，在事件循环线程(开启了dispatch时在工作线程)中调用。
+ * @param hs
+ * @param ok 成功得到响应的请求数(任何http状态码都算成功，因为连接已经建好了)
+ * @param total 发起的请求数
+ * @param ctx cehc_prewarm传入的ctx
+ */
+typedef void (*cehc_prewarm_cb)(cehc_http_service_t *hs, int ok, int total, void *ctx);
+
+/**
+ * 预热http service到若干个host的连接。service需要已经在运行(或者嵌入模式下由user驱动)。
+ * @param hs
+ * @param urls 每个host一个url，如"https://api.example.com/"，scheme和端口决定了连接
+ * @param url_cnt
+ * @param conns_per_host 每个host的连接数
+ * @param cb 全部结束时调用，可以为NULL；所有请求都发起失败时在本函数返回之前调用
+ * @param ctx
+ * @return 参数非法或者oom时false，此时cb不会被调用
+ */
+bool
+cehc_prewarm(cehc_http_service_t *hs, const char *const *urls, int url_cnt, int conns_per_host,
+             cehc_prewarm_cb cb, void *ctx);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_prewarm__h
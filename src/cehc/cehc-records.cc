@@ -0,0 +1,170 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <string>
+
+#include "../common/byte-scan.h"
+#include "../common/logger.h"
+
+#include "cehc-records.h"
+
+typedef struct cehc_records_s {
+    char delimiter;
+    size_t max_record;
+    cehc_record_cb cb;
+    std::string tail;       // 上一块数据末尾不完整的记录
+    bool aborted;           // 回调中止或者超长，之后的数据和结束时的尾巴都丢弃
+    cehc_record_stats_t stats;
+} cehc_records_t;
+
+/**
+ * @return 回调要求中止时false
+ */
+static inline bool
+cehc_records_deliver(cehc_connection_ptr conn, cehc_records_t *r, const char *rec, size_t len) {
+    if ('\n' == r->delimiter && len > 0 && '\r' == rec[len - 1]) {
+        --len;
+    }
+    if (0 == len) {
+        return true;
+    }
+
+    ++r->stats.records;
+    if (!r->cb(conn, rec, len)) {
+        r->aborted = true;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * 暂存不完整的记录。
+ * @return 超过max_record时false
+ */
+static inline bool
+cehc_records_carry(cehc_connection_ptr conn, cehc_records_t *r, const char *p, size_t len) {
+    if (r->tail.size() + len > r->max_record) {
+        LOGW("record of %s is longer than %lu bytes.", conn->url, (unsigned long)r->max_record);
+        r->stats.oversize = true;
+        r->aborted = true;
+        return false;
+    }
+
+    r->tail.append(p, len);
+    r->stats.carried += len;
+    return true;
+}
+
+bool
+cehc_conn_enable_records(cehc_connection_ptr conn, char delimiter, size_t max_record, cehc_record_cb cb) {
+    if (!conn || !cb || 0 == max_record) {
+        LOGW("invalid records params.");
+        return false;
+    }
+
+    cehc_records_free(conn);
+    cehc_records_t *r = new (std::nothrow) cehc_records_t;
+    if (!r) {
+        LOGE("%s oom when new cehc_records_t.", __func__);
+        return false;
+    }
+
+    r->delimiter = delimiter;
+    r->max_record = max_record;
+    r->cb = cb;
+    conn->records = r;
+    cehc_records_reset(conn);
+    return true;
+}
+
+void
+cehc_conn_get_record_stats(cehc_connection_ptr conn, cehc_record_stats_t *stats) {
+    if (!conn || !conn->records || !stats) {
+        return;
+    }
+
+    *stats = conn->records->stats;
+}
+
+size_t
+cehc_records_on_recv(cehc_connection_ptr conn, void *ptr, size_t size) {
+    cehc_records_t *r = conn->records;
+    if (r->aborted) {
+        return 0;
+    }
+
+    const char *p = (const char*)ptr;
+    const char *end = p + size;
+    r->stats.bytes += size;
+
+    if (!r->tail.empty()) {
+        const char *d = ByteScan::Find(p, end, r->delimiter);
+        if (!cehc_records_carry(conn, r, p, d - p)) {
+            return 0;
+        }
+        if (d == end) {
+            return size;
+        }
+
+        bool ok = cehc_records_deliver(conn, r, r->tail.data(), r->tail.size());
+        r->tail.clear();
+        if (!ok) {
+            return 0;
+        }
+        p = d + 1;
+    }
+
+    while (p < end) {
+        const char *d = ByteScan::Find(p, end, r->delimiter);
+        if (d == end) {
+            break;
+        }
+        if (!cehc_records_deliver(conn, r, p, d - p)) {
+            return 0;
+        }
+        p = d + 1;
+    }
+
+    if (p < end && !cehc_records_carry(conn, r, p, end - p)) {
+        return 0;
+    }
+
+    return size;
+}
+
+void
+cehc_records_on_complete(cehc_connection_ptr conn) {
+    cehc_records_t *r = conn->records;
+    if (!r->aborted && !r->tail.empty()) {
+        if (CURLE_OK == conn->result) {
+            cehc_records_deliver(conn, r, r->tail.data(), r->tail.size());
+        } else {
+            // 传输中断(超时、连接断开等)时尾巴可能只是一条记录的前半段。
+            r->stats.truncated = true;
+        }
+    }
+    r->tail.clear();
+}
+
+void
+cehc_records_reset(cehc_connection_ptr conn) {
+    cehc_records_t *r = conn->records;
+    r->tail.clear();
+    r->aborted = false;
+    r->stats.records = 0;
+    r->stats.bytes = 0;
+    r->stats.carried = 0;
+    r->stats.oversize = false;
+    r->stats.truncated = false;
+}
+
+void
+cehc_records_free(cehc_connection_ptr conn) {
+    if (conn->records) {
+        delete conn->records;
+        conn->records = NULL;
+    }
+}
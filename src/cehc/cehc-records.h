@@ -0,0 +1,84 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_records__h
+#define cehc_records__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按分隔符切分的流式body(NDJSON等一行一条记录的响应)。
+ * -> 分隔符的查找是向量化的(见common/byte-scan.h)；
+ * -> 完整落在curl一次交过来的数据中的记录直接把指针交给回调，不拷贝；
+ * -> 只有跨越两次数据的那一条(上一块的尾巴)被拷贝暂存，内存占用不超过max_record；
+ * -> 传输成功结束时最后一条没有分隔符结尾的记录也会交给回调(在complete_cb之前)；传输失败时它可能是半条，
+ *    丢弃并在统计中标记truncated。
+ * 分隔符为'\n'时记录末尾的'\r'会被去掉；空记录被跳过。开启之后conn的recv_cb不再被调用。
+ * 记录回调在事件循环线程中调用(不经过dispatch)。
+ */
+
+/**
+ * @param conn
+ * @param rec 记录，不含分隔符，只在回调中有效
+ * @param len
+ * @return false中止传输(conn以CURLE_WRITE_ERROR结束)
+ */
+typedef bool (*cehc_record_cb)(cehc_connection_ptr conn, const char *rec, size_t len);
+
+typedef struct cehc_record_stats_s {
+    uint64_t records;       // 交给回调的记录数
+    uint64_t bytes;         // 收到的body字节数
+    uint64_t carried;       // 跨块拼接而拷贝的字节数
+    bool oversize;          // 跨块的记录超过了max_record而中止
+    bool truncated;         // 传输失败，最后一条不完整的记录被丢弃
+} cehc_record_stats_t;
+
+/**
+ * 为conn开启按记录切分，需在cehc_run_conn之前调用，conn重复run时重新开始。
+ * @param conn
+ * @param delimiter
+ * @param max_record 跨块拼接的一条记录的最大字节数
+ * @param cb
+ * @return 成功true，失败false
+ */
+bool
+cehc_conn_enable_records(cehc_connection_ptr conn, char delimiter, size_t max_record, cehc_record_cb cb);
+
+void
+cehc_conn_get_record_stats(cehc_connection_ptr conn, cehc_record_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 事件循环线程调用，切分curl交过来的数据。
+ * @return size或者0(中止)
+ */
+size_t
+cehc_records_on_recv(cehc_connection_ptr conn, void *ptr, size_t size);
+
+/**
+ * 事件循环线程调用，传输结束，成功时交出最后一条记录。
+ */
+void
+cehc_records_on_complete(cehc_connection_ptr conn);
+
+/**
+ * cehc_run_conn时重置。
+ */
+void
+cehc_records_reset(cehc_connection_ptr conn);
+
+void
+cehc_records_free(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_records__h
@@ -0,0 +1,330 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-host.h"
+#include "cehc-resolver.h"
+
+#define CEHC_RESOLVE_RETRY_NS  (1000LL * 1000 * 1000)
+
+typedef struct cehc_resolve_entry_s {
+    cehc_resolver_t *resolver;
+    std::string host;
+    int port;
+    std::atomic<uint64_t> gen;       // 解析结果每变化一次+1，0为还没有结果
+    spin_lock_t sl;
+    std::string addrs;               // "1.2.3.4,[::1]"，由sl保护
+    std::atomic<int64_t> expire_ns;  // addrs过期的单调时钟
+    int64_t next_ns;                 // 下一次解析的时间，只在后台线程中访问
+} cehc_resolve_entry_t;
+
+struct cehc_resolver_s {
+    int64_t ttl_ns;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stop;
+    std::unordered_map<std::string, cehc_resolve_entry_t*> entries; // key为host:port
+    std::thread *thread;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> stale;
+    std::atomic<uint64_t> refreshes;
+    std::atomic<uint64_t> refresh_fail;
+    std::atomic<uint64_t> injects;
+};
+
+/**
+ * 解析一个host，结果有变化时更新addrs并增加gen。在后台线程中调用。
+ */
+static void
+cehc_resolver_resolve(cehc_resolver_t *r, cehc_resolve_entry_t *e) {
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(e->host.c_str(), NULL, &hints, &res);
+    int64_t now = CommonUtils::GetMonotonicNs();
+    if (rc || !res) {
+        r->refresh_fail.fetch_add(1, std::memory_order_relaxed);
+        LOGW("resolve %s err = %s, %s.", e->host.c_str(), gai_strerror(rc),
+             e->gen.load() ? "keep the stale addresses" : "curl will resolve it");
+        e->next_ns = now + CEHC_RESOLVE_RETRY_NS;
+        return;
+    }
+
+    std::string addrs;
+    char buf[INET6_ADDRSTRLEN];
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        const char *s = NULL;
+        bool v6 = AF_INET6 == ai->ai_family;
+        if (AF_INET == ai->ai_family) {
+            s = inet_ntop(AF_INET, &((struct sockaddr_in*)ai->ai_addr)->sin_addr, buf, sizeof(buf));
+        } else if (v6) {
+            s = inet_ntop(AF_INET6, &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr, buf, sizeof(buf));
+        }
+        if (!s) {
+            continue;
+        }
+
+        std::string one = v6 ? std::string("[") + s + "]" : std::string(s);
+        // getaddrinfo对同一地址可能返回多条(不同的protocol)，去重。
+        if (std::string::npos != ("," + addrs + ",").find("," + one + ",")) {
+            continue;
+        }
+        if (!addrs.empty()) {
+            addrs += ",";
+        }
+        addrs += one;
+    }
+    freeaddrinfo(res);
+
+    r->refreshes.fetch_add(1, std::memory_order_relaxed);
+    e->expire_ns.store(now + r->ttl_ns, std::memory_order_relaxed);
+    e->next_ns = now + r->ttl_ns * 8 / 10;
+    {
+        SpinLock l(&e->sl);
+        if (addrs == e->addrs) {
+            return;
+        }
+        e->addrs = addrs;
+    }
+    e->gen.fetch_add(1, std::memory_order_release);
+    LOGI("resolved %s:%d -> %s.", e->host.c_str(), e->port, addrs.c_str());
+}
+
+static void
+cehc_resolver_run(cehc_resolver_t *r) {
+    std::vector<cehc_resolve_entry_t*> due;
+    std::unique_lock<std::mutex> l(r->mtx);
+    while (!r->stop) {
+        int64_t now = CommonUtils::GetMonotonicNs();
+        int64_t next = INT64_MAX;
+        due.clear();
+        for (auto &kv : r->entries) {
+            if (kv.second->next_ns <= now) {
+                due.push_back(kv.second);
+            } else if (kv.second->next_ns < next) {
+                next = kv.second->next_ns;
+            }
+        }
+
+        if (!due.empty()) {
+            // 解析可能很慢，不持有锁，不阻塞登记新的host。
+            l.unlock();
+            for (auto e : due) {
+                cehc_resolver_resolve(r, e);
+            }
+            l.lock();
+            continue;
+        }
+
+        if (INT64_MAX == next) {
+            r->cv.wait(l);
+        } else {
+            r->cv.wait_for(l, std::chrono::nanoseconds(next - now));
+        }
+    }
+}
+
+cehc_resolver_t *
+cehc_new_resolver(int ttl_s) {
+    if (ttl_s <= 0) {
+        LOGW("invalid resolver ttl = %d.", ttl_s);
+        return NULL;
+    }
+
+    cehc_resolver_t *r = new (std::nothrow) cehc_resolver_t;
+    if (!r) {
+        LOGE("%s oom when new cehc_resolver_t.", __func__);
+        return NULL;
+    }
+
+    r->ttl_ns = (int64_t)ttl_s * 1000 * 1000 * 1000;
+    r->stop = false;
+    r->hits.store(0);
+    r->misses.store(0);
+    r->stale.store(0);
+    r->refreshes.store(0);
+    r->refresh_fail.store(0);
+    r->injects.store(0);
+    r->thread = new std::thread(cehc_resolver_run, r);
+    return r;
+}
+
+void
+cehc_delete_resolver(cehc_resolver_t **resolver) {
+    if (resolver && *resolver) {
+        cehc_resolver_t *r = *resolver;
+        {
+            std::unique_lock<std::mutex> l(r->mtx);
+            r->stop = true;
+            r->cv.notify_one();
+        }
+        r->thread->join();
+        delete r->thread;
+        for (auto &kv : r->entries) {
+            delete kv.second;
+        }
+        delete r;
+        *resolver = NULL;
+    }
+}
+
+/**
+ * 查找或者登记一个host:port。
+ */
+static cehc_resolve_entry_t *
+cehc_resolver_get_entry(cehc_resolver_t *r, const char *host, int port) {
+    std::string key = std::string(host) + ":" + std::to_string(port);
+    std::unique_lock<std::mutex> l(r->mtx);
+    auto it = r->entries.find(key);
+    if (it != r->entries.end()) {
+        return it->second;
+    }
+
+    cehc_resolve_entry_t *e = new cehc_resolve_entry_t;
+    e->resolver = r;
+    e->host = host;
+    e->port = port;
+    e->gen.store(0);
+    e->sl = UNLOCKED;
+    e->expire_ns.store(0);
+    e->next_ns = 0;
+    r->entries[key] = e;
+    r->cv.notify_one();
+    return e;
+}
+
+bool
+cehc_resolver_add_host(cehc_resolver_t *resolver, const char *host, int port) {
+    if (!resolver || !host || !*host || port <= 0 || port > 65535) {
+        LOGW("invalid resolver host.");
+        return false;
+    }
+
+    cehc_resolver_get_entry(resolver, host, port);
+    return true;
+}
+
+bool
+cehc_http_service_set_resolver(cehc_http_service_t *hs, cehc_resolver_t *resolver) {
+    if (!hs) {
+        return false;
+    }
+
+    hs->resolver = resolver;
+    return true;
+}
+
+void
+cehc_resolver_get_stats(cehc_resolver_t *resolver, cehc_resolver_stats_t *stats) {
+    if (!resolver || !stats) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> l(resolver->mtx);
+        stats->hosts = resolver->entries.size();
+    }
+    stats->hits = resolver->hits.load(std::memory_order_relaxed);
+    stats->misses = resolver->misses.load(std::memory_order_relaxed);
+    stats->stale = resolver->stale.load(std::memory_order_relaxed);
+    stats->refreshes = resolver->refreshes.load(std::memory_order_relaxed);
+    stats->refresh_fail = resolver->refresh_fail.load(std::memory_order_relaxed);
+    stats->injects = resolver->injects.load(std::memory_order_relaxed);
+}
+
+void
+cehc_resolver_bind_conn(cehc_connection_ptr conn) {
+    cehc_resolver_t *r = conn->http_service->resolver;
+    if (!r || !conn->url) {
+        return;
+    }
+
+    std::string host;
+    int port;
+    if (!cehc_host_parse_url(conn->url, &host, &port)) {
+        return;
+    }
+
+    struct in_addr a;
+    // ip字面值(ipv6带[])不需要解析。
+    if ('[' != host[0] && 1 != inet_pton(AF_INET, host.c_str(), &a)) {
+        conn->resolve_entry = cehc_resolver_get_entry(r, host.c_str(), port);
+        conn->resolve_gen = 0;
+    }
+}
+
+void
+cehc_resolver_apply(cehc_connection_ptr conn) {
+    cehc_resolve_entry_t *e = conn->resolve_entry;
+    if (!e) {
+        return;
+    }
+
+    cehc_resolver_t *r = e->resolver;
+    uint64_t gen = e->gen.load(std::memory_order_acquire);
+    if (!gen) {
+        r->misses.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    r->hits.fetch_add(1, std::memory_order_relaxed);
+    if (e->expire_ns.load(std::memory_order_relaxed) < CommonUtils::GetCoarseMonotonicNs()) {
+        r->stale.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (gen == conn->resolve_gen) {
+        return;
+    }
+
+    // curl在每次传输开始时把CURLOPT_RESOLVE载入DNS缓存(同一host:port会替换旧的)，
+    // 它不拷贝链表，所以链表挂在conn上直到下一次替换或者conn释放。
+    std::string item = e->host + ":" + std::to_string(e->port) + ":";
+    {
+        SpinLock l(&e->sl);
+        item += e->addrs;
+    }
+    struct curl_slist *list = curl_slist_append(NULL, item.c_str());
+    if (!list) {
+        LOGE("%s oom when curl_slist_append.", __func__);
+        return;
+    }
+
+    CURLcode cc = curl_easy_setopt(conn->easy, CURLOPT_RESOLVE, list);
+    if (CURLE_OK != cc) {
+        LOGE("curl_easy_setopt CURLOPT_RESOLVE err = %s.", curl_easy_strerror(cc));
+        curl_slist_free_all(list);
+        return;
+    }
+
+    curl_slist_free_all(conn->resolve_list);
+    conn->resolve_list = list;
+    conn->resolve_gen = gen;
+    r->injects.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+cehc_resolver_free_conn(cehc_connection_ptr conn) {
+    curl_slist_free_all(conn->resolve_list);
+    conn->resolve_list = NULL;
+    conn->resolve_entry = NULL;
+}
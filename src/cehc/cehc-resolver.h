@@ -0,0 +1,93 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_resolver__h
+#define cehc_resolver__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 后台DNS解析缓存：请求路径上不做任何DNS解析。
+ * -> 一个后台线程用getaddrinfo解析登记过的host，在TTL到期之前(80%处)刷新；
+ * -> conn创建时按url的host:port登记并绑定到缓存项上，run时若缓存项有了新的解析结果，
+ *    以CURLOPT_RESOLVE把地址注入给curl，没有变化时什么也不做(一次原子读)；
+ * -> 刷新失败时继续使用旧的地址，之后每秒重试；
+ * -> 还没有解析结果的host(第一次见到)这一次仍由curl自己解析。
+ * url中的host是ip字面值时不经过缓存。一个resolver可以被多个http service共享。
+ */
+typedef struct cehc_resolver_s cehc_resolver_t;
+
+typedef struct cehc_resolver_stats_s {
+    uint64_t hosts;        // 登记的host:port个数
+    uint64_t hits;         // run conn时缓存中有地址
+    uint64_t misses;       // run conn时还没有解析结果，由curl自己解析
+    uint64_t stale;        // 命中的是已经过了TTL的地址(刷新失败)
+    uint64_t refreshes;    // 后台解析成功的次数
+    uint64_t refresh_fail; // 后台解析失败的次数
+    uint64_t injects;      // 向easy注入新地址(CURLOPT_RESOLVE)的次数
+} cehc_resolver_stats_t;
+
+/**
+ * 创建并启动解析缓存。
+ * @param ttl_s 解析结果的有效期(秒)，getaddrinfo拿不到记录的TTL，所以由user指定
+ * @return 失败NULL
+ */
+cehc_resolver_t *
+cehc_new_resolver(int ttl_s);
+
+/**
+ * 停止并释放解析缓存，需要在使用它的conn和http service都释放之后调用。
+ */
+void
+cehc_delete_resolver(cehc_resolver_t **resolver);
+
+/**
+ * 提前登记一个host，后台线程会立即解析它。
+ * @return 参数非法时false
+ */
+bool
+cehc_resolver_add_host(cehc_resolver_t *resolver, const char *host, int port);
+
+/**
+ * 让http service之后创建的conn使用解析缓存。
+ * @param hs
+ * @param resolver NULL为不再使用
+ * @return hs为NULL时false
+ */
+bool
+cehc_http_service_set_resolver(cehc_http_service_t *hs, cehc_resolver_t *resolver);
+
+void
+cehc_resolver_get_stats(cehc_resolver_t *resolver, cehc_resolver_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 按conn的url登记并绑定缓存项，cehc_new_conn中调用。
+ */
+void
+cehc_resolver_bind_conn(cehc_connection_ptr conn);
+
+/**
+ * 缓存项有新的解析结果时注入给conn的easy，cehc_run_conn中调用。
+ */
+void
+cehc_resolver_apply(cehc_connection_ptr conn);
+
+/**
+ * 释放conn上注入用的数据，cehc_delete_conn中调用。
+ */
+void
+cehc_resolver_free_conn(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_resolver__h
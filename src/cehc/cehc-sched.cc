@@ -0,0 +1,417 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-sched.h"
+
+typedef struct cehc_prio_queue_s {
+    cehc_connection_ptr head;
+    cehc_connection_ptr tail;
+    uint64_t len;
+} cehc_prio_queue_t;
+
+typedef struct cehc_prio_class_s {
+    cehc_prio_queue_t queue;
+    int weight;
+    int current_weight;      // 平滑加权轮询的当前权重
+    uint64_t inflight;
+    uint64_t admitted;
+    uint64_t completed;
+    uint64_t paused;
+    uint64_t wait_sum_ns;
+    uint64_t wait_max_ns;
+    uint64_t latency_sum_ns;
+} cehc_prio_class_t;
+
+/**
+ * 所有字段都由multi_handles_mtx保护。
+ */
+struct cehc_sched_s {
+    int max_inflight;
+    int inflight;
+    int paused;                   // 被暂停的bulk个数，不占用名额
+    cehc_prio_class_t classes[CEHC_PRIO_CNT];
+    cehc_connection_ptr bulk_head; // 在传输的bulk请求，双向链表，用于饱和时暂停
+    bool pumping;
+};
+
+static void
+cehc_prio_queue_push(cehc_prio_queue_t *q, cehc_connection_ptr conn) {
+    conn->sched_next = NULL;
+    if (q->tail) {
+        q->tail->sched_next = conn;
+    } else {
+        q->head = conn;
+    }
+    q->tail = conn;
+    ++q->len;
+}
+
+static cehc_connection_ptr
+cehc_prio_queue_pop(cehc_prio_queue_t *q) {
+    cehc_connection_ptr conn = q->head;
+    if (conn) {
+        q->head = conn->sched_next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        conn->sched_next = NULL;
+        --q->len;
+    }
+
+    return conn;
+}
+
+static bool
+cehc_prio_queue_remove(cehc_prio_queue_t *q, cehc_connection_ptr conn) {
+    cehc_connection_ptr prev = NULL;
+    for (cehc_connection_ptr c = q->head; c; prev = c, c = c->sched_next) {
+        if (c != conn) {
+            continue;
+        }
+
+        if (prev) {
+            prev->sched_next = c->sched_next;
+        } else {
+            q->head = c->sched_next;
+        }
+        if (q->tail == c) {
+            q->tail = prev;
+        }
+        c->sched_next = NULL;
+        --q->len;
+        return true;
+    }
+
+    return false;
+}
+
+static void
+cehc_sched_bulk_link(cehc_sched_t *s, cehc_connection_ptr conn) {
+    conn->sched_prev = NULL;
+    conn->sched_next = s->bulk_head;
+    if (s->bulk_head) {
+        s->bulk_head->sched_prev = conn;
+    }
+    s->bulk_head = conn;
+}
+
+static void
+cehc_sched_bulk_unlink(cehc_sched_t *s, cehc_connection_ptr conn) {
+    if (conn->sched_prev) {
+        conn->sched_prev->sched_next = conn->sched_next;
+    } else {
+        s->bulk_head = conn->sched_next;
+    }
+    if (conn->sched_next) {
+        conn->sched_next->sched_prev = conn->sched_prev;
+    }
+    conn->sched_prev = conn->sched_next = NULL;
+}
+
+static inline cehc_prio_t
+cehc_sched_class(cehc_connection_ptr conn) {
+    return (conn->priority >= 0 && conn->priority < CEHC_PRIO_CNT) ? conn->priority : CEHC_PRIO_NORMAL;
+}
+
+/**
+ * 占用一个名额。
+ */
+static void
+cehc_sched_take(cehc_sched_t *s, cehc_connection_ptr conn, int64_t now) {
+    cehc_prio_t prio = cehc_sched_class(conn);
+    cehc_prio_class_t *c = s->classes + prio;
+    uint64_t wait = (uint64_t)(now - conn->run_ns);
+    ++s->inflight;
+    ++c->inflight;
+    ++c->admitted;
+    c->wait_sum_ns += wait;
+    if (wait > c->wait_max_ns) {
+        c->wait_max_ns = wait;
+    }
+
+    conn->sched_state = CEHC_SCHED_ADMITTED;
+    if (CEHC_PRIO_BULK == prio) {
+        cehc_sched_bulk_link(s, conn);
+    }
+}
+
+/**
+ * 有critical或normal在排队。
+ */
+static inline bool
+cehc_sched_saturated(cehc_sched_t *s) {
+    return s->classes[CEHC_PRIO_CRITICAL].queue.len || s->classes[CEHC_PRIO_NORMAL].queue.len;
+}
+
+/**
+ * bulk不占用critical和normal的名额(它们只和不是bulk的请求比较)，所以bulk永远不会挡住高优先级；
+ * bulk自己只能使用没被占用、也没被暂停的名额。
+ */
+static inline bool
+cehc_sched_has_room(cehc_sched_t *s, cehc_prio_t prio) {
+    if (CEHC_PRIO_BULK == prio) {
+        return s->inflight - s->paused < s->max_inflight;
+    }
+
+    return s->inflight - (int)s->classes[CEHC_PRIO_BULK].inflight < s->max_inflight;
+}
+
+/**
+ * 选出下一个放行的优先级：critical严格优先，normal和bulk平滑加权轮询。
+ * @return 没有排队的返回-1
+ */
+static int
+cehc_sched_pick(cehc_sched_t *s) {
+    if (s->classes[CEHC_PRIO_CRITICAL].queue.len && cehc_sched_has_room(s, CEHC_PRIO_CRITICAL)) {
+        return CEHC_PRIO_CRITICAL;
+    }
+
+    int best = -1, total = 0;
+    cehc_prio_t candidates[] = {CEHC_PRIO_NORMAL, CEHC_PRIO_BULK};
+    for (auto prio : candidates) {
+        cehc_prio_class_t *c = s->classes + prio;
+        if (!c->queue.len || !cehc_sched_has_room(s, prio)) {
+            continue;
+        }
+        // critical还在排队时normal不能越过它。
+        if (CEHC_PRIO_NORMAL == prio && s->classes[CEHC_PRIO_CRITICAL].queue.len) {
+            continue;
+        }
+        // 不饱和时先由事件循环恢复被暂停的bulk，之后才放行排队的bulk，否则恢复时会越过max_inflight。
+        if (CEHC_PRIO_BULK == prio && s->paused && !cehc_sched_saturated(s)) {
+            continue;
+        }
+        c->current_weight += c->weight;
+        total += c->weight;
+        if (-1 == best || c->current_weight > s->classes[best].current_weight) {
+            best = prio;
+        }
+    }
+    if (-1 != best) {
+        s->classes[best].current_weight -= total;
+    }
+
+    return best;
+}
+
+/**
+ * bulk的暂停状态需要调整时交给事件循环(cehc_sched_apply)。curl_easy_pause会重入cehc_curl_conn_cb修改epoll，
+ * 只能在事件循环线程中调用，而这里可能在cehc_run_conn或cehc_delete_conn的调用线程中。需持有multi_handles_mtx。
+ */
+static void
+cehc_sched_request_adjust(cehc_http_service_t *hs) {
+    cehc_sched_t *s = hs->sched;
+    bool need = cehc_sched_saturated(s) ? s->classes[CEHC_PRIO_BULK].inflight > (uint64_t)s->paused
+                                        : s->paused && cehc_sched_has_room(s, CEHC_PRIO_BULK);
+    if (need && !atomic_swap(&hs->sched_kick, 1)) {
+        cehc_wakeup_http_service(hs);
+    }
+}
+
+/**
+ * 有空位就放行排队的请求。
+ */
+static void
+cehc_sched_pump(cehc_http_service_t *hs) {
+    cehc_sched_t *s = hs->sched;
+    if (s->pumping) {
+        // 放行失败时结束conn会重入release，由外层的循环继续放行。
+        return;
+    }
+
+    s->pumping = true;
+    int64_t now = CommonUtils::GetMonotonicNs();
+    int prio;
+    while (-1 != (prio = cehc_sched_pick(s))) {
+
+        cehc_connection_ptr conn = cehc_prio_queue_pop(&s->classes[prio].queue);
+        cehc_sched_take(s, conn, now);
+        if (!cehc_add_conn_to_multi(conn)) {
+            cehc_finish_conn(conn);
+        }
+    }
+    s->pumping = false;
+    cehc_sched_request_adjust(hs);
+}
+
+bool
+cehc_http_service_set_prio_sched(cehc_http_service_t *hs, int max_inflight, int normal_weight, int bulk_weight) {
+    if (!hs || max_inflight <= 0 || normal_weight <= 0 || bulk_weight <= 0) {
+        LOGW("invalid prio sched params.");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (!hs->sched) {
+        hs->sched = (cehc_sched_t*)calloc(1, sizeof(cehc_sched_t));
+        if (!hs->sched) {
+            LOGE("%s oom when calloc cehc_sched_t.", __func__);
+            return false;
+        }
+    }
+
+    hs->sched->max_inflight = max_inflight;
+    hs->sched->classes[CEHC_PRIO_CRITICAL].weight = 1;
+    hs->sched->classes[CEHC_PRIO_NORMAL].weight = normal_weight;
+    hs->sched->classes[CEHC_PRIO_BULK].weight = bulk_weight;
+    return true;
+}
+
+void
+cehc_http_service_get_prio_stats(cehc_http_service_t *hs, cehc_prio_t prio, cehc_prio_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    bzero(stats, sizeof(cehc_prio_stats_t));
+    if (!hs || prio < 0 || prio >= CEHC_PRIO_CNT) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    if (!hs->sched) {
+        return;
+    }
+
+    cehc_prio_class_t *c = hs->sched->classes + prio;
+    stats->queued = c->queue.len;
+    stats->inflight = c->inflight;
+    stats->admitted = c->admitted;
+    stats->completed = c->completed;
+    stats->paused = c->paused;
+    stats->wait_avg_ns = c->admitted ? c->wait_sum_ns / c->admitted : 0;
+    stats->wait_max_ns = c->wait_max_ns;
+    stats->latency_avg_ns = c->completed ? c->latency_sum_ns / c->completed : 0;
+}
+
+void
+cehc_sched_delete(cehc_sched_t **sched) {
+    if (sched && *sched) {
+        free(*sched);
+        *sched = NULL;
+    }
+}
+
+bool
+cehc_sched_submit(cehc_connection_ptr conn) {
+    cehc_sched_t *s = conn->http_service->sched;
+    if (!s) {
+        return true;
+    }
+
+    cehc_prio_t prio = cehc_sched_class(conn);
+    // 同优先级已经有排队的则排在它们之后，保持先来先放行；被暂停的bulk也排在前面。
+    bool queued_ahead = s->classes[CEHC_PRIO_CRITICAL].queue.len
+                        || (CEHC_PRIO_CRITICAL != prio && s->classes[prio].queue.len)
+                        || (CEHC_PRIO_BULK == prio && s->paused);
+    if (cehc_sched_has_room(s, prio) && !queued_ahead) {
+        cehc_sched_take(s, conn, conn->run_ns);
+        return true;
+    }
+
+    conn->sched_state = CEHC_SCHED_QUEUED;
+    cehc_prio_queue_push(&s->classes[prio].queue, conn);
+    if (CEHC_PRIO_BULK != prio) {
+        // 饱和了，暂停bulk把带宽和事件循环让给高优先级。
+        cehc_sched_request_adjust(conn->http_service);
+    }
+
+    return false;
+}
+
+void
+cehc_sched_release(cehc_connection_ptr conn) {
+    cehc_sched_t *s = conn->http_service->sched;
+    if (!s || CEHC_SCHED_ADMITTED != conn->sched_state) {
+        return;
+    }
+
+    cehc_prio_t prio = cehc_sched_class(conn);
+    cehc_prio_class_t *c = s->classes + prio;
+    conn->sched_state = CEHC_SCHED_NONE;
+    --s->inflight;
+    --c->inflight;
+    ++c->completed;
+    c->latency_sum_ns += (uint64_t)(CommonUtils::GetMonotonicNs() - conn->run_ns);
+    if (CEHC_PRIO_BULK == prio) {
+        if (conn->sched_paused) {
+            conn->sched_paused = false;
+            --s->paused;
+        }
+        cehc_sched_bulk_unlink(s, conn);
+    }
+
+    cehc_sched_pump(conn->http_service);
+}
+
+void
+cehc_sched_forget(cehc_connection_ptr conn) {
+    if (CEHC_SCHED_QUEUED != conn->sched_state) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(conn->http_service->multi_handles_mtx);
+    cehc_sched_t *s = conn->http_service->sched;
+    if (s && CEHC_SCHED_QUEUED == conn->sched_state) {
+        cehc_prio_queue_remove(&s->classes[cehc_sched_class(conn)].queue, conn);
+        conn->sched_state = CEHC_SCHED_NONE;
+        // 可能是最后一个高优先级的排队，恢复被暂停的bulk。
+        cehc_sched_pump(conn->http_service);
+    }
+}
+
+void
+cehc_sched_apply(cehc_http_service_t *hs) {
+    cehc_sched_t *s = hs->sched;
+    if (!s) {
+        return;
+    }
+
+    bool saturated = cehc_sched_saturated(s);
+    cehc_connection_ptr next;
+    for (cehc_connection_ptr conn = s->bulk_head; conn; conn = next) {
+        next = conn->sched_next;
+        if (saturated == conn->sched_paused || conn->stream) {
+            continue;
+        }
+        // 恢复的bulk重新占用名额，没有名额的等其他请求结束时再恢复。
+        if (!saturated && !cehc_sched_has_room(s, CEHC_PRIO_BULK)) {
+            break;
+        }
+
+        CURLcode cc = curl_easy_pause(conn->easy, saturated ? CURLPAUSE_ALL : CURLPAUSE_CONT);
+        if (CURLE_OK != cc) {
+            if (saturated) {
+                // 还没有建立连接的传输不能暂停(curl返回参数错误)，下一次调整时再试。
+                LOGD("curl_easy_pause all err = %s, url = %s.", curl_easy_strerror(cc), conn->url);
+                continue;
+            }
+
+            // 同cehc_process_resume_list，curl不会再调度这个传输，在这里结束它，release时归还名额。
+            LOGW("curl_easy_pause cont err = %s, url = %s.", curl_easy_strerror(cc), conn->url);
+            cehc_done_transfer(hs, conn, cc);
+            continue;
+        }
+
+        conn->sched_paused = saturated;
+        if (saturated) {
+            ++s->paused;
+            ++s->classes[CEHC_PRIO_BULK].paused;
+        } else {
+            --s->paused;
+        }
+    }
+
+    if (!saturated && !s->paused) {
+        // 被暂停的都恢复了，放行排队的bulk。
+        cehc_sched_pump(hs);
+    }
+}
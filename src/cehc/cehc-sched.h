@@ -0,0 +1,99 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_sched__h
+#define cehc_sched__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按优先级放行请求：http service同时在传输的请求数有上限，超出的请求按优先级排队，有空位时放行。
+ * -> CEHC_PRIO_CRITICAL严格优先：只要有critical在排队，就先放行它；
+ * -> CEHC_PRIO_NORMAL和CEHC_PRIO_BULK按权重分配剩下的空位(平滑加权轮询，同nginx的upstream)；
+ * -> bulk只能用critical和normal没有占用的名额，反过来critical和normal计算名额时不算bulk，所以bulk永远挡不住它们
+ *    (同时在传输的请求最多为2倍max_inflight)；
+ * -> 饱和时(有critical或normal在排队)暂停所有在传输的bulk请求(curl_easy_pause，尚未建立连接的稍后再暂停)，
+ *    把带宽和事件循环让给高优先级，被暂停的bulk不占用名额，高优先级的排队清空之后在名额内逐个恢复，
+ *    都恢复了才放行排队的bulk；暂停和恢复都由事件循环执行，期间cehc_resume_conn不会恢复被暂停的bulk；
+ * 暂停中的bulk请求仍然受CURLOPT_TIMEOUT约束；开启了流式body(cehc-stream.h)的conn不会被暂停。
+ * 未开启时(默认)cehc_run_conn直接交给curl，与之前完全一样。
+ */
+typedef struct cehc_prio_stats_s {
+    uint64_t queued;         // 当前排队的个数
+    uint64_t inflight;       // 当前已放行(在传输或者被暂停)的个数
+    uint64_t admitted;       // 累计放行的个数
+    uint64_t completed;      // 累计结束的个数
+    uint64_t paused;         // 累计被暂停的次数(只有bulk)
+    uint64_t wait_avg_ns;    // 平均排队时间
+    uint64_t wait_max_ns;    // 最大排队时间
+    uint64_t latency_avg_ns; // 从cehc_run_conn到结束的平均时间
+} cehc_prio_stats_t;
+
+/**
+ * 开启按优先级放行，需在cehc_run_http_serivce之前、没有任何conn时调用。
+ * @param hs
+ * @param max_inflight 同时放行的请求数上限
+ * @param normal_weight normal的权重
+ * @param bulk_weight bulk的权重
+ * @return 参数非法时false
+ */
+bool
+cehc_http_service_set_prio_sched(cehc_http_service_t *hs, int max_inflight, int normal_weight, int bulk_weight);
+
+/**
+ * 得到某个优先级的统计。
+ * @param hs
+ * @param prio
+ * @param stats 未开启时全为0
+ */
+void
+cehc_http_service_get_prio_stats(cehc_http_service_t *hs, cehc_prio_t prio, cehc_prio_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+typedef struct cehc_sched_s cehc_sched_t;
+
+// conn的sched_state
+#define CEHC_SCHED_NONE      0
+#define CEHC_SCHED_QUEUED    1
+#define CEHC_SCHED_ADMITTED  2
+
+void
+cehc_sched_delete(cehc_sched_t **sched);
+
+/**
+ * cehc_run_conn中调用，需持有multi_handles_mtx。
+ * @return true为放行，由调用方交给curl；false为已排队
+ */
+bool
+cehc_sched_submit(cehc_connection_ptr conn);
+
+/**
+ * conn结束(或者放行之后交给curl失败)时调用，需持有multi_handles_mtx。归还名额并放行排队的请求。
+ */
+void
+cehc_sched_release(cehc_connection_ptr conn);
+
+/**
+ * 把排队中的conn摘出来，cehc_delete_conn中调用。
+ */
+void
+cehc_sched_forget(cehc_connection_ptr conn);
+
+/**
+ * 按是否饱和暂停或恢复在传输的bulk，事件循环被sched_kick唤醒时调用，需持有multi_handles_mtx。
+ */
+void
+cehc_sched_apply(cehc_http_service_t *hs);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_sched__h
@@ -0,0 +1,95 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+
+#include <mutex>
+
+#include "../common/logger.h"
+
+#include "cehc-share.h"
+
+struct cehc_share_s {
+    CURLSH *sh;
+    std::mutex mtxs[CURL_LOCK_DATA_LAST]; // 每种共享数据一把锁
+};
+
+static void
+cehc_share_lock_cb(CURL *easy, curl_lock_data data, curl_lock_access access, void *userp) {
+    ((cehc_share_t*)userp)->mtxs[data].lock();
+}
+
+static void
+cehc_share_unlock_cb(CURL *easy, curl_lock_data data, void *userp) {
+    ((cehc_share_t*)userp)->mtxs[data].unlock();
+}
+
+cehc_share_t *
+cehc_new_share() {
+    cehc_share_t *share = new (std::nothrow) cehc_share_t;
+    if (!share) {
+        LOGE("%s oom when new cehc_share_t.", __func__);
+        return NULL;
+    }
+
+    share->sh = curl_share_init();
+    if (!share->sh) {
+        LOGE("curl_share_init failed.");
+        delete share;
+        return NULL;
+    }
+
+    CURLSHcode sc;
+    if (CURLSHE_OK != (sc = curl_share_setopt(share->sh, CURLSHOPT_USERDATA, share))
+        || CURLSHE_OK != (sc = curl_share_setopt(share->sh, CURLSHOPT_LOCKFUNC, cehc_share_lock_cb))
+        || CURLSHE_OK != (sc = curl_share_setopt(share->sh, CURLSHOPT_UNLOCKFUNC, cehc_share_unlock_cb))
+        || CURLSHE_OK != (sc = curl_share_setopt(share->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS))) {
+        LOGE("curl_share_setopt err = %s.", curl_share_strerror(sc));
+        curl_share_cleanup(share->sh);
+        delete share;
+        return NULL;
+    }
+
+    // 没有TLS后端时不支持，只共享DNS。
+    if (CURLSHE_OK != (sc = curl_share_setopt(share->sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION))) {
+        LOGW("share ssl session err = %s.", curl_share_strerror(sc));
+    }
+
+    return share;
+}
+
+void
+cehc_delete_share(cehc_share_t **share) {
+    if (share && *share) {
+        CURLSHcode sc = curl_share_cleanup((*share)->sh);
+        if (CURLSHE_OK != sc) {
+            // 还有easy在使用，释放掉会导致野指针，宁可泄漏。
+            LOGE("curl_share_cleanup err = %s.", curl_share_strerror(sc));
+            return;
+        }
+
+        delete *share;
+        *share = NULL;
+    }
+}
+
+bool
+cehc_http_service_set_share(cehc_http_service_t *hs, cehc_share_t *share) {
+    if (!hs) {
+        return false;
+    }
+
+    hs->share = share;
+    return true;
+}
+
+CURLcode
+cehc_share_setup_easy(cehc_http_service_t *hs, CURL *easy) {
+    if (!hs->share) {
+        return CURLE_OK;
+    }
+
+    return curl_easy_setopt(easy, CURLOPT_SHARE, hs->share->sh);
+}
@@ -0,0 +1,57 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_share__h
+#define cehc_share__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 多个http service(分片)共享的DNS缓存和TLS session缓存(curl share)。
+ * -> 一个分片解析过的域名其他分片直接命中；
+ * -> 一个分片和某个server握手得到的TLS session其他分片可以复用(session resumption)，省掉完整握手；
+ * 连接本身不共享，每个service的curl multi有自己的连接缓存。
+ */
+typedef struct cehc_share_s cehc_share_t;
+
+/**
+ * 创建共享缓存。
+ * @return 失败NULL
+ */
+cehc_share_t *
+cehc_new_share();
+
+/**
+ * 释放共享缓存，需要在使用它的conn都cehc_delete_conn、service都cehc_delete_http_serivce之后调用。
+ */
+void
+cehc_delete_share(cehc_share_t **share);
+
+/**
+ * 让http service之后创建的conn使用共享缓存，最好在创建service之后立即调用。
+ * @param hs
+ * @param share NULL为不再使用
+ * @return hs为NULL时false
+ */
+bool
+cehc_http_service_set_share(cehc_http_service_t *hs, cehc_share_t *share);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 为easy设置hs的共享缓存，hs没有共享缓存时什么也不做。
+ */
+CURLcode
+cehc_share_setup_easy(cehc_http_service_t *hs, CURL *easy);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_share__h
@@ -0,0 +1,316 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+
+#include <atomic>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-socket.h"
+
+struct cehc_sock_table_s {
+    cehc_sock_opts_t opts;
+    cehc_sock_entry_t *entries; // 下标为fd
+    int cap;
+    std::atomic<uint64_t> opened;
+    std::atomic<uint64_t> closed;
+    std::atomic<uint64_t> setopt_err;
+};
+
+void
+cehc_sock_opts_init(cehc_sock_opts_t *opts, cehc_sock_profile_t profile) {
+    if (!opts) {
+        return;
+    }
+
+    bzero(opts, sizeof(cehc_sock_opts_t));
+    switch (profile) {
+        case CEHC_SOCK_PROFILE_LATENCY: {
+            opts->tcp_nodelay = 1;
+            opts->tcp_quickack = 1;
+            opts->rcvbuf = 64 * 1024;
+            opts->sndbuf = 64 * 1024;
+            break;
+        }
+        case CEHC_SOCK_PROFILE_THROUGHPUT: {
+            opts->tcp_nodelay = 0;
+            opts->rcvbuf = 4 * 1024 * 1024;
+            opts->sndbuf = 4 * 1024 * 1024;
+            break;
+        }
+        default: {
+            opts->tcp_nodelay = 1;
+            break;
+        }
+    }
+}
+
+cehc_sock_table_t *
+cehc_sock_table_new() {
+    cehc_sock_table_t *table = new (std::nothrow) cehc_sock_table_t;
+    if (!table) {
+        LOGE("%s oom when new cehc_sock_table_t.", __func__);
+        return NULL;
+    }
+
+    cehc_sock_opts_init(&table->opts, CEHC_SOCK_PROFILE_DEFAULT);
+    table->entries = NULL;
+    table->cap = 0;
+    table->opened.store(0);
+    table->closed.store(0);
+    table->setopt_err.store(0);
+    return table;
+}
+
+void
+cehc_sock_table_delete(cehc_sock_table_t **table) {
+    if (table && *table) {
+        free((*table)->entries);
+        delete *table;
+        *table = NULL;
+    }
+}
+
+static void
+cehc_sock_format_peer(const struct curl_sockaddr *address, char *peer) {
+    char ip[INET6_ADDRSTRLEN];
+    switch (address->family) {
+        case AF_INET: {
+            auto sin = (const struct sockaddr_in*)&address->addr;
+            inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+            snprintf(peer, CEHC_SOCK_PEER_LEN, "%s:%d", ip, ntohs(sin->sin_port));
+            break;
+        }
+        case AF_INET6: {
+            auto sin6 = (const struct sockaddr_in6*)&address->addr;
+            inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+            snprintf(peer, CEHC_SOCK_PEER_LEN, "[%s]:%d", ip, ntohs(sin6->sin6_port));
+            break;
+        }
+        case AF_UNIX: {
+            auto sun = (const struct sockaddr_un*)&address->addr;
+            if ('\0' == sun->sun_path[0]) {
+                size_t len = address->addrlen - offsetof(struct sockaddr_un, sun_path) - 1;
+                snprintf(peer, CEHC_SOCK_PEER_LEN, "@%.*s", (int)len, sun->sun_path + 1);
+            } else {
+                snprintf(peer, CEHC_SOCK_PEER_LEN, "%.*s", CEHC_SOCK_PEER_LEN - 1, sun->sun_path);
+            }
+            break;
+        }
+        default: {
+            snprintf(peer, CEHC_SOCK_PEER_LEN, "family %d", address->family);
+            break;
+        }
+    }
+}
+
+/**
+ * 登记一个新的fd，表不够大时按2倍扩容。
+ */
+static bool
+cehc_sock_table_add(cehc_sock_table_t *table, int fd, const struct curl_sockaddr *address) {
+    if (fd >= table->cap) {
+        int cap = table->cap ? table->cap : 64;
+        while (cap <= fd) {
+            cap <<= 1;
+        }
+        cehc_sock_entry_t *entries = (cehc_sock_entry_t*)realloc(table->entries, sizeof(cehc_sock_entry_t) * cap);
+        if (!entries) {
+            LOGE("%s oom when realloc %d socket entries.", __func__, cap);
+            return false;
+        }
+        bzero(entries + table->cap, sizeof(cehc_sock_entry_t) * (cap - table->cap));
+        table->entries = entries;
+        table->cap = cap;
+    }
+
+    cehc_sock_entry_t *e = table->entries + fd;
+    e->used = true;
+    e->family = address->family;
+    e->born_ns = CommonUtils::GetCoarseMonotonicNs();
+    e->watched = false;
+    e->idle_ns = 0;
+    e->requests = 0;
+    e->retired = false;
+    e->closing = false;
+    cehc_sock_format_peer(address, e->peer);
+    return true;
+}
+
+cehc_sock_entry_t *
+cehc_sock_lookup(cehc_http_service_t *hs, int fd) {
+    cehc_sock_table_t *table = hs->sock_table;
+    if (!table || fd < 0 || fd >= table->cap || !table->entries[fd].used) {
+        return NULL;
+    }
+
+    return table->entries + fd;
+}
+
+void
+cehc_sock_foreach(cehc_http_service_t *hs, cehc_sock_visit_cb cb, void *arg) {
+    cehc_sock_table_t *table = hs->sock_table;
+    for (int fd = 0; fd < table->cap; ++fd) {
+        if (table->entries[fd].used) {
+            cb(fd, table->entries + fd, arg);
+        }
+    }
+}
+
+static void
+cehc_sock_setopt(cehc_sock_table_t *table, int fd, int level, int name, int val, const char *name_str) {
+    if (-1 == setsockopt(fd, level, name, &val, sizeof(val))) {
+        int err = errno;
+        // 只在第一次失败时告警，避免每个连接刷一次日志。
+        if (0 == table->setopt_err.fetch_add(1, std::memory_order_relaxed)) {
+            LOGW("setsockopt %s = %d err = %s.", name_str, val, strerror(err));
+        }
+    }
+}
+
+/**
+ * https://curl.haxx.se/libcurl/c/CURLOPT_OPENSOCKETFUNCTION.html
+ */
+static curl_socket_t
+cehc_sock_open_cb(void *clientp, curlsocktype purpose, struct curl_sockaddr *address) {
+    cehc_http_service_t *hs = (cehc_http_service_t*)clientp;
+    int fd = socket(address->family, address->socktype|SOCK_NONBLOCK|SOCK_CLOEXEC, address->protocol);
+    if (-1 == fd) {
+        int err = errno;
+        LOGE("socket family = %d err = %s.", address->family, strerror(err));
+        return CURL_SOCKET_BAD;
+    }
+
+    if (!cehc_sock_table_add(hs->sock_table, fd, address)) {
+        close(fd);
+        return CURL_SOCKET_BAD;
+    }
+    hs->sock_table->opened.fetch_add(1, std::memory_order_relaxed);
+
+    return fd;
+}
+
+/**
+ * https://curl.haxx.se/libcurl/c/CURLOPT_SOCKOPTFUNCTION.html
+ * curl在设置完自己的选项(CURLOPT_TCP_KEEPALIVE等)之后、connect之前调用，所以这里的配置优先。
+ */
+static int
+cehc_sock_opt_cb(void *clientp, curl_socket_t fd, curlsocktype purpose) {
+    cehc_http_service_t *hs = (cehc_http_service_t*)clientp;
+    cehc_sock_table_t *table = hs->sock_table;
+    const cehc_sock_opts_t *opts = &table->opts;
+    cehc_sock_entry_t *e = cehc_sock_lookup(hs, fd);
+    bool tcp = !e || AF_INET == e->family || AF_INET6 == e->family;
+
+    if (opts->rcvbuf > 0) {
+        cehc_sock_setopt(table, fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, "SO_RCVBUF");
+    }
+    if (opts->sndbuf > 0) {
+        cehc_sock_setopt(table, fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, "SO_SNDBUF");
+    }
+#ifdef SO_BUSY_POLL
+    if (hs->so_busy_poll_us > 0) {
+        cehc_sock_setopt(table, fd, SOL_SOCKET, SO_BUSY_POLL, hs->so_busy_poll_us, "SO_BUSY_POLL");
+    }
+#endif
+
+    if (tcp) {
+        // 新建的socket默认就是关闭的，所以只在开启时设置(curl自己的设置在setup_easy中关掉了)。
+        if (opts->tcp_nodelay) {
+            cehc_sock_setopt(table, fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+        }
+        if (opts->tcp_quickack) {
+            cehc_sock_setopt(table, fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+        }
+        if (opts->keepalive_idle_s > 0) {
+            cehc_sock_setopt(table, fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+            cehc_sock_setopt(table, fd, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepalive_idle_s, "TCP_KEEPIDLE");
+            if (opts->keepalive_intvl_s > 0) {
+                cehc_sock_setopt(table, fd, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepalive_intvl_s, "TCP_KEEPINTVL");
+            }
+            if (opts->keepalive_cnt > 0) {
+                cehc_sock_setopt(table, fd, IPPROTO_TCP, TCP_KEEPCNT, opts->keepalive_cnt, "TCP_KEEPCNT");
+            }
+        }
+    }
+
+    return CURL_SOCKOPT_OK;
+}
+
+/**
+ * https://curl.haxx.se/libcurl/c/CURLOPT_CLOSESOCKETFUNCTION.html
+ * 连接缓存中的连接可能在创建它的easy释放之后才关闭，所以clientp只能是hs。
+ */
+static int
+cehc_sock_close_cb(void *clientp, curl_socket_t fd) {
+    cehc_http_service_t *hs = (cehc_http_service_t*)clientp;
+    cehc_sock_entry_t *e = cehc_sock_lookup(hs, fd);
+    if (e) {
+        e->used = false;
+        hs->sock_table->closed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return close(fd);
+}
+
+CURLcode
+cehc_sock_setup_easy(cehc_http_service_t *hs, CURL *easy) {
+    CURLcode cc;
+    // TCP_NODELAY由sockopt回调按service的配置设置，不让curl再设置一次。
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_TCP_NODELAY, 0L))) {
+        return cc;
+    }
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_OPENSOCKETDATA, hs))) {
+        return cc;
+    }
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_OPENSOCKETFUNCTION, cehc_sock_open_cb))) {
+        return cc;
+    }
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_SOCKOPTDATA, hs))) {
+        return cc;
+    }
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_SOCKOPTFUNCTION, cehc_sock_opt_cb))) {
+        return cc;
+    }
+    if (CURLE_OK != (cc = curl_easy_setopt(easy, CURLOPT_CLOSESOCKETDATA, hs))) {
+        return cc;
+    }
+
+    return curl_easy_setopt(easy, CURLOPT_CLOSESOCKETFUNCTION, cehc_sock_close_cb);
+}
+
+bool
+cehc_http_service_set_sock_opts(cehc_http_service_t *hs, const cehc_sock_opts_t *opts) {
+    if (!hs || !opts || opts->rcvbuf < 0 || opts->sndbuf < 0 || opts->keepalive_idle_s < 0
+        || opts->keepalive_intvl_s < 0 || opts->keepalive_cnt < 0) {
+        LOGW("invalid socket opts.");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    hs->sock_table->opts = *opts;
+    return true;
+}
+
+void
+cehc_http_service_get_sock_stats(cehc_http_service_t *hs, cehc_sock_stats_t *stats) {
+    if (hs && stats) {
+        stats->opened = hs->sock_table->opened.load(std::memory_order_relaxed);
+        stats->closed = hs->sock_table->closed.load(std::memory_order_relaxed);
+        stats->setopt_err = hs->sock_table->setopt_err.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,128 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_socket__h
+#define cehc_socket__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * http service自己创建和关闭连接的socket(CURLOPT_OPENSOCKETFUNCTION/SOCKOPTFUNCTION/CLOSESOCKETFUNCTION)：
+ * -> socket创建时即带SOCK_NONBLOCK|SOCK_CLOEXEC，事件循环不再需要每次fcntl；
+ * -> 按service的配置设置TCP_NODELAY、收发缓冲区、TCP_QUICKACK、keepalive(以及SO_BUSY_POLL，见set_busy_poll)；
+ * -> 创建时登记到service的socket表(以fd为下标)，关闭时注销。
+ * 非TCP的socket(如unix domain socket)只设置通用的选项。
+ */
+typedef enum cehc_sock_profile_e {
+    CEHC_SOCK_PROFILE_DEFAULT    = 0, // 只开TCP_NODELAY(同curl默认)，其余用系统默认
+    CEHC_SOCK_PROFILE_LATENCY    = 1, // TCP_NODELAY + TCP_QUICKACK，小缓冲区
+    CEHC_SOCK_PROFILE_THROUGHPUT = 2, // 关闭TCP_NODELAY合并小包，大缓冲区
+} cehc_sock_profile_t;
+
+typedef struct cehc_sock_opts_s {
+    int tcp_nodelay;       // 1开启，0关闭
+    int tcp_quickack;      // 1连接建立时设置TCP_QUICKACK(内核会在之后自行退出quickack模式)
+    int rcvbuf;            // SO_RCVBUF字节数，0为系统默认(保留自动调整)
+    int sndbuf;            // SO_SNDBUF字节数，0为系统默认
+    int keepalive_idle_s;  // >0开启SO_KEEPALIVE，空闲多少秒开始探测
+    int keepalive_intvl_s; // 探测间隔秒数，0为系统默认
+    int keepalive_cnt;     // 探测失败多少次断开，0为系统默认
+} cehc_sock_opts_t;
+
+/**
+ * 对端地址字符串的长度：ip:port(IPv6为[ip]:port)，unix socket为路径(abstract以'@'开头，过长时截断)。
+ */
+#define CEHC_SOCK_PEER_LEN 64
+
+typedef struct cehc_sock_stats_s {
+    uint64_t opened;       // 创建的socket数
+    uint64_t closed;       // 关闭的socket数
+    uint64_t setopt_err;   // 设置选项失败的次数(不影响连接)
+} cehc_sock_stats_t;
+
+/**
+ * 以预设填充opts。
+ * @param opts
+ * @param profile
+ */
+void
+cehc_sock_opts_init(cehc_sock_opts_t *opts, cehc_sock_profile_t profile);
+
+/**
+ * 设置http service新建连接的socket选项，对已经建立的连接不生效，最好在cehc_run_http_serivce之前调用。
+ * 未设置时为CEHC_SOCK_PROFILE_DEFAULT。
+ * @param hs
+ * @param opts
+ * @return 参数非法时false
+ */
+bool
+cehc_http_service_set_sock_opts(cehc_http_service_t *hs, const cehc_sock_opts_t *opts);
+
+void
+cehc_http_service_get_sock_stats(cehc_http_service_t *hs, cehc_sock_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * socket表中的一项，下标为fd。
+ */
+typedef struct cehc_sock_entry_s {
+    bool used;
+    int family;
+    int64_t born_ns; // 创建时的单调时钟
+    /**
+     * 连接的使用状态，见cehc-lifecycle.h：watched为curl正在等待该fd的事件；
+     * idle_ns为最后一个请求完成的单调时钟，之后再被curl等待时清0(暂停的传输同样不被等待，但不是空闲)。
+     */
+    bool watched;
+    int64_t idle_ns;
+    uint32_t requests; // 完成的请求数
+    bool retired;      // 请求数到达上限，空闲之后回收
+    bool closing;      // 已被回收(shutdown)，等待curl关闭
+    char peer[CEHC_SOCK_PEER_LEN];
+} cehc_sock_entry_t;
+
+typedef struct cehc_sock_table_s cehc_sock_table_t;
+
+cehc_sock_table_t *
+cehc_sock_table_new();
+
+/**
+ * 需在curl_multi_cleanup之后调用，因为连接缓存中的socket在那时才关闭。
+ */
+void
+cehc_sock_table_delete(cehc_sock_table_t **table);
+
+/**
+ * 为easy设置本service的open/sockopt/close socket回调。
+ * @return curl_easy_setopt的结果
+ */
+CURLcode
+cehc_sock_setup_easy(cehc_http_service_t *hs, CURL *easy);
+
+/**
+ * 查找由本service创建的fd，需持有multi_handles_mtx(所有curl回调都在锁内)。
+ * @return 不是本service创建的返回NULL
+ */
+cehc_sock_entry_t *
+cehc_sock_lookup(cehc_http_service_t *hs, int fd);
+
+typedef void (*cehc_sock_visit_cb)(int fd, cehc_sock_entry_t *e, void *arg);
+
+/**
+ * 遍历本service打开的所有socket，需持有multi_handles_mtx。
+ */
+void
+cehc_sock_foreach(cehc_http_service_t *hs, cehc_sock_visit_cb cb, void *arg);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_socket__h
@@ -0,0 +1,180 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "../common/logger.h"
+#include "../common/spsc-ring.h"
+
+#include "cehc-stream.h"
+
+typedef struct cehc_stream_s {
+    explicit cehc_stream_s(size_t capacity) : ring(capacity) {}
+
+    SpscRing<char> ring;
+    /**
+     * 生产者因环满暂停了传输时置1，消费者腾出paused_need以上的空间后置0并发起恢复。
+     */
+    volatile int paused = 0;
+    volatile size_t paused_need = 0;
+    volatile bool eof = false;
+    /**
+     * 消费者是否在cv上等待，生产者只有在其为1时才走加锁通知的慢路径。
+     */
+    volatile int waiting = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+} cehc_stream_t;
+
+static void
+cehc_stream_wake_consumer(cehc_stream_t *s) {
+    hw_rw_memory_barrier();
+    if (s->waiting) {
+        std::unique_lock<std::mutex> l(s->mtx);
+        s->cv.notify_one();
+    }
+}
+
+/**
+ * 空间是否足够恢复：至少要放下被暂停的那一块数据，且留有1/4的余量，避免暂停/恢复来回抖动。
+ */
+static inline bool
+cehc_stream_can_resume(cehc_stream_t *s) {
+    size_t need = s->paused_need;
+    size_t quarter = s->ring.Capacity() >> 2;
+    return s->ring.FreeSpace() >= (need > quarter ? need : quarter);
+}
+
+bool
+cehc_conn_enable_stream(cehc_connection_ptr conn, size_t capacity) {
+    if (!conn) {
+        return false;
+    }
+
+    if (capacity < CURL_MAX_WRITE_SIZE) {
+        capacity = CURL_MAX_WRITE_SIZE;
+    }
+
+    cehc_stream_free(conn);
+    conn->stream = new (std::nothrow) cehc_stream_t(capacity);
+    if (!conn->stream) {
+        LOGE("%s oom when new cehc_stream_t.", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t
+cehc_stream_read(cehc_connection_ptr conn, void *buf, size_t len, int timeout_ms) {
+    if (!conn || !conn->stream) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cehc_stream_t *s = conn->stream;
+    size_t n = 0;
+    for (;;) {
+        n = s->ring.TryPopN((char*)buf, len);
+        if (n || !len) {
+            break;
+        }
+
+        // 先读eof再确认一次环为空，避免EOF之前最后一块数据被漏读。
+        if (s->eof) {
+            hw_rw_memory_barrier();
+            if (s->ring.Empty()) {
+                return 0;
+            }
+            continue;
+        }
+
+        if (0 == timeout_ms) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        std::unique_lock<std::mutex> l(s->mtx);
+        s->waiting = 1;
+        hw_rw_memory_barrier();
+        if (s->ring.Empty() && !s->eof) {
+            if (-1 == timeout_ms) {
+                s->cv.wait(l);
+            } else if (std::cv_status::timeout == s->cv.wait_for(l, std::chrono::milliseconds(timeout_ms))) {
+                s->waiting = 0;
+                if (s->ring.Empty() && !s->eof) {
+                    errno = EAGAIN;
+                    return -1;
+                }
+            }
+        }
+        s->waiting = 0;
+    }
+
+    if (s->paused && cehc_stream_can_resume(s) && atomic_cas(&s->paused, 1, 0)) {
+        cehc_resume_conn(conn);
+    }
+
+    return (ssize_t)n;
+}
+
+size_t
+cehc_stream_readable(cehc_connection_ptr conn) {
+    if (!conn || !conn->stream) {
+        return 0;
+    }
+
+    return conn->stream->ring.Size();
+}
+
+size_t
+cehc_stream_on_recv(cehc_connection_ptr conn, void *ptr, size_t size) {
+    cehc_stream_t *s = conn->stream;
+    if (s->ring.TryPushAll((const char*)ptr, size)) {
+        cehc_stream_wake_consumer(s);
+        return size;
+    }
+
+    // 环满，暂停。置位之后需要再检查一次：消费者可能在置位之前已经把数据读空了而没有看到paused。
+    s->paused_need = size;
+    s->paused = 1;
+    hw_rw_memory_barrier();
+    if (cehc_stream_can_resume(s) && atomic_cas(&s->paused, 1, 0)) {
+        if (s->ring.TryPushAll((const char*)ptr, size)) {
+            cehc_stream_wake_consumer(s);
+            return size;
+        }
+        s->paused = 1;
+    }
+
+    cehc_stream_wake_consumer(s);
+    return CURL_WRITEFUNC_PAUSE;
+}
+
+void
+cehc_stream_on_complete(cehc_connection_ptr conn) {
+    cehc_stream_t *s = conn->stream;
+    s->paused = 0;
+    s->eof = true;
+    cehc_stream_wake_consumer(s);
+}
+
+void
+cehc_stream_reset(cehc_connection_ptr conn) {
+    cehc_stream_t *s = conn->stream;
+    char drop[4096];
+    while (s->ring.TryPopN(drop, sizeof(drop)));
+    s->paused = 0;
+    s->paused_need = 0;
+    s->eof = false;
+}
+
+void
+cehc_stream_free(cehc_connection_ptr conn) {
+    DELETE_PTR(conn->stream);
+}
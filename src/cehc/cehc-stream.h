@@ -0,0 +1,81 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_stream__h
+#define cehc_stream__h
+
+#include <sys/types.h>
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 流式body通道：事件循环线程(生产者)与一个消费线程之间的有界无锁SPSC环。
+ * -> 环满时，接收回调向curl返回CURL_WRITEFUNC_PAUSE暂停该传输，事件循环不阻塞、也不无限缓存；
+ * -> 消费线程读出数据腾出空间后，通过cehc_resume_conn把curl_easy_pause(CONT)交回事件循环执行。
+ * 开启之后conn的recv_cb不再被调用，complete_cb照常在事件循环中调用。
+ * 注意：consumer读到EOF(返回0)之后才能cehc_delete_conn，读的过程中不可释放conn。
+ */
+
+/**
+ * 为conn开启流式body模式，需在cehc_run_conn之前调用，conn重复run时环会被清空复用。
+ * @param conn
+ * @param capacity 环的字节数，小于CURL_MAX_WRITE_SIZE时按CURL_MAX_WRITE_SIZE处理(curl单次回调的上限)，
+ *                 最终向上取整为2的幂。
+ * @return 成功true，失败false
+ */
+bool
+cehc_conn_enable_stream(cehc_connection_ptr conn, size_t capacity);
+
+/**
+ * 消费线程读取body数据。只能有一个消费线程。
+ * @param conn
+ * @param buf
+ * @param len
+ * @param timeout_ms 无数据可读时的等待时间，0不等待，-1一直等待。
+ * @return >0为读到的字节数；0表示EOF(传输已结束且数据已读完，需要检查conn的错误码)；
+ *         -1表示超时或者conn未开启流式模式(errno为EAGAIN或者EINVAL)。
+ */
+ssize_t
+cehc_stream_read(cehc_connection_ptr conn, void *buf, size_t len, int timeout_ms);
+
+/**
+ * 当前可读的字节数(瞬时值)。
+ */
+size_t
+cehc_stream_readable(cehc_connection_ptr conn);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 事件循环线程调用，把curl交过来的数据写入环。
+ * @return 写入的大小，或者CURL_WRITEFUNC_PAUSE
+ */
+size_t
+cehc_stream_on_recv(cehc_connection_ptr conn, void *ptr, size_t size);
+
+/**
+ * 事件循环线程调用，传输结束，标记EOF并唤醒消费线程。
+ */
+void
+cehc_stream_on_complete(cehc_connection_ptr conn);
+
+/**
+ * cehc_run_conn时重置。
+ */
+void
+cehc_stream_reset(cehc_connection_ptr conn);
+
+void
+cehc_stream_free(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_stream__h
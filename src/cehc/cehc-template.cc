@@ -0,0 +1,111 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdlib.h>
+
+#include <mutex>
+
+#include "../common/logger.h"
+
+#include "cehc-template.h"
+
+struct cehc_template_s {
+    cehc_http_service_t *hs;
+    CURL *easy;
+    struct curl_slist *headers;
+    std::mutex mtx;   // curl_easy_duphandle读模板的easy，不能和其他线程同时进行
+};
+
+cehc_template_t *
+cehc_new_template(cehc_http_service_t *hs, const char *const *headers, int header_cnt) {
+    if (!hs || header_cnt < 0 || (header_cnt > 0 && !headers)) {
+        LOGW("invalid template params.");
+        return NULL;
+    }
+
+    cehc_template_t *tpl = new (std::nothrow) cehc_template_t;
+    if (!tpl) {
+        LOGE("%s oom when new cehc_template_t.", __func__);
+        return NULL;
+    }
+
+    tpl->hs = hs;
+    tpl->headers = NULL;
+    tpl->easy = curl_easy_init();
+    if (!tpl->easy) {
+        LOGE("curl_easy_init failed.");
+        delete tpl;
+        return NULL;
+    }
+
+    for (int i = 0; i < header_cnt; ++i) {
+        struct curl_slist *l = curl_slist_append(tpl->headers, headers[i]);
+        if (!l) {
+            LOGE("%s oom when curl_slist_append.", __func__);
+            cehc_delete_template(&tpl);
+            return NULL;
+        }
+        tpl->headers = l;
+    }
+
+    if (tpl->headers) {
+        CURLcode cc = curl_easy_setopt(tpl->easy, CURLOPT_HTTPHEADER, tpl->headers);
+        if (CURLE_OK != cc) {
+            LOGE("set template headers err = %s.", curl_easy_strerror(cc));
+            cehc_delete_template(&tpl);
+            return NULL;
+        }
+    }
+
+    return tpl;
+}
+
+CURL *
+cehc_template_easy(cehc_template_t *tpl) {
+    return tpl ? tpl->easy : NULL;
+}
+
+cehc_connection_t *
+cehc_new_conn_from_template(cehc_template_t *tpl, cehc_newconn_params_ptr params, const void *body, size_t body_len) {
+    if (!tpl || !params) {
+        LOGW("input params cannot be null!");
+        return NULL;
+    }
+
+    std::unique_lock<std::mutex> l(tpl->mtx);
+    CURL *easy = curl_easy_duphandle(tpl->easy);
+    l.unlock();
+    if (!easy) {
+        LOGE("curl_easy_duphandle failed.");
+        return NULL;
+    }
+
+    params->hs = tpl->hs;
+    cehc_connection_t *conn = cehc_new_conn_with_easy(params, easy);
+    if (!conn || !body) {
+        return conn;
+    }
+
+    CURLcode cc;
+    if (CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body_len))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, body))) {
+        LOGE("set template conn body err = %s.", curl_easy_strerror(cc));
+        cehc_delete_conn(&conn);
+    }
+
+    return conn;
+}
+
+void
+cehc_delete_template(cehc_template_t **tpl) {
+    if (tpl && *tpl) {
+        if ((*tpl)->easy) {
+            curl_easy_cleanup((*tpl)->easy);
+        }
+        curl_slist_free_all((*tpl)->headers);
+        delete *tpl;
+        *tpl = NULL;
+    }
+}
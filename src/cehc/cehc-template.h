@@ -0,0 +1,62 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_template__h
+#define cehc_template__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 请求模板：同一类请求(超时、header、认证、CURLOPT_POST等)只在模板上设置一次，
+ * 之后每个conn用curl_easy_duphandle从模板复制出来，只需要再带上自己的url和body。
+ * -> header列表属于模板，所有conn共享同一份且不可修改，conn不需要自己构造和释放curl_slist；
+ * -> 模板的easy handle只用于复制，不会被run；cehc_new_conn中声明的保留属性在模板上设置了也会被conn覆盖；
+ * -> 模板需要比从它复制出来的conn活得久(共享的header列表和其他curl不拷贝的指针)。
+ * 用法：
+ *   cehc_template_t *t = cehc_new_template(hs, headers, 2);
+ *   curl_easy_setopt(cehc_template_easy(t), CURLOPT_TIMEOUT, 5L);
+ *   ...
+ *   cehc_connection_ptr conn = cehc_new_conn_from_template(t, &params, body, body_len);
+ *   cehc_run_conn(conn, errmsg);
+ */
+typedef struct cehc_template_s cehc_template_t;
+
+/**
+ * @param hs
+ * @param headers 形如"Content-Type: application/json"的header，会被拷贝
+ * @param header_cnt
+ * @return 失败返回NULL
+ */
+cehc_template_t *
+cehc_new_template(cehc_http_service_t *hs, const char *const *headers, int header_cnt);
+
+/**
+ * 得到模板的easy handle，用于curl_easy_setopt设置公共的选项，需在从模板创建conn之前设置完。
+ */
+CURL *
+cehc_template_easy(cehc_template_t *tpl);
+
+/**
+ * 从模板创建conn，params->hs不用填(取模板的)，线程安全。
+ * @param tpl
+ * @param params url、回调等每个请求自己的参数
+ * @param body 非NULL时作为请求body(CURLOPT_POSTFIELDS，不拷贝，需在请求结束之前有效)
+ * @param body_len
+ * @return 失败返回NULL
+ */
+cehc_connection_t *
+cehc_new_conn_from_template(cehc_template_t *tpl, cehc_newconn_params_ptr params, const void *body, size_t body_len);
+
+void
+cehc_delete_template(cehc_template_t **tpl);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_template__h
@@ -0,0 +1,412 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+
+#include "cehc-trace.h"
+
+#define CEHC_TRACE_ARG_LEN      128
+#define CEHC_TRACE_NAME_LEN     16
+
+typedef struct cehc_trace_event_s {
+    const char *name;   // 静态字符串
+    int64_t ts_ns;
+    int64_t dur_ns;
+    uint64_t id;
+    bool async;
+    char arg[CEHC_TRACE_ARG_LEN];
+} cehc_trace_event_t;
+
+/**
+ * 一个线程的环形缓冲，只有所属线程写，锁只用于和dump互斥。
+ */
+typedef struct cehc_trace_ring_s {
+    spin_lock_t sl;
+    pid_t tid;
+    char thread_name[CEHC_TRACE_NAME_LEN];
+    uint64_t head;
+    std::vector<cehc_trace_event_t> events;
+} cehc_trace_ring_t;
+
+typedef struct cehc_tracer_s {
+    uint64_t serial;
+    cehc_trace_opts_t opts;
+    std::mutex mtx;                         // 保护rings
+    std::vector<cehc_trace_ring_t*> rings;
+    std::atomic<uint64_t> next_id;
+    std::atomic<uint64_t> sampled;
+    std::atomic<int> inflight;              // 已交给curl还没有结束的采样请求数
+} cehc_tracer_t;
+
+typedef struct cehc_trace_tls_s {
+    uint64_t serial;
+    cehc_trace_ring_t *ring;
+} cehc_trace_tls_t;
+
+// 每个tracer一个全局唯一的序号，线程缓存的环不会错配到释放之后新建的tracer上。
+static std::atomic<uint64_t> s_tracer_serial(0);
+static thread_local cehc_trace_tls_t t_ring_cache = {0, NULL};
+static thread_local uint32_t t_sample_tick = 0;
+
+void
+cehc_trace_opts_init(cehc_trace_opts_t *opts) {
+    if (opts) {
+        opts->sample_every = 100;
+        opts->ring_events = 16384;
+    }
+}
+
+bool
+cehc_http_service_set_tracer(cehc_http_service_t *hs, const cehc_trace_opts_t *opts) {
+    cehc_trace_opts_t o;
+    cehc_trace_opts_init(&o);
+    if (opts) {
+        o = *opts;
+    }
+    if (!hs || o.sample_every <= 0 || o.ring_events <= 0) {
+        LOGW("invalid trace opts.");
+        return false;
+    }
+    if (hs->tracer) {
+        LOGW("tracer of http service is already set.");
+        return false;
+    }
+
+    cehc_tracer_t *tr = new (std::nothrow) cehc_tracer_t;
+    if (!tr) {
+        LOGE("%s oom when new cehc_tracer_t.", __func__);
+        return false;
+    }
+
+    tr->serial = s_tracer_serial.fetch_add(1) + 1;
+    tr->opts = o;
+    tr->next_id.store(1);
+    tr->sampled.store(0);
+    tr->inflight.store(0);
+    hs->tracer = tr;
+    return true;
+}
+
+/**
+ * 当前线程在tr中的环，第一次记录时创建。
+ */
+static cehc_trace_ring_t *
+cehc_trace_ring_of(cehc_tracer_t *tr) {
+    if (LIKELY(t_ring_cache.serial == tr->serial)) {
+        return t_ring_cache.ring;
+    }
+
+    // 同一个线程交替给多个service记录时缓存会失效，按tid找回原来的环。
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    cehc_trace_ring_t *ring = NULL;
+    {
+        std::unique_lock<std::mutex> l(tr->mtx);
+        for (auto r : tr->rings) {
+            if (r->tid == tid) {
+                ring = r;
+                break;
+            }
+        }
+
+        if (!ring) {
+            ring = new (std::nothrow) cehc_trace_ring_t;
+            if (!ring) {
+                LOGE("%s oom when new cehc_trace_ring_t.", __func__);
+                return NULL;
+            }
+            ring->sl = UNLOCKED;
+            ring->tid = tid;
+            ring->head = 0;
+            if (0 != pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name))) {
+                snprintf(ring->thread_name, sizeof(ring->thread_name), "%d", tid);
+            }
+            ring->events.resize((size_t)tr->opts.ring_events);
+            tr->rings.push_back(ring);
+        }
+    }
+
+    t_ring_cache.serial = tr->serial;
+    t_ring_cache.ring = ring;
+    return ring;
+}
+
+static void
+cehc_trace_record(cehc_tracer_t *tr, const char *name, int64_t start_ns, int64_t end_ns, uint64_t id, bool async,
+                  const char *arg) {
+    cehc_trace_ring_t *ring = cehc_trace_ring_of(tr);
+    if (UNLIKELY(!ring)) {
+        return;
+    }
+
+    SpinLock l(&ring->sl);
+    cehc_trace_event_t &ev = ring->events[ring->head % ring->events.size()];
+    ++ring->head;
+    ev.name = name;
+    ev.ts_ns = start_ns;
+    ev.dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    ev.id = id;
+    ev.async = async;
+    if (arg) {
+        snprintf(ev.arg, sizeof(ev.arg), "%s", arg);
+    } else {
+        ev.arg[0] = '\0';
+    }
+}
+
+void
+cehc_trace_on_run(cehc_connection_ptr conn) {
+    cehc_tracer_t *tr = conn->http_service->tracer;
+    if (++t_sample_tick % (uint32_t)tr->opts.sample_every) {
+        return;
+    }
+
+    conn->trace_id = tr->next_id.fetch_add(1, std::memory_order_relaxed);
+    tr->sampled.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+cehc_trace_span(cehc_http_service_t *hs, const char *name, int64_t start_ns, uint64_t id) {
+    cehc_trace_record(hs->tracer, name, start_ns, CommonUtils::GetMonotonicNs(), id, false, NULL);
+}
+
+bool
+cehc_trace_active(cehc_http_service_t *hs) {
+    return hs->tracer->inflight.load(std::memory_order_relaxed) > 0;
+}
+
+void
+cehc_trace_on_admit(cehc_connection_ptr conn) {
+    conn->http_service->tracer->inflight.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t
+cehc_trace_recv(cehc_connection_ptr conn, void *ptr, size_t size, size_t nmemb) {
+    char arg[32];
+    int64_t start = CommonUtils::GetMonotonicNs();
+    size_t n = conn->recv_cb(conn, ptr, size, nmemb);
+    int64_t end = CommonUtils::GetMonotonicNs();
+    snprintf(arg, sizeof(arg), "bytes=%zu", size * nmemb);
+    cehc_trace_record(conn->http_service->tracer, "recv_cb", start, end, conn->trace_id, false, arg);
+    return n;
+}
+
+void
+cehc_trace_complete(cehc_connection_ptr conn) {
+    // complete_cb中conn可能被释放。
+    cehc_tracer_t *tr = conn->http_service->tracer;
+    uint64_t id = conn->trace_id;
+    int64_t start = CommonUtils::GetMonotonicNs();
+    conn->complete_cb(conn);
+    cehc_trace_record(tr, "complete_cb", start, CommonUtils::GetMonotonicNs(), id, false, NULL);
+}
+
+void
+cehc_trace_dispatched(cehc_connection_ptr conn, int64_t enqueue_ns) {
+    cehc_trace_record(conn->http_service->tracer, "dispatch_wait", enqueue_ns, CommonUtils::GetMonotonicNs(),
+                      conn->trace_id, true, NULL);
+}
+
+/**
+ * curl的一个阶段，时间为相对传输开始的微秒数，长度为0的不记录。
+ */
+static inline void
+cehc_trace_phase(cehc_tracer_t *tr, const char *name, int64_t base_ns, curl_off_t from_us, curl_off_t to_us,
+                 uint64_t id) {
+    if (to_us > from_us) {
+        cehc_trace_record(tr, name, base_ns + from_us * 1000, base_ns + to_us * 1000, id, true, NULL);
+    }
+}
+
+void
+cehc_trace_on_finish(cehc_connection_ptr conn) {
+    cehc_tracer_t *tr = conn->http_service->tracer;
+    int64_t now = CommonUtils::GetMonotonicNs();
+    char arg[CEHC_TRACE_ARG_LEN];
+    if (CEHC_REJECT_NONE != conn->rejected) {
+        snprintf(arg, sizeof(arg), "rejected=%d %s", conn->rejected, conn->url ? conn->url : "");
+    } else {
+        snprintf(arg, sizeof(arg), "http_code=%ld result=%d %s", conn->http_code, (int)conn->result,
+                 conn->url ? conn->url : "");
+    }
+    cehc_trace_record(tr, "request", conn->run_ns, now, conn->trace_id, true, arg);
+    if (0 == conn->admit_ns) {
+        return;
+    }
+
+    tr->inflight.fetch_sub(1, std::memory_order_relaxed);
+    cehc_trace_record(tr, "queued", conn->run_ns, conn->admit_ns, conn->trace_id, true, NULL);
+
+    // 各阶段为curl从开始传输到该阶段结束的累计时间，复用的连接上dns、connect、tls为0。
+    curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, ttfb = 0, total = 0;
+    curl_easy_getinfo(conn->easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(conn->easy, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(conn->easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(conn->easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(conn->easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(conn->easy, CURLINFO_TOTAL_TIME_T, &total);
+    cehc_trace_phase(tr, "dns", conn->admit_ns, 0, dns, conn->trace_id);
+    cehc_trace_phase(tr, "connect", conn->admit_ns, dns, connect, conn->trace_id);
+    if (tls > 0) {
+        cehc_trace_phase(tr, "tls", conn->admit_ns, connect, tls, conn->trace_id);
+    }
+    cehc_trace_phase(tr, "ttfb", conn->admit_ns, pretransfer, ttfb, conn->trace_id);
+    cehc_trace_phase(tr, "receive", conn->admit_ns, ttfb, total, conn->trace_id);
+}
+
+/**
+ * ts和dur为微秒，保留到纳秒。
+ */
+static inline void
+cehc_trace_write_us(FILE *f, const char *key, int64_t ns) {
+    fprintf(f, ",\"%s\":%lld.%03lld", key, (long long)(ns / 1000), (long long)(ns % 1000));
+}
+
+static void
+cehc_trace_write_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if ('"' == c || '\\' == c) {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void
+cehc_trace_write_event(FILE *f, int pid, pid_t tid, const cehc_trace_event_t &ev) {
+    if (!ev.async) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cehc\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d", ev.name, pid, tid);
+        cehc_trace_write_us(f, "ts", ev.ts_ns);
+        cehc_trace_write_us(f, "dur", ev.dur_ns);
+    } else {
+        // 同一请求的异步事件共用id，在一条轨道上按时间嵌套。
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cehc\",\"ph\":\"b\",\"id\":\"0x%llx\",\"pid\":%d,\"tid\":%d",
+                ev.name, (unsigned long long)ev.id, pid, tid);
+        cehc_trace_write_us(f, "ts", ev.ts_ns);
+    }
+
+    fprintf(f, ",\"args\":{\"req\":%llu", (unsigned long long)ev.id);
+    if (ev.arg[0]) {
+        fputs(",\"detail\":", f);
+        cehc_trace_write_str(f, ev.arg);
+    }
+    fputs("}}", f);
+
+    if (ev.async) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cehc\",\"ph\":\"e\",\"id\":\"0x%llx\",\"pid\":%d,\"tid\":%d",
+                ev.name, (unsigned long long)ev.id, pid, tid);
+        cehc_trace_write_us(f, "ts", ev.ts_ns + ev.dur_ns);
+        fputs("}", f);
+    }
+}
+
+bool
+cehc_http_service_dump_trace(cehc_http_service_t *hs, const char *path) {
+    if (!hs || !path || !hs->tracer) {
+        LOGW("invalid dump trace params or tracer is not set.");
+        return false;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        int err = errno;
+        LOGE("open trace file %s err = %s.", path, strerror(err));
+        return false;
+    }
+
+    cehc_tracer_t *tr = hs->tracer;
+    int pid = (int)getpid();
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"cehc\"}}", pid);
+
+    std::vector<cehc_trace_event_t> events;
+    std::unique_lock<std::mutex> l(tr->mtx);
+    for (auto ring : tr->rings) {
+        // 先拷贝出来，不在持有自旋锁时写文件。
+        {
+            SpinLock sl(&ring->sl);
+            uint64_t cap = ring->events.size();
+            uint64_t first = ring->head > cap ? ring->head - cap : 0;
+            events.clear();
+            for (uint64_t i = first; i < ring->head; ++i) {
+                events.push_back(ring->events[i % cap]);
+            }
+        }
+
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid,
+                ring->tid);
+        cehc_trace_write_str(f, ring->thread_name);
+        fputs("}}", f);
+        for (auto &ev : events) {
+            cehc_trace_write_event(f, pid, ring->tid, ev);
+        }
+    }
+    l.unlock();
+
+    fputs("\n]}\n", f);
+    bool ok = !ferror(f);
+    if (0 != fclose(f)) {
+        ok = false;
+    }
+    if (!ok) {
+        LOGE("write trace file %s failed.", path);
+    }
+
+    return ok;
+}
+
+void
+cehc_http_service_get_trace_stats(cehc_http_service_t *hs, cehc_trace_stats_t *stats) {
+    if (!hs || !stats) {
+        return;
+    }
+
+    bzero(stats, sizeof(cehc_trace_stats_t));
+    cehc_tracer_t *tr = hs->tracer;
+    if (!tr) {
+        return;
+    }
+
+    stats->sampled = tr->sampled.load(std::memory_order_relaxed);
+    std::unique_lock<std::mutex> l(tr->mtx);
+    stats->threads = (int)tr->rings.size();
+    for (auto ring : tr->rings) {
+        SpinLock sl(&ring->sl);
+        stats->events += ring->head;
+        if (ring->head > ring->events.size()) {
+            stats->overwritten += ring->head - ring->events.size();
+        }
+    }
+}
+
+void
+cehc_trace_delete(cehc_http_service_t *hs) {
+    cehc_tracer_t *tr = hs->tracer;
+    if (tr) {
+        for (auto ring : tr->rings) {
+            delete ring;
+        }
+        delete tr;
+        hs->tracer = NULL;
+    }
+}
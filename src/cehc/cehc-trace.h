@@ -0,0 +1,122 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_trace__h
+#define cehc_trace__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按请求采样的时间线，导出为Chrome trace JSON(chrome://tracing或者ui.perfetto.dev直接打开)，用于离线分析慢请求。
+ * -> 每个线程一个环形缓冲，只有采样到的请求记录事件，写满之后覆盖最旧的；
+ * -> 每个采样的请求一条异步轨道(按请求序号)：queued(本地排队)、dns、connect、tls、ttfb(等首字节)、receive
+ *    (后五段取自curl的时间统计)、dispatch_wait(等工作线程执行回调)；
+ * -> 线程轨道：调用线程上的lock_wait(等multi_handles_mtx)，recv_cb、complete_cb在哪个线程执行就记在哪个线程，
+ *    有采样的请求在传输时事件循环、定时器线程的curl_multi_socket_action也会记录，可以看到请求在等谁。
+ * 事件循环、定时器、工作线程的名字分别为cehc-loop、cehc-timer、cehc-worker。
+ */
+
+typedef struct cehc_trace_opts_s {
+    int sample_every;   // 每个线程每多少次cehc_run_conn采样一次，1为全部
+    int ring_events;    // 每个线程环形缓冲的事件数
+} cehc_trace_opts_t;
+
+typedef struct cehc_trace_stats_s {
+    uint64_t sampled;       // 采样的请求数
+    uint64_t events;        // 记录的事件数
+    uint64_t overwritten;   // 环满被覆盖的事件数
+    int threads;            // 记录过事件的线程数
+} cehc_trace_stats_t;
+
+/**
+ * 默认每100次采样一次，每个线程16384个事件。
+ */
+void
+cehc_trace_opts_init(cehc_trace_opts_t *opts);
+
+/**
+ * 为http service开启采样，需在cehc_run_http_serivce(嵌入模式为第一次cehc_run_conn)之前调用。
+ * @param hs
+ * @param opts NULL为默认
+ * @return 参数非法或者重复开启时false
+ */
+bool
+cehc_http_service_set_tracer(cehc_http_service_t *hs, const cehc_trace_opts_t *opts);
+
+/**
+ * 把所有线程缓冲中的事件写为Chrome trace JSON，可以在运行中随时调用，不清空缓冲。
+ * @param hs
+ * @param path
+ * @return 没有开启采样或者写文件失败时false
+ */
+bool
+cehc_http_service_dump_trace(cehc_http_service_t *hs, const char *path);
+
+void
+cehc_http_service_get_trace_stats(cehc_http_service_t *hs, cehc_trace_stats_t *stats);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * cehc_run_conn时决定是否采样，采样时设置conn->trace_id(从1开始，0为没有采样)。
+ */
+void
+cehc_trace_on_run(cehc_connection_ptr conn);
+
+/**
+ * 在当前线程的轨道上记录一段[start_ns, 现在)的事件。
+ * @param id 所属请求的trace_id，0为不属于某个请求
+ */
+void
+cehc_trace_span(cehc_http_service_t *hs, const char *name, int64_t start_ns, uint64_t id);
+
+/**
+ * 有采样的请求正在传输。
+ */
+bool
+cehc_trace_active(cehc_http_service_t *hs);
+
+/**
+ * 采样的conn交给了curl，需持有multi_handles_mtx。
+ */
+void
+cehc_trace_on_admit(cehc_connection_ptr conn);
+
+/**
+ * 采样的conn调用recv_cb并记录。
+ */
+size_t
+cehc_trace_recv(cehc_connection_ptr conn, void *ptr, size_t size, size_t nmemb);
+
+/**
+ * 采样的conn调用complete_cb并记录(之后不再访问conn)。
+ */
+void
+cehc_trace_complete(cehc_connection_ptr conn);
+
+/**
+ * 完成派发的任务开始执行，记录排队的时间。
+ */
+void
+cehc_trace_dispatched(cehc_connection_ptr conn, int64_t enqueue_ns);
+
+/**
+ * 传输结束(含被本地拒绝的)，需持有multi_handles_mtx，记录整个请求及curl的各阶段。
+ */
+void
+cehc_trace_on_finish(cehc_connection_ptr conn);
+
+void
+cehc_trace_delete(cehc_http_service_t *hs);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_trace__h
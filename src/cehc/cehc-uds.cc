@@ -0,0 +1,123 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <string.h>
+#include <sys/un.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "../common/logger.h"
+
+#include "cehc-host.h"
+#include "cehc-uds.h"
+
+/**
+ * key为host:port，匹配所有端口的路由port为0。
+ */
+typedef struct cehc_uds_s {
+    std::unordered_map<std::string, std::string> routes;
+} cehc_uds_t;
+
+static inline std::string
+cehc_uds_key(const std::string &host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+static const char *
+cehc_uds_lookup(cehc_http_service_t *hs, const std::string &host, int port) {
+    auto &routes = hs->uds->routes;
+    auto it = routes.find(cehc_uds_key(host, port));
+    if (it == routes.end()) {
+        it = routes.find(cehc_uds_key(host, 0));
+    }
+
+    return it == routes.end() ? NULL : it->second.c_str();
+}
+
+/**
+ * @param path NULL时清除，连接回到TCP
+ */
+static CURLcode
+cehc_uds_set(CURL *easy, const char *path) {
+    if (path && '@' == path[0]) {
+        return curl_easy_setopt(easy, CURLOPT_ABSTRACT_UNIX_SOCKET, path + 1);
+    }
+
+    return curl_easy_setopt(easy, CURLOPT_UNIX_SOCKET_PATH, path);
+}
+
+bool
+cehc_http_service_add_unix_route(cehc_http_service_t *hs, const char *host, int port, const char *path) {
+    if (!hs || !host || !*host || !path || port > 65535 || port == 0 || port < -1) {
+        LOGW("invalid unix route params.");
+        return false;
+    }
+    // abstract socket的'@'不占sun_path，普通路径需要留出结尾的'\0'。
+    size_t max = sizeof(((struct sockaddr_un*)0)->sun_path) - ('@' == path[0] ? 0 : 1);
+    if (!*path || strlen(path) > max) {
+        LOGW("unix socket path '%s' is empty or longer than %zu.", path, max);
+        return false;
+    }
+
+    if (!hs->uds) {
+        hs->uds = new (std::nothrow) cehc_uds_t;
+        if (!hs->uds) {
+            LOGE("%s oom when new cehc_uds_t.", __func__);
+            return false;
+        }
+    }
+
+    hs->uds->routes[cehc_uds_key(host, -1 == port ? 0 : port)] = path;
+    LOGI("route %s:%d over unix socket %s.", host, port, path);
+    return true;
+}
+
+void
+cehc_uds_bind_conn(cehc_connection_ptr conn) {
+    cehc_http_service_t *hs = conn->http_service;
+    if (!hs->uds || conn->lb_group) {
+        return;
+    }
+
+    std::string host;
+    int port;
+    if (!cehc_host_parse_url(conn->url, &host, &port)) {
+        return;
+    }
+
+    const char *path = cehc_uds_lookup(hs, host, port);
+    if (path) {
+        CURLcode cc = cehc_uds_set(conn->easy, path);
+        if (CURLE_OK != cc) {
+            LOGE("set unix socket path of %s err = %s.", conn->url, curl_easy_strerror(cc));
+        }
+    }
+}
+
+bool
+cehc_uds_apply_endpoint(cehc_connection_ptr conn) {
+    cehc_http_service_t *hs = conn->http_service;
+    if (!hs->uds || !conn->lb_group || !conn->host) {
+        return true;
+    }
+
+    // 副本可能一部分在本机，没有路由的副本要清除上一次的设置。
+    const char *path = cehc_uds_lookup(hs, conn->host->host, conn->host->port);
+    if (CURLE_OK != (conn->ce_code = cehc_uds_set(conn->easy, path))) {
+        sprintf(conn->errormsg, "%s", curl_easy_strerror(conn->ce_code));
+        return false;
+    }
+
+    return true;
+}
+
+void
+cehc_uds_delete(cehc_http_service_t *hs) {
+    if (hs->uds) {
+        delete hs->uds;
+        hs->uds = NULL;
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_uds__h
+#define cehc_uds__h
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 按目标host走unix domain socket(CURLOPT_UNIX_SOCKET_PATH)：本机sidecar代理等本地流量不再经过TCP/IP协议栈，
+ * url不需要改动，只是连接改为连到配置的socket文件。
+ * -> conn创建时按url的host:port匹配路由(endpoint group的conn在每次选中副本时按副本匹配)；
+ * -> curl的连接缓存按socket路径区分连接，keep-alive复用与TCP相同；
+ * -> path以'@'开头时为Linux的abstract socket(CURLOPT_ABSTRACT_UNIX_SOCKET)。
+ * socket同样由service创建，见cehc-socket.h(只设置通用的选项)。
+ */
+
+/**
+ * 添加一条路由，需在创建conn之前调用(之后只读，匹配不加锁)。同一个host:port重复添加时覆盖。
+ * @param hs
+ * @param host url中的host(或者endpoint group副本的host)
+ * @param port -1匹配所有端口；精确端口的路由优先
+ * @param path socket路径
+ * @return 参数非法(path超过sun_path的长度等)时false
+ */
+bool
+cehc_http_service_add_unix_route(cehc_http_service_t *hs, const char *host, int port, const char *path);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * conn创建时按url设置socket路径(endpoint group的conn除外)。
+ */
+void
+cehc_uds_bind_conn(cehc_connection_ptr conn);
+
+/**
+ * endpoint group的conn选中副本之后按副本的host设置(或清除)socket路径，需持有multi_handles_mtx。
+ * @return curl_easy_setopt失败时false，并设置conn的错误信息
+ */
+bool
+cehc_uds_apply_endpoint(cehc_connection_ptr conn);
+
+void
+cehc_uds_delete(cehc_http_service_t *hs);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_uds__h
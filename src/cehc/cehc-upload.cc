@@ -0,0 +1,384 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "../common/logger.h"
+
+#include "cehc-upload.h"
+
+typedef struct cehc_upload_buf_s {
+    const char *base;
+    size_t len;
+    cehc_upload_release_cb release;
+    void *ctx;
+} cehc_upload_buf_t;
+
+/**
+ * 发送游标只有事件循环线程访问；chunked时bufs、finished、paused由mtx保护(生产线程追加)。
+ */
+typedef struct cehc_upload_s {
+    std::vector<cehc_upload_buf_t> bufs;
+    size_t cur;         // 正在发送的buffer
+    size_t off;         // 在cur中的偏移
+    int64_t total;      // body的总长度，chunked为-1
+    bool finished;
+    bool started;       // chunked已经开始发送
+    bool paused;        // chunked没有数据可发，传输已暂停，追加数据或结束时需要恢复
+    uint64_t sent;
+    std::mutex mtx;
+} cehc_upload_t;
+
+static void
+cehc_upload_release(cehc_upload_buf_t *b) {
+    if (b->release) {
+        b->release((void*)b->base, b->len, b->ctx);
+    }
+}
+
+static void
+cehc_upload_munmap(void *base, size_t len, void *ctx) {
+    // ctx为base到页对齐的映射起点的距离。
+    size_t delta = (size_t)(uintptr_t)ctx;
+    if (-1 == munmap((char*)base - delta, len + delta)) {
+        int err = errno;
+        LOGE("munmap upload file err = %s.", strerror(err));
+    }
+}
+
+static int
+cehc_upload_seek(void *ctx, curl_off_t offset, int origin) {
+    cehc_connection_ptr conn = (cehc_connection_ptr)ctx;
+    cehc_upload_t *u = conn->upload;
+    // 重定向、认证等需要重发body时curl会先回到开头。chunked的数据发完即交还了，无法回退。
+    if (!u || u->total < 0 || SEEK_SET != origin || offset < 0 || offset > u->total) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+
+    u->cur = 0;
+    u->off = 0;
+    u->sent = (uint64_t)offset;
+    while (offset > 0 && u->cur < u->bufs.size()) {
+        curl_off_t n = (curl_off_t)u->bufs[u->cur].len;
+        if (offset < n) {
+            u->off = (size_t)offset;
+            break;
+        }
+        offset -= n;
+        ++u->cur;
+    }
+
+    return CURL_SEEKFUNC_OK;
+}
+
+/**
+ * 给conn换上新的数据源并设置curl的相关选项。
+ */
+static bool
+cehc_upload_attach(cehc_connection_ptr conn, cehc_upload_t *u) {
+    CURLcode cc;
+    if (CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POST, 1L))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, NULL))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)u->total))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_SEEKFUNCTION, cehc_upload_seek))
+        || CURLE_OK != (cc = curl_easy_setopt(conn->easy, CURLOPT_SEEKDATA, conn))) {
+        LOGE("set upload opts err = %s.", curl_easy_strerror(cc));
+        return false;
+    }
+
+    cehc_upload_free(conn);
+    conn->upload = u;
+    return true;
+}
+
+static cehc_upload_t *
+cehc_upload_new(int64_t total) {
+    cehc_upload_t *u = new (std::nothrow) cehc_upload_t;
+    if (!u) {
+        LOGE("%s oom when new cehc_upload_t.", __func__);
+        return NULL;
+    }
+
+    u->cur = 0;
+    u->off = 0;
+    u->total = total;
+    u->finished = total >= 0;
+    u->started = false;
+    u->paused = false;
+    u->sent = 0;
+    return u;
+}
+
+bool
+cehc_conn_upload_iov(cehc_connection_ptr conn, const struct iovec *iov, int iovcnt,
+                     cehc_upload_release_cb release, void *ctx) {
+    if (!conn || iovcnt < 0 || (iovcnt > 0 && !iov)) {
+        LOGW("invalid upload iov params.");
+        return false;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += (int64_t)iov[i].iov_len;
+    }
+    cehc_upload_t *u = cehc_upload_new(total);
+    if (!u) {
+        return false;
+    }
+
+    u->bufs.reserve(iovcnt);
+    for (int i = 0; i < iovcnt; ++i) {
+        cehc_upload_buf_t b = {(const char*)iov[i].iov_base, iov[i].iov_len, release, ctx};
+        u->bufs.push_back(b);
+    }
+
+    if (!cehc_upload_attach(conn, u)) {
+        delete u;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+cehc_conn_upload_file(cehc_connection_ptr conn, const char *path, off_t offset, int64_t len) {
+    if (!conn || !path || offset < 0) {
+        LOGW("invalid upload file params.");
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        int err = errno;
+        LOGE("open %s err = %s.", path, strerror(err));
+        return false;
+    }
+
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+        int err = errno;
+        LOGE("fstat %s err = %s.", path, strerror(err));
+        close(fd);
+        return false;
+    }
+    if (offset > st.st_size || (len >= 0 && offset + len > st.st_size)) {
+        LOGW("upload range(%ld, %ld) is out of %s(size = %ld).", (long)offset, (long)len, path, (long)st.st_size);
+        close(fd);
+        return false;
+    }
+    if (len < 0) {
+        len = st.st_size - offset;
+    }
+
+    cehc_upload_t *u = cehc_upload_new(len);
+    if (!u) {
+        close(fd);
+        return false;
+    }
+
+    if (len > 0) {
+        // mmap的偏移需要页对齐，多映射的部分在交还时一起unmap。
+        off_t aligned = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+        size_t delta = (size_t)(offset - aligned);
+        void *m = mmap(NULL, (size_t)len + delta, PROT_READ, MAP_PRIVATE, fd, aligned);
+        if (MAP_FAILED == m) {
+            int err = errno;
+            LOGE("mmap %s err = %s.", path, strerror(err));
+            close(fd);
+            delete u;
+            return false;
+        }
+        madvise(m, (size_t)len + delta, MADV_SEQUENTIAL);
+        cehc_upload_buf_t b = {(const char*)m + delta, (size_t)len, cehc_upload_munmap, (void*)(uintptr_t)delta};
+        u->bufs.push_back(b);
+    }
+    close(fd);
+
+    if (!cehc_upload_attach(conn, u)) {
+        for (auto &b : u->bufs) {
+            cehc_upload_release(&b);
+        }
+        delete u;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+cehc_conn_upload_chunked(cehc_connection_ptr conn) {
+    if (!conn) {
+        return false;
+    }
+
+    cehc_upload_t *u = cehc_upload_new(-1);
+    if (!u) {
+        return false;
+    }
+
+    if (!cehc_upload_attach(conn, u)) {
+        delete u;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+cehc_upload_append(cehc_connection_ptr conn, const void *base, size_t len,
+                   cehc_upload_release_cb release, void *ctx) {
+    if (!conn || !conn->upload || conn->upload->total >= 0 || (len > 0 && !base)) {
+        LOGW("invalid upload append params.");
+        return false;
+    }
+
+    cehc_upload_t *u = conn->upload;
+    bool paused = false;
+    {
+        std::unique_lock<std::mutex> l(u->mtx);
+        if (u->finished) {
+            LOGW("append to a finished upload.");
+            return false;
+        }
+        if (len > 0) {
+            cehc_upload_buf_t b = {(const char*)base, len, release, ctx};
+            u->bufs.push_back(b);
+            std::swap(paused, u->paused);
+        }
+    }
+
+    // 只有发送回调确实暂停了传输才需要恢复，否则每次追加都会让事件循环多做一次恢复。
+    if (paused) {
+        cehc_resume_conn(conn);
+    }
+    return true;
+}
+
+void
+cehc_upload_finish(cehc_connection_ptr conn) {
+    if (!conn || !conn->upload) {
+        return;
+    }
+
+    cehc_upload_t *u = conn->upload;
+    bool paused = false;
+    {
+        std::unique_lock<std::mutex> l(u->mtx);
+        u->finished = true;
+        std::swap(paused, u->paused);
+    }
+    if (paused) {
+        cehc_resume_conn(conn);
+    }
+}
+
+uint64_t
+cehc_upload_sent(cehc_connection_ptr conn) {
+    return conn && conn->upload ? conn->upload->sent : 0;
+}
+
+size_t
+cehc_upload_on_send(cehc_connection_ptr conn, void *ptr, size_t size) {
+    cehc_upload_t *u = conn->upload;
+    char *dst = (char*)ptr;
+    size_t copied = 0;
+    if (u->total >= 0) {
+        while (copied < size && u->cur < u->bufs.size()) {
+            cehc_upload_buf_t &b = u->bufs[u->cur];
+            size_t n = std::min(size - copied, b.len - u->off);
+            memcpy(dst + copied, b.base + u->off, n);
+            copied += n;
+            u->off += n;
+            if (u->off == b.len) {
+                ++u->cur;
+                u->off = 0;
+            }
+        }
+        u->sent += copied;
+        return copied;
+    }
+
+    // chunked：发完的buffer在锁外交还，release中可以再append。
+    std::vector<cehc_upload_buf_t> done;
+    bool finished;
+    {
+        std::unique_lock<std::mutex> l(u->mtx);
+        u->started = true;
+        while (copied < size && u->cur < u->bufs.size()) {
+            cehc_upload_buf_t &b = u->bufs[u->cur];
+            size_t n = std::min(size - copied, b.len - u->off);
+            memcpy(dst + copied, b.base + u->off, n);
+            copied += n;
+            u->off += n;
+            if (u->off == b.len) {
+                done.push_back(b);
+                ++u->cur;
+                u->off = 0;
+            }
+        }
+        if (u->cur == u->bufs.size()) {
+            u->bufs.clear();
+            u->cur = 0;
+        }
+        finished = u->finished;
+        // 与是否暂停的判断在同一个锁内，之后的append/finish一定能看到paused。
+        u->paused = !copied && !finished;
+    }
+
+    for (auto &b : done) {
+        cehc_upload_release(&b);
+    }
+
+    u->sent += copied;
+    if (copied > 0 || finished) {
+        return copied;
+    }
+
+    // 生产者还没有追加数据，暂停传输，cehc_upload_append会恢复它。
+    return CURL_READFUNC_PAUSE;
+}
+
+void
+cehc_upload_reset(cehc_connection_ptr conn) {
+    cehc_upload_t *u = conn->upload;
+    if (u->total >= 0) {
+        u->cur = 0;
+        u->off = 0;
+        u->sent = 0;
+    } else if (u->started) {
+        LOGW("chunked upload of %s cannot be sent again.", conn->url);
+    }
+    u->paused = false;
+}
+
+void
+cehc_upload_free(cehc_connection_ptr conn) {
+    cehc_upload_t *u = conn->upload;
+    if (!u) {
+        return;
+    }
+
+    for (size_t i = u->cur; i < u->bufs.size(); ++i) {
+        cehc_upload_release(&u->bufs[i]);
+    }
+    if (u->total >= 0) {
+        // 定长的数据源发送过的buffer也还没有交还。
+        for (size_t i = 0; i < u->cur; ++i) {
+            cehc_upload_release(&u->bufs[i]);
+        }
+    }
+
+    delete u;
+    conn->upload = NULL;
+}
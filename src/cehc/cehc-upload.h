@@ -0,0 +1,108 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef cehc_upload__h
+#define cehc_upload__h
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "cehttpclient.h"
+
+#ifndef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 上传数据源：请求的body由一组不连续的buffer组成时不需要先拼接成一块。
+ * -> iovec：按顺序把每个buffer直接拷贝进curl的发送缓冲区，buffer的归属通过release回调交还给user；
+ * -> 文件：mmap整个文件(或其中一段)，按页顺序拷贝进curl的发送缓冲区，不经过read的用户态缓存；
+ * -> chunked：总长度未知时，由生产线程不断cehc_upload_append追加buffer，最后cehc_upload_finish，
+ *    curl以Transfer-Encoding: chunked发送；没有数据可发时暂停该传输(不阻塞事件循环)，追加之后恢复。
+ * 设置了数据源之后conn的send_cb不再被调用。数据源会设置CURLOPT_POST、CURLOPT_POSTFIELDSIZE_LARGE和
+ * CURLOPT_SEEKFUNCTION/SEEKDATA，其他方法(比如PUT)用CURLOPT_CUSTOMREQUEST指定。
+ * 需在cehc_run_conn之前设置，一个conn同时只有一个数据源，重新设置时旧的数据源被释放。
+ * iovec及文件的数据源在conn重复run时从头再发一次，chunked的数据源只能发送一次。
+ */
+
+/**
+ * 交还buffer。iovec的buffer在数据源被释放(conn释放或者设置了新的数据源)时交还；
+ * chunked的buffer在发送完之后即在事件循环线程中交还。
+ */
+typedef void (*cehc_upload_release_cb)(void *base, size_t len, void *ctx);
+
+/**
+ * 以iovec为body。
+ * @param conn
+ * @param iov 数组本身会被拷贝，buffer不会被拷贝，需要在交还之前有效
+ * @param iovcnt
+ * @param release 可以为NULL
+ * @param ctx release的参数
+ * @return 失败false，此时buffer不会被交还
+ */
+bool
+cehc_conn_upload_iov(cehc_connection_ptr conn, const struct iovec *iov, int iovcnt,
+                     cehc_upload_release_cb release, void *ctx);
+
+/**
+ * 以文件的一段为body。
+ * @param conn
+ * @param path
+ * @param offset
+ * @param len -1为到文件末尾
+ * @return 失败false
+ */
+bool
+cehc_conn_upload_file(cehc_connection_ptr conn, const char *path, off_t offset, int64_t len);
+
+/**
+ * 以chunked方式发送，之后用cehc_upload_append追加body。
+ */
+bool
+cehc_conn_upload_chunked(cehc_connection_ptr conn);
+
+/**
+ * 追加一个buffer，可在任意线程调用(同一个conn只能有一个生产线程)。
+ * @return conn不是chunked数据源或者已经finish时false，此时buffer不会被交还
+ */
+bool
+cehc_upload_append(cehc_connection_ptr conn, const void *base, size_t len,
+                   cehc_upload_release_cb release, void *ctx);
+
+/**
+ * body结束，已追加的数据发完之后结束上传。
+ */
+void
+cehc_upload_finish(cehc_connection_ptr conn);
+
+/**
+ * 已经交给curl的字节数。
+ */
+uint64_t
+cehc_upload_sent(cehc_connection_ptr conn);
+
+
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 事件循环线程调用，向curl的发送缓冲区填充数据。
+ * @return 填充的大小，0为发送完毕，或者CURL_READFUNC_PAUSE
+ */
+size_t
+cehc_upload_on_send(cehc_connection_ptr conn, void *ptr, size_t size);
+
+/**
+ * cehc_run_conn时重置。
+ */
+void
+cehc_upload_reset(cehc_connection_ptr conn);
+
+void
+cehc_upload_free(cehc_connection_ptr conn);
+
+#ifndef __cplusplus
+}
+#endif
+#endif //cehc_upload__h
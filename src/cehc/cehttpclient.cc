@@ -6,13 +6,43 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <errno.h>
 #include <curl/curl.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#include "../common/common-utils.h"
+#include "../common/logger.h"
+#include "../common/usdt.h"
+
 #include "cehttpclient.h"
+#include "cehc-breaker.h"
+#include "cehc-codec.h"
+#include "cehc-cq.h"
+#include "cehc-dispatch.h"
+#include "cehc-host.h"
+#include "cehc-lb.h"
+#include "cehc-lifecycle.h"
+#include "cehc-limiter.h"
+#include "cehc-poller.h"
+#include "cehc-records.h"
+#include "cehc-resolver.h"
+#include "cehc-sched.h"
+#include "cehc-share.h"
+#include "cehc-socket.h"
+#include "cehc-stream.h"
+#include "cehc-trace.h"
+#include "cehc-uds.h"
+#include "cehc-upload.h"
+
+// conn的resume_state：IDLE为在运行中(可以被恢复)，PENDING为在恢复队列中，DONE为没有在运行(新建或者已完成)。
+#define CEHC_RESUME_IDLE     0
+#define CEHC_RESUME_PENDING  1
+#define CEHC_RESUME_DONE     2
 
 #define cehc_def_epoll_event struct epoll_event ee;                \
                              bzero(&ee, sizeof(struct epoll_event));
@@ -26,8 +56,7 @@ cehc_set_nonblocking(int fd, cehc_connection_t *conn) {
     int opts;
     if((opts = fcntl(fd, F_GETFL)) < 0) {
         conn->err_no = errno;
-        //LOG(ERROR) << "get fd = " << fd << ", opts err = " << strerror(conn->err_no) << ", url = " << conn->url;
-        fprintf(stderr, "get fd = %d, opts err = %s, url = %s", fd, strerror(conn->err_no), conn->url);
+        LOGE("get fd = %d, opts err = %s, url = %s", fd, strerror(conn->err_no), conn->url);
 
         return opts;
     }
@@ -35,8 +64,7 @@ cehc_set_nonblocking(int fd, cehc_connection_t *conn) {
     opts = opts|O_NONBLOCK;
     if((conn->err_no = fcntl(fd, F_SETFL, opts)) < 0) {
         conn->err_no = errno;
-        //LOG(WARNING) << "set fd = " << fd << " O_NONBLOCK err = " << strerror(conn->err_no) << ", url = " << conn->url;
-        fprintf(stderr, "set fd = %d, O_NONBLOCK err = %s, url = %s", fd, strerror(conn->err_no), conn->url);
+        LOGW("set fd = %d, O_NONBLOCK err = %s, url = %s", fd, strerror(conn->err_no), conn->url);
 
         return conn->err_no;
     }
@@ -50,53 +78,185 @@ cehc_set_timer(cehc_http_service_t *hs, long time_ms) {
         return;
     }
 
-    Timer::Event ev(nullptr, &hs->timer_cb);
-    hs->timer->SubscribeEventAfter(uctime_t(0, time_ms * 1000 * 1000), ev);
+    Timer::Event ev(hs, &hs->timer_cb);
+    hs->timer->SubscribeEventAfter(uctime_t::from_ms(time_ms), ev);
+}
+
+/**
+ * 嵌入模式下curl的定时器由加在epoll中的timerfd实现，这样user只需要等待epoll fd即可。
+ * @param hs
+ * @param timeout_ms -1为取消，0为立即触发。
+ */
+static void
+cehc_set_timer_fd(cehc_http_service_t *hs, long timeout_ms) {
+    struct itimerspec its;
+    bzero(&its, sizeof(its));
+    if (-1 != timeout_ms) {
+        // it_value全0表示取消，所以立即触发用1ns。
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = timeout_ms ? (timeout_ms % 1000) * 1000 * 1000 : 1;
+    }
+
+    if (-1 == timerfd_settime(hs->timer_fd, 0, &its, NULL)) {
+        int err = errno;
+        LOGE("timerfd_settime err = %s.", strerror(err));
+    }
+}
+
+void
+cehc_wakeup_http_service(cehc_http_service_t *hs) {
+    uint64_t one = 1;
+    if (-1 == write(hs->notify_fd, &one, sizeof(one)) && EAGAIN != errno) {
+        int err = errno;
+        LOGE("write notify fd err = %s.", strerror(err));
+    }
+}
+
+/**
+ * 在事件循环线程中恢复所有排队的conn，需要持有multi_handles_mtx。
+ * @param hs
+ */
+static void
+cehc_process_resume_list(cehc_http_service_t *hs) {
+    cehc_connection_ptr conn = atomic_swap(&hs->resume_list, NULL);
+    while (conn) {
+        cehc_connection_ptr next = conn->resume_next;
+        conn->resume_next = NULL;
+        // 还在排队(admit_ns为0)的尚未交给curl，不需要恢复；被sched暂停的bulk由sched在有名额时恢复
+        // (CURLPAUSE_CONT两个方向都恢复)，这里恢复会越过max_inflight。
+        if (atomic_cas(&conn->resume_state, CEHC_RESUME_PENDING, CEHC_RESUME_IDLE)
+            && conn->admit_ns && !conn->sched_paused) {
+            CURLcode cc = curl_easy_pause(conn->easy, CURLPAUSE_CONT);
+            if (CURLE_OK != cc) {
+                // 恢复时交出暂存数据的回调失败了(如recv_cb要求中止)，curl不会再调度这个传输，在这里结束它。
+                LOGW("curl_easy_pause cont err = %s, url = %s.", curl_easy_strerror(cc), conn->url);
+                cehc_done_transfer(hs, conn, cc);
+            }
+        }
+        conn = next;
+    }
+}
+
+/**
+ * 一个conn的传输结束了(无论成功失败)，通知user。需要持有multi_handles_mtx。
+ * @param conn
+ */
+void
+cehc_finish_conn(cehc_connection_ptr conn) {
+    CEHC_PROBE7(conn__done, conn, conn->url, conn->result, conn->http_code, conn->run_ns, conn->admit_ns,
+                conn->rejected);
+    if (UNLIKELY(conn->trace_id)) {
+        cehc_trace_on_finish(conn);
+    }
+    // 归还名额，放行排队中的请求。
+    cehc_sched_release(conn);
+    cehc_limiter_release(conn);
+    cehc_breaker_release(conn);
+    cehc_lb_release(conn);
+
+    if (CEHC_RESUME_PENDING == atomic_swap(&conn->resume_state, CEHC_RESUME_DONE)) {
+        // 还挂在恢复队列中，先摘出来，否则user在complete_cb中释放conn之后事件循环会访问野指针。
+        cehc_process_resume_list(conn->http_service);
+    }
+
+    if (conn->stream) {
+        cehc_stream_on_complete(conn);
+    }
+
+    if (conn->records) {
+        cehc_records_on_complete(conn);
+    }
+
+    if (conn->codec && cehc_codec_on_complete(conn)) {
+        // 还有数据在工作线程中解压，由它通知user。
+        return;
+    }
+
+    if (conn->cq) {
+        cehc_cq_post(conn->cq, conn);
+        return;
+    }
+
+    if (conn->http_service->dispatch_pool) {
+        cehc_dispatch_complete(conn);
+        return;
+    }
+
+    if (conn->complete_cb) {
+        if (UNLIKELY(conn->trace_id)) {
+            cehc_trace_complete(conn);
+        } else {
+            conn->complete_cb(conn);
+        }
+    }
+}
+
+/**
+ * curl_multi_socket_action加上进出的探针，需要持有multi_handles_mtx。
+ */
+static inline CURLMcode
+cehc_socket_action(cehc_http_service_t *hs, curl_socket_t fd, int ev_bitmask) {
+    CEHC_PROBE3(action__entry, hs, fd, ev_bitmask);
+    CURLMcode cc;
+    if (UNLIKELY(hs->tracer) && cehc_trace_active(hs)) {
+        // 有采样的请求在传输时才记录，看它在等哪个线程上的处理。
+        int64_t start = CommonUtils::GetMonotonicNs();
+        cc = curl_multi_socket_action(hs->multi, fd, ev_bitmask, &(hs->running_count));
+        cehc_trace_span(hs, "socket_action", start, 0);
+    } else {
+        cc = curl_multi_socket_action(hs->multi, fd, ev_bitmask, &(hs->running_count));
+    }
+    CEHC_PROBE4(action__return, hs, fd, cc, hs->running_count);
+    return cc;
+}
+
+/**
+ * 传输结束，从multi中移除并通知user，需要持有multi_handles_mtx。之后不能再访问conn。
+ */
+void
+cehc_done_transfer(cehc_http_service_t *hs, cehc_connection_ptr conn, CURLcode result) {
+    CURLcode cc;
+    if ((cc =  curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &(conn->http_code))) != CURLE_OK) {
+        auto errmsg = curl_easy_strerror(cc);
+        LOGE("curl get http response code failed with errmsg = %s.", errmsg);
+        conn->ce_code = cc;
+        sprintf(conn->errormsg, "%s", errmsg);
+    }
+
+    conn->result = result;
+    cehc_lifecycle_on_done(conn);
+    curl_multi_remove_handle(hs->multi, conn->easy);
+    LOGD("%s: DONE %s => (fd = %d), (curl status = %s)",
+         __FUNCTION__, conn->url, conn->fd, curl_easy_strerror(result));
+    cehc_finish_conn(conn);
 }
 
 /* Check for completed transfers, and remove their easy handles */
 static void
 cehc_check_multi_info(cehc_http_service_t *http_service) {
-    //printf("[DEBUG] %s:.\n", __FUNCTION__);
+    LOGD("%s:.", __FUNCTION__);
     CURLMsg *msg = NULL;
     int msgs_left = 0;
     CURL *easy = NULL;
     while ((msg = curl_multi_info_read(http_service->multi, &msgs_left))) {
         if (msg->msg == CURLMSG_DONE) {
-            //printf("[INFO] %s: REMAINING=> %d\n", __FUNCTION__, http_service->running_count);
+            LOGD("%s: REMAINING=> %d", __FUNCTION__, http_service->running_count);
             easy = msg->easy_handle;
             if (!easy) {
-                //LOG(ERROR) << "easy handle is null!";
-                fprintf(stderr, "easy handle is null!");
+                LOGE("easy handle is null!");
                 continue;
             }
 
             cehc_connection_ptr conn = NULL;
             CURLcode cc;
             if (((cc = curl_easy_getinfo(easy, CURLINFO_PRIVATE, &conn)) != CURLE_OK) || !conn) {
-                //LOG(ERROR) << "conn is null! curl errmsg = " << curl_easy_strerror(cc) << ".";
-                fprintf(stderr, "conn is null! curl errmsg = %s.", curl_easy_strerror(cc));
+                LOGE("conn is null! curl errmsg = %s.", curl_easy_strerror(cc));
                 curl_multi_remove_handle(http_service->multi, easy);
                 curl_easy_cleanup(easy);
                 continue;
             }
 
-            if ((cc =  curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &(conn->http_code))) != CURLE_OK) {
-                auto errmsg = curl_easy_strerror(cc);
-                //LOG(ERROR) << "curl get http response code failed with errmsg = " << errmsg << ".";
-                fprintf(stderr, "curl get http response code failed with errmsg =  %s.", errmsg);
-                conn->ce_code = cc;
-                sprintf(conn->errormsg, "%s", errmsg);
-            }
-
-            curl_multi_remove_handle(http_service->multi, easy);
-            if (conn) {
-                //printf("[DEBUG] %s: DONE %s => (fd = %d), (curl status = %s)\n",
-                //       __FUNCTION__, conn->url, conn->fd, curl_easy_strerror(res));
-                if (conn->complete_cb) {
-                    conn->complete_cb(conn);
-                }
-            }
+            cehc_done_transfer(http_service, conn, msg->data.result);
         }
     }
 }
@@ -112,8 +272,8 @@ cehc_timer_handler(void *userp) {
     cehc_http_service_t *hs = static_cast<cehc_http_service_t*>(userp);
     if (hs && !hs->stop) {
         std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
-        curl_multi_socket_action(hs->multi, CURL_SOCKET_TIMEOUT, 0, &(hs->running_count));
-        //cehc_check_multi_info(hs);
+        cehc_socket_action(hs, CURL_SOCKET_TIMEOUT, 0);
+        cehc_check_multi_info(hs);
     }
 }
 
@@ -129,11 +289,30 @@ static size_t
 cehc_receive_data(void *ptr, size_t size, size_t nmemb, void *ctx) {
     cehc_connection_t *conn = (ctx ? (cehc_connection_t*)ctx : NULL);
     if (!conn) {
-        fprintf(stderr, "conn ctx is null!");
+        LOGE("conn ctx is null!");
         return 0;
     }
 
+    if (cehc_codec_decoding(conn)) {
+        return cehc_codec_on_recv(conn, ptr, size * nmemb);
+    }
+
+    if (conn->stream) {
+        return cehc_stream_on_recv(conn, ptr, size * nmemb);
+    }
+
+    if (conn->records) {
+        return cehc_records_on_recv(conn, ptr, size * nmemb);
+    }
+
+    if (conn->recv_cb && conn->http_service->dispatch_pool && !conn->cq) {
+        return cehc_dispatch_on_recv(conn, ptr, size * nmemb);
+    }
+
     if (conn->recv_cb) {
+        if (UNLIKELY(conn->trace_id)) {
+            return cehc_trace_recv(conn, ptr, size, nmemb);
+        }
         return conn->recv_cb(conn, ptr, size , nmemb);
     }
     return size * nmemb;
@@ -151,11 +330,18 @@ static size_t
 cehc_send_data(void *ptr, size_t size, size_t nmemb, void *ctx) {
     cehc_connection_t *conn = (ctx ? (cehc_connection_t*)ctx : NULL);
     if (!conn) {
-        //LOG(ERROR) << "conn ctx is null!";
-        fprintf(stderr, "conn ctx is null!");
+        LOGE("conn ctx is null!");
         return 0;
     }
 
+    if (conn->codec) {
+        cehc_codec_on_send(conn);
+    }
+
+    if (conn->upload) {
+        return cehc_upload_on_send(conn, ptr, size * nmemb);
+    }
+
     if (conn->send_cb) {
         return conn->send_cb(conn, ptr, size, nmemb);
     }
@@ -174,11 +360,14 @@ static size_t
 cehc_header_data(void *ptr, size_t size, size_t nmemb, void *ctx) {
     cehc_connection_t *conn = (ctx ? (cehc_connection_t*)ctx : NULL);
     if (!conn) {
-        //LOG(ERROR) << "conn ctx is null!";
-        fprintf(stderr, "conn ctx is null!");
+        LOGE("conn ctx is null!");
         return 0;
     }
 
+    if (conn->codec) {
+        cehc_codec_on_header(conn, (const char*)ptr, size * nmemb);
+    }
+
     if (conn->header_cb) {
         return conn->header_cb(conn, ptr, size, nmemb);
     }
@@ -192,24 +381,31 @@ cehc_complete_conn_by_ep_err(cehc_connection_ptr conn) {
             curl_multi_remove_handle(conn->http_service->multi, conn->easy);
         }
 
-        if (conn->complete_cb) {
-            conn->complete_cb(conn);
-        }
+        cehc_finish_conn(conn);
     }
 }
 
+/**
+ * 一个conn在传输过程中可能先后用到多个fd(如curl异步解析DNS的socketpair之后才是连接的socket)，
+ * 而curl是先通知新fd、再REMOVE旧fd的，并且旧fd通常已经被curl关闭(epoll已自动删除)，所以REMOVE按curl给的fd处理。
+ * @param fd
+ */
 static void
-cehc_ep_remove_conn(cehc_connection_t *conn) {
+cehc_ep_remove_conn(cehc_connection_t *conn, curl_socket_t fd) {
     if (LIKELY(conn->is_in_ep)) {
         SpinLock l(&conn->http_service->ep_sl);
         if (conn->is_in_ep) {
-            conn->is_in_ep = false;
             cehc_def_epoll_event;
-            ee.data.fd = conn->fd;
+            ee.data.fd = fd;
             ee.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLERR;
-            if (-1 == (conn->ep_code = epoll_ctl(conn->http_service->epfd, EPOLL_CTL_DEL, conn->fd, &ee))) {
+            if (-1 == cehc_poller_ctl(conn->http_service->poller, EPOLL_CTL_DEL, fd, ee.events)
+                && ENOENT != errno && EBADF != errno) {
+                conn->ep_code = -1;
                 cehc_process_ep_add_err();
             }
+            if (fd == conn->fd) {
+                conn->is_in_ep = false;
+            }
         }
     }
 }
@@ -224,18 +420,24 @@ cehc_ep_set_conn(cehc_connection_t *conn, curl_socket_t fd, CURL *easy, int act)
     cehc_def_epoll_event;
     ee.events = (uint32_t)event_kind;
     ee.data.fd = fd;
-    conn->fd = fd;
     conn->easy = easy;
     SpinLock l(&conn->http_service->ep_sl);
-    if (conn->is_in_ep) { // 已经存在了，即做修改动作
-        //printf("[DEBUG] %s: epoll_mod fd = %d\n", __FUNCTION__, fd);
-        if ((conn->ep_code = epoll_ctl(conn->http_service->epfd, EPOLL_CTL_MOD, fd, &ee)) == -1) {
+    bool same_fd = conn->is_in_ep && conn->fd == fd;
+    conn->fd = fd;
+    if (same_fd) { // 已经存在了，即做修改动作
+        LOGD("%s: epoll_mod fd = %d", __FUNCTION__, fd);
+        conn->ep_code = cehc_poller_ctl(conn->http_service->poller, EPOLL_CTL_MOD, fd, ee.events);
+        if (-1 == conn->ep_code && ENOENT == errno) {
+            // 旧socket关闭之后新socket复用了同一个fd号，epoll中已经没有它了，重新加入。
+            conn->ep_code = cehc_poller_ctl(conn->http_service->poller, EPOLL_CTL_ADD, fd, ee.events);
+        }
+        if (-1 == conn->ep_code) {
             conn->err_no = errno;
-            fprintf(stderr, "epoll_ctl err = %s.", strerror(conn->err_no));
+            LOGE("epoll_ctl mod fd = %d err = %s.", fd, strerror(conn->err_no));
             // MOD失败，从ep中删除。
-            if (-1 == epoll_ctl(conn->http_service->epfd, EPOLL_CTL_DEL, fd, &ee)) {
+            if (-1 == cehc_poller_ctl(conn->http_service->poller, EPOLL_CTL_DEL, fd, ee.events)) {
                 int err = errno;
-                fprintf(stderr, "epoll_ctl del err = %s.", strerror(err));
+                LOGE("epoll_ctl del fd = %d err = %s.", fd, strerror(err));
             } else {
                 conn->is_in_ep = false;
             }
@@ -243,8 +445,8 @@ cehc_ep_set_conn(cehc_connection_t *conn, curl_socket_t fd, CURL *easy, int act)
             cehc_complete_conn_by_ep_err(conn);
         }
     } else { // 不存在，新增动作
-        //printf("[DEBUG] %s: epoll_add fd = %d\n", __FUNCTION__, fd);
-        if ((conn->ep_code = epoll_ctl(conn->http_service->epfd, EPOLL_CTL_ADD, fd, &ee)) == -1) {
+        LOGD("%s: epoll_add fd = %d", __FUNCTION__, fd);
+        if ((conn->ep_code = cehc_poller_ctl(conn->http_service->poller, EPOLL_CTL_ADD, fd, ee.events)) == -1) {
             cehc_process_ep_add_err();
         } else {
             conn->is_in_ep = true;
@@ -258,22 +460,26 @@ cehc_curl_conn_cb(CURL *easy, curl_socket_t fd, int what, void *cbp, void *no_us
     cehc_connection_t *conn = NULL;
     curl_easy_getinfo(easy, CURLINFO_PRIVATE, &conn);
     if (!conn) {
-        fprintf(stdout, "WARNING: conn is null.");
+        LOGW("conn is null.");
         return 0;
     }
 
 #ifdef DEBUG_LOG
     const char *what_str[] = {"none", "IN", "OUT", "INOUT", "REMOVE"};
-    LOGDFUN6("fd = ", fd, ", what = ", what_str[what], ", url = ", conn->url);
+    LOGD("fd = %d, what = %s, url = %s", fd, what_str[what], conn->url);
 #endif
 
+    CEHC_PROBE3(sock__cb, conn, fd, what);
     if (what == CURL_POLL_REMOVE) {
-        cehc_ep_remove_conn(conn);
+        cehc_ep_remove_conn(conn, fd);
+        cehc_lifecycle_on_poll(conn->http_service, fd, false);
     } else {
-        if (-1 == cehc_set_nonblocking(fd, conn)) {
+        // 本service创建的socket生来就是非阻塞的，只有其他来源的fd才需要设置。
+        if (!cehc_sock_lookup(conn->http_service, fd) && -1 == cehc_set_nonblocking(fd, conn)) {
             return -1;
         }
         cehc_ep_set_conn(conn, fd, easy, what);
+        cehc_lifecycle_on_poll(conn->http_service, fd, true);
     }
 
     return 0;
@@ -290,17 +496,23 @@ static int
 cehc_curl_timer_cb(CURLM *multi,    /* multi handle */
                    long timeout_ms, /* see above */
                    void *userp)   /* private callback pointer */ {
-//    LOGDFUN1(timeout_ms);
+    LOGD("timeout_ms = %ld", timeout_ms);
     if (userp) {
         cehc_http_service_t *hs = (cehc_http_service_t *)userp;
-        if (-1 == timeout_ms) { // cancel timer
-            hs->timer->UnsubscribeAllEvent();
+        if (hs->embedded) {
+            cehc_set_timer_fd(hs, timeout_ms);
+        } else if (-1 == timeout_ms) { // cancel timer
+            hs->timer->UnsubscribeEvents(&hs->timer_cb, false);
+        } else if (0 == timeout_ms) {
+            // 立即超时(如刚add了一个handle)不经过定时器线程，直接让事件循环处理，省掉一次定时器的调度延迟。
+            if (!atomic_swap(&hs->timeout_kick, 1)) {
+                cehc_wakeup_http_service(hs);
+            }
         } else {
-            timeout_ms = timeout_ms ? timeout_ms : 5;
             cehc_set_timer(hs, timeout_ms);
         }
     } else {
-        fprintf(stdout, "WARNING: userp is empty!");
+        LOGW("userp is empty!");
     }
 
     return 0;
@@ -310,112 +522,240 @@ static bool
 cehc_init_curl_multi_service(cehc_http_service_t *hs) {
     CURLMcode cm_code = CURLM_OK;
     if ((cm_code = curl_multi_setopt(hs->multi, CURLMOPT_SOCKETFUNCTION, cehc_curl_conn_cb)) != CURLM_OK) {
-        fprintf(stderr, "FATAL: %s", curl_multi_strerror(cm_code));
+        LOGE("curl_multi_setopt err = %s.", curl_multi_strerror(cm_code));
         return false;
     }
     if ((cm_code = curl_multi_setopt(hs->multi, CURLMOPT_TIMERDATA, hs)) != CURLM_OK) {
-        fprintf(stderr, "FATAL: %s", curl_multi_strerror(cm_code));
+        LOGE("curl_multi_setopt err = %s.", curl_multi_strerror(cm_code));
         return false;
     }
     if ((cm_code = curl_multi_setopt(hs->multi, CURLMOPT_TIMERFUNCTION, cehc_curl_timer_cb)) != CURLM_OK) {
-        fprintf(stderr, "FATAL: %s", curl_multi_strerror(cm_code));
+        LOGE("curl_multi_setopt err = %s.", curl_multi_strerror(cm_code));
         return false;
     }
     // 重要，少了会导致curl链接不足。
     if ((cm_code = curl_multi_setopt(hs->multi, CURLMOPT_MAXCONNECTS, 256)) != CURLM_OK) {
-        fprintf(stderr, "FATAL: %s", curl_multi_strerror(cm_code));
+        LOGE("curl_multi_setopt err = %s.", curl_multi_strerror(cm_code));
         return false;
     }
 
     return true;
 }
 
-static void *
-cehc_inner_run_http_serivce(void *ctx) {
-    if (!ctx) {
-        return NULL;
+/**
+ * 完成所有被本地拒绝的conn，需要持有multi_handles_mtx。
+ * @param hs
+ */
+static void
+cehc_process_reject_list(cehc_http_service_t *hs) {
+    cehc_connection_ptr conn = hs->reject_head;
+    hs->reject_head = hs->reject_tail = NULL;
+    while (conn) {
+        // complete_cb中conn可能被释放。
+        cehc_connection_ptr next = conn->reject_next;
+        conn->reject_next = NULL;
+        cehc_finish_conn(conn);
+        conn = next;
     }
+}
 
-    cehc_http_service_t *hs = (cehc_http_service_t*)ctx;
+/**
+ * 处理其他线程通过notify_fd交给事件循环的请求。
+ * @param hs
+ */
+static void
+cehc_process_notify(cehc_http_service_t *hs) {
+    uint64_t cnt;
+    // 先清eventfd再取队列，保证cehc_resume_conn只在队列由空变非空时写eventfd也不会丢失唤醒。
+    if (-1 == read(hs->notify_fd, &cnt, sizeof(cnt)) && EAGAIN != errno) {
+        int err = errno;
+        LOGE("read notify fd err = %s.", strerror(err));
+    }
+
+    bool kick = atomic_swap(&hs->timeout_kick, 0);
+    bool sched_kick = atomic_swap(&hs->sched_kick, 0);
+    if (!hs->resume_list && !kick && !sched_kick && !hs->reject_head) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    cehc_process_reject_list(hs);
+    cehc_process_resume_list(hs);
+    if (sched_kick) {
+        cehc_sched_apply(hs);
+    }
+    // curl_easy_pause(CONT)只是让curl在下一次超时检查时处理它，这里直接驱动，避免等待定时器。
+    // 立即超时的请求也在这里处理。
+    cehc_socket_action(hs, CURL_SOCKET_TIMEOUT, 0);
+    cehc_check_multi_info(hs);
+}
+
+/**
+ * 嵌入模式下timerfd到期，驱动curl的超时处理。
+ * @param hs
+ */
+static void
+cehc_process_timer_fd(cehc_http_service_t *hs) {
+    uint64_t cnt;
+    if (-1 == read(hs->timer_fd, &cnt, sizeof(cnt)) && EAGAIN != errno) {
+        int err = errno;
+        LOGE("read timer fd err = %s.", strerror(err));
+    }
+
+    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+    cehc_socket_action(hs, CURL_SOCKET_TIMEOUT, 0);
+    cehc_check_multi_info(hs);
+}
+
+/**
+ * 事件循环的一次迭代：epoll_wait一次并处理得到的所有事件。
+ * @param hs
+ * @param timeout_ms epoll_wait的timeout
+ * @param spin 忙轮询中的一次，没有事件时什么也不做
+ * @return epoll_wait的返回值
+ */
+static int
+cehc_loop_once(cehc_http_service_t *hs, int timeout_ms, bool spin) {
     int revents = 0;
+    struct epoll_event ees[hs->ep_once_ev_cnt]; // ees -> epoll events
+    int err = 0;
+    int ees_cnt = cehc_poller_wait(hs->poller, ees, hs->ep_once_ev_cnt, timeout_ms);
+    // 本轮的回调及其之后的代码用粗粒度时钟即可；忙轮询空转的那些轮次不刷新，也不触发探针。
+    if (ees_cnt || !spin) {
+        CommonUtils::TickCoarseMonotonicNs();
+        CEHC_PROBE3(loop__wake, hs, ees_cnt, timeout_ms);
+    }
+    switch (ees_cnt) {
+        case -1: {
+            err = errno;
+            if (EINTR != err) { // if not sys interrupt
+                // log err
+                LOGE("epoll wait err = %s.", strerror(err));
+            }
+            errno = err;
+            break;
+        }
+        case 0: {
+            // 嵌入模式的curl超时由timerfd驱动，无需在这里处理。
+            if (hs->stop || hs->embedded || spin) {
+                break;
+            }
 
-    while (!hs->stop) {
-        struct epoll_event ees[hs->ep_once_ev_cnt]; // ees -> epoll events
-        int err = 0;
-        int ees_cnt = epoll_wait(hs->epfd, ees, hs->ep_once_ev_cnt, hs->ep_timeout_ms);
-        switch (ees_cnt) {
-            case -1: {
+            if (-1 == timeout_ms) { // 无超时还返回了0个
                 err = errno;
-                if (EINTR != err) { // if not sys interrupt
-                    // log err
-                    fprintf(stderr, "epoll wait err = %s", strerror(err));
+                if (EINTR != err) {
+                    LOGE("epoll wait err = %s.", strerror(err));
                 }
+
                 break;
             }
-            case 0: {
-                if (hs->stop) {
-                    break;
+            // curl fd初始化
+            std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
+            cehc_socket_action(hs, CURL_SOCKET_TIMEOUT, 0);
+            cehc_check_multi_info(hs);
+            break;
+        }
+        default: { // > 0，有事件接入。
+            // 可以通过conn这个ctx隔离不同链接，因为每一个链接的conn都是独立的，非公享的，
+            // 你可能需要根据业务自行扩展jrs_connection_t这个上下文类，可以学习nginx及nginx-rtmp进行功能细分，
+            // 事件为事件，session为session，组合在conn之中。
+            int i;
+            for (i = 0; i < ees_cnt; ++i) {
+                if (ees[i].data.fd == hs->notify_fd) {
+                    cehc_process_notify(hs);
+                    continue;
                 }
 
-                if (-1 == hs->ep_timeout_ms) { // 无超时还返回了0个
-                    err = errno;
-                    if (EINTR != err) {
-                        fprintf(stderr, "epoll wait err = %s", strerror(err));
-                    }
-
+                if (hs->embedded && ees[i].data.fd == hs->timer_fd) {
+                    cehc_process_timer_fd(hs);
                     continue;
                 }
-                // curl fd初始化
+
+                revents = ees[i].events;
+                if ((revents & (EPOLLERR | EPOLLHUP))
+                    && (revents & (EPOLLIN | EPOLLOUT)) == 0) {
+                    /*
+                     * if the errormsg events were returned without EPOLLIN or EPOLLOUT,
+                     * then add these flags to handle the events at least in one
+                     * active handler
+                     */
+                    LOGW("epoll_wait() error on fd: %d, events = 0x%x.", ees[i].data.fd, revents);
+                    revents |= EPOLLIN | EPOLLOUT;
+                }
+
+                CURLMcode cc = CURLM_OK;
                 std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
-                curl_multi_socket_action(hs->multi, CURL_SOCKET_TIMEOUT, 0, &(hs->running_count));
+                if (revents & EPOLLIN) {
+                    cc = cehc_socket_action(hs, ees[i].data.fd, CURL_CSELECT_IN);
+                }
+
+                if (revents & EPOLLOUT) {
+                    cc = cehc_socket_action(hs, ees[i].data.fd, CURL_CSELECT_OUT);
+                }
+
+                if (CURLM_OK != cc) {
+                    err = errno;
+                    LOGE("curl_multi_socket_action err = %s, sys err = %s.",
+                         curl_multi_strerror(cc), strerror(err));
+                }
+
                 cehc_check_multi_info(hs);
-                break;
             }
-            default: { // > 0，有事件接入。
-                // 可以通过conn这个ctx隔离不同链接，因为每一个链接的conn都是独立的，非公享的，
-                // 你可能需要根据业务自行扩展jrs_connection_t这个上下文类，可以学习nginx及nginx-rtmp进行功能细分，
-                // 事件为事件，session为session，组合在conn之中。
-                int i;
-                for (i = 0; i < ees_cnt; ++i) {
-                    revents = ees[i].events;
-                    if ((revents & (EPOLLERR | EPOLLHUP))
-                        && (revents & (EPOLLIN | EPOLLOUT)) == 0) {
-                        /*
-                         * if the errormsg events were returned without EPOLLIN or EPOLLOUT,
-                         * then add these flags to handle the events at least in one
-                         * active handler
-                         */
-                        fprintf(stderr, "epoll_wait() errormsg on fd: %d, events = ", ees[i].data.fd, revents);
-                        revents |= EPOLLIN | EPOLLOUT;
-                    }
-
-                    CURLMcode cc = CURLM_OK;
-                    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
-                    if (revents & EPOLLIN) {
-                        cc = curl_multi_socket_action(hs->multi, ees[i].data.fd,
-                                                      CURL_CSELECT_IN, &(hs->running_count));
-                    }
-
-                    if (revents & EPOLLOUT) {
-                        cc = curl_multi_socket_action(hs->multi, ees[i].data.fd,
-                                                      CURL_CSELECT_OUT, &(hs->running_count));
-                    }
-
-                    if (CURLM_OK != cc) {
-                        err = errno;
-                        fprintf(stderr, "curl_multi_socket_action err = %s,"
-                            " sys err = %s", curl_multi_strerror(cc), strerror(err));
-                    }
-
-                    cehc_check_multi_info(hs);
+            break;
+        }
+    }
+
+    // 嵌入模式下user直接等待后端的fd，本轮curl回调中对关注事件的修改需要先提交(epoll下为空操作)；
+    // 自带线程时留到下一次等待，与之合并为一次系统调用。
+    if (hs->embedded) {
+        cehc_poller_flush(hs->poller);
+    }
+    return ees_cnt;
+}
+
+/**
+ * 带忙轮询的一次事件循环：最近busy_poll_us内有过事件时，先以0超时反复轮询直到有事件或者超过busy_poll_us，
+ * 之后才阻塞等待timeout_ms。
+ * @param hs
+ * @param timeout_ms
+ * @return 同cehc_loop_once
+ */
+static int
+cehc_loop_adaptive(cehc_http_service_t *hs, int timeout_ms) {
+    int n;
+    if (hs->busy_poll_us > 0 && timeout_ms) {
+        int64_t deadline = hs->last_active_ns + (int64_t)hs->busy_poll_us * 1000;
+        while (!hs->stop && CommonUtils::GetMonotonicNs() < deadline) {
+            if ((n = cehc_loop_once(hs, 0, true))) {
+                if (n > 0) {
+                    hs->last_active_ns = CommonUtils::GetCoarseMonotonicNs();
                 }
-                break;
+                return n;
             }
+            soft_yield_cpu();
         }
     }
 
-    std::unique_lock<std::mutex> l(hs->multi_handles_mtx);
-    curl_multi_cleanup(hs->multi);
+    n = cehc_loop_once(hs, timeout_ms, false);
+    if (n > 0 && hs->busy_poll_us > 0) {
+        hs->last_active_ns = CommonUtils::GetCoarseMonotonicNs();
+    }
+    return n;
+}
+
+static void *
+cehc_inner_run_http_serivce(void *ctx) {
+    if (!ctx) {
+        return NULL;
+    }
+
+    cehc_http_service_t *hs = (cehc_http_service_t*)ctx;
+    pthread_setname_np(pthread_self(), "cehc-loop");
+    while (!hs->stop) {
+        cehc_loop_adaptive(hs, hs->ep_timeout_ms);
+    }
+
+    // multi handle在cehc_delete_http_serivce中释放。
     return NULL;
 }
 
@@ -425,6 +765,9 @@ cehc_inner_run_http_serivce(void *ctx) {
  *    ->CURLOPT_WRITEDATA、CURLOPT_WRITEFUNCTION、CURLOPT_READDATA、CURLOPT_READFUNCTION
  *    ->CURLOPT_HEADERDATA、CURLOPT_HEADERFUNCTION
  *    ->CURLOPT_PRIVATE、CURLOPT_URL、CURLOPT_NOSIGNAL
+ *    ->CURLOPT_OPENSOCKETDATA、CURLOPT_OPENSOCKETFUNCTION、CURLOPT_SOCKOPTDATA、CURLOPT_SOCKOPTFUNCTION
+ *    ->CURLOPT_CLOSESOCKETDATA、CURLOPT_CLOSESOCKETFUNCTION(socket选项请用cehc_http_service_set_sock_opts)
+ *    ->CURLOPT_RESOLVE(设置了解析缓存时，见cehc-resolver.h)
  * @param url
  * @param hs 如果是c++，此参数实际应用时应当隐藏在http service之中不需要用户传入
  * @return 一个链接
@@ -432,23 +775,32 @@ cehc_inner_run_http_serivce(void *ctx) {
 cehc_connection_t*
 cehc_new_conn(cehc_newconn_params_ptr params) {
     if (!params) {
-        fprintf(stdout, "WARNING: input params cannot be null!");
+        LOGW("input params cannot be null!");
         return NULL;
     }
 
+    return cehc_new_conn_with_easy(params, curl_easy_init());
+}
+
+cehc_connection_t*
+cehc_new_conn_with_easy(cehc_newconn_params_ptr params, CURL *easy) {
     cehc_connection_t *conn = (cehc_connection_t *) calloc(1, sizeof(cehc_connection_t));
     if (!conn) {
         int err = errno;
-        fprintf(stderr, "calloc connection oom with err = %s", strerror(err));
+        LOGE("calloc connection oom with err = %s.", strerror(err));
+        if (easy) {
+            curl_easy_cleanup(easy);
+        }
         return NULL;
     }
 
     conn->errormsg[0] = '\0';
-    conn->easy = curl_easy_init();
+    conn->resume_state = CEHC_RESUME_DONE;
+    conn->easy = easy;
     if (!conn->easy) {
         conn->err_no = errno;
         auto errmsg = strerror(conn->err_no);
-        fprintf(stderr, "curl_easy_init failed, exiting with errmsg = %s.", errmsg);
+        LOGE("curl_easy_init failed with errmsg = %s.", errmsg);
         sprintf(conn->errormsg, "%s", errmsg);
         return conn;
     }
@@ -460,6 +812,8 @@ cehc_new_conn(cehc_newconn_params_ptr params) {
     conn->header_cb = params->header_cb;
     conn->complete_cb = params->complete_cb;
     conn->user_ctx = params->user_ctx;
+    conn->cq = params->cq;
+    conn->priority = params->priority;
     conn->url = strdup(params->url); // url need free in easy done.
 
     // ****Begin: 本封装保留的easy设置，user不可使用。****
@@ -490,11 +844,30 @@ cehc_new_conn(cehc_newconn_params_ptr params) {
     if (CURLE_OK != (conn->ce_code = curl_easy_setopt(conn->easy, CURLOPT_NOSIGNAL, 1L))) {
         goto Label_init_err;
     }
+    if (CURLE_OK != (conn->ce_code = cehc_sock_setup_easy(conn->http_service, conn->easy))) {
+        goto Label_init_err;
+    }
+    if (CURLE_OK != (conn->ce_code = cehc_share_setup_easy(conn->http_service, conn->easy))) {
+        goto Label_init_err;
+    }
+    if (CURLE_OK != (conn->ce_code = cehc_lifecycle_setup_easy(conn->http_service, conn->easy))) {
+        goto Label_init_err;
+    }
     // ****End: 本封装保留的easy设置，user不可使用。****
+    // endpoint group的conn在每次run时才确定副本(及其host)。
+    cehc_lb_bind_conn(conn);
+    if (!conn->lb_group) {
+        cehc_resolver_bind_conn(conn);
+        cehc_uds_bind_conn(conn);
+        if (conn->http_service->limiter || conn->http_service->breaker) {
+            conn->host = cehc_host_get(conn->http_service, conn->url);
+        }
+    }
+    CEHC_PROBE2(conn__new, conn, conn->url);
     return conn;
 
     Label_init_err:
-    fprintf(stderr, "%s, %s", __func__, curl_easy_strerror(conn->ce_code));
+    LOGE("%s, %s", __func__, curl_easy_strerror(conn->ce_code));
     curl_easy_cleanup(conn->easy);
     return NULL;
 }
@@ -506,8 +879,19 @@ cehc_new_conn(cehc_newconn_params_ptr params) {
 void
 cehc_delete_conn(cehc_connection_t **conn) {
     if (conn && *conn) {
-        cehc_ep_remove_conn(*conn);
+        cehc_limiter_forget(*conn);
+        cehc_sched_forget(*conn);
+        cehc_breaker_forget(*conn);
+        cehc_lb_free_conn(*conn);
+        cehc_ep_remove_conn(*conn, (*conn)->fd);
+        cehc_stream_free(*conn);
+        // 先断开压缩任务，它们会向上传追加数据。
+        cehc_codec_free(*conn);
+        cehc_upload_free(*conn);
+        cehc_records_free(*conn);
+        cehc_dispatch_free(*conn);
         curl_easy_cleanup((*conn)->easy);
+        cehc_resolver_free_conn(*conn);
         free((*conn)->url);
         free(*conn);
         *conn = NULL;
@@ -515,16 +899,50 @@ cehc_delete_conn(cehc_connection_t **conn) {
 }
 
 
-static void
+/**
+ * 重置conn的状态准备运行。
+ * @return conn还在运行(或者还挂在恢复队列中)时不能重置，返回false
+ */
+static bool
 cehc_init_conn(cehc_connection_ptr conn) {
+    if (!atomic_cas(&conn->resume_state, CEHC_RESUME_DONE, CEHC_RESUME_IDLE)) {
+        LOGW("conn of %s is still running.", conn->url);
+        return false;
+    }
+
     conn->ce_code = CURLE_OK;
     conn->cm_code = CURLM_OK;
     conn->err_no = 0;
     conn->ep_code = 0;
     conn->fd = 0;
     conn->http_code = 0;
+    conn->rejected = CEHC_REJECT_NONE;
+    conn->result = CURLE_OK;
+    conn->admit_ns = 0;
+    conn->trace_id = 0;
     conn->is_in_ep = false;
+    conn->resume_next = NULL;
+    conn->cq_next = NULL;
+    conn->reject_next = NULL;
+    conn->sched_paused = false;
     bzero(conn->errormsg, sizeof(conn->errormsg));
+    if (conn->stream) {
+        cehc_stream_reset(conn);
+    }
+    if (conn->upload) {
+        cehc_upload_reset(conn);
+    }
+    if (conn->records) {
+        cehc_records_reset(conn);
+    }
+    if (conn->codec) {
+        cehc_codec_reset(conn);
+    }
+    if (conn->dispatch) {
+        cehc_dispatch_reset(conn);
+    }
+    conn->dispatch_delay_ns = 0;
+    return true;
 }
 
 
@@ -550,20 +968,105 @@ cehc_run_conn(cehc_connection_ptr conn, char *errmsg) {
         return false;
     }
 
-    CURLMcode rc;
     // 交给multi托管
-    cehc_init_conn(conn);
+    if (!cehc_init_conn(conn)) {
+#define conn_running_err "Conn is still running!\0"
+        if (errmsg)
+            sprintf(errmsg, "%s", conn_running_err);
+        return false;
+    }
+    // 精确的开始时间，同时刷新粗粒度时钟，之后的选副本、熔断、DNS缓存过期等判断都用后者。
+    conn->run_ns = CommonUtils::TickCoarseMonotonicNs();
+    CEHC_PROBE3(conn__run, conn, conn->url, conn->run_ns);
+    cehc_resolver_apply(conn);
+    int64_t lock_ns = 0;
+    if (UNLIKELY(conn->http_service->tracer)) {
+        cehc_trace_on_run(conn);
+        if (conn->trace_id) {
+            lock_ns = CommonUtils::GetMonotonicNs();
+        }
+    }
     std::unique_lock<std::mutex> l(conn->http_service->multi_handles_mtx);
+    if (UNLIKELY(lock_ns)) {
+        cehc_trace_span(conn->http_service, "lock_wait", lock_ns, conn->trace_id);
+    }
+    if (!cehc_lb_pick(conn)) {
+        conn->resume_state = CEHC_RESUME_DONE;
+        if (errmsg)
+            sprintf(errmsg, "%s", conn->errormsg);
+        return false;
+    }
+
+    if (!cehc_uds_apply_endpoint(conn)) {
+        cehc_lb_release(conn);
+        conn->resume_state = CEHC_RESUME_DONE;
+        if (errmsg)
+            sprintf(errmsg, "%s", conn->errormsg);
+        return false;
+    }
+
+    if (!cehc_breaker_admit(conn)) {
+        // 熔断中，不创建传输，交给事件循环完成：与正常的完成一样在事件循环中回调user，不在调用cehc_run_conn
+        // 的线程(可能持有user自己的锁)中回调。之后不能再访问conn。队列由空变非空时才需要唤醒。
+        cehc_http_service_t *hs = conn->http_service;
+        bool wakeup = !hs->reject_head;
+        if (hs->reject_tail) {
+            hs->reject_tail->reject_next = conn;
+        } else {
+            hs->reject_head = conn;
+        }
+        hs->reject_tail = conn;
+        l.unlock();
+        if (wakeup) {
+            cehc_wakeup_http_service(hs);
+        }
+        return true;
+    }
+
+    int limited = cehc_limiter_submit(conn);
+    if (CEHC_LIMIT_REJECTED == limited) {
+        cehc_breaker_release(conn);
+        cehc_lb_release(conn);
+        conn->resume_state = CEHC_RESUME_DONE;
+        if (errmsg)
+            sprintf(errmsg, "%s", conn->errormsg);
+        return false;
+    }
+
+    // 排队中，稍后由事件循环交给multi
+    if (CEHC_LIMIT_QUEUED == limited || !cehc_sched_submit(conn)) {
+        return true;
+    }
+
+    if (!cehc_add_conn_to_multi(conn)) {
+        cehc_sched_release(conn);
+        cehc_limiter_release(conn);
+        cehc_breaker_release(conn);
+        cehc_lb_release(conn);
+        conn->resume_state = CEHC_RESUME_DONE;
+        if (errmsg)
+            sprintf(errmsg, "%s", conn->errormsg);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+cehc_add_conn_to_multi(cehc_connection_ptr conn) {
+    CURLMcode rc;
     if ((rc = curl_multi_add_handle(conn->http_service->multi, conn->easy)) != CURLM_OK) {
         auto errm = curl_multi_strerror(rc);
-        fprintf(stderr, "curl_multi_add_handle err with errmsg = %s.", errm);
+        LOGE("curl_multi_add_handle err with errmsg = %s.", errm);
         conn->cm_code = rc;
         sprintf(conn->errormsg, "%s", errm);
-        if (errmsg)
-            sprintf(errmsg, "%s", conn->errormsg);
         return false;
     }
 
+    conn->admit_ns = CommonUtils::GetMonotonicNs();
+    if (UNLIKELY(conn->trace_id)) {
+        cehc_trace_on_admit(conn);
+    }
     return true;
 }
 
@@ -574,8 +1077,38 @@ cehc_run_conn(cehc_connection_ptr conn, char *errmsg) {
 bool
 cehc_conn_ok_except_httpcode(cehc_connection_ptr conn) {
     return !(!conn || 0 != conn->err_no || 0 != conn->ep_code
-             || CURLM_OK != conn->cm_code || CURLE_OK != conn->ce_code);
+             || CURLM_OK != conn->cm_code || CURLE_OK != conn->ce_code
+             || CEHC_REJECT_NONE != conn->rejected);
+
+}
+
+
+/**
+ * 恢复一个被暂停的conn，可在任意线程调用，实际的恢复动作在事件循环中执行。
+ * @param conn
+ */
+void
+cehc_resume_conn(cehc_connection_ptr conn) {
+    if (!conn || !conn->http_service) {
+        return;
+    }
+
+    // 只有IDLE->PENDING的那一次入队；DONE表示传输已结束，不再入队。
+    if (!atomic_cas(&conn->resume_state, CEHC_RESUME_IDLE, CEHC_RESUME_PENDING)) {
+        return;
+    }
+
+    cehc_http_service_t *hs = conn->http_service;
+    cehc_connection_ptr head;
+    do {
+        head = hs->resume_list;
+        conn->resume_next = head;
+    } while (!atomic_cas(&hs->resume_list, head, conn));
 
+    // 队列由空变非空才需要唤醒，非空时事件循环必然还会再来取。
+    if (!head) {
+        cehc_wakeup_http_service(hs);
+    }
 }
 
 
@@ -588,7 +1121,7 @@ bool
 cehc_init_curl_global_service() {
     if (CURLE_OK != curl_global_init(CURL_GLOBAL_ALL)) {
         int err = errno;
-        fprintf(stderr, "curl_global_init err = %s.", strerror(err));
+        LOGE("curl_global_init err = %s.", strerror(err));
         return false;
     }
     return true;
@@ -600,6 +1133,7 @@ cehc_init_curl_global_service() {
 void
 cehc_uninit_curl_global_service() {
     curl_global_cleanup();
+    Logger::Flush();
 }
 
 /**
@@ -611,11 +1145,9 @@ cehc_uninit_curl_global_service() {
  */
 cehc_http_service_t *
 cehc_new_http_service(int ep_ev_cnt, int ep_once_ev_cnt, int ep_timeout_ms) {
-    // epoll
-    int epfd = epoll_create(ep_ev_cnt);
-    if (-1 == epfd) {
-        int err = errno;
-        fprintf(stderr, "epoll_create err = %s.", strerror(err));
+    // 事件等待后端，默认epoll
+    cehc_poller_t *poller = cehc_poller_new(CEHC_POLLER_EPOLL, ep_ev_cnt);
+    if (!poller) {
         return NULL;
     }
 
@@ -623,25 +1155,55 @@ cehc_new_http_service(int ep_ev_cnt, int ep_once_ev_cnt, int ep_timeout_ms) {
     CURLM *cm = curl_multi_init();
     if (!cm) {
         int err = errno;
-        fprintf(stderr, "curl_multi_init err = %s.", strerror(err));
+        LOGE("curl_multi_init err = %s.", strerror(err));
+        return NULL;
+    }
+
+    // 跨线程唤醒事件循环
+    int notify_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (-1 == notify_fd) {
+        int err = errno;
+        LOGE("eventfd err = %s.", strerror(err));
+        return NULL;
+    }
+
+    if (-1 == cehc_poller_ctl(poller, EPOLL_CTL_ADD, notify_fd, EPOLLIN)) {
+        int err = errno;
+        LOGE("epoll_ctl add notify fd err = %s.", strerror(err));
+        return NULL;
+    }
+
+    cehc_sock_table_t *sock_table = cehc_sock_table_new();
+    if (!sock_table) {
         return NULL;
     }
 
     // http service
     cehc_http_service_t *hs = (cehc_http_service_t*)calloc(sizeof(cehc_http_service_t), 1);
     if (!hs) {
-        fprintf(stderr, "%s oom when calloc cehc_http_service_t.", __func__);
+        LOGE("%s oom when calloc cehc_http_service_t.", __func__);
         return NULL;
     }
 
     memset(hs, 0, sizeof(cehc_http_service_t));
     hs->ep_once_ev_cnt = ep_once_ev_cnt;
-    hs->epfd = epfd;
+    hs->poller = poller;
+    hs->epfd = cehc_poller_fd(poller);
+    hs->ep_ev_cnt = ep_ev_cnt;
     hs->ep_sl = UNLOCKED;
     hs->multi = cm;
     hs->ep_timeout_ms = ep_timeout_ms;
     hs->timer = new Timer();
     hs->timer_cb = cehc_timer_handler;
+    hs->notify_fd = notify_fd;
+    hs->resume_list = NULL;
+    hs->reject_head = hs->reject_tail = NULL;
+    hs->timer_fd = -1;
+    hs->sock_table = sock_table;
+    if (!cehc_hosts_init(hs)) {
+        free(hs);
+        return NULL;
+    }
 
     return hs;
 }
@@ -667,7 +1229,7 @@ cehc_run_http_serivce(cehc_http_service_t *hs) {
 
     if (-1 == pthread_create(&hs->tid, NULL, cehc_inner_run_http_serivce, hs)) {
         int err = errno;
-        fprintf(stderr, "pthread_create err = %s.", strerror(err));
+        LOGE("pthread_create err = %s.", strerror(err));
         return false;
     }
 
@@ -675,6 +1237,118 @@ cehc_run_http_serivce(cehc_http_service_t *hs) {
     return true;
 }
 
+/**
+ * 创建一个嵌入式的http service，不创建任何线程，由user调用cehc_poll_once驱动。
+ * @param ep_ev_cnt
+ * @param ep_once_ev_cnt
+ * @return
+ */
+cehc_http_service_t *
+cehc_new_embedded_http_service(int ep_ev_cnt, int ep_once_ev_cnt) {
+    cehc_http_service_t *hs = cehc_new_http_service(ep_ev_cnt, ep_once_ev_cnt, 0);
+    if (!hs) {
+        return NULL;
+    }
+
+    // 嵌入模式不需要定时器线程。
+    DELETE_PTR(hs->timer);
+    hs->embedded = true;
+    hs->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (-1 == hs->timer_fd) {
+        int err = errno;
+        LOGE("timerfd_create err = %s.", strerror(err));
+        cehc_delete_http_serivce(&hs);
+        return NULL;
+    }
+
+    if (-1 == cehc_poller_ctl(hs->poller, EPOLL_CTL_ADD, hs->timer_fd, EPOLLIN)) {
+        int err = errno;
+        LOGE("epoll_ctl add timer fd err = %s.", strerror(err));
+        cehc_delete_http_serivce(&hs);
+        return NULL;
+    }
+
+    if (!cehc_init_curl_multi_service(hs)) {
+        cehc_delete_http_serivce(&hs);
+        return NULL;
+    }
+
+    return hs;
+}
+
+int
+cehc_http_service_fd(cehc_http_service_t *hs) {
+    return hs ? hs->epfd : -1;
+}
+
+/**
+ * 替换http service的事件等待后端。
+ * @param hs
+ * @param kind
+ * @return
+ */
+bool
+cehc_http_service_set_poller(cehc_http_service_t *hs, cehc_poller_kind_t kind) {
+    if (!hs) {
+        return false;
+    }
+
+    cehc_poller_t *poller = cehc_poller_new(kind, hs->ep_ev_cnt);
+    if (!poller) {
+        return false;
+    }
+
+    // 此时还没有conn，只需要把service自己的fd重新加进来。
+    if (-1 == cehc_poller_ctl(poller, EPOLL_CTL_ADD, hs->notify_fd, EPOLLIN)
+        || (-1 != hs->timer_fd && -1 == cehc_poller_ctl(poller, EPOLL_CTL_ADD, hs->timer_fd, EPOLLIN))) {
+        int err = errno;
+        LOGE("add service fds to poller %s err = %s.", cehc_poller_name(poller), strerror(err));
+        cehc_poller_delete(&poller);
+        return false;
+    }
+    cehc_poller_flush(poller);
+
+    cehc_poller_delete(&hs->poller);
+    hs->poller = poller;
+    hs->epfd = cehc_poller_fd(poller);
+    return true;
+}
+
+bool
+cehc_http_service_set_busy_poll(cehc_http_service_t *hs, int spin_us, int so_busy_poll_us) {
+    if (!hs || spin_us < 0 || so_busy_poll_us < 0) {
+        LOGW("invalid busy poll params spin_us = %d, so_busy_poll_us = %d.", spin_us, so_busy_poll_us);
+        return false;
+    }
+
+    hs->busy_poll_us = spin_us;
+    hs->so_busy_poll_us = so_busy_poll_us;
+    return true;
+}
+
+void
+cehc_http_service_get_poller_stats(cehc_http_service_t *hs, cehc_poller_stats_t *stats) {
+    if (hs && stats) {
+        cehc_poller_get_stats(hs->poller, stats);
+    }
+}
+
+/**
+ * 在user的线程中执行一次事件循环。
+ * @param hs
+ * @param timeout_ms
+ * @return
+ */
+int
+cehc_poll_once(cehc_http_service_t *hs, int timeout_ms) {
+    if (!hs || !hs->embedded) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return cehc_loop_adaptive(hs, timeout_ms);
+}
+
 /**
  * 释放一个http service，释放前，你最好先释放掉所有创建的connection。
  * @param phs hs的地址
@@ -684,16 +1358,35 @@ cehc_delete_http_serivce(cehc_http_service_t **phs) {
     if (phs && *phs) {
         cehc_http_service_t *hs = *phs;
         hs->stop = true;
-        pthread_join(hs->tid, NULL);
+        if (!hs->embedded) {
+            cehc_wakeup_http_service(hs);
+            pthread_join(hs->tid, NULL);
+        }
         if (hs->timer) {
             hs->timer->Stop();
             delete hs->timer;
         }
+        // 巡检的回调对象在lifecycle中，定时器释放之后才能释放。
+        cehc_lifecycle_delete(hs);
         if (hs->multi) {
             curl_multi_cleanup(hs->multi);
         }
-        if (hs->epfd) {
-            close(hs->epfd);
+        // 连接缓存中的socket在curl_multi_cleanup中才关闭。
+        cehc_sock_table_delete(&hs->sock_table);
+        cehc_sched_delete(&hs->sched);
+        cehc_limiter_delete(&hs->limiter);
+        cehc_breaker_delete(&hs->breaker);
+        cehc_lb_delete(&hs->lb);
+        cehc_codec_service_delete(hs);
+        cehc_uds_delete(hs);
+        cehc_hosts_delete(hs);
+        cehc_trace_delete(hs);
+        cehc_poller_delete(&hs->poller);
+        if (hs->notify_fd) {
+            close(hs->notify_fd);
+        }
+        if (hs->timer_fd > 0) {
+            close(hs->timer_fd);
         }
 
         free(hs);
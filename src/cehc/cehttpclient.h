@@ -13,6 +13,8 @@
 #include "../common/timer.h"
 #include "../common/spin-lock.h"
 
+#include "cehc-poller.h"
+
 using namespace cehc::common;
 
 #ifndef __cplusplus
@@ -23,11 +25,26 @@ extern "C" {
  * cehc <==> curl epoll http client service
  */
 
+/**
+ * 请求的优先级，见cehc-sched.h。
+ */
+typedef enum cehc_prio_e {
+    CEHC_PRIO_NORMAL   = 0, // 默认
+    CEHC_PRIO_CRITICAL = 1, // 面向用户的关键请求，严格优先
+    CEHC_PRIO_BULK     = 2, // 后台预取等批量请求，饱和时会被暂停
+    CEHC_PRIO_CNT
+} cehc_prio_t;
+
 /**
  * 每个http service
  */
 typedef struct cehc_http_service_s {
+    /**
+     * 事件等待后端及其可被epoll的fd(epoll后端即epoll fd本身)，见cehc-poller.h。
+     */
+    struct cehc_poller_s *poller;
     int epfd;
+    int ep_ev_cnt;
     spin_lock_t ep_sl;
     int ep_timeout_ms;
     int ep_once_ev_cnt;
@@ -38,6 +55,89 @@ typedef struct cehc_http_service_s {
     Timer::TimerCallback timer_cb;
     pthread_t tid;
     std::mutex multi_handles_mtx;
+    /**
+     * eventfd，加在epoll之中，其他线程通过它唤醒事件循环。
+     */
+    int notify_fd;
+    /**
+     * 等待在事件循环中恢复(curl_easy_pause(CONT))的conn的无锁栈，见cehc_resume_conn。
+     */
+    struct cehc_connection_s *volatile resume_list;
+    /**
+     * 完成派发的工作线程池及本service在其上的producer id，见cehc-dispatch.h，未开启为NULL。
+     */
+    struct cehc_dispatch_pool_s *dispatch_pool;
+    int dispatch_producer;
+    /**
+     * 嵌入模式，见cehc_new_embedded_http_service。此时没有事件循环线程和定时器线程，
+     * curl的定时器由加在epoll中的timer_fd实现。
+     */
+    bool embedded;
+    int timer_fd;
+    /**
+     * 忙轮询，见cehc_http_service_set_busy_poll。last_active_ns为上一次得到事件的单调时钟。
+     */
+    int busy_poll_us;
+    int so_busy_poll_us;
+    int64_t last_active_ns;
+    /**
+     * curl要求立即超时(timeout_ms为0)时置1并唤醒事件循环，由事件循环执行超时处理。
+     */
+    volatile int timeout_kick;
+    /**
+     * 在cehc_run_conn中被本地拒绝(如熔断)的conn，由事件循环完成，链表由multi_handles_mtx保护。
+     */
+    struct cehc_connection_s *volatile reject_head;
+    struct cehc_connection_s *reject_tail;
+    /**
+     * 本service创建的socket及其选项，见cehc-socket.h。
+     */
+    struct cehc_sock_table_s *sock_table;
+    /**
+     * 多个service共享的DNS/TLS session缓存，见cehc-share.h，未设置为NULL。
+     */
+    struct cehc_share_s *share;
+    /**
+     * 后台DNS解析缓存，见cehc-resolver.h，未设置为NULL。
+     */
+    struct cehc_resolver_s *resolver;
+    /**
+     * 按优先级放行，见cehc-sched.h，未开启为NULL。sched_kick为1时由事件循环调整bulk的暂停状态。
+     */
+    struct cehc_sched_s *sched;
+    volatile int sched_kick;
+    /**
+     * 每个目标host:port的状态，见cehc-host.h。
+     */
+    struct cehc_host_table_s *hosts;
+    /**
+     * 按host的自适应并发限制，见cehc-limiter.h，未开启为NULL。
+     */
+    struct cehc_limiter_s *limiter;
+    /**
+     * 按host的熔断，见cehc-breaker.h，未开启为NULL。
+     */
+    struct cehc_breaker_s *breaker;
+    /**
+     * endpoint group，见cehc-lb.h，没有注册为NULL。
+     */
+    struct cehc_lb_s *lb;
+    /**
+     * 压缩/解压的工作线程池及buffer池，见cehc-codec.h，未开启为NULL。
+     */
+    struct cehc_codec_service_s *codec;
+    /**
+     * 走unix domain socket的路由，见cehc-uds.h，没有添加为NULL。
+     */
+    struct cehc_uds_s *uds;
+    /**
+     * 连接的空闲回收和轮换，见cehc-lifecycle.h，未设置为NULL。
+     */
+    struct cehc_lifecycle_s *lifecycle;
+    /**
+     * 按请求采样的时间线，见cehc-trace.h，未开启为NULL。
+     */
+    struct cehc_tracer_s *tracer;
 } cehc_http_service_t;
 
 
@@ -45,6 +145,17 @@ typedef struct cehc_http_service_s {
  * 每一个easy handle关联的连接上下文。
  * TODO(sunchao):增加连接对象的池子以单纯减少内存碎片和提高性能(因为http连接方面的池子curl本身是有的)
  */
+struct cehc_stream_s;
+struct cehc_dispatch_s;
+struct cehc_dispatch_pool_s;
+struct cehc_completion_queue_s;
+struct cehc_host_s;
+
+// conn被本地拒绝(没有发出)的原因，见conn->rejected。
+#define CEHC_REJECT_NONE        0
+#define CEHC_REJECT_HOST_LIMIT  1   // 超出目标host的并发限制且排队已满，见cehc-limiter.h
+#define CEHC_REJECT_BREAKER_OPEN 2  // 目标host熔断中，见cehc-breaker.h
+
 typedef struct cehc_connection_s {
     CURL *easy;
     curl_socket_t fd;
@@ -89,12 +200,97 @@ typedef struct cehc_connection_s {
     CURLMcode cm_code;  // curl multi code，成功为CURLM_OK
     CURLcode ce_code;   // curl easy code，成功为CURLE_OK
     long http_code;     // http code,按照http规范或者实际业务检查。
+    int rejected;       // 被本地拒绝的原因(CEHC_REJECT_*)，没有拒绝为0。
+    CURLcode result;    // curl给出的传输结果(CURLMsg的data.result)
 
     char errormsg[CURL_ERROR_SIZE];
     /**
      * user可以传递的上下文。
      */
     void *user_ctx;
+
+    /**
+     * 流式body通道，见cehc-stream.h，未开启为NULL。
+     */
+    struct cehc_stream_s *stream;
+    /**
+     * 上传数据源，见cehc-upload.h，未设置为NULL。
+     */
+    struct cehc_upload_s *upload;
+    /**
+     * 按分隔符切分body的状态，见cehc-records.h，未开启为NULL。
+     */
+    struct cehc_records_s *records;
+    /**
+     * 压缩上传及解压响应的状态，见cehc-codec.h，未开启为NULL。
+     */
+    struct cehc_codec_s *codec;
+    /**
+     * 恢复请求的状态(也标识conn是否在运行中，运行中再次cehc_run_conn会失败)及在http service的resume_list
+     * 中的next指针，内部使用。
+     */
+    volatile int resume_state;
+    struct cehc_connection_s *resume_next;
+
+    /**
+     * 完成派发模式下排队的body及排队时间，见cehc-dispatch.h。
+     * dispatch_delay_ns为本次传输结束到complete_cb开始执行的排队延迟，complete_cb中可读。
+     */
+    struct cehc_dispatch_s *dispatch;
+    int64_t dispatch_enqueue_ns;
+    int64_t dispatch_delay_ns;
+
+    /**
+     * 完成队列，见cehc-cq.h。非NULL时传输结束后conn投递到cq而不调用complete_cb。
+     */
+    struct cehc_completion_queue_s *cq;
+    struct cehc_connection_s *cq_next;
+    /**
+     * 在http service的reject链表中的next指针，内部使用。
+     */
+    struct cehc_connection_s *reject_next;
+
+    /**
+     * 绑定的DNS解析缓存项及上一次注入的结果，见cehc-resolver.h。
+     */
+    struct cehc_resolve_entry_s *resolve_entry;
+    uint64_t resolve_gen;
+    struct curl_slist *resolve_list;
+
+    /**
+     * 优先级，两次run之间可以修改；run_ns为本次cehc_run_conn的单调时钟。
+     * 其余为放行的状态，见cehc-sched.h。
+     */
+    cehc_prio_t priority;
+    int64_t run_ns;
+    int sched_state;
+    bool sched_paused;
+    struct cehc_connection_s *sched_next;
+    struct cehc_connection_s *sched_prev;
+
+    /**
+     * 目标host(开启了按host的功能时在创建时绑定)，admit_ns为本次交给curl的单调时钟。
+     * 其余为按host限流、熔断的状态，见cehc-limiter.h、cehc-breaker.h。
+     */
+    struct cehc_host_s *host;
+    int64_t admit_ns;
+    int limit_state;
+    struct cehc_connection_s *limit_next;
+    int breaker_role;
+    uint64_t breaker_round;
+
+    /**
+     * url的host为endpoint group时绑定的group、url中host之后的部分及本次选中的副本，见cehc-lb.h。
+     */
+    struct cehc_lb_group_s *lb_group;
+    char *lb_path;
+    struct cehc_endpoint_s *endpoint;
+    bool lb_inflight;
+
+    /**
+     * 本次run被采样时的请求序号，没有采样为0，见cehc-trace.h。
+     */
+    uint64_t trace_id;
 } cehc_connection_t, *cehc_connection_ptr;
 
 
@@ -141,6 +337,14 @@ typedef struct cehc_newconn_params_s {
      * user可以传递的上下文。
      */
     void *user_ctx;
+    /**
+     * 完成队列(可选)，见cehc-cq.h。设置之后complete_cb不会被调用。
+     */
+    struct cehc_completion_queue_s *cq;
+    /**
+     * 优先级(可选)，默认CEHC_PRIO_NORMAL，http service开启了cehc_http_service_set_prio_sched时生效。
+     */
+    cehc_prio_t priority;
 } cehc_newconn_params_t, *cehc_newconn_params_ptr;
 
 
@@ -183,6 +387,16 @@ bool
 cehc_conn_ok_except_httpcode(cehc_connection_ptr conn);
 
 
+/**
+ * 恢复一个被暂停(回调返回了CURL_WRITEFUNC_PAUSE/CURL_READFUNC_PAUSE)的conn，可在任意线程调用。
+ * curl_easy_pause本身不是线程安全的，所以这里只是把conn挂到http service的恢复队列并唤醒事件循环，
+ * 由事件循环线程真正执行curl_easy_pause(CURLPAUSE_CONT)。重复调用只会入队一次；传输结束之后调用无效果。
+ * @param conn
+ */
+void
+cehc_resume_conn(cehc_connection_ptr conn);
+
+
 /**
  * 初始化curl服务，无论创建多少个http client service，此函数需要全局仅且只有一次调用。
  * @return 成功true，失败false
@@ -228,6 +442,75 @@ cehc_new_http_service_by_default_params();
 bool cehc_run_http_serivce(cehc_http_service_t *hs);
 
 
+/**
+ * 创建一个嵌入式的http service：不创建事件循环线程，由user在自己的线程中调用cehc_poll_once驱动，
+ * 无需cehc_run_http_serivce。在同一个线程里run conn和poll时，请求全程没有跨线程的交接。
+ * -> 可以把cehc_http_service_fd得到的epoll fd加入user自己的epoll，可读时cehc_poll_once(hs, 0)；
+ * -> curl的超时也会使该fd可读，所以user不需要再关心curl的定时器；
+ * -> 其他线程的cehc_run_conn/cehc_resume_conn依然是安全的，它们同样会使该fd可读。
+ * @param ep_ev_cnt epoll处理的事件上限
+ * @param ep_once_ev_cnt 一次cehc_poll_once处理的事件个数上限
+ * @return 失败NULL
+ */
+cehc_http_service_t *
+cehc_new_embedded_http_service(int ep_ev_cnt, int ep_once_ev_cnt);
+
+
+/**
+ * 得到http service的epoll fd，供嵌入模式的user加入自己的事件循环。
+ * @param hs
+ * @return hs为NULL时-1
+ */
+int
+cehc_http_service_fd(cehc_http_service_t *hs);
+
+
+/**
+ * 执行一次事件循环：等待最多timeout_ms并处理就绪的事件，回调都在调用线程中执行。只能用于嵌入式的http service，
+ * 且同一时刻只能有一个线程调用。
+ * 注意：和事件循环线程一样，回调执行时持有multi的锁，回调中不可cehc_run_conn，需要时在cehc_poll_once返回之后run
+ * (或者使用完成队列cehc-cq.h)。
+ * @param hs
+ * @param timeout_ms 0不等待，-1一直等待
+ * @return 处理的事件个数，超时为0；出错为-1并设置errno(EINTR可以直接重试)。
+ */
+int
+cehc_poll_once(cehc_http_service_t *hs, int timeout_ms);
+
+
+/**
+ * 替换http service的事件等待后端(默认epoll)，需在cehc_run_http_serivce之前、没有任何conn时调用。
+ * 嵌入模式下替换之后cehc_http_service_fd得到的是新后端的fd。
+ * @param hs
+ * @param kind CEHC_POLLER_IO_URING需要编译时定义CEHC_WITH_IO_URING
+ * @return 后端不可用时返回false，原后端不变。
+ */
+bool
+cehc_http_service_set_poller(cehc_http_service_t *hs, cehc_poller_kind_t kind);
+
+
+/**
+ * 开启低延迟的忙轮询模式，需在cehc_run_http_serivce之前、没有任何conn时调用。
+ * 事件循环在最近一次得到事件之后的spin_us微秒内不阻塞等待，而是以0超时反复轮询(两次之间pause)，
+ * 省掉阻塞/唤醒带来的调度延迟，代价是这段时间内占满一个cpu；超过spin_us没有事件再回到阻塞等待，
+ * 所以空闲的service不会空转。嵌入模式下对cehc_poll_once同样生效(阻塞等待之前先自旋)。
+ * @param hs
+ * @param spin_us 有事件之后自旋的微秒数，0关闭
+ * @param so_busy_poll_us >0时对每个连接的socket设置SO_BUSY_POLL，让内核在读socket时忙轮询网卡队列，
+ *        需要网卡驱动支持，超过net.core.busy_read的值需要CAP_NET_ADMIN，对loopback无效；0不设置
+ * @return hs为NULL或参数为负时false
+ */
+bool
+cehc_http_service_set_busy_poll(cehc_http_service_t *hs, int spin_us, int so_busy_poll_us);
+
+
+/**
+ * 得到事件等待后端的系统调用统计，可用于比较不同后端每个请求的系统调用次数。
+ */
+void
+cehc_http_service_get_poller_stats(cehc_http_service_t *hs, cehc_poller_stats_t *stats);
+
+
 /**
  * 释放一个http service。
  * @param hs
@@ -236,6 +519,40 @@ void
 cehc_delete_http_serivce(cehc_http_service_t **hs);
 
 
+// ****以下为cehttpclient内部使用，user不可调用。****
+
+/**
+ * 把conn交给curl multi，需持有multi_handles_mtx。
+ * @return 失败时false，并设置conn的错误信息。
+ */
+bool
+cehc_add_conn_to_multi(cehc_connection_ptr conn);
+
+/**
+ * 一个conn的传输结束了(无论成功失败)，通知user。需持有multi_handles_mtx。
+ */
+void
+cehc_finish_conn(cehc_connection_ptr conn);
+
+/**
+ * 传输结束，从multi中移除并通知user，需持有multi_handles_mtx，只能在事件循环线程中调用。之后不能再访问conn。
+ */
+void
+cehc_done_transfer(cehc_http_service_t *hs, cehc_connection_ptr conn, CURLcode result);
+
+/**
+ * 通过notify_fd唤醒事件循环，由它处理其他线程交给它的事情(见cehc_process_notify)。
+ */
+void
+cehc_wakeup_http_service(cehc_http_service_t *hs);
+
+/**
+ * 同cehc_new_conn，但使用调用方给的easy handle(如curl_easy_duphandle得到的)，失败时easy也被释放。
+ */
+cehc_connection_t*
+cehc_new_conn_with_easy(cehc_newconn_params_ptr params, CURL *easy);
+
+
 #ifndef __cplusplus
 }
 #endif
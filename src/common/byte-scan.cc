@@ -0,0 +1,105 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CEHC_BYTE_SCAN_X86
+#endif
+
+#include "byte-scan.h"
+
+namespace cehc {
+    namespace common {
+        static const char* find_scalar(const char *begin, const char *end, char c) {
+            for (; begin < end; ++begin) {
+                if (*begin == c) {
+                    return begin;
+                }
+            }
+
+            return end;
+        }
+
+#ifdef CEHC_BYTE_SCAN_X86
+        __attribute__((target("sse2")))
+        static const char* find_sse2(const char *begin, const char *end, char c) {
+            const __m128i needle = _mm_set1_epi8(c);
+            for (; end - begin >= 16; begin += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)begin);
+                int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+                if (mask) {
+                    return begin + __builtin_ctz(mask);
+                }
+            }
+
+            return find_scalar(begin, end, c);
+        }
+
+        __attribute__((target("avx2")))
+        static const char* find_avx2(const char *begin, const char *end, char c) {
+            const __m256i needle = _mm256_set1_epi8(c);
+            // 一次看64字节，两个比较结果合并之后只有一次分支。
+            for (; end - begin >= 64; begin += 64) {
+                __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)begin), needle);
+                __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(begin + 32)), needle);
+                if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) {
+                    unsigned ma = (unsigned)_mm256_movemask_epi8(a);
+                    if (ma) {
+                        return begin + __builtin_ctz(ma);
+                    }
+                    return begin + 32 + __builtin_ctz((unsigned)_mm256_movemask_epi8(b));
+                }
+            }
+            for (; end - begin >= 32; begin += 32) {
+                unsigned m = (unsigned)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)begin), needle));
+                if (m) {
+                    return begin + __builtin_ctz(m);
+                }
+            }
+
+            return find_sse2(begin, end, c);
+        }
+#endif
+
+        typedef const char* (*find_func_t)(const char*, const char*, char);
+
+        static find_func_t select_find() {
+#ifdef CEHC_BYTE_SCAN_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return find_avx2;
+            }
+            if (__builtin_cpu_supports("sse2")) {
+                return find_sse2;
+            }
+#endif
+            return find_scalar;
+        }
+
+        ByteScan::FindFunc ByteScan::s_pFind = ByteScan::FindFirst;
+
+        const char* ByteScan::FindFirst(const char *begin, const char *end, char c) {
+            FindFunc f = select_find();
+            __atomic_store_n(&s_pFind, f, __ATOMIC_RELAXED);
+            return f(begin, end, c);
+        }
+
+        const char* ByteScan::Impl() {
+            if (s_pFind == FindFirst) {
+                __atomic_store_n(&s_pFind, select_find(), __ATOMIC_RELAXED);
+            }
+#ifdef CEHC_BYTE_SCAN_X86
+            if (s_pFind == find_avx2) {
+                return "avx2";
+            }
+            if (s_pFind == find_sse2) {
+                return "sse2";
+            }
+#endif
+            return "scalar";
+        }
+    }
+}
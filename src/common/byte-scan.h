@@ -0,0 +1,45 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_BYTE_SCAN_H
+#define CEHC_BYTE_SCAN_H
+
+#include <stddef.h>
+
+namespace cehc {
+    namespace common {
+        /**
+         * 向量化的单字节查找：x86上运行时检测CPU，AVX2一次比较32字节，否则SSE2一次16字节；
+         * 其他平台为逐字节的实现。
+         */
+        class ByteScan {
+        public:
+            /**
+             * 在[begin, end)中查找第一个c。
+             * @return 找到的位置，没有找到返回end。
+             */
+            static const char* Find(const char *begin, const char *end, char c) {
+                return s_pFind(begin, end, c);
+            }
+
+            /**
+             * 当前使用的实现，"avx2"、"sse2"或者"scalar"。
+             */
+            static const char* Impl();
+
+        private:
+            typedef const char* (*FindFunc)(const char*, const char*, char);
+
+            /**
+             * 第一次调用时选择实现(与静态初始化的顺序无关)，之后直接调用选中的实现。
+             */
+            static const char* FindFirst(const char *begin, const char *end, char c);
+
+            static FindFunc s_pFind;
+        }; // class ByteScan
+    }
+}
+
+#endif //CEHC_BYTE_SCAN_H
@@ -6,6 +6,9 @@
 #ifndef CEHC_COMMON_DEF_H
 #define CEHC_COMMON_DEF_H
 
+#include <limits.h>
+#include <stdint.h>
+
 #include "time.h"
 
 #define LIKELY(x)                      __builtin_expect(!!(x), 1)
@@ -17,6 +20,7 @@
 #define atomic_cas(lock, old, set)     __sync_bool_compare_and_swap(lock, old, set)
 #define atomic_zero(lock)              __sync_fetch_and_and(lock, 0)
 #define atomic_addone_and_fetch(lock)  __sync_add_and_fetch(lock, 1)
+#define atomic_swap(lock, set)         __sync_lock_test_and_set(lock, set)
 
 #define DELETE_PTR(p) if (p) {delete (p); (p) = nullptr;}
 #define DELETE_ARR_PTR(p) if (p) {delete [](p); (p) = nullptr;}
@@ -45,20 +49,84 @@ namespace cehc {
                 return *this;
             }
 
+            /**
+             * 由时长构造，结果规格化为0 <= nsec < 10^9，不会溢出。
+             */
+            static uctime_s from_ns(int64_t ns) {
+                return uctime_s(ns / 1000000000L, ns % 1000000000L).normalize();
+            }
+
+            static uctime_s from_us(int64_t us) {
+                return uctime_s(us / 1000000L, (us % 1000000L) * 1000L).normalize();
+            }
+
+            static uctime_s from_ms(int64_t ms) {
+                return uctime_s(ms / 1000L, (ms % 1000L) * 1000000L).normalize();
+            }
+
             long sec;
             long nsec;
 
+            /**
+             * 超出long的范围时饱和。
+             */
             long get_total_nsecs() const {
-                return sec * 1000000000 + nsec;
+                if (sec >= LONG_MAX / 1000000000L) {
+                    return LONG_MAX;
+                }
+                if (sec <= LONG_MIN / 1000000000L) {
+                    return LONG_MIN;
+                }
+                return sec * 1000000000L + nsec;
+            }
+
+            /**
+             * nsec进位到sec(或者从sec借位)，使0 <= nsec < 10^9。
+             */
+            uctime_s &normalize() {
+                long carry = nsec / 1000000000L;
+                nsec %= 1000000000L;
+                if (nsec < 0) {
+                    nsec += 1000000000L;
+                    --carry;
+                }
+                if (__builtin_add_overflow(sec, carry, &sec)) {
+                    sec = carry > 0 ? LONG_MAX : LONG_MIN;
+                    nsec = carry > 0 ? 999999999L : 0;
+                }
+                return *this;
             }
         } uctime_t;
 
-        // arithmetic operators
+        // arithmetic operators，sec溢出时饱和
         inline uctime_t &operator+=(uctime_t &l, const uctime_t &r) {
-            l.sec += r.sec + (l.nsec + r.nsec) / 1000000000L;
-            l.nsec += r.nsec;
-            l.nsec %= 1000000000L;
-            return l;
+            uctime_t n(r);
+            l.normalize();
+            n.normalize();
+            if (__builtin_add_overflow(l.sec, n.sec, &l.sec)) {
+                l.sec = n.sec > 0 ? LONG_MAX : LONG_MIN;
+            }
+            l.nsec += n.nsec;
+            return l.normalize();
+        }
+
+        inline uctime_t &operator-=(uctime_t &l, const uctime_t &r) {
+            uctime_t n(r);
+            l.normalize();
+            n.normalize();
+            if (__builtin_sub_overflow(l.sec, n.sec, &l.sec)) {
+                l.sec = n.sec < 0 ? LONG_MAX : LONG_MIN;
+            }
+            l.nsec -= n.nsec;
+            return l.normalize();
+        }
+
+        inline uctime_t operator+(uctime_t l, const uctime_t &r) {
+            return l += r;
+        }
+
+        inline uctime_t operator-(uctime_t l, const uctime_t &r) {
+            return l -= r;
         }
 
         // comparators
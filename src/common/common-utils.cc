@@ -9,11 +9,37 @@
 
 namespace cehc {
     namespace common {
+        std::atomic<int64_t> CommonUtils::s_coarse_ns(0);
+
         uctime_t CommonUtils::GetCurrentTime() {
             struct timespec ts;
             clock_gettime(CLOCK_REALTIME, &ts);
 
             return uctime_t(ts);
         }
+
+        int64_t CommonUtils::GetMonotonicNs() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+        }
+
+        uctime_t CommonUtils::GetMonotonicTime() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return uctime_t(ts);
+        }
+
+        int64_t CommonUtils::TickCoarseMonotonicNs() {
+            int64_t now = GetMonotonicNs();
+            int64_t cur = s_coarse_ns.load(std::memory_order_relaxed);
+            // 先读再比较，已经被其他线程刷新得更新时不写，减少多线程刷新时缓存行的争用。
+            while (cur < now && !s_coarse_ns.compare_exchange_weak(cur, now, std::memory_order_relaxed)) {
+            }
+
+            return now;
+        }
     }
 }
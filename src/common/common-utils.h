@@ -6,6 +6,8 @@
 #ifndef CEHC_COMMON_UTILS_H
 #define CEHC_COMMON_UTILS_H
 
+#include <atomic>
+
 #include "common-def.h"
 
 namespace cehc {
@@ -14,9 +16,41 @@ namespace cehc {
         public:
             /**
              * 获取当前系统时间(unix epoch到现在的秒+纳秒数)。
+             * 系统时间会被NTP等调整，不能用于定时和计算时间间隔。
              * @return
              */
             static uctime_t GetCurrentTime();
+
+            /**
+             * 获取单调时钟的纳秒数，只用于计算时间间隔。
+             * @return
+             */
+            static int64_t GetMonotonicNs();
+
+            /**
+             * 获取单调时钟(系统启动到现在的秒+纳秒数)，定时器的时间点以它为准。
+             * @return
+             */
+            static uctime_t GetMonotonicTime();
+
+            /**
+             * 粗粒度的单调时钟纳秒数：事件循环每一轮、定时器线程每次醒来以及cehc_run_conn时刷新的缓存值，读取只是一次load。
+             * 在这些地方(及其回调中)用于截止时间、空闲时间等判断；进程空闲时它可能落后很久，
+             * 所以其他线程，以及延迟统计等需要精确时间间隔的地方用GetMonotonicNs。
+             * @return
+             */
+            static inline int64_t GetCoarseMonotonicNs() {
+                return s_coarse_ns.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * 精确读取单调时钟并刷新粗粒度时钟(多个线程刷新时只前进不后退)。
+             * @return 读到的纳秒数
+             */
+            static int64_t TickCoarseMonotonicNs();
+
+        private:
+            static std::atomic<int64_t> s_coarse_ns;
         }; // class CommonUtils
     }
 }
@@ -0,0 +1,335 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spsc-ring.h"
+
+#include "logger.h"
+
+#define CEHC_LOG_MSG_SIZE              224
+#define CEHC_LOG_RING_SIZE             512
+#define CEHC_LOG_WRITE_BUF_SIZE        (64 * 1024)
+
+namespace cehc {
+    namespace common {
+        namespace {
+            struct LogRecord {
+                int64_t     ts_ns;
+                const char *file;
+                int         line;
+                int         tid;
+                uint32_t    suppressed;
+                LogLevel    level;
+                char        msg[CEHC_LOG_MSG_SIZE];
+            };
+
+            /**
+             * 每个线程一个，线程退出时只置dead，由后台线程写完剩余日志后释放。
+             */
+            struct ThreadLogBuffer {
+                ThreadLogBuffer() : ring(CEHC_LOG_RING_SIZE) {}
+
+                SpscRing<LogRecord> ring;
+                std::atomic<bool>   dead{false};
+            };
+
+            struct ThreadLogBufferHolder {
+                ~ThreadLogBufferHolder() {
+                    if (buf) {
+                        buf->dead.store(true, std::memory_order_release);
+                    }
+                }
+
+                ThreadLogBuffer *buf = nullptr;
+            };
+
+            struct LogWriter {
+                std::mutex                     mtx;
+                std::condition_variable        cv;
+                std::vector<ThreadLogBuffer*>  buffers;
+                std::thread                   *thread = nullptr;
+                std::atomic<int>               fd{STDERR_FILENO};
+                std::atomic<uint64_t>          dropped{0};
+                // 后台线程没有日志可写、阻塞在cv上(或者正要阻塞)
+                std::atomic<bool>              sleeping{false};
+                uint64_t                       reported_dropped = 0;
+                // Flush()的请求序号与已完成序号
+                uint64_t                       flush_req = 0;
+                uint64_t                       flush_done = 0;
+            };
+
+            LogWriter                   *s_writer = nullptr;
+            std::once_flag               s_writer_once;
+            thread_local ThreadLogBufferHolder s_tls_buf;
+
+            const char s_level_chars[] = {'D', 'I', 'W', 'E', 'F'};
+
+            /**
+             * 时间戳用精确的CLOCK_REALTIME(日志打印到微秒)，限流的时间窗用CLOCK_MONOTONIC_COARSE即可。
+             */
+            inline int64_t clock_ns(clockid_t clk) {
+                struct timespec ts;
+                clock_gettime(clk, &ts);
+                return ts.tv_sec * 1000000000L + ts.tv_nsec;
+            }
+
+            void write_all(int fd, const char *buf, size_t len) {
+                while (len) {
+                    ssize_t n = write(fd, buf, len);
+                    if (n < 0) {
+                        if (EINTR == errno) {
+                            continue;
+                        }
+                        return;
+                    }
+                    buf += n;
+                    len -= (size_t)n;
+                }
+            }
+
+            size_t format_record(const LogRecord &r, char *out, size_t cap) {
+                time_t sec = (time_t)(r.ts_ns / 1000000000L);
+                struct tm tm;
+                localtime_r(&sec, &tm);
+                const char *file = strrchr(r.file, '/');
+                file = file ? file + 1 : r.file;
+                int n;
+                if (r.suppressed) {
+                    n = snprintf(out, cap, "[%04d-%02d-%02d %02d:%02d:%02d.%06ld][%c][%d][%s:%d] %s"
+                                 " (suppressed %u similar messages)\n",
+                                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                                 (long)(r.ts_ns % 1000000000L / 1000), s_level_chars[(int)r.level], r.tid,
+                                 file, r.line, r.msg, r.suppressed);
+                } else {
+                    n = snprintf(out, cap, "[%04d-%02d-%02d %02d:%02d:%02d.%06ld][%c][%d][%s:%d] %s\n",
+                                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                                 (long)(r.ts_ns % 1000000000L / 1000), s_level_chars[(int)r.level], r.tid,
+                                 file, r.line, r.msg);
+                }
+
+                if (n < 0) {
+                    return 0;
+                }
+                return (size_t)n < cap ? (size_t)n : cap - 1;
+            }
+
+            /**
+             * 把所有线程的环中的日志写出。
+             * @return 写出的条数
+             */
+            size_t drain(LogWriter *w, char *out) {
+                std::vector<ThreadLogBuffer*> bufs;
+                {
+                    std::unique_lock<std::mutex> l(w->mtx);
+                    bufs = w->buffers;
+                }
+
+                size_t total = 0, used = 0;
+                int fd = w->fd.load(std::memory_order_relaxed);
+                LogRecord r;
+                for (auto b : bufs) {
+                    while (b->ring.TryPop(r)) {
+                        if (CEHC_LOG_WRITE_BUF_SIZE - used < CEHC_LOG_MSG_SIZE + 256) {
+                            write_all(fd, out, used);
+                            used = 0;
+                        }
+                        used += format_record(r, out + used, CEHC_LOG_WRITE_BUF_SIZE - used);
+                        ++total;
+                    }
+                }
+
+                auto dropped = w->dropped.load(std::memory_order_relaxed);
+                if (dropped != w->reported_dropped) {
+                    if (CEHC_LOG_WRITE_BUF_SIZE - used < 256) {
+                        write_all(fd, out, used);
+                        used = 0;
+                    }
+                    used += (size_t)snprintf(out + used, CEHC_LOG_WRITE_BUF_SIZE - used,
+                                             "[cehc logger] %lu log records dropped because of full buffers\n",
+                                             (unsigned long)(dropped - w->reported_dropped));
+                    w->reported_dropped = dropped;
+                }
+
+                if (used) {
+                    write_all(fd, out, used);
+                }
+
+                // 回收已退出线程的环，先确认环已经空了。
+                std::unique_lock<std::mutex> l(w->mtx);
+                for (auto it = w->buffers.begin(); it != w->buffers.end();) {
+                    if ((*it)->dead.load(std::memory_order_acquire) && (*it)->ring.Empty()) {
+                        delete *it;
+                        it = w->buffers.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+
+                return total;
+            }
+
+            /**
+             * 需持有w->mtx。
+             */
+            bool all_empty(LogWriter *w) {
+                for (auto b : w->buffers) {
+                    if (!b->ring.Empty()) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            void writer_loop(LogWriter *w) {
+                char *out = (char*)malloc(CEHC_LOG_WRITE_BUF_SIZE);
+                for (;;) {
+                    std::unique_lock<std::mutex> l(w->mtx);
+                    auto req = w->flush_req;
+                    l.unlock();
+
+                    auto n = drain(w, out);
+
+                    l.lock();
+                    w->flush_done = req;
+                    w->cv.notify_all();
+                    if (!n && w->flush_req == req) {
+                        // 空闲时阻塞到有日志：先置sleeping再检查一遍所有的环，与Log中先push再检查sleeping配对，
+                        // 两边之间都有全屏障，至少有一方看到对方，不会丢失唤醒。
+                        w->sleeping.store(true, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        if (all_empty(w)) {
+                            w->cv.wait(l, [w, req]() {
+                                return !w->sleeping.load(std::memory_order_relaxed) || w->flush_req != req;
+                            });
+                        }
+                        w->sleeping.store(false, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            void flush_at_exit() {
+                Logger::Flush();
+            }
+
+            LogWriter *get_writer() {
+                std::call_once(s_writer_once, []() {
+                    s_writer = new LogWriter();
+                    s_writer->thread = new std::thread(writer_loop, s_writer);
+                    s_writer->thread->detach();
+                    atexit(flush_at_exit);
+                });
+
+                return s_writer;
+            }
+
+            ThreadLogBuffer *get_thread_buffer() {
+                if (UNLIKELY(!s_tls_buf.buf)) {
+                    auto w = get_writer();
+                    auto b = new ThreadLogBuffer();
+                    std::unique_lock<std::mutex> l(w->mtx);
+                    w->buffers.push_back(b);
+                    s_tls_buf.buf = b;
+                }
+
+                return s_tls_buf.buf;
+            }
+
+            /**
+             * 后台线程在睡眠时唤醒它，只有这种情况下才有锁和系统调用。
+             */
+            inline void wakeup_writer(LogWriter *w) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (UNLIKELY(w->sleeping.load(std::memory_order_relaxed))) {
+                    std::unique_lock<std::mutex> l(w->mtx);
+                    if (w->sleeping.exchange(false, std::memory_order_relaxed)) {
+                        w->cv.notify_all();
+                    }
+                }
+            }
+
+            thread_local int s_tls_tid = 0;
+        } // namespace
+
+        std::atomic<int> Logger::s_level{CEHC_LOG_COMPILE_LEVEL};
+
+        bool LogRateLimiter::Allow(uint32_t *suppressed_out) {
+            int64_t sec = clock_ns(CLOCK_MONOTONIC_COARSE) / 1000000000L;
+            int64_t cur = window.load(std::memory_order_relaxed);
+            if (cur != sec && window.compare_exchange_strong(cur, sec, std::memory_order_relaxed)) {
+                count.store(0, std::memory_order_relaxed);
+                *suppressed_out = suppressed.exchange(0, std::memory_order_relaxed);
+            }
+
+            if (count.fetch_add(1, std::memory_order_relaxed) < kMaxPerSec) {
+                return true;
+            }
+
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        void Logger::Log(LogLevel level, const char *file, int line, uint32_t suppressed, const char *fmt, ...) {
+            auto buf = get_thread_buffer();
+            if (UNLIKELY(!s_tls_tid)) {
+                s_tls_tid = (int)syscall(SYS_gettid);
+            }
+
+            LogRecord r;
+            r.ts_ns = clock_ns(CLOCK_REALTIME);
+            r.file = file;
+            r.line = line;
+            r.tid = s_tls_tid;
+            r.suppressed = suppressed;
+            r.level = level;
+            va_list ap;
+            va_start(ap, fmt);
+            vsnprintf(r.msg, sizeof(r.msg), fmt, ap);
+            va_end(ap);
+
+            if (!buf->ring.TryPush(r)) {
+                s_writer->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            wakeup_writer(s_writer);
+
+            if (UNLIKELY(LogLevel::FATAL == level)) {
+                Flush();
+            }
+        }
+
+        void Logger::SetLevel(LogLevel level) {
+            s_level.store((int)level, std::memory_order_relaxed);
+        }
+
+        void Logger::SetOutputFd(int fd) {
+            get_writer()->fd.store(fd, std::memory_order_relaxed);
+        }
+
+        void Logger::Flush() {
+            auto w = get_writer();
+            std::unique_lock<std::mutex> l(w->mtx);
+            auto req = ++w->flush_req;
+            w->cv.notify_all();
+            while (w->flush_done < req) {
+                w->cv.wait(l);
+            }
+        }
+
+        uint64_t Logger::GetDroppedCount() {
+            return get_writer()->dropped.load(std::memory_order_relaxed);
+        }
+    } // namespace common
+} // namespace cehc
@@ -0,0 +1,117 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_LOGGER_H
+#define CEHC_LOGGER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "common-def.h"
+
+/**
+ * 编译期日志级别，低于此级别的日志点整个被编译掉(包括参数求值)。
+ * 定义DEBUG_LOG则保留DEBUG日志，否则从INFO开始。
+ */
+#ifndef CEHC_LOG_COMPILE_LEVEL
+#ifdef DEBUG_LOG
+#define CEHC_LOG_COMPILE_LEVEL         0
+#else
+#define CEHC_LOG_COMPILE_LEVEL         1
+#endif
+#endif
+
+namespace cehc {
+    namespace common {
+        enum class LogLevel {
+            DEBUG   = 0,
+            INFO    = 1,
+            WARNING = 2,
+            ERROR   = 3,
+            FATAL   = 4
+        };
+
+        /**
+         * 每个日志点一个的限速器：每秒最多放行kMaxPerSec条，之后的同一日志点的日志被计数丢弃，
+         * 下一个时间窗口的第一条日志会带上被抑制的条数。
+         * 只能作为静态对象使用(依赖零初始化)，这样日志点上不会有static局部变量的初始化检查开销。
+         */
+        struct LogRateLimiter {
+            static const uint32_t kMaxPerSec = 16;
+
+            /**
+             * @param suppressed 放行时输出上一个窗口被抑制的条数
+             * @return 是否放行
+             */
+            bool Allow(uint32_t *suppressed);
+
+            std::atomic<int64_t>  window;
+            std::atomic<uint32_t> count;
+            std::atomic<uint32_t> suppressed;
+        };
+
+        /**
+         * 异步日志。
+         * -> 调用线程只做格式化，然后写入本线程独占的无锁SPSC环(环满则丢弃并计数)，只有后台线程空闲睡眠时才唤醒它；
+         * -> 一个后台线程把所有线程的环批量write到输出fd，没有日志时阻塞，不占cpu。
+         * 所以事件循环中记日志不会因为stderr阻塞，错误风暴时也有限速器兜底。
+         */
+        class Logger {
+        public:
+            /**
+             * 记一条日志，请使用LOGX宏而不是直接调用。
+             */
+            static void Log(LogLevel level, const char *file, int line, uint32_t suppressed,
+                            const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+            static void SetLevel(LogLevel level);
+
+            static inline bool Enabled(LogLevel level) {
+                return (int)level >= s_level.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * 设置输出的fd，默认为stderr。
+             */
+            static void SetOutputFd(int fd);
+
+            /**
+             * 等待后台线程把调用此函数之前入队的日志全部写出。
+             */
+            static void Flush();
+
+            /**
+             * 因为环满被丢弃的日志条数。
+             */
+            static uint64_t GetDroppedCount();
+
+        private:
+            static std::atomic<int> s_level;
+        }; // class Logger
+    } // namespace common
+} // namespace cehc
+
+#define CEHC_LOG(lv, fmt, ...)                                                                          \
+    do {                                                                                                 \
+        if ((int)(lv) >= CEHC_LOG_COMPILE_LEVEL && cehc::common::Logger::Enabled(lv)) {                  \
+            static cehc::common::LogRateLimiter __cehc_log_rl;                                           \
+            uint32_t __cehc_log_suppressed = 0;                                                          \
+            if (__cehc_log_rl.Allow(&__cehc_log_suppressed)) {                                           \
+                cehc::common::Logger::Log(lv, __FILE__, __LINE__, __cehc_log_suppressed, fmt, ##__VA_ARGS__); \
+            }                                                                                            \
+        }                                                                                                \
+    } while (0)
+
+#if CEHC_LOG_COMPILE_LEVEL <= 0
+#define LOGD(fmt, ...)  CEHC_LOG(cehc::common::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOGD(fmt, ...)  do {} while (0)
+#endif
+#define LOGI(fmt, ...)  CEHC_LOG(cehc::common::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LOGW(fmt, ...)  CEHC_LOG(cehc::common::LogLevel::WARNING, fmt, ##__VA_ARGS__)
+#define LOGE(fmt, ...)  CEHC_LOG(cehc::common::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LOGF(fmt, ...)  CEHC_LOG(cehc::common::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+#endif //CEHC_LOGGER_H
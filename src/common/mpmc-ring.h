@@ -0,0 +1,143 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_MPMC_RING_H
+#define CEHC_MPMC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "common-def.h"
+#include "spsc-ring.h"
+
+namespace cehc {
+    namespace common {
+        /**
+         * 多生产者多消费者的有界无锁环形队列(Dmitry Vyukov的算法)。
+         * 每个槽位带一个序号，生产者/消费者各自CAS自己的游标抢占槽位，再通过槽位序号交接数据，
+         * 所以不会出现ABA，也不需要锁。
+         * 容量会向上取整为2的幂。
+         */
+        template <typename T>
+        class MpmcRing {
+        public:
+            explicit MpmcRing(size_t capacity) {
+                m_iCap = 2;
+                while (m_iCap < capacity) {
+                    m_iCap <<= 1;
+                }
+                m_iMask = m_iCap - 1;
+                m_pCells = new Cell[m_iCap];
+                for (size_t i = 0; i < m_iCap; ++i) {
+                    m_pCells[i].seq.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            ~MpmcRing() {
+                DELETE_ARR_PTR(m_pCells);
+            }
+
+            size_t Capacity() const {
+                return m_iCap;
+            }
+
+            /**
+             * 瞬时的元素个数，仅供参考。
+             */
+            size_t Size() const {
+                auto tail = m_iTail.load(std::memory_order_acquire);
+                auto head = m_iHead.load(std::memory_order_acquire);
+                return tail > head ? tail - head : 0;
+            }
+
+            /**
+             * @return 队列满返回false。
+             */
+            bool TryPush(const T &v) {
+                Cell *cell;
+                auto pos = m_iTail.load(std::memory_order_relaxed);
+                for (;;) {
+                    cell = &m_pCells[pos & m_iMask];
+                    auto seq = cell->seq.load(std::memory_order_acquire);
+                    auto diff = (intptr_t)seq - (intptr_t)pos;
+                    if (0 == diff) {
+                        if (m_iTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = m_iTail.load(std::memory_order_relaxed);
+                    }
+                }
+
+                cell->data = v;
+                cell->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+             * @return 队列空返回false。
+             */
+            bool TryPop(T &v) {
+                Cell *cell;
+                auto pos = m_iHead.load(std::memory_order_relaxed);
+                for (;;) {
+                    cell = &m_pCells[pos & m_iMask];
+                    auto seq = cell->seq.load(std::memory_order_acquire);
+                    auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                    if (0 == diff) {
+                        if (m_iHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = m_iHead.load(std::memory_order_relaxed);
+                    }
+                }
+
+                v = cell->data;
+                cell->seq.store(pos + m_iMask + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+             * 尽量多地读出n个元素。
+             * @return 实际读出的个数。
+             */
+            size_t TryPopN(T *vs, size_t n) {
+                size_t i = 0;
+                while (i < n && TryPop(vs[i])) {
+                    ++i;
+                }
+
+                return i;
+            }
+
+        private:
+            MpmcRing(const MpmcRing&) = delete;
+            MpmcRing& operator=(const MpmcRing&) = delete;
+
+            struct Cell {
+                std::atomic<size_t> seq;
+                T                   data;
+            };
+
+        private:
+            Cell                *m_pCells = nullptr;
+            size_t               m_iCap = 0;
+            size_t               m_iMask = 0;
+            char                 m_pad0[CEHC_CACHELINE_SIZE];
+            std::atomic<size_t>  m_iTail{0};
+            char                 m_pad1[CEHC_CACHELINE_SIZE];
+            std::atomic<size_t>  m_iHead{0};
+            char                 m_pad2[CEHC_CACHELINE_SIZE];
+        }; // class MpmcRing
+    } // namespace common
+} // namespace cehc
+
+#endif //CEHC_MPMC_RING_H
@@ -0,0 +1,155 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_SPSC_RING_H
+#define CEHC_SPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "common-def.h"
+
+#define CEHC_CACHELINE_SIZE            64
+
+namespace cehc {
+    namespace common {
+        /**
+         * 单生产者单消费者的无锁环形队列。
+         * 注意：同一时刻只能有一个线程Push，一个线程Pop，否则行为未定义。
+         * 容量会向上取整为2的幂，以位与代替取模。
+         * 生产者和消费者的游标各占一个cache line，并各自缓存对方游标以减少cache line的来回传递。
+         */
+        template <typename T>
+        class SpscRing {
+        public:
+            explicit SpscRing(size_t capacity) {
+                m_iCap = 1;
+                while (m_iCap < capacity) {
+                    m_iCap <<= 1;
+                }
+                m_iMask = m_iCap - 1;
+                m_pItems = new T[m_iCap];
+            }
+
+            ~SpscRing() {
+                DELETE_ARR_PTR(m_pItems);
+            }
+
+            size_t Capacity() const {
+                return m_iCap;
+            }
+
+            /**
+             * 当前元素个数。生产者和消费者调用都是安全的，但结果只是一个瞬时值。
+             */
+            size_t Size() const {
+                return m_iTail.load(std::memory_order_acquire) - m_iHead.load(std::memory_order_acquire);
+            }
+
+            size_t FreeSpace() const {
+                return m_iCap - Size();
+            }
+
+            bool Empty() const {
+                return 0 == Size();
+            }
+
+            /**
+             * 生产者调用。
+             * @return 队列满返回false。
+             */
+            bool TryPush(const T &v) {
+                return 1 == TryPushN(&v, 1);
+            }
+
+            /**
+             * 消费者调用。
+             * @return 队列空返回false。
+             */
+            bool TryPop(T &v) {
+                return 1 == TryPopN(&v, 1);
+            }
+
+            /**
+             * 生产者调用，尽量多地写入n个元素。
+             * @return 实际写入的个数。
+             */
+            size_t TryPushN(const T *vs, size_t n) {
+                auto tail = m_iTail.load(std::memory_order_relaxed);
+                if (m_iCap - (tail - m_iHeadCache) < n) {
+                    m_iHeadCache = m_iHead.load(std::memory_order_acquire);
+                }
+                auto free = m_iCap - (tail - m_iHeadCache);
+                n = n < free ? n : free;
+                for (size_t i = 0; i < n; ++i) {
+                    m_pItems[(tail + i) & m_iMask] = vs[i];
+                }
+                if (n) {
+                    m_iTail.store(tail + n, std::memory_order_release);
+                }
+
+                return n;
+            }
+
+            /**
+             * 生产者调用，要么全部写入，要么一个也不写。
+             */
+            bool TryPushAll(const T *vs, size_t n) {
+                auto tail = m_iTail.load(std::memory_order_relaxed);
+                if (m_iCap - (tail - m_iHeadCache) < n) {
+                    m_iHeadCache = m_iHead.load(std::memory_order_acquire);
+                    if (m_iCap - (tail - m_iHeadCache) < n) {
+                        return false;
+                    }
+                }
+
+                return n == TryPushN(vs, n);
+            }
+
+            /**
+             * 消费者调用，尽量多地读出n个元素。
+             * @return 实际读出的个数。
+             */
+            size_t TryPopN(T *vs, size_t n) {
+                auto head = m_iHead.load(std::memory_order_relaxed);
+                if (m_iTailCache - head < n) {
+                    m_iTailCache = m_iTail.load(std::memory_order_acquire);
+                }
+                auto avail = m_iTailCache - head;
+                n = n < avail ? n : avail;
+                for (size_t i = 0; i < n; ++i) {
+                    vs[i] = m_pItems[(head + i) & m_iMask];
+                }
+                if (n) {
+                    m_iHead.store(head + n, std::memory_order_release);
+                }
+
+                return n;
+            }
+
+        private:
+            SpscRing(const SpscRing&) = delete;
+            SpscRing& operator=(const SpscRing&) = delete;
+
+        private:
+            T                   *m_pItems = nullptr;
+            size_t               m_iCap = 0;
+            size_t               m_iMask = 0;
+            // 以填充代替alignas，避免C++11下new过对齐类型的问题。
+            char                 m_pad0[CEHC_CACHELINE_SIZE];
+            // 消费者独占
+            std::atomic<size_t>  m_iHead{0};
+            size_t               m_iTailCache = 0;
+            char                 m_pad1[CEHC_CACHELINE_SIZE];
+            // 生产者独占
+            std::atomic<size_t>  m_iTail{0};
+            size_t               m_iHeadCache = 0;
+            char                 m_pad2[CEHC_CACHELINE_SIZE];
+        }; // class SpscRing
+    } // namespace common
+} // namespace cehc
+
+#endif //CEHC_SPSC_RING_H
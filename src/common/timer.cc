@@ -3,10 +3,14 @@
  * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
  */
 
+#include <pthread.h>
+
 #include <cassert>
+#include <vector>
 
 #include "common-utils.h"
 #include "timer.h"
+#include "usdt.h"
 
 namespace cehc {
     namespace common {
@@ -15,8 +19,10 @@ namespace cehc {
                 Stop();
             }
 
-            m_pWorkThread->join();
-            delete m_pWorkThread;
+            if (m_pWorkThread) {
+                m_pWorkThread->join();
+                delete m_pWorkThread;
+            }
         }
 
         void Timer::Start() {
@@ -35,7 +41,8 @@ namespace cehc {
             UnsubscribeAllEvent();
             SpinLock l(&m_thread_safe_sl);
             m_stop = true;
-            m_cv.notify_one();
+            l.Unlock();
+            notify();
         }
 
         Timer::EventId Timer::SubscribeEventAt(uctime_t when, Event &ev) {
@@ -55,7 +62,8 @@ namespace cehc {
             EventsTable::value_type et_pair(evId, insert_pos);
             m_mapEventsEntry.insert(et_pair);
             if (insert_pos == m_mapSubscribedEvents.begin()) {
-                m_cv.notify_one();
+                l.Unlock();
+                notify();
             }
 
             return EventId(when, ev.callback);
@@ -63,10 +71,7 @@ namespace cehc {
 
         Timer::EventId Timer::SubscribeEventAfter(uctime_t duration, Event &ev) {
             assert(ev.callback);
-            auto now = CommonUtils::GetCurrentTime();
-            now += duration;
-
-            return SubscribeEventAt(now, ev);
+            return SubscribeEventAt(CommonUtils::GetMonotonicTime() + duration, ev);
         }
 
         bool Timer::UnsubscribeEvent(EventId eventId) {
@@ -88,30 +93,81 @@ namespace cehc {
             m_mapSubscribedEvents.clear();
         }
 
+        void Timer::UnsubscribeEvents(TimerCallbackPointer how, bool wait) {
+            assert(how);
+            SpinLock l(&m_thread_safe_sl);
+            for (auto it = m_mapEventsEntry.begin(); it != m_mapEventsEntry.end();) {
+                if (it->first.how == how) {
+                    m_mapSubscribedEvents.erase(it->second);
+                    it = m_mapEventsEntry.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            l.Unlock();
+
+            if (wait && (!m_pWorkThread || std::this_thread::get_id() != m_pWorkThread->get_id())) {
+                std::unique_lock<std::mutex> ml(m_evs_mtx);
+                while (m_bDispatching) {
+                    m_done_cv.wait(ml);
+                }
+            }
+        }
+
+        void Timer::notify() {
+            // 先经过一次m_evs_mtx，保证处理线程要么还没有检查事件表，要么已经在wait之中，不会丢失唤醒。
+            // 调用方不能持有m_thread_safe_sl(加锁顺序为先m_evs_mtx后m_thread_safe_sl)。
+            {
+                std::unique_lock<std::mutex> l(m_evs_mtx);
+            }
+            m_cv.notify_one();
+        }
+
         void Timer::process() {
+            pthread_setname_np(pthread_self(), "cehc-timer");
             std::unique_lock<std::mutex> ml(m_evs_mtx);
             while (!m_stop) { // 锁有屏障作用，无需担心m_stop多线程访问的问题。
+                // 每次醒来只读一次时钟，同时刷新粗粒度时钟供回调使用。
+                auto now = uctime_t::from_ns(CommonUtils::TickCoarseMonotonicNs());
                 SpinLock sl(&m_thread_safe_sl);
+                std::vector<TimerEvents::value_type> expired;
                 while (!m_mapSubscribedEvents.empty()) {
                     auto min = m_mapSubscribedEvents.begin();
-                    if (min->first > CommonUtils::GetCurrentTime()) {
+                    if (min->first > now) {
                         break;
                     }
 
-                    (*(min->second.callback))(min->second.ctx);
+                    expired.push_back(*min);
                     EventId evId(min->first, min->second.callback);
                     m_mapEventsEntry.erase(evId);
                     m_mapSubscribedEvents.erase(min);
                 }
 
+                // 回调在锁外执行，回调之中可以再订阅事件(比如curl的timer回调)。
+                if (!expired.empty()) {
+                    sl.Unlock();
+                    m_bDispatching = true;
+                    ml.unlock();
+                    for (auto &te : expired) {
+                        CEHC_PROBE4(timer__fire, this, te.second.callback, te.second.ctx, te.first.get_total_nsecs());
+                        (*(te.second.callback))(te.second.ctx);
+                    }
+                    ml.lock();
+                    m_bDispatching = false;
+                    m_done_cv.notify_all();
+                    continue;
+                }
+
                 if (m_mapSubscribedEvents.empty()) {
                     sl.Unlock();
                     m_cv.wait(ml);
                 } else {
-                    auto min = m_mapSubscribedEvents.begin();
+                    // 解锁之后其他线程可能退订(删除)最早的事件，先取出时间点。
+                    auto min_ns = m_mapSubscribedEvents.begin()->first.get_total_nsecs();
                     sl.Unlock();
                     using namespace std::chrono;
-                    time_point<system_clock, nanoseconds> tp(nanoseconds(min->first.get_total_nsecs()));
+                    // 时间点是CLOCK_MONOTONIC的，与steady_clock同源，系统时间跳变不影响等待。
+                    time_point<steady_clock, nanoseconds> tp{nanoseconds(min_ns)};
                     m_cv.wait_until(ml, tp);
                 }
             }
@@ -32,7 +32,9 @@ namespace cehc {
                 TimerCallbackPointer how;
 
                 bool operator<(const EventId &another) const {
-                    return (this->when < another.when) || (this->how < another.how);
+                    // 先按时间再按回调排序(严格弱序)，否则按key删除时可能找不到，留下指向已删除事件的表项。
+                    return (this->when < another.when)
+                           || (!(another.when < this->when) && (this->how < another.how));
                 }
             };
 
@@ -81,7 +83,7 @@ namespace cehc {
 
             /**
              * 订阅事件：在指定的时间点触发。
-             * @param when 从epoch到触发的时间。
+             * @param when 单调时钟的时间点(见CommonUtils::GetMonotonicTime)，不受系统时间调整的影响。
              * @return 返回订阅事件的id，可用于取消。
              */
             EventId SubscribeEventAt(uctime_t when, Event &ev);
@@ -104,18 +106,33 @@ namespace cehc {
              */
             void UnsubscribeAllEvent();
 
+            /**
+             * 取消指定回调的所有订阅。
+             * @param how 订阅时的callback。
+             * @param wait 是否等待正在执行的这一轮到期回调返回(之后可以安全地释放回调用到的资源)。
+             *             在定时器线程(回调之中)调用时不等待；持有回调中需要的锁时不可等待。
+             */
+            void UnsubscribeEvents(TimerCallbackPointer how, bool wait);
+
         private:
             /**
              * 事件处理线程。
              */
             void process();
 
+            /**
+             * 唤醒事件处理线程。
+             */
+            void notify();
+
         private:
             bool m_stop = true;
             TimerEvents m_mapSubscribedEvents;
             EventsTable m_mapEventsEntry;
             std::mutex m_evs_mtx;
             std::condition_variable m_cv;
+            std::condition_variable m_done_cv;
+            bool m_bDispatching = false; // 正在锁外执行一轮到期的回调，由m_evs_mtx保护
             std::thread *m_pWorkThread = nullptr;
             spin_lock_t m_thread_safe_sl = UNLOCKED;
         }; // class Timer
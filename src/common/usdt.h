@@ -0,0 +1,42 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_USDT_H
+#define CEHC_USDT_H
+
+/**
+ * USDT静态探针，provider为cehc，供perf/bpftrace在线上直接挂载(不用重新编译，见src/tools/bpftrace)。
+ * 编译时定义CEHC_WITH_USDT(cmake选项CEHC_WITH_USDT，需要systemtap的sys/sdt.h)才生成探针：
+ * 每个探针只是一条nop加上.note.stapsdt中的描述，没有挂载时几乎没有开销；未定义时什么都不生成，参数也不求值。
+ * 时间参数都是CLOCK_MONOTONIC的纳秒数，与bpftrace的nsecs同源，可以直接相减。
+ *
+ * 探针及参数：
+ *   conn__new      (conn, url)                                   cehc_new_conn创建了conn
+ *   conn__run      (conn, url, run_ns)                           cehc_run_conn
+ *   conn__done     (conn, url, result, http_code, run_ns, admit_ns, rejected)
+ *                                                                传输结束(含被本地拒绝的)，admit_ns为交给curl的时间，没交给为0
+ *   sock__cb       (conn, fd, what)                              curl的socket回调，what为CURL_POLL_*
+ *   poller__ctl    (fd, op, events, ret)                         事件后端的EPOLL_CTL_ADD/MOD/DEL
+ *   loop__wake     (hs, nevents, timeout_ms)                     事件循环等待返回
+ *   action__entry  (hs, fd, ev_bitmask)                          curl_multi_socket_action之前
+ *   action__return (hs, fd, mcode, running)                      curl_multi_socket_action之后
+ *   timer__fire    (timer, callback, ctx, when_ns)               定时器回调之前，when_ns为订阅的到期时间
+ */
+
+#ifdef CEHC_WITH_USDT
+#include <sys/sdt.h>
+
+#define CEHC_PROBE2(name, a1, a2)                         DTRACE_PROBE2(cehc, name, a1, a2)
+#define CEHC_PROBE3(name, a1, a2, a3)                     DTRACE_PROBE3(cehc, name, a1, a2, a3)
+#define CEHC_PROBE4(name, a1, a2, a3, a4)                 DTRACE_PROBE4(cehc, name, a1, a2, a3, a4)
+#define CEHC_PROBE7(name, a1, a2, a3, a4, a5, a6, a7)     DTRACE_PROBE7(cehc, name, a1, a2, a3, a4, a5, a6, a7)
+#else
+#define CEHC_PROBE2(name, a1, a2)                         do {} while (0)
+#define CEHC_PROBE3(name, a1, a2, a3)                     do {} while (0)
+#define CEHC_PROBE4(name, a1, a2, a3, a4)                 do {} while (0)
+#define CEHC_PROBE7(name, a1, a2, a3, a4, a5, a6, a7)     do {} while (0)
+#endif
+
+#endif //CEHC_USDT_H
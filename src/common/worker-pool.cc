@@ -0,0 +1,242 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#include <pthread.h>
+
+#include <chrono>
+#include <functional>
+
+#include "worker-pool.h"
+
+// worker一次从环中搬到本地队列的最大任务数
+#define CEHC_WP_PULL_BATCH             64
+
+namespace cehc {
+    namespace common {
+        WorkerPool::WorkerPool(int workers, size_t ringCapacity) {
+            if (workers < 1) {
+                workers = 1;
+            }
+
+            for (int i = 0; i < workers; ++i) {
+                m_vWorkers.push_back(new Worker(ringCapacity));
+            }
+            for (int i = 0; i < kMaxProducers; ++i) {
+                m_producerCursor[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        WorkerPool::~WorkerPool() {
+            Stop();
+            for (auto w : m_vWorkers) {
+                for (int i = 0; i < kMaxProducers; ++i) {
+                    DELETE_PTR(w->rings[i]);
+                }
+                delete w;
+            }
+        }
+
+        void WorkerPool::Start() {
+            bool expected = true;
+            if (!m_bStop.compare_exchange_strong(expected, false)) {
+                return;
+            }
+
+            for (int i = 0; i < (int)m_vWorkers.size(); ++i) {
+                m_vWorkers[i]->thread = new std::thread(std::bind(&WorkerPool::run, this, i));
+            }
+        }
+
+        void WorkerPool::Stop() {
+            bool expected = false;
+            if (!m_bStop.compare_exchange_strong(expected, true)) {
+                return;
+            }
+
+            for (auto w : m_vWorkers) {
+                wakeup(w);
+            }
+            for (auto w : m_vWorkers) {
+                if (w->thread) {
+                    w->thread->join();
+                    DELETE_PTR(w->thread);
+                }
+            }
+        }
+
+        int WorkerPool::RegisterProducer() {
+            // 注册不是热路径，用第一个worker的锁串行化即可。
+            std::unique_lock<std::mutex> l(m_vWorkers[0]->mtx);
+            int id = m_iProducers.load(std::memory_order_relaxed);
+            if (id >= kMaxProducers) {
+                return -1;
+            }
+
+            for (auto w : m_vWorkers) {
+                w->rings[id] = new SpscRing<Task>(w->ring_cap);
+            }
+            // release之后worker才能看到新的环。
+            m_iProducers.store(id + 1, std::memory_order_release);
+            return id;
+        }
+
+        bool WorkerPool::Submit(int producer, TaskFunc func, void *arg) {
+            if (UNLIKELY(producer < 0 || producer >= m_iProducers.load(std::memory_order_acquire))) {
+                return false;
+            }
+
+            Task t;
+            t.func = func;
+            t.arg = arg;
+            t.enqueue_ns = NowNs();
+            auto n = (uint32_t)m_vWorkers.size();
+            auto start = m_producerCursor[producer].fetch_add(1, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < n; ++i) {
+                Worker *w = m_vWorkers[(start + i) % n];
+                if (w->rings[producer]->TryPush(t)) {
+                    wakeup(w);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void WorkerPool::GetStats(Stats *stats) {
+            stats->executed = m_iExecuted.load(std::memory_order_relaxed);
+            stats->stolen = m_iStolen.load(std::memory_order_relaxed);
+            stats->queue_delay_total_ns = m_iDelayTotalNs.load(std::memory_order_relaxed);
+            stats->queue_delay_max_ns = m_iDelayMaxNs.load(std::memory_order_relaxed);
+        }
+
+        int64_t WorkerPool::NowNs() {
+            using namespace std::chrono;
+            return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        }
+
+        void WorkerPool::run(int idx) {
+            pthread_setname_np(pthread_self(), "cehc-worker");
+            Worker *self = m_vWorkers[idx];
+            Task t;
+            for (;;) {
+                auto pulled = pullRings(self);
+                if (pulled > 1) {
+                    // 一次搬来多个，叫醒一个空闲的worker来偷。
+                    wakeupOneSleeping(idx);
+                }
+
+                if (popLocal(self, &t)) {
+                    execute(t);
+                    continue;
+                }
+
+                if (steal(idx, &t)) {
+                    m_iStolen.fetch_add(1, std::memory_order_relaxed);
+                    execute(t);
+                    continue;
+                }
+
+                if (m_bStop.load(std::memory_order_acquire)) {
+                    // 停止之前确认环中也没有剩余任务了。
+                    if (!pullRings(self)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> l(self->mtx);
+                self->sleeping = 1;
+                hw_rw_memory_barrier();
+                bool empty = true;
+                auto producers = m_iProducers.load(std::memory_order_acquire);
+                for (int i = 0; i < producers; ++i) {
+                    if (!self->rings[i]->Empty()) {
+                        empty = false;
+                        break;
+                    }
+                }
+                if (empty && !m_bStop.load(std::memory_order_acquire)) {
+                    // 投递方先入环再检查sleeping，这里先置sleeping再检查环，两边之间都有全屏障，不会丢失唤醒。
+                    self->cv.wait(l);
+                }
+                self->sleeping = 0;
+            }
+        }
+
+        size_t WorkerPool::pullRings(Worker *w) {
+            Task batch[CEHC_WP_PULL_BATCH];
+            size_t total = 0;
+            auto producers = m_iProducers.load(std::memory_order_acquire);
+            for (int i = 0; i < producers; ++i) {
+                auto n = w->rings[i]->TryPopN(batch, CEHC_WP_PULL_BATCH);
+                if (n) {
+                    SpinLock l(&w->local_sl);
+                    w->local.insert(w->local.end(), batch, batch + n);
+                    total += n;
+                }
+            }
+
+            return total;
+        }
+
+        bool WorkerPool::popLocal(Worker *w, Task *t) {
+            SpinLock l(&w->local_sl);
+            if (w->local.empty()) {
+                return false;
+            }
+
+            *t = w->local.front();
+            w->local.pop_front();
+            return true;
+        }
+
+        bool WorkerPool::steal(int self, Task *t) {
+            auto n = (int)m_vWorkers.size();
+            for (int i = 1; i < n; ++i) {
+                Worker *victim = m_vWorkers[(self + i) % n];
+                SpinLock l(&victim->local_sl, true);
+                if (!l.TryLock()) {
+                    continue;
+                }
+                if (!victim->local.empty()) {
+                    *t = victim->local.back();
+                    victim->local.pop_back();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void WorkerPool::execute(const Task &t) {
+            auto delay = (uint64_t)(NowNs() - t.enqueue_ns);
+            m_iDelayTotalNs.fetch_add(delay, std::memory_order_relaxed);
+            auto max = m_iDelayMaxNs.load(std::memory_order_relaxed);
+            while (delay > max && !m_iDelayMaxNs.compare_exchange_weak(max, delay, std::memory_order_relaxed));
+            m_iExecuted.fetch_add(1, std::memory_order_relaxed);
+
+            t.func(t.arg);
+        }
+
+        void WorkerPool::wakeup(Worker *w) {
+            hw_rw_memory_barrier();
+            if (w->sleeping) {
+                std::unique_lock<std::mutex> l(w->mtx);
+                w->cv.notify_one();
+            }
+        }
+
+        void WorkerPool::wakeupOneSleeping(int except) {
+            auto n = (int)m_vWorkers.size();
+            for (int i = 1; i < n; ++i) {
+                Worker *w = m_vWorkers[(except + i) % n];
+                if (w->sleeping) {
+                    wakeup(w);
+                    return;
+                }
+            }
+        }
+    } // namespace common
+} // namespace cehc
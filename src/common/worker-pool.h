@@ -0,0 +1,125 @@
+/**
+ * This work copyright Chao Sun(qq:296449610) and licensed under
+ * a Creative Commons Attribution 3.0 Unported License(https://creativecommons.org/licenses/by/3.0/).
+ */
+
+#ifndef CEHC_WORKER_POOL_H
+#define CEHC_WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common-def.h"
+#include "spin-lock.h"
+#include "spsc-ring.h"
+
+namespace cehc {
+    namespace common {
+        /**
+         * 工作线程池。
+         * -> 投递方(producer，比如一个事件循环)先RegisterProducer，之后它和每个worker之间各有一个SPSC环，
+         *    投递只是一次无锁入环，只有在目标worker睡眠时才有一次加锁通知；
+         * -> worker把自己环中的任务搬到本地队列再执行，空闲的worker从其他worker的本地队列尾部偷任务。
+         * 同一个task一定只在一个worker上执行，需要保序的工作请合并为一个task。
+         */
+        class WorkerPool {
+        public:
+            typedef void (*TaskFunc)(void *arg);
+
+            struct Task {
+                TaskFunc func;
+                void    *arg;
+                /**
+                 * 入队时间(单调时钟纳秒)，用于统计排队延迟。
+                 */
+                int64_t  enqueue_ns;
+            };
+
+            struct Stats {
+                uint64_t executed;
+                uint64_t stolen;
+                uint64_t queue_delay_total_ns;
+                uint64_t queue_delay_max_ns;
+            };
+
+            static const int kMaxProducers = 64;
+
+            /**
+             * @param workers 工作线程数
+             * @param ringCapacity 每个producer到每个worker的环的容量
+             */
+            WorkerPool(int workers, size_t ringCapacity);
+
+            ~WorkerPool();
+
+            void Start();
+
+            /**
+             * 停止并等待所有worker退出，已经投递的任务会在退出之前执行完。
+             */
+            void Stop();
+
+            /**
+             * 注册一个producer。
+             * @return producer id，超过kMaxProducers返回-1。
+             */
+            int RegisterProducer();
+
+            /**
+             * 投递任务，非阻塞。同一个producer id同一时刻只能有一个线程投递(或由调用方的锁保证互斥)。
+             * @return 所有worker的环都满时返回false，由调用方决定降级策略。
+             */
+            bool Submit(int producer, TaskFunc func, void *arg);
+
+            int Workers() const {
+                return (int)m_vWorkers.size();
+            }
+
+            void GetStats(Stats *stats);
+
+            static int64_t NowNs();
+
+        private:
+            struct Worker {
+                explicit Worker(size_t ringCapacity) : ring_cap(ringCapacity) {
+                    for (int i = 0; i < kMaxProducers; ++i) {
+                        rings[i] = nullptr;
+                    }
+                }
+
+                size_t                                  ring_cap;
+                SpscRing<Task>                         *rings[kMaxProducers];
+                spin_lock_t                             local_sl = UNLOCKED;
+                std::deque<Task>                        local;
+                std::mutex                              mtx;
+                std::condition_variable                 cv;
+                volatile int                            sleeping = 0;
+                std::thread                            *thread = nullptr;
+            };
+
+            void run(int idx);
+            size_t pullRings(Worker *w);
+            bool popLocal(Worker *w, Task *t);
+            bool steal(int self, Task *t);
+            void execute(const Task &t);
+            void wakeup(Worker *w);
+            void wakeupOneSleeping(int except);
+
+        private:
+            std::vector<Worker*>          m_vWorkers;
+            std::atomic<int>              m_iProducers{0};
+            std::atomic<uint32_t>         m_producerCursor[kMaxProducers];
+            std::atomic<bool>             m_bStop{true};
+            std::atomic<uint64_t>         m_iExecuted{0};
+            std::atomic<uint64_t>         m_iStolen{0};
+            std::atomic<uint64_t>         m_iDelayTotalNs{0};
+            std::atomic<uint64_t>         m_iDelayMaxNs{0};
+        }; // class WorkerPool
+    } // namespace common
+} // namespace cehc
+
+#endif //CEHC_WORKER_POOL_H
@@ -71,10 +71,24 @@ namespace cehc {
             if (!cehc_run_http_serivce(m_pCehcHttpClient)) {
                 throw std::runtime_error("cehc_run_http_serivce failed!");
             }
+
+            m_pGetTpl = cehc_new_template(m_pCehcHttpClient, nullptr, 0);
+            m_pPostTpl = cehc_new_template(m_pCehcHttpClient, nullptr, 0);
+            if (!m_pGetTpl || !m_pPostTpl) {
+                throw std::runtime_error("cehc_new_template failed!");
+            }
+
+            curl_easy_setopt(cehc_template_easy(m_pGetTpl), CURLOPT_TIMEOUT, 5L); // TODO(sunchao): 改为可配值
+            curl_easy_setopt(cehc_template_easy(m_pGetTpl), CURLOPT_CONNECTTIMEOUT_MS, 2000);
+            curl_easy_setopt(cehc_template_easy(m_pPostTpl), CURLOPT_TIMEOUT, 5L);
+            curl_easy_setopt(cehc_template_easy(m_pPostTpl), CURLOPT_CONNECTTIMEOUT_MS, 2000);
+            curl_easy_setopt(cehc_template_easy(m_pPostTpl), CURLOPT_POST, 1);
         }
 
         void HttpClientService::Stop() {
             cehc_delete_http_serivce(&m_pCehcHttpClient);
+            cehc_delete_template(&m_pGetTpl);
+            cehc_delete_template(&m_pPostTpl);
         }
 
         void HttpClientService::Get(HttpGetParams &get_params) {
@@ -106,13 +120,11 @@ namespace cehc {
                 .user_ctx = (void*)(&ctx)
             };
 
-            auto conn = cehc_new_conn(&conn_param);
+            auto conn = cehc_new_conn_from_template(m_pGetTpl, &conn_param, nullptr, 0);
             if (!conn) {
                 throw new std::runtime_error("cehc_new_conn failed!");
             }
 
-            curl_easy_setopt(conn->easy, CURLOPT_TIMEOUT, 5L); // TODO(sunchao): 改为可配值
-            curl_easy_setopt(conn->easy, CURLOPT_CONNECTTIMEOUT_MS, 2000);
             char errmsg[CURL_ERROR_SIZE];
             if (!cehc_run_conn(conn, errmsg)) {
                 cehc_delete_conn(&conn);
@@ -131,6 +143,14 @@ namespace cehc {
         }
 
         bool HttpClientService::Post(const string &url, const string &data) {
+            return DoPost(url, data.c_str(), data.size(), nullptr, 0);
+        }
+
+        bool HttpClientService::Post(const string &url, const struct iovec *iov, int iovcnt) {
+            return DoPost(url, nullptr, 0, iov, iovcnt);
+        }
+
+        bool HttpClientService::DoPost(const string &url, const char *data, size_t len, const struct iovec *iov, int iovcnt) {
             bool res = false;
             mutex mtx;
             condition_variable cv;
@@ -147,16 +167,16 @@ namespace cehc {
                 .user_ctx = (void*)(&ctx)
             };
 
-            auto conn = cehc_new_conn(&conn_param);
+            // data、iov在请求结束之前一直有效(下面等待完成)。
+            auto conn = cehc_new_conn_from_template(m_pPostTpl, &conn_param, data, len);
             if (!conn) {
                 throw new std::runtime_error("cehc_new_conn failed!");
             }
+            if (iov && !cehc_conn_upload_iov(conn, iov, iovcnt, nullptr, nullptr)) {
+                cehc_delete_conn(&conn);
+                throw new std::runtime_error("cehc_conn_upload_iov failed!");
+            }
 
-            curl_easy_setopt(conn->easy, CURLOPT_TIMEOUT, 5L); // TODO(sunchao): 改为可配值
-            curl_easy_setopt(conn->easy, CURLOPT_CONNECTTIMEOUT_MS, 2000);
-            curl_easy_setopt(conn->easy, CURLOPT_POST, 1);
-            curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, data.c_str());
-            curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, data.size()); // <= 2GB，否则用CURLOPT_POSTFIELDSIZE_LARGE
             char errmsg[CURL_ERROR_SIZE];
             if (!cehc_run_conn(conn, errmsg)) {
                 cehc_delete_conn(&conn);
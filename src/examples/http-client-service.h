@@ -13,6 +13,8 @@
 using namespace std;
 
 #include "../cehc/cehttpclient.h"
+#include "../cehc/cehc-template.h"
+#include "../cehc/cehc-upload.h"
 
 namespace cehc {
     namespace test {
@@ -53,13 +55,25 @@ namespace cehc {
              * @return 成功返回true，失败返回false。
              */
             bool Post(const string &url, const string &data);
+            /**
+             * 发送多个buffer组成的body(不拼接)，不接收响应数据。
+             * @param url
+             * @param iov buffer在返回之前一直有效
+             * @param iovcnt
+             * @return 成功返回true，失败返回false。
+             */
+            bool Post(const string &url, const struct iovec *iov, int iovcnt);
 
         private:
             friend class ServiceManager;
             HttpClientService();
+            bool DoPost(const string &url, const char *data, size_t len, const struct iovec *iov, int iovcnt);
 
         private:
             cehc_http_service_t *m_pCehcHttpClient = nullptr;
+            // Get(url)和Post的公共选项只在模板上设置一次。
+            cehc_template_t *m_pGetTpl = nullptr;
+            cehc_template_t *m_pPostTpl = nullptr;
         };
     }
 }